@@ -133,8 +133,8 @@ fi
 # travis platformio target is used for nightly Test
 travis=$(list_envs | grep travis | sort)
 
-# get all taregts, excluding travis and debug
-available=$(list_envs | grep -Ev -- 'travis|debug|release' | sort)
+# get all taregts, excluding travis, debug and the native host builds
+available=$(list_envs | grep -Ev -- 'travis|debug|release|native' | sort)
 
 export PLATFORMIO_BUILD_FLAGS="${PLATFORMIO_BUILD_FLAGS}"
 
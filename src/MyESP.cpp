@@ -1890,6 +1890,11 @@ bool MyESP::fs_saveCustomConfig(JsonObject root) {
     return ok;
 }
 
+// save the custom settings, for when they've been changed by the app itself instead of the 'set' command
+bool MyESP::fs_saveSettings() {
+    return _fs_createCustomConfig();
+}
+
 // save system config to spiffs
 bool MyESP::fs_saveConfig(JsonObject root) {
     // call any custom functions before handling SPIFFS
@@ -304,6 +304,7 @@ class MyESP {
     void setSettings(fs_loadsave_callback_f loadsave, fs_setlist_callback_f setlist, bool useSerial = true);
     bool fs_saveConfig(JsonObject root);
     bool fs_saveCustomConfig(JsonObject root);
+    bool fs_saveSettings();
     bool fs_setSettingValue(char ** setting, const char * value, const char * value_default);
     bool fs_setSettingValue(uint16_t * setting, const char * value, uint16_t value_default);
     bool fs_setSettingValue(uint8_t * setting, const char * value, uint8_t value_default);
@@ -87,6 +87,7 @@ function listCustomStats() {
         document.getElementById("boiler_show").style.display = "none";
         document.getElementById("sm_show").style.display = "none";
         document.getElementById("hp_show").style.display = "none";
+        document.getElementById("timing_show").style.display = "none";
         return;
     }
 
@@ -163,6 +164,19 @@ function listCustomStats() {
         document.getElementById("hp_show").style.display = "none";
     }
 
+    var timing = ajaxobj.emsbus.timing;
+    var names = { poll_interval: "Poll Interval", poll_latency: "Poll to Tx", read_latency: "Read to Reply", gap: "Gap" };
+    var rows = document.getElementById("timing");
+
+    document.getElementById("timing_show").style.display = "block";
+    rows.innerHTML = "";
+    for (var key in names) {
+        var t = timing[key];
+        var r = document.createElement("tr");
+        r.innerHTML = "<th>" + names[key] + "</th><td>" + t.n + "</td><td>" + t.p50 + "</td><td>" + t.p90 + "</td><td>" + t.p99 + "</td><td>" + t.max + "</td>";
+        rows.appendChild(r);
+    }
+
 
 }
 
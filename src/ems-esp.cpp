@@ -42,8 +42,7 @@ bool _need_first_publish = true; // this ensures on boot we always send out MQTT
 #define SYSTEMCHECK_TIME 30 // every 30 seconds check if EMS can be reached
 Ticker systemCheckTimer;
 
-#define REGULARUPDATES_TIME 60 // every minute a call is made to fetch data from EMS devices manually
-Ticker regularUpdatesTimer;
+Ticker regularUpdatesTimer; // runs the refresh scheduler, which reads the values that are out of date
 
 #define LEDCHECK_TIME 500 // every 1/2 second blink the heartbeat LED
 Ticker ledcheckTimer;
@@ -79,6 +78,7 @@ typedef struct {
     uint8_t  dallas_gpio;     // pin for attaching external dallas temperature sensors
     bool     dallas_parasite; // on/off is using parasite
     uint8_t  tx_mode;         // TX mode 1,2 or 3
+    uint16_t cache_ttl;       // seconds a value read from the bus is served from memory on a refresh
 } _EMSESP_Settings;
 
 typedef struct {
@@ -100,6 +100,7 @@ static const command_t project_cmds[] PROGMEM = {
     {true, "shower_alert <on | off>", "stop hot water to send 3 cold burst warnings after max shower time is exceeded"},
     {true, "publish_time <seconds>", "set frequency for publishing data to MQTT (0=automatic)"},
     {true, "tx_mode <n>", "changes Tx logic. 1=EMS generic, 2=EMS+, 3=HT3"},
+    {true, "cache_ttl <seconds>", "how long a value is served from memory instead of read again on a refresh (0=always read)"},
 
     {false, "info", "show current values deciphered from the EMS messages"},
     {false, "log <n | b | t | s | r | j | v | w [type ID]", "set logging to none, basic, thermostat, solar module, raw, jabber, verbose or watch a specific type"},
@@ -112,6 +113,9 @@ static const command_t project_cmds[] PROGMEM = {
     {false, "refresh", "fetch values from the EMS devices"},
     {false, "devices", "list detected EMS devices"},
     {false, "queue", "show current Tx queue"},
+    {false, "timing [clear]", "show percentiles of the bus timing, or start them again"},
+    {false, "traffic [clear]", "show how busy the bus is and who is using it, or start counting again"},
+    {false, "calibrate [reset]", "find the shortest Tx timing this bus takes in tx_mode 2 and 3, or go back to the defaults"},
     {false, "autodetect [scan]", "detect EMS devices and attempt to automatically set boiler and thermostat types"},
     {false, "send XX ...", "send raw telegram data to EMS bus (XX are hex values)"},
     {false, "thermostat read <type ID>", "send read request to the thermostat for heating circuit hc 1-4"},
@@ -254,7 +258,117 @@ void showInfo() {
 
     if (ems_getBusConnected()) {
         myDebug_P(PSTR("  Bus is connected, protocol: %s"), ((EMS_Sys_Status.emsIDMask == 0x80) ? "HT3" : "Buderus"));
+        _EMS_Discovery * discovery = ems_getDiscovery();
+        if (discovery->running) {
+            myDebug_P(PSTR("  Discovery: running, %d of %d devices replied so far"), discovery->found, discovery->probed);
+        } else if (discovery->runs) {
+            myDebug_P(PSTR("  Discovery: took %d ms, %d of %d devices replied"), discovery->time, discovery->found, discovery->probed);
+        }
         myDebug_P(PSTR("  Rx: # successful read requests=%d, # CRC errors=%d"), EMS_Sys_Status.emsRxPgks, EMS_Sys_Status.emxCrcErr);
+        for (uint8_t src = 0; src < 0x80; src++) {
+            if (EMS_Sys_Status.emsCrcErrSrc[src]) {
+                myDebug_P(PSTR("      # CRC errors from 0x%02X=%d"), src, EMS_Sys_Status.emsCrcErrSrc[src]);
+            }
+        }
+        myDebug_P(PSTR("      # telegrams that changed no values=%d, of which not decoded=%d"), EMS_Sys_Status.emsRxUnchanged, EMS_Sys_Status.emsRxSkipped);
+        myDebug_P(PSTR("  Tx queue: # reads merged=%d, # reads planned=%d, # writes replaced=%d, # writes combined=%d, # validates skipped=%d"),
+                  EMS_Sys_Status.emsTxReadsMerged,
+                  EMS_Sys_Status.emsTxReadsPlanned,
+                  EMS_Sys_Status.emsTxWritesReplaced,
+                  EMS_Sys_Status.emsTxWritesCombined,
+                  EMS_Sys_Status.emsTxValidatesSkipped);
+        for (uint8_t lane = 0; lane < EMS_TX_LANES; lane++) {
+            const _EMS_TxLaneStats * laneStats = EMS_TxQueue.laneStats(lane);
+            myDebug_P(PSTR("      lane %s: # waiting=%d, # sent=%d, avg wait=%d ms, max wait=%d ms"),
+                      ems_getTxLaneName(lane),
+                      EMS_TxQueue.depth(lane),
+                      laneStats->telegrams,
+                      laneStats->telegrams ? (laneStats->waitTotal / laneStats->telegrams) : 0,
+                      laneStats->waitMax);
+        }
+        for (uint8_t fail = 0; fail < EMS_TX_FAILS; fail++) {
+            _EMS_TxFailStats * failStats = ems_getTxFailStats(fail);
+            if (failStats->count) {
+                myDebug_P(PSTR("      # failed with %s=%d, on average %d ms lost"),
+                          ems_getTxFailName(fail),
+                          failStats->count,
+                          failStats->lost / failStats->count);
+            }
+        }
+        myDebug_P(PSTR("  Refresh: # types kept up to date=%d, # reads=%d"), ems_getRefreshCount(), EMS_Sys_Status.emsRefreshReads);
+        for (uint8_t i = 0; i < ems_getRefreshCount(); i++) {
+            _EMS_Refresh * refresh = ems_getRefresh(i);
+            myDebug_P(PSTR("      type 0x%02X from 0x%02X: last seen %d s ago, broadcast every %d s, # reads=%d"),
+                      refresh->type,
+                      refresh->dest,
+                      (millis() - refresh->lastSeen) / 1000,
+                      refresh->interval / 1000,
+                      refresh->reads);
+        }
+        myDebug_P(PSTR("  Cache: # served from memory=%d, # read from the bus=%d, TTL=%d s"),
+                  EMS_Sys_Status.emsCacheHits,
+                  EMS_Sys_Status.emsCacheMisses,
+                  EMS_Sys_Status.emsCacheTTL / 1000);
+        myDebug_P(PSTR("  Blocks: # read in chunks=%d"), ems_getBlockCount());
+        for (uint8_t i = 0; i < ems_getBlockCount(); i++) {
+            _EMS_Block * block = ems_getBlock(i);
+            myDebug_P(PSTR("      type 0x%02X from 0x%02X: %d bytes%s, # transfers=%d, # failed=%d, last took %d ms (max %d ms)"),
+                      block->type,
+                      block->dest,
+                      block->length,
+                      block->complete ? "" : " (incomplete)",
+                      block->transfers,
+                      block->failed,
+                      block->timeLast,
+                      block->timeMax);
+        }
+
+        _EMSUART_RxStats * rxStats = emsuart_getRxStats();
+        myDebug_P(PSTR("  Rx ring: # telegrams=%d, # dropped=%d, # too long=%d, max depth=%d of %d"),
+                  rxStats->telegrams,
+                  rxStats->dropped,
+                  rxStats->overflows,
+                  rxStats->depthMax,
+                  EMSUART_RXRING_SIZE);
+        myDebug_P(PSTR("      # too short=%d, # double BRK=%d, # phantom BRK=%d, # FIFO overruns=%d, # frame errors=%d, max FIFO=%d bytes"),
+                  rxStats->runts,
+                  rxStats->breaks,
+                  rxStats->phantomBreaks,
+                  rxStats->overruns,
+                  rxStats->frameErrors,
+                  rxStats->fifoMax);
+        myDebug_P(PSTR("      # interrupts=%d, %d us in total, average %d us (max %d us)"),
+                  rxStats->isrCalls,
+                  (uint32_t)(rxStats->isrCycles / ESP.getCpuFreqMHz()),
+                  rxStats->isrCalls ? (uint32_t)(rxStats->isrCycles / rxStats->isrCalls / ESP.getCpuFreqMHz()) : 0,
+                  rxStats->isrCyclesMax / ESP.getCpuFreqMHz());
+
+        _EMSUART_TxStats * txStats = emsuart_getTxStats();
+        myDebug_P(PSTR("  Tx engine: # telegrams=%d, # collisions=%d, # timeouts=%d, # busy=%d"),
+                  txStats->telegrams,
+                  txStats->collisions,
+                  txStats->timeouts,
+                  txStats->busy);
+        myDebug_P(PSTR("      main loop blocked %d us (max %d us), on the bus %d us (max %d us) for the last telegram"),
+                  txStats->blockedLast,
+                  txStats->blockedMax,
+                  txStats->busLast,
+                  txStats->busMax);
+        myDebug_P(PSTR("      polls answered from the Rx interrupt=%d, # on time=%d, # late=%d, last %d us (max %d us) after the poll"),
+                  txStats->pollsStaged,
+                  txStats->pollsOnTime,
+                  txStats->pollsLate,
+                  txStats->pollLast,
+                  txStats->pollMax);
+        myDebug_P(PSTR("      # came back right=%d, # failed=%d, echo %d us (max %d us), brk_wait=%d us, gap=%d us, %s"),
+                  txStats->echoOk,
+                  txStats->echoErrors,
+                  txStats->echoLast,
+                  txStats->echoMax,
+                  emsuart_getTxTiming()->brkWait,
+                  emsuart_getTxTiming()->gap,
+                  (emsuart_getCalibrateState() == EMSUART_CALIBRATE_RUNNING) ? "calibrating"
+                                                                            : ((emsuart_getCalibrateState() == EMSUART_CALIBRATE_DONE) ? "calibrated" : "defaults"));
 
         if (ems_getTxCapable()) {
             char valuestr[8] = {0}; // for formatting floats
@@ -496,6 +610,227 @@ void showInfo() {
     myDebug_P(PSTR("")); // newline
 }
 
+// the bus timing histograms, in the order of _timing_names
+static const char * const _timing_names[] = {"poll_interval", "poll_latency", "read_latency", "gap"};
+
+static void _timingHistograms(const _EMS_Histogram * histograms[]) {
+    _EMSUART_Timing * timing = emsuart_getTiming();
+    histograms[0]            = &timing->pollInterval;
+    histograms[1]            = &timing->pollLatency;
+    histograms[2]            = &timing->readLatency;
+    histograms[3]            = &timing->gap;
+}
+
+// add the count, percentiles and max of a histogram to a JSON object
+static void _timingToJson(JsonObject json, const _EMS_Histogram * histogram) {
+    json["n"]   = histogram->count;
+    json["p50"] = _histogram_percentile(histogram, 50);
+    json["p90"] = _histogram_percentile(histogram, 90);
+    json["p99"] = _histogram_percentile(histogram, 99);
+    json["max"] = histogram->max;
+}
+
+// show the bus timing percentiles, all in microseconds
+void showTiming() {
+    const _EMS_Histogram * histograms[ArraySize(_timing_names)];
+    _timingHistograms(histograms);
+
+    myDebug_P(PSTR("%sEMS bus timing in microseconds:%s"), COLOR_BOLD_ON, COLOR_BOLD_OFF);
+    myDebug_P(PSTR("  %-14s %8s %9s %9s %9s %9s"), "", "count", "p50", "p90", "p99", "max");
+    for (uint8_t i = 0; i < ArraySize(_timing_names); i++) {
+        myDebug_P(PSTR("  %-14s %8lu %9lu %9lu %9lu %9lu"),
+                  _timing_names[i],
+                  (unsigned long)histograms[i]->count,
+                  (unsigned long)_histogram_percentile(histograms[i], 50),
+                  (unsigned long)_histogram_percentile(histograms[i], 90),
+                  (unsigned long)_histogram_percentile(histograms[i], 99),
+                  (unsigned long)histograms[i]->max);
+    }
+    myDebug_P(PSTR("")); // newline
+}
+
+// send the bus timing percentiles as a JSON package to MQTT
+void publishTimingValues() {
+    if (!myESP.isMQTTConnected() || (!ems_getBusConnected())) {
+        return;
+    }
+
+    StaticJsonDocument<MQTT_MAX_PAYLOAD_SIZE> doc;
+    JsonObject                                rootTiming = doc.to<JsonObject>();
+    const _EMS_Histogram *                    histograms[ArraySize(_timing_names)];
+    _timingHistograms(histograms);
+
+    for (uint8_t i = 0; i < ArraySize(_timing_names); i++) {
+        _timingToJson(rootTiming.createNestedObject(_timing_names[i]), histograms[i]);
+    }
+
+    char data[MQTT_MAX_PAYLOAD_SIZE] = {0};
+    serializeJson(doc, data, sizeof(data));
+    myESP.mqttPublish(TOPIC_BUS_TIMING, data);
+}
+
+// a rate per second, rounded to 2 decimals
+static float _trafficRate(uint32_t count, uint32_t elapsed) {
+    return elapsed ? ((int)(count * 100000.0 / elapsed + 0.5) / 100.0) : 0;
+}
+
+// a fixed point average of the bus occupancy in %, rounded to 1 decimal
+static float _trafficLoad(uint32_t load) {
+    return (int)(load * 10.0 / (1 << EMS_BUSSTATS_FSHIFT) + 0.5) / 10.0;
+}
+
+// the hex key of a source or type ID
+static char * _trafficId(char * buffer, uint16_t id) {
+    if (id == EMS_BUSSTATS_OTHER) {
+        strlcpy(buffer, "other", 6);
+    } else {
+        snprintf(buffer, 6, (id > 0xFF) ? "%04X" : "%02X", id);
+    }
+    return buffer;
+}
+
+static void _showTrafficCounts(const char * what, const _EMS_BusCount * counts, uint8_t used, uint32_t elapsed, uint32_t bytes) {
+    char id_s[6]        = {0};
+    char valuestr[2][8] = {{0}};
+    for (uint8_t i = 0; i < used; i++) {
+        myDebug_P(PSTR("      %s %s: %s telegrams/s, %s bytes/s, %d%% of the bytes"),
+                  what,
+                  _trafficId(id_s, counts[i].id),
+                  _float_to_char(valuestr[0], _trafficRate(counts[i].telegrams, elapsed)),
+                  _float_to_char(valuestr[1], _trafficRate(counts[i].bytes, elapsed)),
+                  bytes ? (uint8_t)((counts[i].bytes * 100ULL) / bytes) : 0);
+    }
+}
+
+// show the bus occupancy and who is using it
+void showTraffic() {
+    ems_busStatsTick();
+    _EMS_BusStats * stats   = ems_getBusStats();
+    uint32_t        elapsed = millis() - stats->start;
+    char            valuestr[3][8];
+
+    myDebug_P(PSTR("%sEMS bus traffic over the last %d seconds:%s"), COLOR_BOLD_ON, elapsed / 1000, COLOR_BOLD_OFF);
+    myDebug_P(PSTR("  Occupancy: last %d s=%d.%d%%, 1 min=%s%%, 5 min=%s%%, 15 min=%s%%"),
+              EMS_BUSSTATS_SAMPLE / 1000,
+              stats->lastBusy / 10,
+              stats->lastBusy % 10,
+              _float_to_char(valuestr[0], _trafficLoad(stats->load[0]), 1),
+              _float_to_char(valuestr[1], _trafficLoad(stats->load[1]), 1),
+              _float_to_char(valuestr[2], _trafficLoad(stats->load[2]), 1));
+    myDebug_P(PSTR("      of which our Tx: last %d s=%d.%d%%, 1 min=%s%%, 5 min=%s%%, 15 min=%s%%"),
+              EMS_BUSSTATS_SAMPLE / 1000,
+              stats->lastOurs / 10,
+              stats->lastOurs % 10,
+              _float_to_char(valuestr[0], _trafficLoad(stats->ourLoad[0]), 1),
+              _float_to_char(valuestr[1], _trafficLoad(stats->ourLoad[1]), 1),
+              _float_to_char(valuestr[2], _trafficLoad(stats->ourLoad[2]), 1));
+    myDebug_P(PSTR("  # telegrams=%d (%s/s), # bytes=%d (%s/s), # polls=%d (%s/s)"),
+              stats->telegrams,
+              _float_to_char(valuestr[0], _trafficRate(stats->telegrams, elapsed)),
+              stats->bytes,
+              _float_to_char(valuestr[1], _trafficRate(stats->bytes, elapsed)),
+              stats->polls,
+              _float_to_char(valuestr[2], _trafficRate(stats->polls, elapsed)));
+    myDebug_P(PSTR("  Our Tx: # telegrams=%d, # bytes=%d, %d%% of the bytes"),
+              stats->ourTelegrams,
+              stats->ourBytes,
+              stats->bytes ? (uint8_t)((stats->ourBytes * 100ULL) / stats->bytes) : 0);
+    _showTrafficCounts("from", stats->sources, stats->sourceCount, elapsed, stats->bytes);
+    _showTrafficCounts("type", stats->types, stats->typeCount, elapsed, stats->bytes);
+    myDebug_P(PSTR("")); // newline
+}
+
+// add the telegrams and bytes per second of each source or type ID to a JSON object
+static void _trafficToJson(JsonObject json, const _EMS_BusCount * counts, uint8_t used, uint32_t elapsed) {
+    char id_s[6] = {0};
+    for (uint8_t i = 0; i < used; i++) {
+        JsonArray rates = json.createNestedArray(_trafficId(id_s, counts[i].id));
+        rates.add(_trafficRate(counts[i].telegrams, elapsed));
+        rates.add(_trafficRate(counts[i].bytes, elapsed));
+    }
+}
+
+// send the bus occupancy and the traffic by source and type as a JSON package to MQTT
+void publishTrafficValues() {
+    if (!myESP.isMQTTConnected() || (!ems_getBusConnected())) {
+        return;
+    }
+
+    ems_busStatsTick();
+    _EMS_BusStats *     stats   = ems_getBusStats();
+    uint32_t            elapsed = millis() - stats->start;
+    DynamicJsonDocument doc(MQTT_MAX_PAYLOAD_SIZE_LARGE);
+    JsonObject          rootTraffic = doc.to<JsonObject>();
+
+    // occupancy in %: the last sample, then the 1, 5 and 15 minute averages
+    JsonArray load = rootTraffic.createNestedArray("load");
+    JsonArray tx   = rootTraffic.createNestedArray("tx");
+    load.add(stats->lastBusy / 10.0);
+    tx.add(stats->lastOurs / 10.0);
+    for (uint8_t i = 0; i < 3; i++) {
+        load.add(_trafficLoad(stats->load[i]));
+        tx.add(_trafficLoad(stats->ourLoad[i]));
+    }
+
+    rootTraffic["tps"]   = _trafficRate(stats->telegrams, elapsed);
+    rootTraffic["bps"]   = _trafficRate(stats->bytes, elapsed);
+    rootTraffic["polls"] = _trafficRate(stats->polls, elapsed);
+    _trafficToJson(rootTraffic.createNestedObject("src"), stats->sources, stats->sourceCount, elapsed);
+    _trafficToJson(rootTraffic.createNestedObject("type"), stats->types, stats->typeCount, elapsed);
+
+    char data[MQTT_MAX_PAYLOAD_SIZE_LARGE] = {0};
+    serializeJson(doc, data, sizeof(data));
+    myESP.mqttPublish(TOPIC_BUS_STATS, data);
+}
+
+// send the UART counters as a JSON package to MQTT, to tell noise on the bus from data lost in the ESP
+void publishUARTValues() {
+    if (!myESP.isMQTTConnected() || (!ems_getBusConnected())) {
+        return;
+    }
+
+    _EMSUART_RxStats *                        rxStats = emsuart_getRxStats();
+    StaticJsonDocument<MQTT_MAX_PAYLOAD_SIZE> doc;
+    JsonObject                                rootUART = doc.to<JsonObject>();
+
+    rootUART["rx"]          = rxStats->telegrams;
+    rootUART["dropped"]     = rxStats->dropped;
+    rootUART["too_long"]    = rxStats->overflows;
+    rootUART["too_short"]   = rxStats->runts;
+    rootUART["double_brk"]  = rxStats->breaks;
+    rootUART["phantom_brk"] = rxStats->phantomBreaks;
+    rootUART["overruns"]    = rxStats->overruns;
+    rootUART["frame_err"]   = rxStats->frameErrors;
+    rootUART["fifo_max"]    = rxStats->fifoMax;
+    rootUART["isr"]         = rxStats->isrCalls;
+    rootUART["isr_us"]      = (uint32_t)(rxStats->isrCycles / ESP.getCpuFreqMHz());
+    rootUART["isr_max_us"]  = rxStats->isrCyclesMax / ESP.getCpuFreqMHz();
+
+    char data[MQTT_MAX_PAYLOAD_SIZE] = {0};
+    serializeJson(doc, data, sizeof(data));
+    myESP.mqttPublish(TOPIC_UART_STATS, data);
+}
+
+// a block read in chunks, with how long the last read of it took. with_data adds its bytes in hex
+static void _blockToJson(JsonObject json, const _EMS_Block * block, bool with_data) {
+    json["device"]    = block->dest;
+    json["type"]      = block->type;
+    json["length"]    = block->length;
+    json["complete"]  = block->complete;
+    json["transfers"] = block->transfers;
+    json["failed"]    = block->failed;
+    json["ms"]        = block->timeLast;
+    json["max_ms"]    = block->timeMax;
+
+    if (with_data) {
+        char hex[(EMS_BLOCK_LENGTH_MAX * 2) + 1] = {0};
+        for (uint8_t i = 0; i < block->length; i++) {
+            _hextoa(block->data[i], &hex[i * 2]);
+        }
+        json["data"] = hex; // copied, as it's not const
+    }
+}
+
 // send all dallas sensor values as a JSON package to MQTT
 void publishSensorValues() {
     // don't send if MQTT is connected
@@ -822,11 +1157,33 @@ void publishEMSValues(bool force) {
         myESP.mqttPublish(TOPIC_HP_DATA, data);
         ems_Device_remove_flags(EMS_DEVICE_UPDATE_FLAG_HEATPUMP); // unset flag
     }
+
+    // handle the blocks read in chunks, each as one object
+    if (ems_Device_has_flags(EMS_DEVICE_UPDATE_FLAG_BLOCK) || force) {
+        char topic[20];
+        for (uint8_t i = 0; i < ems_getBlockCount(); i++) {
+            _EMS_Block * block = ems_getBlock(i);
+            if (!block->complete) {
+                continue;
+            }
+            doc.clear();
+            _blockToJson(doc.to<JsonObject>(), block, true);
+
+            data[0] = '\0'; // reset data for next package
+            serializeJson(doc, data, sizeof(data));
+            snprintf(topic, sizeof(topic), TOPIC_BLOCK_DATA, block->dest, block->type);
+            myESP.mqttPublish(topic, data);
+        }
+        ems_Device_remove_flags(EMS_DEVICE_UPDATE_FLAG_BLOCK); // unset flag
+    }
 }
 
 // call PublishValues without forcing
 void do_publishValues() {
     publishEMSValues(true); // force publish
+    publishTimingValues();
+    publishTrafficValues();
+    publishUARTValues();
 }
 
 // callback to light up the LED, called via Ticker every second
@@ -849,7 +1206,8 @@ void do_systemCheck() {
     }
 }
 
-// force calls to get data from EMS for the types that aren't sent as broadcasts
+// force calls to get data from EMS for the types that aren't sent as broadcasts, with the refresh command
+// the regular reads are done by ems_refreshTick()
 // only if we have a EMS connection
 void do_regularUpdates() {
     if (ems_getBusConnected() && !ems_getTxDisabled()) {
@@ -916,6 +1274,11 @@ bool LoadSaveCallback(MYESP_FSACTION_t action, JsonObject settings) {
         EMSESP_Settings.tx_mode = settings["tx_mode"] | EMS_TXMODE_DEFAULT; // default to 1 (generic)
         ems_setTxMode(EMSESP_Settings.tx_mode);
 
+        EMSESP_Settings.cache_ttl = settings["cache_ttl"] | (EMS_CACHE_TTL / 1000);
+        ems_setCacheTTL(EMSESP_Settings.cache_ttl * 1000UL);
+
+        emsuart_setTxTiming(settings["tx_brk_wait"], settings["tx_gap"]); // 0 if not calibrated, for the default
+
         return true;
     }
 
@@ -929,6 +1292,9 @@ bool LoadSaveCallback(MYESP_FSACTION_t action, JsonObject settings) {
         settings["shower_alert"]    = EMSESP_Settings.shower_alert;
         settings["publish_time"]    = EMSESP_Settings.publish_time;
         settings["tx_mode"]         = EMSESP_Settings.tx_mode;
+        settings["cache_ttl"]       = EMSESP_Settings.cache_ttl;
+        settings["tx_brk_wait"]     = emsuart_getTxTiming()->brkWait;
+        settings["tx_gap"]          = emsuart_getTxTiming()->gap;
 
         return true;
     }
@@ -1073,6 +1439,13 @@ bool SetListCallback(MYESP_FSACTION_t action, uint8_t wc, const char * setting,
                 myDebug_P(PSTR("Error. Usage: set tx_mode <1 | 2 | 3>"));
             }
         }
+
+        // cache_ttl
+        if ((strcmp(setting, "cache_ttl") == 0) && (wc == 2)) {
+            EMSESP_Settings.cache_ttl = atoi(value);
+            ems_setCacheTTL(EMSESP_Settings.cache_ttl * 1000UL);
+            ok = true;
+        }
     }
 
     if (action == MYESP_FSACTION_LIST) {
@@ -1081,6 +1454,8 @@ bool SetListCallback(MYESP_FSACTION_t action, uint8_t wc, const char * setting,
         myDebug_P(PSTR("  dallas_gpio=%d"), EMSESP_Settings.dallas_gpio);
         myDebug_P(PSTR("  dallas_parasite=%s"), EMSESP_Settings.dallas_parasite ? "on" : "off");
         myDebug_P(PSTR("  tx_mode=%d"), EMSESP_Settings.tx_mode);
+        myDebug_P(PSTR("  tx_brk_wait=%d, tx_gap=%d (use 'calibrate' to change)"), emsuart_getTxTiming()->brkWait, emsuart_getTxTiming()->gap);
+        myDebug_P(PSTR("  cache_ttl=%d"), EMSESP_Settings.cache_ttl);
         myDebug_P(PSTR("  listen_mode=%s"), EMSESP_Settings.listen_mode ? "on" : "off");
         myDebug_P(PSTR("  shower_timer=%s"), EMSESP_Settings.shower_timer ? "on" : "off");
         myDebug_P(PSTR("  shower_alert=%s"), EMSESP_Settings.shower_alert ? "on" : "off");
@@ -1152,6 +1527,50 @@ void TelnetCommandCallback(uint8_t wc, const char * commandLine) {
         ok = true;
     }
 
+    if (strcmp(first_cmd, "timing") == 0) {
+        if (wc == 2) {
+            char * second_cmd = _readWord();
+            if (strcmp(second_cmd, "clear") == 0) {
+                emsuart_clearTiming();
+                ok = true;
+            }
+        } else {
+            showTiming();
+            ok = true;
+        }
+    }
+
+    if (strcmp(first_cmd, "traffic") == 0) {
+        if (wc == 2) {
+            char * second_cmd = _readWord();
+            if (strcmp(second_cmd, "clear") == 0) {
+                ems_clearBusStats();
+                ok = true;
+            }
+        } else {
+            showTraffic();
+            ok = true;
+        }
+    }
+
+    if (strcmp(first_cmd, "calibrate") == 0) {
+        if (wc == 2) {
+            char * second_cmd = _readWord();
+            if (strcmp(second_cmd, "reset") == 0) {
+                emsuart_setTxTiming(0, 0);
+                myESP.fs_saveSettings();
+                myDebug_P(PSTR("Tx timing set back to the defaults"));
+                ok = true;
+            }
+        } else if (emsuart_calibrate()) {
+            myDebug_P(PSTR("Calibrating the Tx timing. This takes a few minutes, 'info' shows how far it has got"));
+            ok = true;
+        } else {
+            myDebug_P(PSTR("Only tx_mode 2 and 3 have a Tx timing to calibrate"));
+            ok = true;
+        }
+    }
+
     if (strcmp(first_cmd, "publish") == 0) {
         do_publishValues();
         publishSensorValues();
@@ -1183,7 +1602,7 @@ void TelnetCommandCallback(uint8_t wc, const char * commandLine) {
             }
         } else {
             ems_clearDeviceList();
-            ems_doReadCommand(EMS_TYPE_UBADevices, EMS_Boiler.device_id);
+            ems_discoverModels();
             ok = true;
         }
     }
@@ -1609,10 +2028,12 @@ void WebCallback(JsonObject root) {
     }
 
     // send over EMS devices
-    JsonArray list = emsbus.createNestedArray("devices");
-    char      buffer[50];
+    JsonArray          list = emsbus.createNestedArray("devices");
+    char               buffer[50];
+    uint8_t            n = 0;
+    _Detected_Device * it;
 
-    for (std::list<_Detected_Device>::iterator it = Devices.begin(); it != Devices.end(); ++it) {
+    while ((it = ems_nextDevice(&n))) {
         JsonObject item = list.createNestedObject();
 
         (void)ems_getDeviceTypeDescription((it)->device_id, buffer);
@@ -1638,6 +2059,20 @@ void WebCallback(JsonObject root) {
         item["deviceid"] = tmp_hex;
     }
 
+    // send over the bus timing percentiles
+    JsonObject             timing = emsbus.createNestedObject("timing");
+    const _EMS_Histogram * histograms[ArraySize(_timing_names)];
+    _timingHistograms(histograms);
+    for (uint8_t i = 0; i < ArraySize(_timing_names); i++) {
+        _timingToJson(timing.createNestedObject(_timing_names[i]), histograms[i]);
+    }
+
+    // and the blocks read in chunks, without their bytes which wouldn't fit. They go to MQTT
+    JsonArray blocks = emsbus.createNestedArray("blocks");
+    for (uint8_t i = 0; i < ems_getBlockCount(); i++) {
+        _blockToJson(blocks.createNestedObject(), ems_getBlock(i), false);
+    }
+
     // send over Thermostat data
     JsonObject thermostat = root.createNestedObject("thermostat");
 
@@ -1774,6 +2209,7 @@ void initEMSESP() {
     EMSESP_Settings.led_gpio       = EMSESP_LED_GPIO;
     EMSESP_Settings.dallas_gpio    = EMSESP_DALLAS_GPIO;
     EMSESP_Settings.tx_mode        = EMS_TXMODE_DEFAULT; // default tx mode
+    EMSESP_Settings.cache_ttl      = EMS_CACHE_TTL / 1000;
 
     // shower settings
     EMSESP_Shower.timerStart    = 0;
@@ -1888,7 +2324,7 @@ void setup() {
 
     // enable regular checks
     if (!EMSESP_Settings.listen_mode) {
-        regularUpdatesTimer.attach(REGULARUPDATES_TIME, do_regularUpdates); // regular reads from the EMS
+        regularUpdatesTimer.attach(EMS_REFRESH_TICK_TIME, ems_refreshTick); // regular reads from the EMS
     }
 
     // set timers for MQTT publish
@@ -1917,6 +2353,14 @@ void setup() {
 void loop() {
     myESP.loop(); // handle telnet, mqtt, wifi etc
 
+    emsuart_loop(); // only does something for UART backends without an Rx interrupt
+    ems_txTick();   // reply timeouts and the backoff after Tx failures
+
+    // the Tx timing has been calibrated, or backed off after failures
+    if (emsuart_txTimingChanged()) {
+        myESP.fs_saveSettings();
+    }
+
     // check Dallas sensors, using same schedule as publish_time (default 2 mins in DS18_READ_INTERVAL)
     // these values are published to MQTT separately via the timer publishSensorValuesTimer
     if (EMSESP_Settings.dallas_sensors) {
@@ -11,7 +11,6 @@
 #include "ems_devices.h"
 #include "ems_utils.h"
 #include "emsuart.h"
-#include <CircularBuffer.h> // https://github.com/rlogiacco/CircularBuffer
 #include <map>
 
 #ifdef TESTS
@@ -19,9 +18,25 @@
 uint8_t _TEST_DATA_max = ArraySize(TEST_DATA);
 #endif
 
-_EMS_Sys_Status                                            EMS_Sys_Status; // EMS Status
-CircularBuffer<_EMS_TxTelegram, EMS_TX_TELEGRAM_QUEUE_MAX> EMS_TxQueue;    // FIFO queue for Tx send buffer
-std::list<_Detected_Device>                                Devices;        // for storing all detected EMS devices
+_EMS_Sys_Status EMS_Sys_Status; // EMS Status
+EMSTxQueue      EMS_TxQueue;    // FIFO queue for Tx send buffer
+
+// the Tx queue telegram staged for the next poll, see ems_stageTx()
+#define EMS_STAGE_TX (EMSUART_STAGE_POLLACK + 1) // its tag
+static bool _ems_stageBatching = false;          // a new write was held back, see _ems_txBatching()
+
+// the Tx state machine for the telegram at the front of the Tx queue, see ems_txTick()
+static uint32_t         _ems_txSent     = 0; // millis() when it went out
+static uint32_t         _ems_txDeadline = 0; // millis() by which the reply must be in, or when it can go again after a failure
+static uint8_t          _ems_txFailures = 0; // # failures in a row, for the backoff
+static _EMS_TxFailStats _ems_txFailStats[EMS_TX_FAILS];
+
+// acknowledged writes whose validate is in the Tx queue, see _ems_validateSeen()
+static _EMS_PendingValidate _ems_validatePending[EMS_VALIDATE_PENDING_MAX];
+static uint8_t              _ems_validateNext = 0; // the slot that goes next when they're all taken
+
+// the running device discovery, see ems_discoverModels()
+static _EMS_Discovery EMS_Discovery;
 
 uint8_t _EMS_Devices_max       = ArraySize(EMS_Devices);
 uint8_t _EMS_Devices_Types_max = ArraySize(EMS_Devices_Types);
@@ -74,23 +89,44 @@ void ems_Device_remove_flags(unsigned int flags) {
 // init stats and counters and buffers
 void ems_init() {
     ems_clearDeviceList(); // init the device map
+    _ems_hashTypes();      // for looking up telegram types
+    _ems_clearShadows();   // no copies of earlier telegrams
+    _ems_clearRefresh();   // nothing scheduled to be read
+    _ems_clearBlocks();    // no blocks to read
+    _ems_checkFields();    // the field lists must be sorted, see _ems_decodeFields()
+    memset(&EMS_Discovery, 0, sizeof(EMS_Discovery));
+    ems_clearBusStats();   // start counting the bus traffic
+    memset(_ems_txFailStats, 0, sizeof(_ems_txFailStats));
+    memset(_ems_validatePending, 0, sizeof(_ems_validatePending));
 
     // overall status
-    EMS_Sys_Status.emsRxPgks         = 0;
-    EMS_Sys_Status.emsTxPkgs         = 0;
-    EMS_Sys_Status.emxCrcErr         = 0;
-    EMS_Sys_Status.emsRxStatus       = EMS_RX_STATUS_IDLE;
-    EMS_Sys_Status.emsTxStatus       = EMS_TX_REV_DETECT;
-    EMS_Sys_Status.emsRefreshedFlags = EMS_DEVICE_UPDATE_FLAG_NONE;
-    EMS_Sys_Status.emsPollEnabled    = false; // start up with Poll disabled
-    EMS_Sys_Status.emsBusConnected   = false;
-    EMS_Sys_Status.emsRxTimestamp    = 0;
-    EMS_Sys_Status.emsTxCapable      = false;
-    EMS_Sys_Status.emsTxDisabled     = false;
-    EMS_Sys_Status.emsPollFrequency  = 0;
-    EMS_Sys_Status.txRetryCount      = 0;
-    EMS_Sys_Status.emsIDMask         = 0x00;
-    EMS_Sys_Status.emsPollAck[0]     = EMS_ID_ME;
+    EMS_Sys_Status.emsRxPgks             = 0;
+    EMS_Sys_Status.emsTxPkgs             = 0;
+    EMS_Sys_Status.emxCrcErr             = 0;
+    memset(EMS_Sys_Status.emsCrcErrSrc, 0, sizeof(EMS_Sys_Status.emsCrcErrSrc));
+    EMS_Sys_Status.emsRxUnchanged        = 0;
+    EMS_Sys_Status.emsRxSkipped          = 0;
+    EMS_Sys_Status.emsTxReadsMerged      = 0;
+    EMS_Sys_Status.emsTxReadsPlanned     = 0;
+    EMS_Sys_Status.emsTxWritesReplaced   = 0;
+    EMS_Sys_Status.emsTxWritesCombined   = 0;
+    EMS_Sys_Status.emsTxValidatesSkipped = 0;
+    EMS_Sys_Status.emsRefreshReads       = 0;
+    EMS_Sys_Status.emsCacheHits          = 0;
+    EMS_Sys_Status.emsCacheMisses        = 0;
+    EMS_Sys_Status.emsCacheTTL           = EMS_CACHE_TTL;
+    EMS_Sys_Status.emsRxStatus           = EMS_RX_STATUS_IDLE;
+    EMS_Sys_Status.emsTxStatus           = EMS_TX_REV_DETECT;
+    EMS_Sys_Status.emsRefreshedFlags     = EMS_DEVICE_UPDATE_FLAG_NONE;
+    EMS_Sys_Status.emsPollEnabled        = false; // start up with Poll disabled
+    EMS_Sys_Status.emsBusConnected       = false;
+    EMS_Sys_Status.emsRxTimestamp        = 0;
+    EMS_Sys_Status.emsTxCapable          = false;
+    EMS_Sys_Status.emsTxDisabled         = false;
+    EMS_Sys_Status.emsPollFrequency      = 0;
+    EMS_Sys_Status.txRetryCount          = 0;
+    EMS_Sys_Status.emsIDMask             = 0x00;
+    EMS_Sys_Status.emsPollAck[0]         = EMS_ID_ME;
 
     // thermostat
     strlcpy(EMS_Thermostat.datetime, "?", sizeof(EMS_Thermostat.datetime));
@@ -208,6 +244,7 @@ void ems_init() {
 // Getters and Setters for parameters
 void ems_setPoll(bool b) {
     EMS_Sys_Status.emsPollEnabled = b;
+    ems_stageTx();
     myDebug_P(PSTR("EMS Bus Poll is set to %s"), EMS_Sys_Status.emsPollEnabled ? "enabled" : "disabled");
 }
 
@@ -245,6 +282,7 @@ uint8_t ems_getSolarModuleModel() {
 
 void ems_setTxDisabled(bool b) {
     EMS_Sys_Status.emsTxDisabled = b;
+    ems_stageTx();
 }
 
 bool ems_getTxDisabled() {
@@ -325,72 +363,57 @@ uint8_t _crcCalculator(uint8_t * data, uint8_t len) {
     return crc;
 }
 
-// unsigned short
-void _setValue(_EMS_RxTelegram * EMS_RxTelegram, uint16_t * param_op, uint8_t index) {
-    if (index >= EMS_RxTelegram->data_length) {
-        return;
-    }
-
-    uint16_t value = (EMS_RxTelegram->data[index] << 8) + EMS_RxTelegram->data[index + 1];
-
-    // check for undefined/unset values, 0x8000
-    if (value == EMS_VALUE_USHORT_NOTSET) {
-        return;
-    }
-
-    *param_op = value;
-}
-
-// signed short
-void _setValue(_EMS_RxTelegram * EMS_RxTelegram, int16_t * param_op, uint8_t index) {
-    if (index >= EMS_RxTelegram->data_length) {
-        return;
-    }
-
-    int16_t value = (EMS_RxTelegram->data[index] << 8) + EMS_RxTelegram->data[index + 1];
-
-    // check for undefined/unset values, 0x8000
-    if ((value == EMS_VALUE_SHORT_NOTSET) || (EMS_RxTelegram->data[index] == 0x7D)) {
-        return;
-    }
-
-    *param_op = value;
-}
-
-// Byte
-void _setValue(_EMS_RxTelegram * EMS_RxTelegram, uint8_t * param_op, uint8_t index) {
-    if (index >= EMS_RxTelegram->data_length) {
-        return;
-    }
-
-    *param_op = (uint8_t)EMS_RxTelegram->data[index];
-}
-
-// convert signed short to single 8 byte, for setpoint thermostat temperatures that don't store their temps in 2 bytes
-void _setValue8(_EMS_RxTelegram * EMS_RxTelegram, int16_t * param_op, uint8_t index) {
-    if (index >= EMS_RxTelegram->data_length) {
-        return;
-    }
+// bytes each _EMS_FIELD_FORMAT takes up
+const uint8_t EMS_Field_width[] = {1, 1, 2, 2, 3, 1};
 
-    *param_op = EMS_RxTelegram->data[index];
+// a field from a list in flash, in one read
+static inline _EMS_Field _ems_readField(const _EMS_Field * fields, uint8_t i) {
+    uint32_t   word = pgm_read_dword(&fields[i]);
+    _EMS_Field field;
+    memcpy(&field, &word, sizeof(_EMS_Field));
+    return field;
 }
 
-// Long
-void _setValue(_EMS_RxTelegram * EMS_RxTelegram, uint32_t * param_op, uint8_t index) {
-    if (index >= EMS_RxTelegram->data_length) {
-        return;
-    }
-
-    *param_op = (uint32_t)((EMS_RxTelegram->data[index] << 16) + (EMS_RxTelegram->data[index + 1] << 8) + (EMS_RxTelegram->data[index + 2]));
-}
+/**
+ * Decode a list of fields from a telegram into dest, e.g. &EMS_Boiler or &EMS_Thermostat.hc[hc]
+ * The list is in flash and sorted by index (checked by _ems_checkFields()), so it stops at the first field past the end
+ * of the telegram. Values that are not set are skipped. The formats are tested most common first, which is quicker than a switch
+ */
+void _ems_decodeFields(_EMS_RxTelegram * EMS_RxTelegram, const _EMS_Field * fields, uint8_t count, void * dest) {
+    uint8_t   data_length = EMS_RxTelegram->data_length;
+    uint8_t * telegram    = EMS_RxTelegram->data;
+    uint8_t * values      = (uint8_t *)dest;
+
+    for (uint8_t i = 0; i < count; i++) {
+        _EMS_Field field = _ems_readField(fields, i);
+        if (field.index >= data_length) {
+            break;
+        }
 
-// bit from a byte
-void _setValue(_EMS_RxTelegram * EMS_RxTelegram, uint8_t * param_op, uint8_t index, uint8_t bit) {
-    if (index >= EMS_RxTelegram->data_length) {
-        return;
+        uint8_t * data   = &telegram[field.index];
+        uint8_t * value  = values + field.value;
+        uint8_t   format = field.format;
+
+        if (format == EMS_FIELD_FORMAT_UBYTE) {
+            *value = data[0];
+        } else if (format == EMS_FIELD_FORMAT_BIT) {
+            *value = (data[0] >> field.bit) & 0x01;
+        } else if (format == EMS_FIELD_FORMAT_USHORT) {
+            uint16_t v = (data[0] << 8) + data[1];
+            if (v != EMS_VALUE_USHORT_NOTSET) {
+                *(uint16_t *)value = v;
+            }
+        } else if (format == EMS_FIELD_FORMAT_SHORT) {
+            int16_t v = (data[0] << 8) + data[1];
+            if ((v != EMS_VALUE_SHORT_NOTSET) && (data[0] != 0x7D)) {
+                *(int16_t *)value = v;
+            }
+        } else if (format == EMS_FIELD_FORMAT_BYTE16) {
+            *(int16_t *)value = data[0];
+        } else {
+            *(uint32_t *)value = (uint32_t)((data[0] << 16) + (data[1] << 8) + data[2]);
+        }
     }
-
-    *param_op = (uint8_t)(((EMS_RxTelegram->data[index]) >> (bit)) & 0x01);
 }
 
 void ems_setTxMode(uint8_t mode) {
@@ -483,2245 +506,4333 @@ void _debugPrintTelegram(const char * prefix, _EMS_RxTelegram * EMS_RxTelegram,
 }
 
 /**
- * send the contents of the Tx buffer to the UART
- * we take telegram from the queue and send it, but don't remove it until later when its confirmed successful
+ * the bytes of an encoded telegram, which follow its queue entry
  */
-void _ems_sendTelegram() {
-    // check if we have something in the queue to send
-    if (EMS_TxQueue.isEmpty()) {
-        return;
-    }
+uint8_t * _ems_txData(_EMS_TxQueueEntry * entry) {
+    return (uint8_t *)(entry + 1);
+}
 
-    // if we're preventing all outbound traffic, quit
-    if (ems_getTxDisabled()) {
-        EMS_TxQueue.shift(); // remove from queue
-        return;
+/**
+ * the Tx queue lane for a telegram
+ */
+static uint8_t _ems_txLane(const _EMS_TxTelegram * EMS_TxTelegram) {
+    if (EMS_TxTelegram->action == EMS_TX_TELEGRAM_VALIDATE) {
+        return EMS_TX_LANE_VALIDATE;
     }
-
-    // get the first in the queue, which is at the head
-    // we don't remove from the queue yet
-    _EMS_TxTelegram EMS_TxTelegram = EMS_TxQueue.first();
-
-    // if we're in raw mode just fire and forget
-    if (EMS_TxTelegram.action == EMS_TX_TELEGRAM_RAW) {
-        EMS_TxTelegram.data[EMS_TxTelegram.length - 1] = _crcCalculator(EMS_TxTelegram.data, EMS_TxTelegram.length); // add the CRC
-
-        if (EMS_Sys_Status.emsLogging != EMS_SYS_LOGGING_NONE) {
-            _EMS_RxTelegram EMS_RxTelegram;                     // create new Rx object
-            EMS_RxTelegram.length      = EMS_TxTelegram.length; // full length of telegram
-            EMS_RxTelegram.telegram    = EMS_TxTelegram.data;
-            EMS_RxTelegram.data_length = 0;                     // ignore #data=
-            EMS_RxTelegram.timestamp   = myESP.getSystemTime(); // now
-            _debugPrintTelegram("Sending raw: ", &EMS_RxTelegram, COLOR_CYAN, true);
+    if (EMS_TxTelegram->action == EMS_TX_TELEGRAM_READ) {
+        if ((EMS_TxTelegram->type == EMS_TYPE_Version) || (EMS_TxTelegram->type == EMS_TYPE_UBADevices)) {
+            return EMS_TX_LANE_DISCOVERY;
         }
+        return EMS_TX_LANE_REFRESH;
+    }
+    return EMS_TX_LANE_INTERACTIVE; // writes and raw
+}
 
-        _EMS_TX_STATUS _txStatus = emsuart_tx_buffer(EMS_TxTelegram.data, EMS_TxTelegram.length); // send the telegram to the UART Tx
-        if (EMS_TX_BRK_DETECT == _txStatus || EMS_TX_WTD_TIMEOUT == _txStatus) {
-            // Tx Error!
-            if (EMS_Sys_Status.emsLogging == EMS_SYS_LOGGING_VERBOSE) {
-                myDebug_P(PSTR("** error sending buffer: %s"), _txStatus == EMS_TX_BRK_DETECT ? "BRK" : "WDTO");
-            }
-            // EMS_Sys_Status.emsTxStatus = EMS_TX_STATUS_IDLE;
-        }
-        EMS_TxQueue.shift(); // and remove from queue
+/**
+ * Encode a Tx telegram into a queue entry, building the header, EMS+ type bytes and CRC
+ * This is done once when it is added to the queue so sending it on a poll is just handing the bytes to the UART
+ */
+void _ems_encodeTx(const _EMS_TxTelegram * EMS_TxTelegram, _EMS_TxQueueEntry * entry) {
+    uint8_t * data = _ems_txData(entry);
+
+    entry->timestamp          = EMS_TxTelegram->timestamp;
+    entry->type               = EMS_TxTelegram->type;
+    entry->type_validate      = EMS_TxTelegram->type_validate;
+    entry->comparisonPostRead = EMS_TxTelegram->comparisonPostRead;
+    entry->action             = EMS_TxTelegram->action;
+    entry->dest               = EMS_TxTelegram->dest;
+    entry->offset             = EMS_TxTelegram->offset;
+    entry->dataValue          = EMS_TxTelegram->dataValue;
+    entry->comparisonValue    = EMS_TxTelegram->comparisonValue;
+    entry->comparisonOffset   = EMS_TxTelegram->comparisonOffset;
+    entry->emsIDMask          = EMS_Sys_Status.emsIDMask;
+    entry->lane               = _ems_txLane(EMS_TxTelegram);
+    entry->length             = (EMS_TxTelegram->length > EMS_MAX_TELEGRAM_LENGTH) ? EMS_MAX_TELEGRAM_LENGTH : EMS_TxTelegram->length;
+
+    memcpy(data, EMS_TxTelegram->data, entry->length);
+
+    // if we're in raw mode the telegram is as given, only the CRC is added
+    if (entry->action == EMS_TX_TELEGRAM_RAW) {
+        data[entry->length - 1] = _crcCalculator(data, entry->length); // add the CRC
         return;
     }
 
     // create the header
-    EMS_TxTelegram.data[0] = EMS_ID_ME ^ EMS_Sys_Status.emsIDMask; // src
+    data[0] = EMS_ID_ME ^ entry->emsIDMask; // src
 
     // dest
-    if (EMS_TxTelegram.action == EMS_TX_TELEGRAM_WRITE) {
-        EMS_TxTelegram.data[1] = EMS_TxTelegram.dest;
+    if (entry->action == EMS_TX_TELEGRAM_WRITE) {
+        data[1] = entry->dest;
     } else {
         // for a READ or VALIDATE
-        EMS_TxTelegram.data[1] = (EMS_TxTelegram.dest | 0x80); // read has 8th bit set, always
+        data[1] = (entry->dest | 0x80); // read has 8th bit set, always
     }
 
     // complete the rest of the header depending on EMS or EMS+
-    if (EMS_TxTelegram.type > 0xFF) {
+    if (entry->type > 0xFF) {
         // EMS 2.0 / EMS+
-        EMS_TxTelegram.data[2] = 0xFF; // fixed value indicating an extended message
-        EMS_TxTelegram.data[3] = EMS_TxTelegram.offset;
-        EMS_TxTelegram.length += 2; // add 2 bytes to length to compensate the extra FF and byte for the type
+        data[2] = 0xFF; // fixed value indicating an extended message
+        data[3] = entry->offset;
+        entry->length += 2; // add 2 bytes to length to compensate the extra FF and byte for the type
 
         // EMS+ has different format for read and write. See https://github.com/proddy/EMS-ESP/wiki/RC3xx-Thermostats
-        if ((EMS_TxTelegram.action == EMS_TX_TELEGRAM_READ) || (EMS_TxTelegram.action == EMS_TX_TELEGRAM_VALIDATE)) {
-            EMS_TxTelegram.data[4] = EMS_TxTelegram.dataValue;   // for read its #bytes to return
-            EMS_TxTelegram.data[5] = EMS_TxTelegram.type >> 8;   // type, 1st byte
-            EMS_TxTelegram.data[6] = EMS_TxTelegram.type & 0xFF; // type, 2nd byte
-        } else if (EMS_TxTelegram.action == EMS_TX_TELEGRAM_WRITE) {
-            EMS_TxTelegram.data[4] = EMS_TxTelegram.type >> 8;   // type, 1st byte
-            EMS_TxTelegram.data[5] = EMS_TxTelegram.type & 0xFF; // type, 2nd byte
-            EMS_TxTelegram.data[6] = EMS_TxTelegram.dataValue;   // for write it the value to set
+        if ((entry->action == EMS_TX_TELEGRAM_READ) || (entry->action == EMS_TX_TELEGRAM_VALIDATE)) {
+            data[4] = entry->dataValue;   // for read its #bytes to return
+            data[5] = entry->type >> 8;   // type, 1st byte
+            data[6] = entry->type & 0xFF; // type, 2nd byte
+        } else if (entry->action == EMS_TX_TELEGRAM_WRITE) {
+            data[4] = entry->type >> 8;   // type, 1st byte
+            data[5] = entry->type & 0xFF; // type, 2nd byte
+            if (EMS_TxTelegram->length > EMS_MIN_TELEGRAM_LENGTH) {
+                memcpy(&data[6], &EMS_TxTelegram->data[4], EMS_TxTelegram->length - 5); // the values to set, given as for EMS 1.0
+            } else {
+                data[6] = entry->dataValue; // for write it the value to set
+            }
         }
     } else {
         // EMS 1.0
-        EMS_TxTelegram.data[2] = EMS_TxTelegram.type;   // type
-        EMS_TxTelegram.data[3] = EMS_TxTelegram.offset; // offset
-        if (EMS_TxTelegram.length == EMS_MIN_TELEGRAM_LENGTH) {
-            EMS_TxTelegram.data[4] = EMS_TxTelegram.dataValue; // for read its #bytes to return, for write it the value to set
+        data[2] = entry->type;   // type
+        data[3] = entry->offset; // offset
+        if (entry->length == EMS_MIN_TELEGRAM_LENGTH) {
+            data[4] = entry->dataValue; // for read its #bytes to return, for write it the value to set
         }
     }
 
     // finally calculate CRC and add it to the end
-    EMS_TxTelegram.data[EMS_TxTelegram.length - 1] = _crcCalculator(EMS_TxTelegram.data, EMS_TxTelegram.length);
+    data[entry->length - 1] = _crcCalculator(data, entry->length);
+}
 
-    // print debug info
-    if (EMS_Sys_Status.emsLogging == EMS_SYS_LOGGING_VERBOSE) {
-        char s[64] = {0};
-        if (EMS_TxTelegram.action == EMS_TX_TELEGRAM_WRITE) {
-            snprintf(s, sizeof(s), "Sending write of type 0x%02X to 0x%02X, ", EMS_TxTelegram.type, EMS_TxTelegram.dest & 0x7F);
-        } else if (EMS_TxTelegram.action == EMS_TX_TELEGRAM_READ) {
-            snprintf(s, sizeof(s), "Sending read of type 0x%02X to 0x%02X, ", EMS_TxTelegram.type, EMS_TxTelegram.dest & 0x7F);
-        } else if (EMS_TxTelegram.action == EMS_TX_TELEGRAM_VALIDATE) {
-            snprintf(s, sizeof(s), "Sending validate of type 0x%02X to 0x%02X, ", EMS_TxTelegram.type, EMS_TxTelegram.dest & 0x7F);
-        }
+// bytes an entry takes up in the arena, rounded up to keep the next one aligned
+static inline uint16_t _ems_txEntrySize(uint8_t length) {
+    return (sizeof(_EMS_TxQueueEntry) + length + 3) & ~3;
+}
 
-        _EMS_RxTelegram EMS_RxTelegram;
-        EMS_RxTelegram.length      = EMS_TxTelegram.length; // complete length of telegram incl CRC
-        EMS_RxTelegram.data_length = 0;                     // ignore the data length for read and writes. only used for incoming.
-        EMS_RxTelegram.telegram    = EMS_TxTelegram.data;
-        EMS_RxTelegram.timestamp   = myESP.getSystemTime(); // now
-        _debugPrintTelegram(s, &EMS_RxTelegram, COLOR_CYAN);
+/**
+ * the values a write sets, one byte from dataValue or the bytes after the header. Returns how many
+ */
+static uint8_t _ems_txWriteData(const _EMS_TxTelegram * EMS_TxTelegram, const uint8_t ** values) {
+    uint8_t count = EMS_TxTelegram->length - EMS_MIN_TELEGRAM_LENGTH + 1;
+    *values       = (count == 1) ? &EMS_TxTelegram->dataValue : &EMS_TxTelegram->data[4];
+    return count;
+}
+
+static uint8_t _ems_txEntryWriteData(_EMS_TxQueueEntry * entry, const uint8_t ** values) {
+    uint8_t header = (entry->type > 0xFF) ? 6 : 4;
+    *values        = _ems_txData(entry) + header;
+    return entry->length - header - 1;
+}
+
+_EMS_TxQueueEntry * EMSTxQueue::_entry(uint8_t index) {
+    uint8_t * p = (uint8_t *)_arena;
+    while (index--) {
+        p += _ems_txEntrySize(((_EMS_TxQueueEntry *)p)->length);
     }
+    return (_EMS_TxQueueEntry *)p;
+}
 
-    // send the telegram to the UART Tx
-    _EMS_TX_STATUS _txStatus = emsuart_tx_buffer(EMS_TxTelegram.data, EMS_TxTelegram.length); // send the telegram to the UART Tx
-    if (EMS_TX_STATUS_OK == _txStatus || EMS_TX_STATUS_IDLE == _txStatus)
-        EMS_Sys_Status.emsTxStatus = EMS_TX_STATUS_WAIT;
-    else {
-        // Tx Error!
-        if (EMS_Sys_Status.emsLogging == EMS_SYS_LOGGING_VERBOSE) {
-            myDebug_P(PSTR("** error sending buffer: %s"), _txStatus == EMS_TX_BRK_DETECT ? "BRK" : "WDTO");
+bool EMSTxQueue::_insert(uint16_t pos, const _EMS_TxTelegram & EMS_TxTelegram) {
+    uint32_t            buffer[_ems_txEntrySize(EMS_MAX_TELEGRAM_LENGTH + 2) / 4]; // room for the EMS+ type bytes;
+    _EMS_TxQueueEntry * entry = (_EMS_TxQueueEntry *)buffer;
+
+    _ems_encodeTx(&EMS_TxTelegram, entry);
+    uint16_t size = _ems_txEntrySize(entry->length);
+
+    if ((_used + size) > EMS_TX_QUEUE_SIZE) {
+        if (EMS_Sys_Status.emsLogging != EMS_SYS_LOGGING_NONE) {
+            myDebug_P(PSTR("** Warning, Tx queue is full. Dropping type 0x%02X to 0x%02X"), EMS_TxTelegram.type, EMS_TxTelegram.dest & 0x7F);
         }
-        EMS_Sys_Status.emsTxStatus = EMS_TX_STATUS_IDLE;
+        return false;
     }
+
+    uint8_t * p = (uint8_t *)_arena + pos;
+    memmove(p + size, p, _used - pos); // make room
+    memcpy(p, entry, size);
+    _used += size;
+    _count++;
+
+    return true;
+}
+
+// takes out the entry starting at byte pos
+void EMSTxQueue::_remove(uint16_t pos) {
+    uint8_t * p    = (uint8_t *)_arena + pos;
+    uint16_t  size = _ems_txEntrySize(((_EMS_TxQueueEntry *)p)->length);
+    _used -= size;
+    _count--;
+    memmove(p, p + size, _used - pos);
 }
 
 /**
- * Takes the last write command and turns into a validate request
- * placing it on the Tx queue
+ * look for a telegram already waiting in the queue that makes this one unnecessary
+ * - a read of the same type and offset from the same device, which will bring back the same data
+ * - a write to the same type and offset on the same device, which is overwritten with the new value where it is
+ * - a write to the bytes next to it or overlapping it on the same device and type, see _combine()
+ * The telegram at the front may already be on the bus, so a write there is left alone while it's locked
+ * returns true if the telegram has been taken care of and doesn't need adding
  */
-void _createValidate() {
-    if (EMS_TxQueue.isEmpty()) {
-        return;
+bool EMSTxQueue::_coalesce(const _EMS_TxTelegram & EMS_TxTelegram, bool frontLocked) {
+    if ((EMS_TxTelegram.action != EMS_TX_TELEGRAM_READ) && (EMS_TxTelegram.action != EMS_TX_TELEGRAM_WRITE)) {
+        return false;
     }
 
-    // release the Tx lock
-    EMS_Sys_Status.emsTxStatus = EMS_TX_STATUS_IDLE;
+    uint16_t pos = 0;
+    for (uint8_t i = 0; i < _count; i++) {
+        _EMS_TxQueueEntry * entry = (_EMS_TxQueueEntry *)((uint8_t *)_arena + pos);
+        uint16_t            size  = _ems_txEntrySize(entry->length);
 
-    // get the first in the queue, which is at the head
-    _EMS_TxTelegram EMS_TxTelegram = EMS_TxQueue.first();
+        if ((entry->action == EMS_TxTelegram.action) && (entry->type == EMS_TxTelegram.type) && ((entry->dest & 0x7F) == (EMS_TxTelegram.dest & 0x7F))) {
+            if (EMS_TxTelegram.action == EMS_TX_TELEGRAM_READ) {
+                if ((entry->offset == EMS_TxTelegram.offset) && (entry->dataValue >= EMS_TxTelegram.dataValue)) {
+                    EMS_Sys_Status.emsTxReadsMerged++;
+                    return true;
+                }
+            } else if (((i != 0) || !frontLocked) && _combine(pos, EMS_TxTelegram)) {
+                return true;
+            }
+        }
+        pos += size;
+    }
 
-    // safety check: only do a validate after a write and when we have a type to validate
-    if ((EMS_TxTelegram.action != EMS_TX_TELEGRAM_WRITE) || (EMS_TxTelegram.type_validate == EMS_ID_NONE)) {
-        EMS_TxQueue.shift(); // remove from queue
-        return;
+    return false;
+}
+
+/**
+ * put a write together with the waiting write at pos, if it sets the same bytes or the ones next to them
+ * The same bytes are replaced with the new values. Otherwise they become one telegram of up to EMS_TX_WRITE_BATCH_MAX bytes
+ * with a single validate, so both must be validated by reading back the type and bytes written
+ * The combined write keeps the place and age of the waiting one
+ */
+bool EMSTxQueue::_combine(uint16_t pos, const _EMS_TxTelegram & EMS_TxTelegram) {
+    const uint8_t *     oldValues;
+    const uint8_t *     newValues;
+    _EMS_TxQueueEntry * entry    = (_EMS_TxQueueEntry *)((uint8_t *)_arena + pos);
+    uint8_t             oldCount = _ems_txEntryWriteData(entry, &oldValues);
+    uint8_t             newCount = _ems_txWriteData(&EMS_TxTelegram, &newValues);
+
+    // the same bytes, replace it with the new value where it is
+    if ((entry->offset == EMS_TxTelegram.offset) && (oldCount == newCount)) {
+        _EMS_TxTelegram replaced = EMS_TxTelegram;
+        replaced.timestamp       = entry->timestamp; // keeps its age in the lane
+        _remove(pos);
+        if (!_insert(pos, replaced)) {
+            return false; // doesn't fit, shouldn't happen as the old one was the same size
+        }
+        EMS_Sys_Status.emsTxWritesReplaced++;
+        if (EMS_Sys_Status.emsLogging >= EMS_SYS_LOGGING_BASIC) {
+            myDebug_P(PSTR("Replacing waiting write to 0x%02X type 0x%02X offset %d with value 0x%02X"),
+                      EMS_TxTelegram.dest & 0x7F,
+                      EMS_TxTelegram.type,
+                      EMS_TxTelegram.offset,
+                      EMS_TxTelegram.dataValue);
+        }
+        return true;
     }
 
-    // create a new Telegram copying from the last write
-    _EMS_TxTelegram new_EMS_TxTelegram;
-    new_EMS_TxTelegram.action = EMS_TX_TELEGRAM_VALIDATE;
+    // both must be validated from the bytes they write
+    if ((entry->type_validate != entry->type) || (entry->type_validate != EMS_TxTelegram.type_validate)
+        || (entry->comparisonPostRead != EMS_TxTelegram.comparisonPostRead) || (entry->comparisonOffset != entry->offset)
+        || (EMS_TxTelegram.comparisonOffset != EMS_TxTelegram.offset)) {
+        return false;
+    }
 
-    // copy old Write record
-    new_EMS_TxTelegram.type_validate      = EMS_TxTelegram.type;          // save the original type in the type_validate, increase we need to re-try
-    new_EMS_TxTelegram.type               = EMS_TxTelegram.type_validate; // new type is the validate type
-    new_EMS_TxTelegram.dest               = EMS_TxTelegram.dest;
-    new_EMS_TxTelegram.comparisonValue    = EMS_TxTelegram.comparisonValue;
-    new_EMS_TxTelegram.comparisonPostRead = EMS_TxTelegram.comparisonPostRead;
-    new_EMS_TxTelegram.comparisonOffset   = EMS_TxTelegram.comparisonOffset;
+    // next to each other or overlapping, and not too long
+    uint16_t oldEnd = entry->offset + oldCount;
+    uint16_t newEnd = EMS_TxTelegram.offset + newCount;
+    uint8_t  start  = (entry->offset < EMS_TxTelegram.offset) ? entry->offset : EMS_TxTelegram.offset;
+    uint16_t end    = (oldEnd > newEnd) ? oldEnd : newEnd;
+    if ((EMS_TxTelegram.offset > oldEnd) || (entry->offset > newEnd) || ((end - start) > EMS_TX_WRITE_BATCH_MAX)) {
+        return false;
+    }
 
-    // this is what is different
-    new_EMS_TxTelegram.offset    = EMS_TxTelegram.comparisonOffset; // location of byte to fetch
-    new_EMS_TxTelegram.dataValue = 1;                               // fetch one byte
-    new_EMS_TxTelegram.length    = EMS_MIN_TELEGRAM_LENGTH;         // is always 6 bytes long (including CRC at end)
-    new_EMS_TxTelegram.timestamp = millis();
+    _EMS_TxTelegram combined = EMS_TxTelegram;
 
-    // remove old telegram from queue and add this new read one
-    EMS_TxQueue.shift();                     // remove from queue
-    EMS_TxQueue.unshift(new_EMS_TxTelegram); // add back to queue making it first to be picked up next (FIFO)
+    combined.timestamp        = entry->timestamp;
+    combined.offset           = start;
+    combined.comparisonOffset = start;
+    combined.length           = EMS_MIN_TELEGRAM_LENGTH + (end - start) - 1;
+    memcpy(&combined.data[4 + entry->offset - start], oldValues, oldCount);
+    memcpy(&combined.data[4 + EMS_TxTelegram.offset - start], newValues, newCount); // the new values win where they overlap
+    combined.dataValue       = combined.data[4];
+    combined.comparisonValue = combined.data[4];
+
+    uint16_t oldSize = _ems_txEntrySize(entry->length);
+    uint16_t newSize = _ems_txEntrySize(combined.length + ((combined.type > 0xFF) ? 2 : 0));
+    if ((_used - oldSize + newSize) > EMS_TX_QUEUE_SIZE) {
+        return false; // it's queued on its own, if there's room
+    }
+    _remove(pos);
+    _insert(pos, combined);
+
+    EMS_Sys_Status.emsTxWritesCombined++;
+    if (EMS_Sys_Status.emsLogging >= EMS_SYS_LOGGING_BASIC) {
+        myDebug_P(PSTR("Combining write to 0x%02X type 0x%02X offset %d with the waiting write, now %d bytes from offset %d"),
+                  EMS_TxTelegram.dest & 0x7F,
+                  EMS_TxTelegram.type,
+                  EMS_TxTelegram.offset,
+                  end - start,
+                  start);
+    }
+    return true;
 }
 
 /**
- * dump a UART Tx or Rx buffer to console...
+ * bring the telegram that should go next to the front of the queue
+ * that's the one in the highest lane after aging, and the first one queued if there's more than one
+ * only called when the front telegram isn't on the bus
  */
-void ems_dumpBuffer(const char * prefix, uint8_t * telegram, uint8_t length) {
-    uint32_t    timestamp       = millis();
-    static char output_str[200] = {0};
-    static char buffer[16]      = {0};
-
-    strlcpy(output_str, "(", sizeof(output_str));
-    strlcat(output_str, COLOR_CYAN, sizeof(output_str));
-    strlcat(output_str, _smallitoa((uint8_t)((timestamp / 3600000) % 24), buffer), sizeof(output_str));
-    strlcat(output_str, ":", sizeof(output_str));
-    strlcat(output_str, _smallitoa((uint8_t)((timestamp / 60000) % 60), buffer), sizeof(output_str));
-    strlcat(output_str, ":", sizeof(output_str));
-    strlcat(output_str, _smallitoa((uint8_t)((timestamp / 1000) % 60), buffer), sizeof(output_str));
-    strlcat(output_str, ".", sizeof(output_str));
-    strlcat(output_str, _smallitoa3(timestamp % 1000, buffer), sizeof(output_str));
-    strlcat(output_str, COLOR_RESET, sizeof(output_str));
-    strlcat(output_str, ") ", sizeof(output_str));
+void EMSTxQueue::_schedule() {
+    uint32_t now      = millis();
+    uint16_t pos      = 0;
+    uint16_t bestPos  = 0;
+    uint8_t  bestLane = EMS_TX_LANES;
+
+    for (uint8_t i = 0; i < _count; i++) {
+        _EMS_TxQueueEntry * entry = (_EMS_TxQueueEntry *)((uint8_t *)_arena + pos);
+        uint32_t            aged  = (now - entry->timestamp) / EMS_TX_LANE_AGING;
+        uint8_t             lane  = (aged >= entry->lane) ? 0 : (entry->lane - aged);
+        if (lane < bestLane) {
+            bestLane = lane;
+            bestPos  = pos;
+            if (lane == 0) {
+                break; // can't do better
+            }
+        }
+        pos += _ems_txEntrySize(entry->length);
+    }
 
-    strlcat(output_str, COLOR_YELLOW, sizeof(output_str));
-    strlcat(output_str, prefix, sizeof(output_str));
+    if (bestPos == 0) {
+        return; // already at the front
+    }
 
-    // show some EMS_Sys_Status entries
-    strlcat(output_str, _hextoa(EMS_Sys_Status.emsRxStatus, buffer), sizeof(output_str));
-    strlcat(output_str, " ", sizeof(output_str));
-    strlcat(output_str, _hextoa(EMS_Sys_Status.emsTxStatus, buffer), sizeof(output_str));
-    strlcat(output_str, ": ", sizeof(output_str));
+    // move it to the front, and everything before it down
+    uint32_t  buffer[_ems_txEntrySize(EMS_MAX_TELEGRAM_LENGTH + 2) / 4];
+    uint8_t * p    = (uint8_t *)_arena;
+    uint16_t  size = _ems_txEntrySize(((_EMS_TxQueueEntry *)(p + bestPos))->length);
+    memcpy(buffer, p + bestPos, size);
+    memmove(p + size, p, bestPos);
+    memcpy(p, buffer, size);
+}
 
-    // print whole buffer, don't interpret any data
-    for (int i = 0; i < (length); i++) {
-        strlcat(output_str, _hextoa(telegram[i], buffer), sizeof(output_str));
-        strlcat(output_str, " ", sizeof(output_str));
+// # telegrams waiting in a lane
+uint8_t EMSTxQueue::depth(uint8_t lane) {
+    uint8_t  n   = 0;
+    uint16_t pos = 0;
+    for (uint8_t i = 0; i < _count; i++) {
+        _EMS_TxQueueEntry * entry = (_EMS_TxQueueEntry *)((uint8_t *)_arena + pos);
+        if (entry->lane == lane) {
+            n++;
+        }
+        pos += _ems_txEntrySize(entry->length);
     }
+    return n;
+}
 
-    strlcat(output_str, COLOR_RESET, sizeof(output_str));
-
-    myDebug(output_str);
+bool EMSTxQueue::push(const _EMS_TxTelegram & EMS_TxTelegram) {
+    // if the front telegram has been sent it stays there until its reply comes back
+    bool locked = frontLocked();
+    bool ok     = _coalesce(EMS_TxTelegram, locked) || _insert(_used, EMS_TxTelegram);
+    if (!locked) {
+        _schedule();
+    }
+    ems_stageTx();
+    return ok;
 }
 
 /**
- * Entry point triggered by an interrupt in emsuart.cpp
- * length is the number of all the telegram bytes up to and including the CRC at the end
- * Read commands are asynchronous as they're handled by the interrupt
- * When a telegram is processed we forcefully erase it from the stack to prevent overflow
+ * replace the front telegram with another, like a write with its validate, without the Rx interrupt seeing the queue
+ * in between. False if the front is locked, see frontLocked()
  */
-void ems_parseTelegram(uint8_t * telegram, uint8_t length) {
-    if (EMS_Sys_Status.emsLogging == EMS_SYS_LOGGING_JABBER) {
-        ems_dumpBuffer("ems_parseTelegram: ", telegram, length);
+bool EMSTxQueue::replaceFront(const _EMS_TxTelegram & EMS_TxTelegram) {
+    if (!_count || frontLocked()) {
+        return false;
     }
 
-    /*
-     * Detect the EMS bus type - Buderus or Junkers - and set emsIDMask accordingly.
-     *  we wait for the first valid telegram and look at the SourceID.
-     *  If Bit 7 is set we have a Buderus, otherwise a Junkers
-     */
-    if (EMS_Sys_Status.emsTxStatus == EMS_TX_REV_DETECT) {
-        if ((length >= 5) && (telegram[length - 1] == _crcCalculator(telegram, length))) {
-            EMS_Sys_Status.emsTxStatus   = EMS_TX_STATUS_IDLE;
-            EMS_Sys_Status.emsIDMask     = telegram[0] & 0x80;
-            EMS_Sys_Status.emsPollAck[0] = EMS_ID_ME ^ EMS_Sys_Status.emsIDMask;
-        } else
-            return; // ignore the whole telegram Rx Telegram while in DETECT mode
+    _leave();
+    _remove(0);
+    bool ok = _insert(0, EMS_TxTelegram);
+    ems_stageTx();
+    return ok;
+}
+
+void EMSTxQueue::shift() {
+    if (!_count) {
+        return;
     }
 
-    /* 
-     * It may happen that we were interrupted (for instance by WIFI activity) and the 
-     * buffer isn't valid anymore, so we must not answer at all...
-     */
-    if (EMS_Sys_Status.emsRxStatus != EMS_RX_STATUS_IDLE) {
-        if (EMS_Sys_Status.emsLogging > EMS_SYS_LOGGING_NONE) {
-            myDebug_P(PSTR("** Warning, we missed the bus - Rx non-idle!"));
-        }
+    _leave();
+    _remove(0); // move the rest up to the front
+    _schedule();
+    ems_stageTx();
+}
+
+// the front telegram is leaving the queue, count the time it spent there
+void EMSTxQueue::_leave() {
+    _EMS_TxQueueEntry * entry = front();
+    _EMS_TxLaneStats *  stats = &_laneStats[entry->lane];
+    uint32_t            wait  = millis() - entry->timestamp;
+    stats->telegrams++;
+    stats->waitTotal += wait;
+    if (wait > stats->waitMax) {
+        stats->waitMax = wait;
+    }
+}
+
+void EMSTxQueue::remove(uint8_t index) {
+    if (index == 0) {
+        shift();
         return;
     }
 
-    /*
-     * check if we just received one byte
-     * it could well be a Poll request from the boiler for us, which will have a value of 0x8B (0x0B | 0x80)
-     * or either a return code like 0x01 or 0x04 from the last Write command
-     */
-    if (length == 1) {
-        uint8_t         value                  = telegram[0]; // 1st byte of data package
-        static uint32_t _last_emsPollFrequency = 0;
+    if (index < _count) {
+        _remove((uint8_t *)_entry(index) - (uint8_t *)_arena); // the front doesn't change
+        ems_stageTx();
+    }
+}
 
-        // check first for a Poll for us
-        if ((value ^ 0x80 ^ EMS_Sys_Status.emsIDMask) == EMS_ID_ME) {
-            uint32_t timenow_microsecs      = micros();
-            EMS_Sys_Status.emsPollFrequency = (timenow_microsecs - _last_emsPollFrequency);
-            _last_emsPollFrequency          = timenow_microsecs;
+int8_t EMSTxQueue::find(uint8_t action, uint8_t dest, uint16_t type, uint8_t offset) {
+    for (uint8_t i = 0; i < _count; i++) {
+        _EMS_TxQueueEntry * entry = _entry(i);
+        if ((entry->action == action) && ((entry->dest & 0x7F) == (dest & 0x7F)) && (entry->type == type) && (entry->offset == offset)) {
+            return i;
+        }
+    }
+    return -1;
+}
 
-            // do we have something to send thats waiting in the Tx queue?
-            // if so send it if the Queue is not in a wait state
-            if ((!EMS_TxQueue.isEmpty()) && (EMS_Sys_Status.emsTxStatus == EMS_TX_STATUS_IDLE)) {
-                _ems_sendTelegram(); // perform the read/write command immediately
-            } else {
-                // nothing to send so just send a poll acknowledgement back
-                if (EMS_Sys_Status.emsPollEnabled) {
-                    ems_tx_pollAck();
-                }
-            }
-        } else if (EMS_Sys_Status.emsTxStatus == EMS_TX_STATUS_WAIT) {
-            // this may be a byte 01 (success) or 04 (error) from a recent write command?
-            if (value == EMS_TX_SUCCESS) {
-                EMS_Sys_Status.emsTxPkgs++;
-                // got a success 01. Send a validate to check the value of the last write
-                ems_tx_pollAck();  // send a poll to free the EMS bus
-                _createValidate(); // create a validate Tx request (if needed)
-            } else if (value == EMS_TX_ERROR) {
-                // last write failed (04), delete it from queue and dont bother to retry
-                if (EMS_Sys_Status.emsLogging == EMS_SYS_LOGGING_VERBOSE) {
-                    myDebug_P(PSTR("-> Error: Write command failed from host"));
-                }
-                ems_tx_pollAck(); // send a poll to free the EMS bus
-                _removeTxQueue(); // remove from queue
-            }
-        }
-
-        return; // all done here
-    }
-
-    // ignore anything that doesn't resemble a proper telegram package
-    // minimal is 5 bytes, excluding CRC at the end (for EMS1.0)
-    if (length <= 4) {
-        // _debugPrintTelegram("Noisy data: ", &EMS_RxTelegram, COLOR_RED);
-        return;
-    }
+void EMSTxQueue::clear() {
+    _used  = 0;
+    _count = 0;
+    ems_stageTx();
+}
 
-    static _EMS_RxTelegram EMS_RxTelegram; // create the Rx package
-    EMS_RxTelegram.telegram  = telegram;
-    EMS_RxTelegram.timestamp = myESP.getSystemTime();
-    EMS_RxTelegram.length    = length;
+_EMS_TxQueueEntry * EMSTxQueue::front() {
+    return (_EMS_TxQueueEntry *)_arena;
+}
 
-    EMS_RxTelegram.src    = telegram[0] & 0x7F; // removing 8th bit as we deal with both reads and writes here
-    EMS_RxTelegram.dest   = telegram[1] & 0x7F; // remove 8th bit (don't care if read or write)
-    EMS_RxTelegram.offset = telegram[3];        // offset is always 4th byte
+/**
+ * true while the front telegram mustn't be replaced, combined or moved back: it's on the bus waiting for its reply,
+ * or the Rx interrupt has sent it on a poll that hasn't been processed yet
+ * Otherwise it's taken back from the stage, so the Rx interrupt can't send it while it changes. ems_stageTx() stages it again
+ */
+bool EMSTxQueue::frontLocked() {
+    return (EMS_Sys_Status.emsTxStatus == EMS_TX_STATUS_WAIT) || !emsuart_tx_stage(nullptr, 0, EMSUART_STAGE_NONE);
+}
 
-    // determing if its normal ems or ems plus, check for marker
-    if (telegram[2] >= 0xF0) {
-        // its EMS plus / EMS 2.0
-        EMS_RxTelegram.emsplus      = true;
-        EMS_RxTelegram.emsplus_type = telegram[2]; // 0xFF, 0xF7 or 0xF9
+_EMS_TxTelegram EMSTxQueue::first() {
+    return (*this)[0];
+}
 
-        if (EMS_RxTelegram.emsplus_type == 0xFF) {
-            EMS_RxTelegram.type = (telegram[4] << 8) + telegram[5]; // is a long in bytes 5 & 6
-            EMS_RxTelegram.data = telegram + 6;
+/**
+ * a copy of the i-th telegram as it was added, with the length before any EMS+ bytes were added
+ */
+_EMS_TxTelegram EMSTxQueue::operator[](uint8_t index) {
+    _EMS_TxTelegram     EMS_TxTelegram = EMS_TX_TELEGRAM_NEW;
+    _EMS_TxQueueEntry * entry          = _entry(index);
+
+    EMS_TxTelegram.timestamp          = entry->timestamp;
+    EMS_TxTelegram.type               = entry->type;
+    EMS_TxTelegram.type_validate      = entry->type_validate;
+    EMS_TxTelegram.comparisonPostRead = entry->comparisonPostRead;
+    EMS_TxTelegram.action             = (_EMS_TX_TELEGRAM_ACTION)entry->action;
+    EMS_TxTelegram.dest               = entry->dest;
+    EMS_TxTelegram.offset             = entry->offset;
+    EMS_TxTelegram.dataValue          = entry->dataValue;
+    EMS_TxTelegram.comparisonValue    = entry->comparisonValue;
+    EMS_TxTelegram.comparisonOffset   = entry->comparisonOffset;
+    EMS_TxTelegram.length             = entry->length;
+    if ((entry->action != EMS_TX_TELEGRAM_RAW) && (entry->type > 0xFF)) {
+        EMS_TxTelegram.length -= 2;
+    }
+    memcpy(EMS_TxTelegram.data, _ems_txData(entry), entry->length);
+
+    return EMS_TxTelegram;
+}
 
-            if (length <= 7) {
-                EMS_RxTelegram.data_length = 0; // special broadcast on ems+ have no data values
-            } else {
-                EMS_RxTelegram.data_length = length - 7; // remove 6 byte header plus CRC
-            }
-        } else {
-            // its F9 or F7
-            uint8_t shift       = (telegram[4] != 0xFF); // true (1) if byte 4 is not 0xFF, then telegram is 1 byte longer
-            EMS_RxTelegram.type = (telegram[5 + shift] << 8) + telegram[6 + shift];
-            EMS_RxTelegram.data = telegram + 6 + shift; // there is a special byte after the typeID which we ignore for now
-            if (length <= (9 + shift)) {
-                EMS_RxTelegram.data_length = 0; // special broadcast on ems+ have no data values
-            } else {
-                EMS_RxTelegram.data_length = length - (9 + shift);
-            }
-        }
-    } else {
-        // Normal EMS 1.0
-        EMS_RxTelegram.emsplus     = false;
-        EMS_RxTelegram.type        = telegram[2]; // 3rd byte
-        EMS_RxTelegram.data        = telegram + 4;
-        EMS_RxTelegram.data_length = length - 5; // remove 4 bytes header plus CRC
+// for the Tx error messages
+static const char * _ems_txStatusName(_EMS_TX_STATUS status) {
+    if (status == EMS_TX_BRK_DETECT) {
+        return "BRK";
+    } else if (status == EMS_TX_BUSY) {
+        return "busy";
     }
+    return "WDTO";
+}
 
-    // if we are in raw logging mode then just print out the telegram as it is
-    // else if we're watching a specific type ID show it and also log an event to the SysLog
-    // but still continue to process it
-    if ((EMS_Sys_Status.emsLogging == EMS_SYS_LOGGING_RAW)) {
-        _debugPrintTelegram("", &EMS_RxTelegram, COLOR_WHITE, true);
-    } else if ((EMS_Sys_Status.emsLogging == EMS_SYS_LOGGING_WATCH) && (EMS_RxTelegram.type == EMS_Sys_Status.emsLogging_typeID)) {
-        _debugPrintTelegram("", &EMS_RxTelegram, COLOR_WHITE, true);
-    }
+/**
+ * our src ID in a telegram queued before we knew if it's a Buderus or Junkers bus has to change
+ */
+void _ems_txSetMask(_EMS_TxQueueEntry * entry) {
+    uint8_t * data   = _ems_txData(entry);
+    uint8_t   length = entry->length;
 
-    // Assume at this point we have something that vaguely resembles a telegram in the format [src] [dest] [type] [offset] [data] [crc]
-    // validate the CRC, if it's bad ignore it
-    if (telegram[length - 1] != _crcCalculator(telegram, length)) {
-        EMS_Sys_Status.emxCrcErr++;
-        if (EMS_Sys_Status.emsLogging == EMS_SYS_LOGGING_VERBOSE) {
-            _debugPrintTelegram("Corrupt telegram: ", &EMS_RxTelegram, COLOR_RED, true);
-        }
-        return;
+    if (entry->emsIDMask != EMS_Sys_Status.emsIDMask) {
+        entry->emsIDMask = EMS_Sys_Status.emsIDMask;
+        data[0]          = EMS_ID_ME ^ entry->emsIDMask;
+        data[length - 1] = _crcCalculator(data, length);
     }
-
-    // here we know its a valid incoming telegram of at least 6 bytes
-    // we use this to see if we always have a connection to the boiler, in case of drop outs
-    EMS_Sys_Status.emsRxTimestamp  = millis(); // timestamp of last read
-    EMS_Sys_Status.emsBusConnected = true;
-
-    // now lets process it and see what to do next
-    _processType(&EMS_RxTelegram);
 }
 
 /**
- * print the telegram
+ * debug print a telegram from the Tx queue as it's sent
  */
-void _printMessage(_EMS_RxTelegram * EMS_RxTelegram) {
-    // header info
-    uint8_t  src    = EMS_RxTelegram->src;
-    uint8_t  dest   = EMS_RxTelegram->dest;
-    uint16_t type   = EMS_RxTelegram->type;
-    uint8_t  length = EMS_RxTelegram->data_length;
+void _ems_txPrint(_EMS_TxQueueEntry * entry) {
+    uint8_t * data   = _ems_txData(entry);
+    uint8_t   length = entry->length;
 
-    char output_str[200] = {0};
-    char buffer[16]      = {0};
-    char color_s[20]     = {0};
-    char type_s[30];
+    if (EMS_Sys_Status.emsLogging == EMS_SYS_LOGGING_VERBOSE) {
+        char s[64] = {0};
+        if (entry->action == EMS_TX_TELEGRAM_WRITE) {
+            snprintf(s, sizeof(s), "Sending write of type 0x%02X to 0x%02X, ", entry->type, entry->dest & 0x7F);
+        } else if (entry->action == EMS_TX_TELEGRAM_READ) {
+            snprintf(s, sizeof(s), "Sending read of type 0x%02X to 0x%02X, ", entry->type, entry->dest & 0x7F);
+        } else if (entry->action == EMS_TX_TELEGRAM_VALIDATE) {
+            snprintf(s, sizeof(s), "Sending validate of type 0x%02X to 0x%02X, ", entry->type, entry->dest & 0x7F);
+        }
 
-    // source
-    ems_getDeviceTypeDescription(src, type_s);
-    strlcpy(output_str, type_s, sizeof(output_str));
-    strlcat(output_str, " -> ", sizeof(output_str));
+        _EMS_RxTelegram EMS_RxTelegram;
+        EMS_RxTelegram.length      = length; // complete length of telegram incl CRC
+        EMS_RxTelegram.data_length = 0;      // ignore the data length for read and writes. only used for incoming.
+        EMS_RxTelegram.telegram    = data;
+        EMS_RxTelegram.timestamp   = myESP.getSystemTime(); // now
+        _debugPrintTelegram(s, &EMS_RxTelegram, COLOR_CYAN);
+    }
+}
 
-    // destination
-    (void)ems_getDeviceTypeDescription(dest, type_s);
-    strlcat(output_str, type_s, sizeof(output_str));
+/**
+ * send the contents of the Tx buffer to the UART
+ * we take telegram from the queue and send it, but don't remove it until later when its confirmed successful
+ * it was already encoded when it was added to the queue
+ */
+void _ems_sendTelegram() {
+    // check if we have something in the queue to send
+    if (EMS_TxQueue.isEmpty()) {
+        return;
+    }
 
-    if (dest == EMS_ID_ME) {
-        strlcpy(color_s, COLOR_YELLOW, sizeof(color_s)); // me
-    } else if (dest == EMS_ID_NONE) {
-        strlcpy(color_s, COLOR_GREEN, sizeof(color_s)); // broadcast
-    } else {
-        strlcpy(color_s, COLOR_MAGENTA, sizeof(color_s)); // everything else
+    // if we're preventing all outbound traffic, quit
+    if (ems_getTxDisabled()) {
+        EMS_TxQueue.shift(); // remove from queue
+        return;
     }
 
-    if (length) {
-        // type
-        strlcat(output_str, ", type 0x", sizeof(output_str));
+    // get the first in the queue, which is at the head
+    // we don't remove from the queue yet
+    _EMS_TxQueueEntry * entry  = EMS_TxQueue.front();
+    uint8_t *           data   = _ems_txData(entry);
+    uint8_t             length = entry->length;
 
-        if (EMS_RxTelegram->emsplus) {
-            strlcat(output_str, _hextoa(type >> 8, buffer), sizeof(output_str));
-            strlcat(output_str, _hextoa(type & 0xFF, buffer), sizeof(output_str));
-        } else {
-            strlcat(output_str, _hextoa(type, buffer), sizeof(output_str));
+    // if we're in raw mode just fire and forget
+    if (entry->action == EMS_TX_TELEGRAM_RAW) {
+        if (EMS_Sys_Status.emsLogging != EMS_SYS_LOGGING_NONE) {
+            _EMS_RxTelegram EMS_RxTelegram;                     // create new Rx object
+            EMS_RxTelegram.length      = length;                // full length of telegram
+            EMS_RxTelegram.telegram    = data;
+            EMS_RxTelegram.data_length = 0;                     // ignore #data=
+            EMS_RxTelegram.timestamp   = myESP.getSystemTime(); // now
+            _debugPrintTelegram("Sending raw: ", &EMS_RxTelegram, COLOR_CYAN, true);
+        }
+
+        _EMS_TX_STATUS _txStatus = emsuart_tx_buffer(data, length); // send the telegram to the UART Tx
+        if (EMS_TX_STATUS_OK != _txStatus) {
+            // Tx Error!
+            if (EMS_Sys_Status.emsLogging == EMS_SYS_LOGGING_VERBOSE) {
+                myDebug_P(PSTR("** error sending buffer: %s"), _ems_txStatusName(_txStatus));
+            }
+            // EMS_Sys_Status.emsTxStatus = EMS_TX_STATUS_IDLE;
         }
+        EMS_TxQueue.shift(); // and remove from queue
+        return;
     }
 
-    strlcat(output_str, ", ", sizeof(output_str));
+    _ems_txSetMask(entry);
+    _ems_txPrint(entry);
 
-    if (EMS_Sys_Status.emsLogging == EMS_SYS_LOGGING_THERMOSTAT) {
-        // only print ones to/from thermostat if logging is set to thermostat only
-        if ((src == EMS_Thermostat.device_id) || (dest == EMS_Thermostat.device_id)) {
-            _debugPrintTelegram(output_str, EMS_RxTelegram, color_s);
-        }
-    } else if (EMS_Sys_Status.emsLogging == EMS_SYS_LOGGING_SOLARMODULE) {
-        // only print ones to/from thermostat if logging is set to thermostat only
-        if ((src == EMS_SolarModule.device_id) || (dest == EMS_SolarModule.device_id)) {
-            _debugPrintTelegram(output_str, EMS_RxTelegram, color_s);
+    // send the telegram to the UART Tx
+    _EMS_TX_STATUS _txStatus = emsuart_tx_buffer(data, length); // send the telegram to the UART Tx
+    if (EMS_TX_STATUS_OK == _txStatus || EMS_TX_STATUS_IDLE == _txStatus)
+        _ems_txWait();
+    else {
+        // Tx Error!
+        if (EMS_Sys_Status.emsLogging == EMS_SYS_LOGGING_VERBOSE) {
+            myDebug_P(PSTR("** error sending buffer: %s"), _ems_txStatusName(_txStatus));
         }
-    } else {
-        // always print
-        _debugPrintTelegram(output_str, EMS_RxTelegram, color_s);
+        EMS_Sys_Status.emsTxStatus = EMS_TX_STATUS_IDLE;
     }
 }
 
 /**
- * Remove current Tx telegram from queue and release lock on Tx
+ * a new write at the front of the Tx queue waits EMS_TX_WRITE_BATCH_WINDOW ms before it goes,
+ * so the writes that come straight after it can be combined with it. See EMSTxQueue::_combine()
  */
-void _removeTxQueue() {
-    if (!EMS_TxQueue.isEmpty()) {
-        EMS_TxQueue.shift(); // remove item from top of the queue
+static bool _ems_txBatching() {
+    if (EMS_TxQueue.isEmpty()) {
+        return false;
     }
-    EMS_Sys_Status.emsTxStatus = EMS_TX_STATUS_IDLE;
+    _EMS_TxQueueEntry * entry = EMS_TxQueue.front();
+    return (entry->action == EMS_TX_TELEGRAM_WRITE) && ((millis() - entry->timestamp) < EMS_TX_WRITE_BATCH_WINDOW);
 }
 
 /**
- * Check if hot tap water or heating is active
- * using a quick hack for checking the heating. Selected Flow Temp >= 70
+ * stage what we'll send on the next poll for us, so the Rx interrupt can answer it without waiting for the main loop
+ * that's the telegram at the front of the Tx queue if we're not waiting for a reply, else the poll acknowledgement
+ * called whenever the Tx queue or the Tx status may have changed
  */
-void _checkActive() {
-    // hot tap water, using flow to check instead of the burner power
-    if (EMS_Boiler.wWCurFlow != EMS_VALUE_INT_NOTSET && EMS_Boiler.burnGas != EMS_VALUE_INT_NOTSET) {
-        EMS_Boiler.tapwaterActive = ((EMS_Boiler.wWCurFlow != 0) && (EMS_Boiler.burnGas == EMS_VALUE_BOOL_ON));
-    }
+void ems_stageTx() {
+    uint8_t * data   = nullptr;
+    uint8_t   length = 0;
+    uint8_t   tag    = EMSUART_STAGE_NONE;
 
-    // heating
-    if (EMS_Boiler.selFlowTemp != EMS_VALUE_INT_NOTSET && EMS_Boiler.burnGas != EMS_VALUE_INT_NOTSET) {
-        EMS_Boiler.heatingActive = ((EMS_Boiler.selFlowTemp >= EMS_BOILER_SELFLOWTEMP_HEATING) && (EMS_Boiler.burnGas == EMS_VALUE_BOOL_ON));
+    // the same choice as for a poll in _ems_parseTelegram(). Raw telegrams and Tx disabled are left to the main loop
+    _ems_stageBatching = (EMS_Sys_Status.emsTxStatus == EMS_TX_STATUS_IDLE) && _ems_txBatching();
+    if (EMS_Sys_Status.emsTxStatus == EMS_TX_REV_DETECT) {
+        tag = EMSUART_STAGE_NONE;
+    } else if ((!EMS_TxQueue.isEmpty()) && (EMS_Sys_Status.emsTxStatus == EMS_TX_STATUS_IDLE) && !_ems_stageBatching) {
+        _EMS_TxQueueEntry * entry = EMS_TxQueue.front();
+        if ((entry->action != EMS_TX_TELEGRAM_RAW) && !ems_getTxDisabled()) {
+            _ems_txSetMask(entry);
+            data   = _ems_txData(entry);
+            length = entry->length;
+            tag    = EMS_STAGE_TX;
+        }
+    } else if (EMS_Sys_Status.emsPollEnabled) {
+        data   = &EMS_Sys_Status.emsPollAck[0];
+        length = 1;
+        tag    = EMSUART_STAGE_POLLACK;
     }
+
+    // if the last one has gone out but ems.cpp hasn't seen its poll yet, it stays as it is
+    (void)emsuart_tx_stage(data, length, tag);
 }
 
 /**
- * UBAParameterWW - type 0x33 - warm water parameters
- * received only after requested (not broadcasted)
+ * the Rx interrupt has answered a poll for us with the telegram staged by ems_stageTx()
  */
-void _process_UBAParameterWW(_EMS_RxTelegram * EMS_RxTelegram) {
-    _setValue(EMS_RxTelegram, &EMS_Boiler.wWActivated, 1); // 0xFF means on
-    _setValue(EMS_RxTelegram, &EMS_Boiler.wWCircPump, 6);  // 0xFF means on
-    _setValue(EMS_RxTelegram, &EMS_Boiler.wWSelTemp, 2);
-    _setValue(EMS_RxTelegram, &EMS_Boiler.wWDesiredTemp, 8);
-    _setValue(EMS_RxTelegram, &EMS_Boiler.wWComfort, EMS_OFFSET_UBAParameterWW_wwComfort);
+void _ems_txStaged(uint8_t tag) {
+    if (tag == EMSUART_STAGE_POLLACK) {
+        return;
+    }
+
+    // the front of the queue is what was sent, it's locked until now. See EMSTxQueue::frontLocked()
+    // unless the queue has been cleared since
+    if (EMS_TxQueue.isEmpty()) {
+        return;
+    }
+
+    _EMS_TxQueueEntry * entry = EMS_TxQueue.front();
+    _ems_txPrint(entry);
+    _ems_txWait();
 }
 
 /**
- * UBATotalUptimeMessage - type 0x14 - total uptime
- * received only after requested (not broadcasted)
+ * how long we wait for the reply to a telegram we sent, or before it goes again after a failure, from the poll interval
+ * the reply comes straight after the telegram, but the bus master can poll others first
  */
-void _process_UBATotalUptimeMessage(_EMS_RxTelegram * EMS_RxTelegram) {
-    _setValue(EMS_RxTelegram, &EMS_Boiler.UBAuptime, 0);
+static uint32_t _ems_txPollInterval() {
+    const _EMS_Histogram * pollInterval = &emsuart_getTiming()->pollInterval;
+    return pollInterval->count ? (_histogram_percentile(pollInterval, 50) / 1000) : 0;
 }
 
-/**
- * UBAParametersMessage - type 0x16
- */
-void _process_UBAParametersMessage(_EMS_RxTelegram * EMS_RxTelegram) {
-    _setValue(EMS_RxTelegram, &EMS_Boiler.heating_temp, 1);
-    _setValue(EMS_RxTelegram, &EMS_Boiler.pump_mod_max, 9);
-    _setValue(EMS_RxTelegram, &EMS_Boiler.pump_mod_min, 10);
+static uint32_t _ems_txReplyTimeout() {
+    uint32_t timeout = EMS_TX_REPLY_MIN + (2 * _ems_txPollInterval());
+    return (timeout > EMS_TX_REPLY_MAX) ? EMS_TX_REPLY_MAX : timeout;
+}
+
+static uint32_t _ems_txBackoff(uint8_t failures) {
+    uint32_t backoff = _ems_txPollInterval();
+    if (backoff < EMS_TX_BACKOFF_MIN) {
+        backoff = EMS_TX_BACKOFF_MIN;
+    }
+    while ((--failures) && (backoff < EMS_TX_BACKOFF_MAX)) {
+        backoff <<= 1;
+    }
+    return (backoff > EMS_TX_BACKOFF_MAX) ? EMS_TX_BACKOFF_MAX : backoff;
 }
 
 /**
- * UBAMonitorWWMessage - type 0x34 - warm water monitor. 19 bytes long
- * received every 10 seconds
+ * the telegram at the front of the Tx queue has gone out, wait for its reply
  */
-void _process_UBAMonitorWWMessage(_EMS_RxTelegram * EMS_RxTelegram) {
-    _setValue(EMS_RxTelegram, &EMS_Boiler.wWCurTmp, 1);
-    _setValue(EMS_RxTelegram, &EMS_Boiler.wWStarts, 13);
-    _setValue(EMS_RxTelegram, &EMS_Boiler.wWWorkM, 10);
-    _setValue(EMS_RxTelegram, &EMS_Boiler.wWOneTime, 5, 1);
-    _setValue(EMS_RxTelegram, &EMS_Boiler.wWCurFlow, 9);
+void _ems_txWait() {
+    _ems_txSent                = millis();
+    _ems_txDeadline            = _ems_txSent + _ems_txReplyTimeout();
+    EMS_Sys_Status.emsTxStatus = EMS_TX_STATUS_WAIT;
 }
 
 /**
- * Activate / De-activate One Time warm water 0x35
- * true = on, false = off
+ * the telegram at the front of the Tx queue didn't work. retry keeps it there to go again once the backoff is over,
+ * else the caller removes it. The backoff doubles with each failure in a row, up to EMS_TX_BACKOFF_MAX
  */
-void ems_setWarmWaterOnetime(bool activated) {
-    myDebug_P(PSTR("Setting boiler warm water OneTime loading %s"), activated ? "on" : "off");
-
-    _EMS_TxTelegram EMS_TxTelegram = EMS_TX_TELEGRAM_NEW; // create new Tx
-    EMS_TxTelegram.timestamp       = millis();            // set timestamp
-    EMS_Sys_Status.txRetryCount    = 0;                   // reset retry counter
+void _ems_txFailed(uint8_t fail, bool retry) {
+    uint32_t now     = millis();
+    uint32_t backoff = retry ? _ems_txBackoff(++_ems_txFailures) : 0;
 
-    EMS_TxTelegram.action        = EMS_TX_TELEGRAM_WRITE;
-    EMS_TxTelegram.dest          = EMS_Boiler.device_id;
-    EMS_TxTelegram.type          = EMS_TYPE_UBAFlags;
-    EMS_TxTelegram.offset        = EMS_OFFSET_UBAParameterWW_wwOneTime;
-    EMS_TxTelegram.length        = EMS_MIN_TELEGRAM_LENGTH;
-    EMS_TxTelegram.type_validate = EMS_ID_NONE;               // don't validate
-    EMS_TxTelegram.dataValue     = (activated ? 0x22 : 0x02); // 0x22 is on, 0x02 is off for RC20RF
+    _ems_txFailStats[fail].count++;
+    _ems_txFailStats[fail].lost += (now - _ems_txSent) + backoff;
 
-    EMS_TxQueue.push(EMS_TxTelegram);
+    if (retry) {
+        _ems_txDeadline            = now + backoff;
+        EMS_Sys_Status.emsTxStatus = EMS_TX_STATUS_BACKOFF;
+    } else {
+        EMS_Sys_Status.emsTxStatus = EMS_TX_STATUS_IDLE;
+    }
+    ems_stageTx(); // not on the next poll while backing off
 }
 
 /**
- * UBAMonitorFast - type 0x18 - central heating monitor part 1 (25 bytes long)
- * received every 10 seconds
+ * the UART couldn't send the telegram we're waiting on. It goes again, unless the bus has refused it too often
  */
-void _process_UBAMonitorFast(_EMS_RxTelegram * EMS_RxTelegram) {
-    _setValue(EMS_RxTelegram, &EMS_Boiler.selFlowTemp, 0);
-    _setValue(EMS_RxTelegram, &EMS_Boiler.curFlowTemp, 1);
-    _setValue(EMS_RxTelegram, &EMS_Boiler.selBurnPow, 3); // burn power max setting
-    _setValue(EMS_RxTelegram, &EMS_Boiler.curBurnPow, 4);
-
-    _setValue(EMS_RxTelegram, &EMS_Boiler.burnGas, 7, 0);
-    _setValue(EMS_RxTelegram, &EMS_Boiler.fanWork, 7, 2);
-    _setValue(EMS_RxTelegram, &EMS_Boiler.ignWork, 7, 3);
-    _setValue(EMS_RxTelegram, &EMS_Boiler.heatPmp, 7, 5);
-    _setValue(EMS_RxTelegram, &EMS_Boiler.wWHeat, 7, 6);
-    _setValue(EMS_RxTelegram, &EMS_Boiler.wWCirc, 7, 7);
-
-    _setValue(EMS_RxTelegram, &EMS_Boiler.boilTemp, 11); // 0x8000 if not available
-    _setValue(EMS_RxTelegram, &EMS_Boiler.retTemp, 13);
-    _setValue(EMS_RxTelegram, &EMS_Boiler.flameCurr, 15);
-    _setValue(EMS_RxTelegram, &EMS_Boiler.serviceCode, 20);
-
-    // system pressure. FF means missing
-    _setValue(EMS_RxTelegram, &EMS_Boiler.sysPress, 17); // is *10
+static void _ems_txCheckFailure() {
+    if (EMS_Sys_Status.emsTxStatus != EMS_TX_STATUS_WAIT) {
+        return;
+    }
 
-    // read the service code / installation status as appears on the display
-    if (EMS_RxTelegram->data_length > 18) {
-        EMS_Boiler.serviceCodeChar[0] = char(EMS_RxTelegram->data[18]); // ascii character 1
-        EMS_Boiler.serviceCodeChar[1] = char(EMS_RxTelegram->data[19]); // ascii character 2
-        EMS_Boiler.serviceCodeChar[2] = '\0';                           // null terminate string
+    _EMS_TX_STATUS status = emsuart_tx_failure();
+    if (status == EMS_TX_STATUS_OK) {
+        return;
     }
 
-    // at this point do a quick check to see if the hot water or heating is active
-    _checkActive();
+    bool retry = (_ems_txFailures + 1) < EMS_TX_FAIL_MAX;
+    if (EMS_Sys_Status.emsLogging == EMS_SYS_LOGGING_VERBOSE) {
+        myDebug_P(PSTR("** error sending buffer: %s, %s"), _ems_txStatusName(status), retry ? "retrying" : "giving up");
+    }
+    _ems_txFailed((status == EMS_TX_BRK_DETECT) ? EMS_TX_FAIL_BRK : EMS_TX_FAIL_WDTO, retry);
+    if (!retry) {
+        _removeTxQueue();
+    }
 }
 
 /**
- * UBAMonitorFast2 - type 0xE4 - central heating monitor
+ * the reply to the telegram we're waiting on hasn't come. It goes again up to TX_WRITE_TIMEOUT_COUNT times,
+ * except for a discovery probe of an ID that's most likely not there
  */
-void _process_UBAMonitorFast2(_EMS_RxTelegram * EMS_RxTelegram) {
-    _setValue(EMS_RxTelegram, &EMS_Boiler.selFlowTemp, 6);
-    _setValue(EMS_RxTelegram, &EMS_Boiler.burnGas, 11, 0);
-    _setValue(EMS_RxTelegram, &EMS_Boiler.wWHeat, 11, 2);
-    _setValue(EMS_RxTelegram, &EMS_Boiler.curBurnPow, 10);
-    _setValue(EMS_RxTelegram, &EMS_Boiler.selBurnPow, 9);
-    _setValue(EMS_RxTelegram, &EMS_Boiler.curFlowTemp, 7); // 0x8000 if not available
-    _setValue(EMS_RxTelegram, &EMS_Boiler.flameCurr, 19);
-
-    // read the service code / installation status as appears on the display
-    if (EMS_RxTelegram->data_length > 4) {
-        EMS_Boiler.serviceCodeChar[0] = char(EMS_RxTelegram->data[4]); // ascii character 1
-        EMS_Boiler.serviceCodeChar[1] = char(EMS_RxTelegram->data[5]); // ascii character 2
-        EMS_Boiler.serviceCodeChar[2] = '\0';
+void _ems_txNoReply() {
+    _EMS_TxQueueEntry * entry = EMS_TxQueue.isEmpty() ? nullptr : EMS_TxQueue.front();
+    uint16_t            type  = entry ? entry->type : EMS_ID_NONE;
+    uint8_t             dest  = entry ? entry->dest : EMS_ID_NONE;
+
+    bool retry = (++EMS_Sys_Status.txRetryCount <= TX_WRITE_TIMEOUT_COUNT) && !_ems_discoveryQuick(type, dest);
+    if (EMS_Sys_Status.emsLogging >= EMS_SYS_LOGGING_BASIC) {
+        myDebug_P(PSTR("-> No reply after %d ms. %s (%d/%d)"),
+                  millis() - _ems_txSent,
+                  retry ? "Retrying" : "Giving up",
+                  EMS_Sys_Status.txRetryCount,
+                  TX_WRITE_TIMEOUT_COUNT);
+    }
+    _ems_txFailed(EMS_TX_FAIL_NOREPLY, retry);
+    if (!retry) {
+        _removeTxQueue();
+        _ems_discoveryLost(type, dest);
     }
-
-    // still to figure out:
-    //  EMS_Boiler.serviceCode
-    //  EMS_Boiler.retTemp
-    //  EMS_Boiler.sysPress
-
-    // at this point do a quick check to see if the hot water or heating is active
-    _checkActive();
 }
 
 /**
- * UBAMonitorSlow - type 0x19 - central heating monitor part 2 (27 bytes long)
- * received every 60 seconds
- * e.g. 08 00 19 00 80 00 02 41 80 00 00 00 00 00 03 91 7B 05 B8 40 00 00 00 04 92 AD 00 5E EE 80 00 (CRC=C9) #data=27
- *      08 0B 19 00 FF EA 02 47 80 00 00 00 00 62 03 CA 24 2C D6 23 00 00 00 27 4A B6 03 6E 43 
- *                  00 01 02 03 04 05 06 07 08 09 10 11 12 13 14 15 16 17 17 19 20 21 22 23 24
+ * The Tx state machine, called often from the main loop. EMS_Sys_Status.emsTxStatus is
+ *  IDLE    the front of the Tx queue goes on the next poll for us
+ *  WAIT    it has gone out, and the reply must come by the deadline. The UART failing to send it, a reply that doesn't match
+ *          or no reply, see _processType(), are failures
+ *  BACKOFF it failed, or is a validate held back by _ems_txHold(), and goes again once the deadline has passed
+ * A telegram that had no reply goes again up to TX_WRITE_TIMEOUT_COUNT times, one the bus didn't take up to EMS_TX_FAIL_MAX
+ * A new write is also held back for EMS_TX_WRITE_BATCH_WINDOW ms while IDLE, see _ems_txBatching()
  */
-void _process_UBAMonitorSlow(_EMS_RxTelegram * EMS_RxTelegram) {
-    _setValue(EMS_RxTelegram, &EMS_Boiler.extTemp, 0);
-    _setValue(EMS_RxTelegram, &EMS_Boiler.boilTemp, 2);
-    _setValue(EMS_RxTelegram, &EMS_Boiler.switchTemp, 25); // only if there is a mixer
-    _setValue(EMS_RxTelegram, &EMS_Boiler.pumpMod, 9);
-    _setValue(EMS_RxTelegram, &EMS_Boiler.burnStarts, 10);
-    _setValue(EMS_RxTelegram, &EMS_Boiler.burnWorkMin, 13);
-    _setValue(EMS_RxTelegram, &EMS_Boiler.heatWorkMin, 19);
-}
+void ems_txTick() {
+    _ems_txCheckFailure();
 
-/**
- * UBAMonitorSlow2 - type 0xE5 - central heating monitor
- */
-void _process_UBAMonitorSlow2(_EMS_RxTelegram * EMS_RxTelegram) {
-    _setValue(EMS_RxTelegram, &EMS_Boiler.fanWork, 2, 2);
-    _setValue(EMS_RxTelegram, &EMS_Boiler.ignWork, 2, 3);
-    _setValue(EMS_RxTelegram, &EMS_Boiler.heatPmp, 2, 5);
-    _setValue(EMS_RxTelegram, &EMS_Boiler.wWCirc, 2, 7);
-    _setValue(EMS_RxTelegram, &EMS_Boiler.burnStarts, 10);
-    _setValue(EMS_RxTelegram, &EMS_Boiler.burnWorkMin, 13);
-    _setValue(EMS_RxTelegram, &EMS_Boiler.heatWorkMin, 19);
-    _setValue(EMS_RxTelegram, &EMS_Boiler.pumpMod, 25); // or is it switchTemp ?
+    if ((EMS_Sys_Status.emsTxStatus == EMS_TX_STATUS_WAIT) && ((int32_t)(millis() - _ems_txDeadline) >= 0)) {
+        _ems_txNoReply();
+    } else if ((EMS_Sys_Status.emsTxStatus == EMS_TX_STATUS_BACKOFF) && ((int32_t)(millis() - _ems_txDeadline) >= 0)) {
+        EMS_Sys_Status.emsTxStatus = EMS_TX_STATUS_IDLE;
+        ems_stageTx();
+    } else if (_ems_stageBatching && !_ems_txBatching()) {
+        ems_stageTx(); // the write held back can go now
+    }
 }
 
 /**
- * UBAOutdoorTemp - type 0xD1 - external temperature
+ * keep the front of the Tx queue back for ms, without it counting as a failure
  */
-void _process_UBAOutdoorTemp(_EMS_RxTelegram * EMS_RxTelegram) {
-    _setValue(EMS_RxTelegram, &EMS_Boiler.extTemp, 0);
+void _ems_txHold(uint32_t ms) {
+    _ems_txDeadline            = millis() + ms;
+    EMS_Sys_Status.emsTxStatus = EMS_TX_STATUS_BACKOFF;
+    ems_stageTx();
 }
 
 /**
- * type 0xB1 - data from the RC10 thermostat (0x17)
- * For reading the temp values only
- * received every 60 seconds
- * e.g. 17 0B 91 00 80 1E 00 CB 27 00 00 00 00 05 01 00 CB 00 (CRC=47), #data=14
+ * name of a Tx failure class, for printing
  */
-void _process_RC10StatusMessage(_EMS_RxTelegram * EMS_RxTelegram) {
-    uint8_t hc                   = EMS_THERMOSTAT_DEFAULTHC - 1; // use HC1
-    EMS_Thermostat.hc[hc].active = true;
+const char * ems_getTxFailName(uint8_t fail) {
+    switch (fail) {
+    case EMS_TX_FAIL_BRK:
+        return "BRK";
+    case EMS_TX_FAIL_WDTO:
+        return "WDTO";
+    case EMS_TX_FAIL_NOREPLY:
+        return "no reply";
+    case EMS_TX_FAIL_WRONG:
+        return "wrong reply";
+    case EMS_TX_FAIL_REJECTED:
+        return "rejected";
+    default:
+        return "?";
+    }
+}
 
-    _setValue8(EMS_RxTelegram, &EMS_Thermostat.hc[hc].setpoint_roomTemp, EMS_OFFSET_RC10StatusMessage_setpoint); // is * 2, force as single byte
-    _setValue(EMS_RxTelegram, &EMS_Thermostat.hc[hc].curr_roomTemp, EMS_OFFSET_RC10StatusMessage_curr);          // is * 10
+_EMS_TxFailStats * ems_getTxFailStats(uint8_t fail) {
+    return &_ems_txFailStats[fail];
 }
 
 /**
- * type 0x91 - data from the RC20 thermostat (0x17) - 15 bytes long
- * For reading the temp values only
- * received every 60 seconds
+ * the acknowledged write a validate in the Tx queue is for, if it's still remembered
  */
-void _process_RC20StatusMessage(_EMS_RxTelegram * EMS_RxTelegram) {
-    uint8_t hc                   = EMS_THERMOSTAT_DEFAULTHC - 1; // use HC1
-    EMS_Thermostat.hc[hc].active = true;
-
-    _setValue8(EMS_RxTelegram, &EMS_Thermostat.hc[hc].setpoint_roomTemp, EMS_OFFSET_RC20StatusMessage_setpoint); // is * 2, force as single byte
-    _setValue(EMS_RxTelegram, &EMS_Thermostat.hc[hc].curr_roomTemp, EMS_OFFSET_RC20StatusMessage_curr);          // is * 10
+static _EMS_PendingValidate * _ems_findValidate(uint8_t dest, uint16_t type, uint8_t offset) {
+    for (uint8_t i = 0; i < EMS_VALIDATE_PENDING_MAX; i++) {
+        _EMS_PendingValidate * slot = &_ems_validatePending[i];
+        if (slot->dest && ((slot->dest & 0x7F) == (dest & 0x7F)) && (slot->type == type) && (slot->offset == offset)) {
+            return slot;
+        }
+    }
+    return nullptr;
 }
 
 /**
- * type 0x41 - data from the RC30 thermostat(0x10) - 14 bytes long
- * For reading the temp values only * received every 60 seconds 
-*/
-void _process_RC30StatusMessage(_EMS_RxTelegram * EMS_RxTelegram) {
-    uint8_t hc                   = EMS_THERMOSTAT_DEFAULTHC - 1; // use HC1
-    EMS_Thermostat.hc[hc].active = true;
-
-    _setValue8(EMS_RxTelegram, &EMS_Thermostat.hc[hc].setpoint_roomTemp, EMS_OFFSET_RC30StatusMessage_setpoint); // is * 2, force as single byte
-    _setValue(EMS_RxTelegram, &EMS_Thermostat.hc[hc].curr_roomTemp, EMS_OFFSET_RC30StatusMessage_curr);
+ * true if the telegram has all the bytes of the write, with the values written
+ */
+static bool _ems_validateMatch(const _EMS_PendingValidate * pending, const _EMS_RxTelegram * EMS_RxTelegram) {
+    if ((pending->offset < EMS_RxTelegram->offset) || ((pending->offset + pending->length) > (EMS_RxTelegram->offset + EMS_RxTelegram->data_length))) {
+        return false;
+    }
+    return (memcmp(&EMS_RxTelegram->data[pending->offset - EMS_RxTelegram->offset], pending->value, pending->length) == 0);
 }
 
 /**
- * type 0x3E (HC1), 0x48 (HC2), 0x52 (HC3), 0x5C (HC4) - HK1MonitorMessage - data from the RC35 thermostat (0x10) - 16 bytes
- * examples:
- * broadcasts when manually setting HC2 to 14 degrees:
- * 10 00 3E 00   04 03 00 7D 00 00 00 00 00 00 00 00 00 11 05 00
- * 10 00 48 00   04 13 1C 00 E4 00 00 00 00 00 00 00 64 11 0F 00
- * 
- * 10 00 3E 00   80 02 1A 7D 00 00 00 00 00 00 00 00 64 11 16 00
- *
- * 10 0B 3E 00   00 00 00 7D 00 00 00 00 00 00 00 00 00 11 05 04
- * 10 00 48 00   00 00 00 00 E4 00 00 00 00 00 00 00 00 11 05 04
- * 10 0B 52 00   00 00 00 00 00 00 00 00 00 00 00 00 00 11 00 00
- * 10 0B 5C 00   00 00 00 00 00 00 00 00 00 00 00 00 00 11 00 00
- * 
- * night mode:
- * 10 00 3E 00   04 03 00 7D 00 00 00 00 00 00 00 00 00 11 05 00
- * 10 00 48 00   00 00 10 00 E9 00 00 00 00 00 00 00 00 11 05 00
- * 
- * day mode:
- * 10 0B 3E 00   04 03 00 7D 00 00 00 00 00 00 00 00 00 11 05 00
- * 10 0B 48 00   00 00 10 00 E8 00 00 00 00 00 00 00 00 11 05 00
- * 
- * auto day:
- * 10 00 3E 00   04 03 00 7D 00 00 00 00 00 00 00 00 00 11 05 00
- * 10 0B 48 00   04 03 00 00 EB 00 00 00 00 00 00 00 00 11 05 00
- * 
- * For reading the current room temperature only and picking up the modes
- * received every 60 seconds
+ * Takes the last write command and turns into a validate request
+ * placing it on the Tx queue
  */
-void _process_RC35StatusMessage(_EMS_RxTelegram * EMS_RxTelegram) {
-    // exit if...
-    // - the 15th byte (second from last) is 0x00, which I think is flow temp, means HC is not is use
-    // - its not a broadcast, so destination is 0x00
-    if ((EMS_RxTelegram->data[14] == 0x00) || (EMS_RxTelegram->dest != EMS_ID_NONE)) {
+void _createValidate() {
+    if (EMS_TxQueue.isEmpty()) {
         return;
     }
 
-    uint8_t hc_num = _getHeatingCircuit(EMS_RxTelegram); // which HC is it, 0-3
+    // release the Tx lock, the write has worked
+    EMS_Sys_Status.emsTxStatus = EMS_TX_STATUS_IDLE;
+    _ems_txFailures            = 0;
 
-    // ignore if the value is 0 (see https://github.com/proddy/EMS-ESP/commit/ccc30738c00f12ae6c89177113bd15af9826b836)
-    if (EMS_RxTelegram->data[EMS_OFFSET_RC35StatusMessage_setpoint] != 0x00) {
-        _setValue8(EMS_RxTelegram, &EMS_Thermostat.hc[hc_num].setpoint_roomTemp, EMS_OFFSET_RC35StatusMessage_setpoint); // is * 2, force to single byte
+    // get the first in the queue, which is at the head
+    _EMS_TxTelegram EMS_TxTelegram = EMS_TxQueue.first();
+
+    // safety check: only do a validate after a write and when we have a type to validate
+    if ((EMS_TxTelegram.action != EMS_TX_TELEGRAM_WRITE) || (EMS_TxTelegram.type_validate == EMS_ID_NONE)) {
+        EMS_TxQueue.shift(); // remove from queue
+        return;
     }
 
-    // ignore if the value is unset. Hopefully it will be picked up via a later message
-    _setValue(EMS_RxTelegram, &EMS_Thermostat.hc[hc_num].curr_roomTemp, EMS_OFFSET_RC35StatusMessage_curr); // is * 10
-    _setValue(EMS_RxTelegram, &EMS_Thermostat.hc[hc_num].day_mode, EMS_OFFSET_RC35StatusMessage_mode, 1);
-    _setValue(EMS_RxTelegram, &EMS_Thermostat.hc[hc_num].summer_mode, EMS_OFFSET_RC35StatusMessage_mode, 0);
-    _setValue(EMS_RxTelegram, &EMS_Thermostat.hc[hc_num].holiday_mode, EMS_OFFSET_RC35StatusMessage_mode1, 5);
-    _setValue(EMS_RxTelegram, &EMS_Thermostat.hc[hc_num].circuitcalctemp, EMS_OFFSET_RC35Set_circuitcalctemp);
-}
+    // a combined write is validated by reading back all its bytes, see EMSTxQueue::_combine()
+    const uint8_t * values;
+    uint8_t         count = _ems_txEntryWriteData(EMS_TxQueue.front(), &values);
+    if ((count > EMS_TX_WRITE_BATCH_MAX) || (EMS_TxTelegram.comparisonOffset != EMS_TxTelegram.offset)
+        || (EMS_TxTelegram.type_validate != EMS_TxTelegram.type)) {
+        count  = 1;
+        values = &EMS_TxTelegram.comparisonValue;
+    }
 
-/**
- * type 0x0A - data from the Nefit Easy/TC100 thermostat (0x18) - 31 bytes long
- * The Easy has a digital precision of its floats to 2 decimal places, so values must be divided by 100
- */
-void _process_EasyStatusMessage(_EMS_RxTelegram * EMS_RxTelegram) {
-    uint8_t hc                   = EMS_THERMOSTAT_DEFAULTHC - 1; // use HC1
-    EMS_Thermostat.hc[hc].active = true;
+    // create a new Telegram copying from the last write
+    _EMS_TxTelegram new_EMS_TxTelegram;
+    new_EMS_TxTelegram.action = EMS_TX_TELEGRAM_VALIDATE;
 
-    _setValue(EMS_RxTelegram, &EMS_Thermostat.hc[hc].curr_roomTemp, EMS_OFFSET_EasyStatusMessage_curr);         // is * 100
-    _setValue(EMS_RxTelegram, &EMS_Thermostat.hc[hc].setpoint_roomTemp, EMS_OFFSET_EasyStatusMessage_setpoint); // is * 100
-}
+    // copy old Write record
+    new_EMS_TxTelegram.type_validate      = EMS_TxTelegram.type;          // save the original type in the type_validate, increase we need to re-try
+    new_EMS_TxTelegram.type               = EMS_TxTelegram.type_validate; // new type is the validate type
+    new_EMS_TxTelegram.dest               = EMS_TxTelegram.dest;
+    new_EMS_TxTelegram.comparisonValue    = EMS_TxTelegram.comparisonValue;
+    new_EMS_TxTelegram.comparisonPostRead = EMS_TxTelegram.comparisonPostRead;
+    new_EMS_TxTelegram.comparisonOffset   = EMS_TxTelegram.comparisonOffset;
 
-void _process_MMPLUSStatusMessage(_EMS_RxTelegram * EMS_RxTelegram) {
-    uint8_t hc = (EMS_RxTelegram->type - EMS_TYPE_MMPLUSStatusMessage_HC1); // 0 to 3
-    if (hc >= EMS_THERMOSTAT_MAXHC) {
-        return; // invalid type
+    // this is what is different
+    new_EMS_TxTelegram.offset    = EMS_TxTelegram.comparisonOffset; // location of byte to fetch
+    new_EMS_TxTelegram.dataValue = count;                           // fetch the bytes written
+    new_EMS_TxTelegram.length    = EMS_MIN_TELEGRAM_LENGTH;         // is always 6 bytes long (including CRC at end)
+    new_EMS_TxTelegram.timestamp = millis();
+
+    // remember it, as a broadcast of the validate type can confirm the write instead. See _ems_validateSeen()
+    _EMS_PendingValidate * pending = nullptr;
+    for (uint8_t i = 0; i < EMS_VALIDATE_PENDING_MAX; i++) {
+        _EMS_PendingValidate * slot = &_ems_validatePending[i];
+        if ((slot->dest == new_EMS_TxTelegram.dest) && (slot->type == new_EMS_TxTelegram.type) && (slot->offset == new_EMS_TxTelegram.offset)) {
+            pending = slot; // a newer write to the same value
+            break;
+        }
+        if ((!slot->dest) && (!pending)) {
+            pending = slot;
+        }
+    }
+    if (!pending) {
+        pending           = &_ems_validatePending[_ems_validateNext];
+        _ems_validateNext = (_ems_validateNext + 1) % EMS_VALIDATE_PENDING_MAX;
+    }
+    pending->dest     = new_EMS_TxTelegram.dest;
+    pending->type     = new_EMS_TxTelegram.type;
+    pending->offset   = new_EMS_TxTelegram.offset;
+    pending->length   = count;
+    pending->postRead = new_EMS_TxTelegram.comparisonPostRead;
+    memcpy(pending->value, values, count);
+
+    // if the device broadcasts the validate type, it usually does so straight after the write. Give it the time of a reply
+    if (_ems_refreshBroadcast(new_EMS_TxTelegram.type, new_EMS_TxTelegram.dest)) {
+        _ems_txHold(_ems_txReplyTimeout());
     }
-    EMS_Mixing.hc[hc].active = true;
 
-    _setValue(EMS_RxTelegram, &EMS_Mixing.hc[hc].flowTemp, EMS_OFFSET_MMPLUSStatusMessage_flow_temp);
-    _setValue(EMS_RxTelegram, &EMS_Mixing.hc[hc].pumpMod, EMS_OFFSET_MMPLUSStatusMessage_pump_mod);
-    _setValue(EMS_RxTelegram, &EMS_Mixing.hc[hc].valveStatus, EMS_OFFSET_MMPLUSStatusMessage_valve_status);
+    // remove old telegram from queue and add this new read one
+    EMS_TxQueue.replaceFront(new_EMS_TxTelegram); // so it's the first to be picked up next
 }
 
 /**
- * type 0x01A5 - data from the Nefit RC1010/3000 thermostat (0x18) and RC300/310s on 0x10
- * EMS+ messages may come in with different offsets so handle them here
+ * a broadcast has come in. If it carries the value of a write we're about to validate, the write has worked
+ * and the validate read is taken out of the Tx queue. If it was already on the bus, the reply we're waiting on
+ * doesn't matter any more, so the Tx queue moves on and the broadcast is processed like any other
  */
-void _process_RCPLUSStatusMessage(_EMS_RxTelegram * EMS_RxTelegram) {
-    // figure out which heating circuit
-    uint8_t hc = (EMS_RxTelegram->type - EMS_TYPE_RCPLUSStatusMessage_HC1); // 0 to 3
-    if (hc >= EMS_THERMOSTAT_MAXHC) {
-        return; // invalid type
-    }
-    EMS_Thermostat.hc[hc].active = true;
+void _ems_validateSeen(_EMS_RxTelegram * EMS_RxTelegram) {
+    for (uint8_t i = 0; i < EMS_VALIDATE_PENDING_MAX; i++) {
+        _EMS_PendingValidate * slot = &_ems_validatePending[i];
+        if ((!slot->dest) || ((slot->dest & 0x7F) != (EMS_RxTelegram->src & 0x7F)) || (slot->type != EMS_RxTelegram->type)) {
+            continue;
+        }
 
-    // handle single data values. data will always be at position data[0]
-    if (EMS_RxTelegram->data_length == 1) {
-        switch (EMS_RxTelegram->offset) {
-        case EMS_OFFSET_RCPLUSStatusMessage_curr:                               // setpoint target temp
-            _setValue(EMS_RxTelegram, &EMS_Thermostat.hc[hc].curr_roomTemp, 0); // value is * 10
-            break;
-        case EMS_OFFSET_RCPLUSStatusMessage_setpoint:                          // current target temp
-            EMS_Thermostat.hc[hc].setpoint_roomTemp = EMS_RxTelegram->data[0]; // convert to single byte, value is * 2
-            break;
-        case EMS_OFFSET_RCPLUSStatusMessage_currsetpoint:                      // current setpoint temp,  e.g. Thermostat -> all, telegram: 10 00 FF 06 01 A5 22
-            EMS_Thermostat.hc[hc].setpoint_roomTemp = EMS_RxTelegram->data[0]; // convert to single byte, value is * 2
-            break;
-        case EMS_OFFSET_RCPLUSStatusMessage_mode: // thermostat mode auto/manual
-                                                  // manual : 10 00 FF 0A 01 A5 02
-                                                  // auto :   10 00 FF 0A 01 A5 03
-            _setValue(EMS_RxTelegram, &EMS_Thermostat.hc[hc].mode, 0,
-                      0); // bit 1, mode (auto=1 or manual=0). Note this may be bit 2 - still need to validate
-            _setValue(EMS_RxTelegram, &EMS_Thermostat.hc[hc].day_mode, 0, 1); // get day mode flag
+        int8_t index = EMS_TxQueue.find(EMS_TX_TELEGRAM_VALIDATE, slot->dest, slot->type, slot->offset);
+        if (index < 0) {
+            slot->dest = 0; // it has been validated, or given up on
+            continue;
+        }
 
-            break;
+        if (!_ems_validateMatch(slot, EMS_RxTelegram)) {
+            continue; // not in this one, or not changed yet
         }
-    } else if (EMS_RxTelegram->data_length > 20) {
-        // the whole telegram
-        // e.g. Thermostat -> all, telegram: 10 00 FF 00 01 A5 00 D7 21 00 00 00 00 30 01 84 01 01 03 01 84 01 F1 00 00 11 01 00 08 63 00
-        //                                   10 00 FF 00 01 A5 80 00 01 30 28 00 30 28 01 54 03 03 01 01 54 02 A8 00 00 11 01 03 FF FF 00
-        _setValue(EMS_RxTelegram, &EMS_Thermostat.hc[hc].curr_roomTemp, EMS_OFFSET_RCPLUSStatusMessage_curr);          // value is * 10
-        _setValue8(EMS_RxTelegram, &EMS_Thermostat.hc[hc].setpoint_roomTemp, EMS_OFFSET_RCPLUSStatusMessage_setpoint); // convert to single byte, value is * 2
-        _setValue(EMS_RxTelegram, &EMS_Thermostat.hc[hc].day_mode, EMS_OFFSET_RCPLUSStatusMessage_mode, 1);
-        _setValue(EMS_RxTelegram, &EMS_Thermostat.hc[hc].mode, EMS_OFFSET_RCPLUSStatusMessage_mode, 0); // bit 1, mode (auto=1 or manual=0)
+
+        // sent by the Rx interrupt on a poll that hasn't been processed yet, its reply takes care of it
+        if ((index == 0) && (EMS_Sys_Status.emsTxStatus == EMS_TX_STATUS_IDLE) && EMS_TxQueue.frontLocked()) {
+            continue;
+        }
+
+        if ((index == 0) && ((EMS_Sys_Status.emsTxStatus == EMS_TX_STATUS_WAIT) || (EMS_Sys_Status.emsTxStatus == EMS_TX_STATUS_BACKOFF))) {
+            EMS_Sys_Status.emsTxStatus  = EMS_TX_STATUS_IDLE;
+            EMS_Sys_Status.txRetryCount = 0;
+            _ems_txFailures             = 0;
+        }
+        EMS_TxQueue.remove(index);
+        EMS_Sys_Status.emsTxValidatesSkipped++;
+        if (EMS_Sys_Status.emsLogging >= EMS_SYS_LOGGING_BASIC) {
+            myDebug_P(PSTR("-> Write to 0x%02X confirmed by its broadcast"), slot->dest & 0x7F);
+        }
+
+        // the post read isn't needed either if that comes as a broadcast
+        if (!_ems_refreshBroadcast(slot->postRead, slot->dest)) {
+            ems_doReadCommand(slot->postRead, slot->dest, true);
+        }
+        slot->dest = 0;
     }
 }
 
 /**
- * type 0x01AF - summer/winter mode from the Nefit RC1010 thermostat (0x18) and RC300/310s on 0x10
+ * dump a UART Tx or Rx buffer to console...
  */
-void _process_RCPLUSStatusMode(_EMS_RxTelegram * EMS_RxTelegram) {
-    // data[0] // 0x00=OFF 0x01=Automatic 0x02=Forced
+void ems_dumpBuffer(const char * prefix, uint8_t * telegram, uint8_t length) {
+    uint32_t    timestamp       = millis();
+    static char output_str[200] = {0};
+    static char buffer[16]      = {0};
+
+    strlcpy(output_str, "(", sizeof(output_str));
+    strlcat(output_str, COLOR_CYAN, sizeof(output_str));
+    strlcat(output_str, _smallitoa((uint8_t)((timestamp / 3600000) % 24), buffer), sizeof(output_str));
+    strlcat(output_str, ":", sizeof(output_str));
+    strlcat(output_str, _smallitoa((uint8_t)((timestamp / 60000) % 60), buffer), sizeof(output_str));
+    strlcat(output_str, ":", sizeof(output_str));
+    strlcat(output_str, _smallitoa((uint8_t)((timestamp / 1000) % 60), buffer), sizeof(output_str));
+    strlcat(output_str, ".", sizeof(output_str));
+    strlcat(output_str, _smallitoa3(timestamp % 1000, buffer), sizeof(output_str));
+    strlcat(output_str, COLOR_RESET, sizeof(output_str));
+    strlcat(output_str, ") ", sizeof(output_str));
+
+    strlcat(output_str, COLOR_YELLOW, sizeof(output_str));
+    strlcat(output_str, prefix, sizeof(output_str));
+
+    // show some EMS_Sys_Status entries
+    strlcat(output_str, _hextoa(EMS_Sys_Status.emsRxStatus, buffer), sizeof(output_str));
+    strlcat(output_str, " ", sizeof(output_str));
+    strlcat(output_str, _hextoa(EMS_Sys_Status.emsTxStatus, buffer), sizeof(output_str));
+    strlcat(output_str, ": ", sizeof(output_str));
+
+    // print whole buffer, don't interpret any data
+    for (int i = 0; i < (length); i++) {
+        strlcat(output_str, _hextoa(telegram[i], buffer), sizeof(output_str));
+        strlcat(output_str, " ", sizeof(output_str));
+    }
+
+    strlcat(output_str, COLOR_RESET, sizeof(output_str));
+
+    myDebug(output_str);
 }
 
 /**
- * FR10/FR50/FR100 Junkers - type x006F
- *    e.g. for FR10:  90 00 FF 00 00 6F   03 01 00 BE 00 BF
- *         for FW100: 90 00 FF 00 00 6F   03 02 00 D7 00 DA F3 34 00 C4
+ * a poll for us, keep track of how often they come. The time is from the <BRK>, taken in the Rx interrupt
  */
-void _process_JunkersStatusMessage(_EMS_RxTelegram * EMS_RxTelegram) {
-    if (EMS_RxTelegram->offset == 0 && EMS_RxTelegram->data_length > 1) {
-        uint8_t hc                   = EMS_THERMOSTAT_DEFAULTHC - 1; // use HC1
-        EMS_Thermostat.hc[hc].active = true;
-
-        _setValue(EMS_RxTelegram, &EMS_Thermostat.hc[hc].curr_roomTemp, EMS_OFFSET_JunkersStatusMessage_curr);         // value is * 10
-        _setValue(EMS_RxTelegram, &EMS_Thermostat.hc[hc].setpoint_roomTemp, EMS_OFFSET_JunkersStatusMessage_setpoint); // value is * 10
-        _setValue(EMS_RxTelegram, &EMS_Thermostat.hc[hc].day_mode, EMS_OFFSET_JunkersStatusMessage_daymode);           // 3 = day, 2 = night
-        _setValue(EMS_RxTelegram, &EMS_Thermostat.hc[hc].mode, EMS_OFFSET_JunkersStatusMessage_mode);                  // 1 = manual, 2 = auto
-    }
+static void _ems_pollSeen() {
+    static uint32_t _last_emsPollFrequency = 0;
+    uint32_t        timenow_microsecs      = emsuart_rx_time();
+    EMS_Sys_Status.emsPollFrequency        = (timenow_microsecs - _last_emsPollFrequency);
+    if (_last_emsPollFrequency) {
+        _histogram_add(&emsuart_getTiming()->pollInterval, EMS_Sys_Status.emsPollFrequency);
+    }
+    _last_emsPollFrequency = timenow_microsecs;
 }
 
 /**
- * type 0x01B9 EMS+ for reading the mode from RC300/RC310 thermostat
+ * Entry point triggered by an interrupt in emsuart.cpp
+ * length is the number of all the telegram bytes up to and including the CRC at the end
+ * crcOk is the CRC check, done by the UART as the bytes came in
+ * Read commands are asynchronous as they're handled by the interrupt
+ * When a telegram is processed we forcefully erase it from the stack to prevent overflow
  */
-void _process_RCPLUSSetMessage(_EMS_RxTelegram * EMS_RxTelegram) {
-    // ignore F7 and F9
-    if (EMS_RxTelegram->emsplus_type != 0xFF) {
-        return;
+void ems_parseTelegram(uint8_t * telegram, uint8_t length, bool crcOk) {
+    _ems_busStatsAdd(telegram, length, crcOk);
+    _ems_txCheckFailure(); // before this telegram is taken as its reply
+    _ems_parseTelegram(telegram, length, crcOk);
+    ems_stageTx(); // ready for the next poll
+}
+
+void _ems_parseTelegram(uint8_t * telegram, uint8_t length, bool crcOk) {
+    if (EMS_Sys_Status.emsLogging == EMS_SYS_LOGGING_JABBER) {
+        ems_dumpBuffer("ems_parseTelegram: ", telegram, length);
     }
 
-    uint8_t hc                   = EMS_THERMOSTAT_DEFAULTHC - 1; // use HC1
-    EMS_Thermostat.hc[hc].active = true;
+    /*
+     * Detect the EMS bus type - Buderus or Junkers - and set emsIDMask accordingly.
+     *  we wait for the first valid telegram and look at the SourceID.
+     *  If Bit 7 is set we have a Buderus, otherwise a Junkers
+     */
+    if (EMS_Sys_Status.emsTxStatus == EMS_TX_REV_DETECT) {
+        if ((length >= 5) && crcOk) {
+            EMS_Sys_Status.emsTxStatus   = EMS_TX_STATUS_IDLE;
+            EMS_Sys_Status.emsIDMask     = telegram[0] & 0x80;
+            EMS_Sys_Status.emsPollAck[0] = EMS_ID_ME ^ EMS_Sys_Status.emsIDMask;
+        } else
+            return; // ignore the whole telegram Rx Telegram while in DETECT mode
+    }
 
-    // check for one data value
-    // but ignore values of 0xFF, e.g.  10 00 FF 08 01 B9 FF
-    if ((EMS_RxTelegram->data_length == 1) && (EMS_RxTelegram->data[0] != 0xFF)) {
-        // check for setpoint temps, e.g. Thermostat -> all, type 0x01B9, telegram: 10 00 FF 08 01 B9 26
-        if ((EMS_RxTelegram->offset == EMS_OFFSET_RCPLUSSet_temp_setpoint) || (EMS_RxTelegram->offset == EMS_OFFSET_RCPLUSSet_manual_setpoint)) {
-            _setValue8(EMS_RxTelegram, &EMS_Thermostat.hc[hc].setpoint_roomTemp, 0); // single byte conversion, value is * 2
-        } else if (EMS_RxTelegram->offset == EMS_OFFSET_RCPLUSSet_mode) {
-            // check for mode, eg.  10 00 FF 08 01 B9 FF
-            EMS_Thermostat.hc[hc].mode = (EMS_RxTelegram->data[0] == 0xFF); // Auto = xFF, Manual = x00   (auto=1 or manual=0)
+    // a poll for us, already answered by the Rx interrupt
+    uint8_t answered = emsuart_rx_answered();
+    if (answered != EMSUART_STAGE_NONE) {
+        _ems_pollSeen();
+        _ems_txStaged(answered);
+        return;
+    }
+
+    /* 
+     * It may happen that we were interrupted (for instance by WIFI activity) and the 
+     * buffer isn't valid anymore, so we must not answer at all...
+     */
+    if (EMS_Sys_Status.emsRxStatus != EMS_RX_STATUS_IDLE) {
+        if (EMS_Sys_Status.emsLogging > EMS_SYS_LOGGING_NONE) {
+            myDebug_P(PSTR("** Warning, we missed the bus - Rx non-idle!"));
         }
-        return; // quit
+        return;
     }
 
-    // check for long broadcasts
-    if (EMS_RxTelegram->offset == 0) {
-        _setValue(EMS_RxTelegram, &EMS_Thermostat.hc[hc].mode, EMS_OFFSET_RCPLUSSet_mode);
-        _setValue(EMS_RxTelegram, &EMS_Thermostat.hc[hc].daytemp, EMS_OFFSET_RCPLUSSet_temp_comfort2); // is * 2
-        _setValue(EMS_RxTelegram, &EMS_Thermostat.hc[hc].nighttemp, EMS_OFFSET_RCPLUSSet_temp_eco);    // is * 2
+    /*
+     * check if we just received one byte
+     * it could well be a Poll request from the boiler for us, which will have a value of 0x8B (0x0B | 0x80)
+     * or either a return code like 0x01 or 0x04 from the last Write command
+     */
+    if (length == 1) {
+        uint8_t value = telegram[0]; // 1st byte of data package
+
+        // check first for a Poll for us
+        if ((value ^ 0x80 ^ EMS_Sys_Status.emsIDMask) == EMS_ID_ME) {
+            _ems_pollSeen();
+
+            // do we have something to send thats waiting in the Tx queue?
+            // if so send it if the Queue is not in a wait state
+            if ((!EMS_TxQueue.isEmpty()) && (EMS_Sys_Status.emsTxStatus == EMS_TX_STATUS_IDLE) && !_ems_txBatching()) {
+                _ems_sendTelegram(); // perform the read/write command immediately
+            } else {
+                // nothing to send so just send a poll acknowledgement back
+                if (EMS_Sys_Status.emsPollEnabled) {
+                    ems_tx_pollAck();
+                }
+            }
+        } else if (EMS_Sys_Status.emsTxStatus == EMS_TX_STATUS_WAIT) {
+            // this may be a byte 01 (success) or 04 (error) from a recent write command?
+            if (value == EMS_TX_SUCCESS) {
+                EMS_Sys_Status.emsTxPkgs++;
+                // got a success 01. Send a validate to check the value of the last write
+                ems_tx_pollAck();  // send a poll to free the EMS bus
+                _createValidate(); // create a validate Tx request (if needed)
+            } else if (value == EMS_TX_ERROR) {
+                // last write failed (04), delete it from queue and dont bother to retry
+                if (EMS_Sys_Status.emsLogging == EMS_SYS_LOGGING_VERBOSE) {
+                    myDebug_P(PSTR("-> Error: Write command failed from host"));
+                }
+                ems_tx_pollAck(); // send a poll to free the EMS bus
+                _ems_txFailed(EMS_TX_FAIL_REJECTED, false);
+                _removeTxQueue(); // remove from queue
+            }
+        }
+
+        return; // all done here
+    }
+
+    // ignore anything that doesn't resemble a proper telegram package
+    // minimal is 5 bytes, excluding CRC at the end (for EMS1.0)
+    if (length <= 4) {
+        // _debugPrintTelegram("Noisy data: ", &EMS_RxTelegram, COLOR_RED);
+        return;
+    }
+
+    static _EMS_RxTelegram EMS_RxTelegram; // create the Rx package
+    EMS_RxTelegram.telegram  = telegram;
+    EMS_RxTelegram.timestamp = myESP.getSystemTime();
+    EMS_RxTelegram.length    = length;
+
+    EMS_RxTelegram.src    = telegram[0] & 0x7F; // removing 8th bit as we deal with both reads and writes here
+    EMS_RxTelegram.dest   = telegram[1] & 0x7F; // remove 8th bit (don't care if read or write)
+    EMS_RxTelegram.offset = telegram[3];        // offset is always 4th byte
+
+    // determing if its normal ems or ems plus, check for marker
+    if (telegram[2] >= 0xF0) {
+        // its EMS plus / EMS 2.0
+        EMS_RxTelegram.emsplus      = true;
+        EMS_RxTelegram.emsplus_type = telegram[2]; // 0xFF, 0xF7 or 0xF9
+
+        if (EMS_RxTelegram.emsplus_type == 0xFF) {
+            EMS_RxTelegram.type = (telegram[4] << 8) + telegram[5]; // is a long in bytes 5 & 6
+            EMS_RxTelegram.data = telegram + 6;
+
+            if (length <= 7) {
+                EMS_RxTelegram.data_length = 0; // special broadcast on ems+ have no data values
+            } else {
+                EMS_RxTelegram.data_length = length - 7; // remove 6 byte header plus CRC
+            }
+        } else {
+            // its F9 or F7
+            uint8_t shift       = (telegram[4] != 0xFF); // true (1) if byte 4 is not 0xFF, then telegram is 1 byte longer
+            EMS_RxTelegram.type = (telegram[5 + shift] << 8) + telegram[6 + shift];
+            EMS_RxTelegram.data = telegram + 6 + shift; // there is a special byte after the typeID which we ignore for now
+            if (length <= (9 + shift)) {
+                EMS_RxTelegram.data_length = 0; // special broadcast on ems+ have no data values
+            } else {
+                EMS_RxTelegram.data_length = length - (9 + shift);
+            }
+        }
+    } else {
+        // Normal EMS 1.0
+        EMS_RxTelegram.emsplus     = false;
+        EMS_RxTelegram.type        = telegram[2]; // 3rd byte
+        EMS_RxTelegram.data        = telegram + 4;
+        EMS_RxTelegram.data_length = length - 5; // remove 4 bytes header plus CRC
+    }
+
+    // if we are in raw logging mode then just print out the telegram as it is
+    // else if we're watching a specific type ID show it and also log an event to the SysLog
+    // but still continue to process it
+    if ((EMS_Sys_Status.emsLogging == EMS_SYS_LOGGING_RAW)) {
+        _debugPrintTelegram("", &EMS_RxTelegram, COLOR_WHITE, true);
+    } else if ((EMS_Sys_Status.emsLogging == EMS_SYS_LOGGING_WATCH) && (EMS_RxTelegram.type == EMS_Sys_Status.emsLogging_typeID)) {
+        _debugPrintTelegram("", &EMS_RxTelegram, COLOR_WHITE, true);
+    }
+
+    // Assume at this point we have something that vaguely resembles a telegram in the format [src] [dest] [type] [offset] [data] [crc]
+    // check the CRC, if it's bad ignore it
+    if (!crcOk) {
+        EMS_Sys_Status.emxCrcErr++;
+        EMS_Sys_Status.emsCrcErrSrc[EMS_RxTelegram.src]++;
+        if (EMS_Sys_Status.emsLogging == EMS_SYS_LOGGING_VERBOSE) {
+            _debugPrintTelegram("Corrupt telegram: ", &EMS_RxTelegram, COLOR_RED, true);
+        }
+        return;
     }
+
+    // here we know its a valid incoming telegram of at least 6 bytes
+    // we use this to see if we always have a connection to the boiler, in case of drop outs
+    EMS_Sys_Status.emsRxTimestamp  = millis(); // timestamp of last read
+    EMS_Sys_Status.emsBusConnected = true;
+
+    // now lets process it and see what to do next
+    _processType(&EMS_RxTelegram);
 }
 
 /**
- * type 0xB0 - for reading the mode from the RC10 thermostat (0x17)
- * received only after requested
+ * print the telegram
  */
-void _process_RC10Set(_EMS_RxTelegram * EMS_RxTelegram) {
-    // mode not implemented yet
+void _printMessage(_EMS_RxTelegram * EMS_RxTelegram) {
+    // header info
+    uint8_t  src    = EMS_RxTelegram->src;
+    uint8_t  dest   = EMS_RxTelegram->dest;
+    uint16_t type   = EMS_RxTelegram->type;
+    uint8_t  length = EMS_RxTelegram->data_length;
+
+    char output_str[200] = {0};
+    char buffer[16]      = {0};
+    char color_s[20]     = {0};
+    char type_s[30];
+
+    // source
+    ems_getDeviceTypeDescription(src, type_s);
+    strlcpy(output_str, type_s, sizeof(output_str));
+    strlcat(output_str, " -> ", sizeof(output_str));
+
+    // destination
+    (void)ems_getDeviceTypeDescription(dest, type_s);
+    strlcat(output_str, type_s, sizeof(output_str));
+
+    if (dest == EMS_ID_ME) {
+        strlcpy(color_s, COLOR_YELLOW, sizeof(color_s)); // me
+    } else if (dest == EMS_ID_NONE) {
+        strlcpy(color_s, COLOR_GREEN, sizeof(color_s)); // broadcast
+    } else {
+        strlcpy(color_s, COLOR_MAGENTA, sizeof(color_s)); // everything else
+    }
+
+    if (length) {
+        // type
+        strlcat(output_str, ", type 0x", sizeof(output_str));
+
+        if (EMS_RxTelegram->emsplus) {
+            strlcat(output_str, _hextoa(type >> 8, buffer), sizeof(output_str));
+            strlcat(output_str, _hextoa(type & 0xFF, buffer), sizeof(output_str));
+        } else {
+            strlcat(output_str, _hextoa(type, buffer), sizeof(output_str));
+        }
+    }
+
+    strlcat(output_str, ", ", sizeof(output_str));
+
+    if (EMS_Sys_Status.emsLogging == EMS_SYS_LOGGING_THERMOSTAT) {
+        // only print ones to/from thermostat if logging is set to thermostat only
+        if ((src == EMS_Thermostat.device_id) || (dest == EMS_Thermostat.device_id)) {
+            _debugPrintTelegram(output_str, EMS_RxTelegram, color_s);
+        }
+    } else if (EMS_Sys_Status.emsLogging == EMS_SYS_LOGGING_SOLARMODULE) {
+        // only print ones to/from thermostat if logging is set to thermostat only
+        if ((src == EMS_SolarModule.device_id) || (dest == EMS_SolarModule.device_id)) {
+            _debugPrintTelegram(output_str, EMS_RxTelegram, color_s);
+        }
+    } else {
+        // always print
+        _debugPrintTelegram(output_str, EMS_RxTelegram, color_s);
+    }
 }
 
 /**
- * type 0xA8 - for reading the mode from the RC20 thermostat (0x17)
- * received only after requested
+ * Remove current Tx telegram from queue and release lock on Tx
  */
-void _process_RC20Set(_EMS_RxTelegram * EMS_RxTelegram) {
-    uint8_t hc                   = EMS_THERMOSTAT_DEFAULTHC - 1; // use HC1
-    EMS_Thermostat.hc[hc].active = true;
-    _setValue(EMS_RxTelegram, &EMS_Thermostat.hc[hc].mode, EMS_OFFSET_RC20Set_mode); // note, fixed for HC1
+void _removeTxQueue() {
+    if (!EMS_TxQueue.isEmpty()) {
+        EMS_TxQueue.shift(); // remove item from top of the queue
+    }
+    EMS_Sys_Status.emsTxStatus = EMS_TX_STATUS_IDLE;
+    _ems_txFailures            = 0; // the next one starts afresh
 }
 
 /**
- * type 0xA7 - for reading the mode from the RC30 thermostat (0x10)
- * received only after requested
+ * Check if hot tap water or heating is active
+ * using a quick hack for checking the heating. Selected Flow Temp >= 70
  */
-void _process_RC30Set(_EMS_RxTelegram * EMS_RxTelegram) {
-    uint8_t hc                   = EMS_THERMOSTAT_DEFAULTHC - 1; // use HC1
-    EMS_Thermostat.hc[hc].active = true;
-    _setValue(EMS_RxTelegram, &EMS_Thermostat.hc[hc].mode, EMS_OFFSET_RC30Set_mode); // note, fixed for HC1
+void _checkActive() {
+    // hot tap water, using flow to check instead of the burner power
+    if (EMS_Boiler.wWCurFlow != EMS_VALUE_INT_NOTSET && EMS_Boiler.burnGas != EMS_VALUE_INT_NOTSET) {
+        EMS_Boiler.tapwaterActive = ((EMS_Boiler.wWCurFlow != 0) && (EMS_Boiler.burnGas == EMS_VALUE_BOOL_ON));
+    }
+
+    // heating
+    if (EMS_Boiler.selFlowTemp != EMS_VALUE_INT_NOTSET && EMS_Boiler.burnGas != EMS_VALUE_INT_NOTSET) {
+        EMS_Boiler.heatingActive = ((EMS_Boiler.selFlowTemp >= EMS_BOILER_SELFLOWTEMP_HEATING) && (EMS_Boiler.burnGas == EMS_VALUE_BOOL_ON));
+    }
 }
 
-// return which heating circuit it is, 0-3 for HC1 to HC4
-// based on type 0x3E (HC1), 0x48 (HC2), 0x52 (HC3), 0x5C (HC4)
-uint8_t _getHeatingCircuit(_EMS_RxTelegram * EMS_RxTelegram) {
-    uint8_t hc_num;
-    switch (EMS_RxTelegram->type) {
-    case EMS_TYPE_RC35StatusMessage_HC1:
-    case EMS_TYPE_RC35Set_HC1:
-    default:
-        hc_num = 1; // also default
-        break;
-    case EMS_TYPE_RC35StatusMessage_HC2:
-    case EMS_TYPE_RC35Set_HC2:
-        hc_num = 2;
-        break;
-    case EMS_TYPE_RC35StatusMessage_HC3:
-    case EMS_TYPE_RC35Set_HC3:
-        hc_num = 3;
-        break;
-    case EMS_TYPE_RC35StatusMessage_HC4:
+/**
+ * UBAParameterWW - type 0x33 - warm water parameters
+ * received only after requested (not broadcasted)
+ */
+const _EMS_Field EMS_Fields_UBAParameterWW[] PROGMEM = {
+    EMS_FIELD(1, _EMS_Boiler, wWActivated), // 0xFF means on
+    EMS_FIELD(2, _EMS_Boiler, wWSelTemp),
+    EMS_FIELD(6, _EMS_Boiler, wWCircPump),  // 0xFF means on
+    EMS_FIELD(8, _EMS_Boiler, wWDesiredTemp),
+    EMS_FIELD(EMS_OFFSET_UBAParameterWW_wwComfort, _EMS_Boiler, wWComfort),
+};
+
+void _process_UBAParameterWW(_EMS_RxTelegram * EMS_RxTelegram) {
+    _ems_decodeFields(EMS_RxTelegram, EMS_Fields_UBAParameterWW, ArraySize(EMS_Fields_UBAParameterWW), &EMS_Boiler);
+}
+
+/**
+ * UBATotalUptimeMessage - type 0x14 - total uptime
+ * received only after requested (not broadcasted)
+ */
+const _EMS_Field EMS_Fields_UBATotalUptimeMessage[] PROGMEM = {
+    EMS_FIELD(0, _EMS_Boiler, UBAuptime),
+};
+
+void _process_UBATotalUptimeMessage(_EMS_RxTelegram * EMS_RxTelegram) {
+    _ems_decodeFields(EMS_RxTelegram, EMS_Fields_UBATotalUptimeMessage, ArraySize(EMS_Fields_UBATotalUptimeMessage), &EMS_Boiler);
+}
+
+/**
+ * UBAParametersMessage - type 0x16
+ */
+const _EMS_Field EMS_Fields_UBAParametersMessage[] PROGMEM = {
+    EMS_FIELD(1, _EMS_Boiler, heating_temp),
+    EMS_FIELD(9, _EMS_Boiler, pump_mod_max),
+    EMS_FIELD(10, _EMS_Boiler, pump_mod_min),
+};
+
+void _process_UBAParametersMessage(_EMS_RxTelegram * EMS_RxTelegram) {
+    _ems_decodeFields(EMS_RxTelegram, EMS_Fields_UBAParametersMessage, ArraySize(EMS_Fields_UBAParametersMessage), &EMS_Boiler);
+}
+
+/**
+ * UBAMonitorWWMessage - type 0x34 - warm water monitor. 19 bytes long
+ * received every 10 seconds
+ */
+const _EMS_Field EMS_Fields_UBAMonitorWWMessage[] PROGMEM = {
+    EMS_FIELD(1, _EMS_Boiler, wWCurTmp),
+    EMS_FIELD_BIT(5, 1, _EMS_Boiler, wWOneTime),
+    EMS_FIELD(9, _EMS_Boiler, wWCurFlow),
+    EMS_FIELD(10, _EMS_Boiler, wWWorkM),
+    EMS_FIELD(13, _EMS_Boiler, wWStarts),
+};
+
+void _process_UBAMonitorWWMessage(_EMS_RxTelegram * EMS_RxTelegram) {
+    _ems_decodeFields(EMS_RxTelegram, EMS_Fields_UBAMonitorWWMessage, ArraySize(EMS_Fields_UBAMonitorWWMessage), &EMS_Boiler);
+}
+
+/**
+ * Activate / De-activate One Time warm water 0x35
+ * true = on, false = off
+ */
+void ems_setWarmWaterOnetime(bool activated) {
+    myDebug_P(PSTR("Setting boiler warm water OneTime loading %s"), activated ? "on" : "off");
+
+    _EMS_TxTelegram EMS_TxTelegram = EMS_TX_TELEGRAM_NEW; // create new Tx
+    EMS_TxTelegram.timestamp       = millis();            // set timestamp
+    EMS_Sys_Status.txRetryCount    = 0;                   // reset retry counter
+
+    EMS_TxTelegram.action        = EMS_TX_TELEGRAM_WRITE;
+    EMS_TxTelegram.dest          = EMS_Boiler.device_id;
+    EMS_TxTelegram.type          = EMS_TYPE_UBAFlags;
+    EMS_TxTelegram.offset        = EMS_OFFSET_UBAParameterWW_wwOneTime;
+    EMS_TxTelegram.length        = EMS_MIN_TELEGRAM_LENGTH;
+    EMS_TxTelegram.type_validate = EMS_ID_NONE;               // don't validate
+    EMS_TxTelegram.dataValue     = (activated ? 0x22 : 0x02); // 0x22 is on, 0x02 is off for RC20RF
+
+    EMS_TxQueue.push(EMS_TxTelegram);
+}
+
+/**
+ * UBAMonitorFast - type 0x18 - central heating monitor part 1 (25 bytes long)
+ * received every 10 seconds
+ */
+const _EMS_Field EMS_Fields_UBAMonitorFast[] PROGMEM = {
+    EMS_FIELD(0, _EMS_Boiler, selFlowTemp),
+    EMS_FIELD(1, _EMS_Boiler, curFlowTemp),
+    EMS_FIELD(3, _EMS_Boiler, selBurnPow), // burn power max setting
+    EMS_FIELD(4, _EMS_Boiler, curBurnPow),
+
+    EMS_FIELD_BIT(7, 0, _EMS_Boiler, burnGas),
+    EMS_FIELD_BIT(7, 2, _EMS_Boiler, fanWork),
+    EMS_FIELD_BIT(7, 3, _EMS_Boiler, ignWork),
+    EMS_FIELD_BIT(7, 5, _EMS_Boiler, heatPmp),
+    EMS_FIELD_BIT(7, 6, _EMS_Boiler, wWHeat),
+    EMS_FIELD_BIT(7, 7, _EMS_Boiler, wWCirc),
+
+    EMS_FIELD(11, _EMS_Boiler, boilTemp), // 0x8000 if not available
+    EMS_FIELD(13, _EMS_Boiler, retTemp),
+    EMS_FIELD(15, _EMS_Boiler, flameCurr),
+    EMS_FIELD(17, _EMS_Boiler, sysPress), // system pressure, is *10. FF means missing
+    EMS_FIELD(20, _EMS_Boiler, serviceCode),
+};
+const uint8_t EMS_Fields_UBAMonitorFast_max = ArraySize(EMS_Fields_UBAMonitorFast);
+
+void _process_UBAMonitorFast(_EMS_RxTelegram * EMS_RxTelegram) {
+    _ems_decodeFields(EMS_RxTelegram, EMS_Fields_UBAMonitorFast, EMS_Fields_UBAMonitorFast_max, &EMS_Boiler);
+
+    // read the service code / installation status as appears on the display
+    if (EMS_RxTelegram->data_length > 18) {
+        EMS_Boiler.serviceCodeChar[0] = char(EMS_RxTelegram->data[18]); // ascii character 1
+        EMS_Boiler.serviceCodeChar[1] = char(EMS_RxTelegram->data[19]); // ascii character 2
+        EMS_Boiler.serviceCodeChar[2] = '\0';                           // null terminate string
+    }
+
+    // at this point do a quick check to see if the hot water or heating is active
+    _checkActive();
+}
+
+/**
+ * UBAMonitorFast2 - type 0xE4 - central heating monitor
+ */
+const _EMS_Field EMS_Fields_UBAMonitorFast2[] PROGMEM = {
+    EMS_FIELD(6, _EMS_Boiler, selFlowTemp),
+    EMS_FIELD(7, _EMS_Boiler, curFlowTemp), // 0x8000 if not available
+    EMS_FIELD(9, _EMS_Boiler, selBurnPow),
+    EMS_FIELD(10, _EMS_Boiler, curBurnPow),
+    EMS_FIELD_BIT(11, 0, _EMS_Boiler, burnGas),
+    EMS_FIELD_BIT(11, 2, _EMS_Boiler, wWHeat),
+    EMS_FIELD(19, _EMS_Boiler, flameCurr),
+};
+
+void _process_UBAMonitorFast2(_EMS_RxTelegram * EMS_RxTelegram) {
+    _ems_decodeFields(EMS_RxTelegram, EMS_Fields_UBAMonitorFast2, ArraySize(EMS_Fields_UBAMonitorFast2), &EMS_Boiler);
+
+    // read the service code / installation status as appears on the display
+    if (EMS_RxTelegram->data_length > 4) {
+        EMS_Boiler.serviceCodeChar[0] = char(EMS_RxTelegram->data[4]); // ascii character 1
+        EMS_Boiler.serviceCodeChar[1] = char(EMS_RxTelegram->data[5]); // ascii character 2
+        EMS_Boiler.serviceCodeChar[2] = '\0';
+    }
+
+    // still to figure out:
+    //  EMS_Boiler.serviceCode
+    //  EMS_Boiler.retTemp
+    //  EMS_Boiler.sysPress
+
+    // at this point do a quick check to see if the hot water or heating is active
+    _checkActive();
+}
+
+/**
+ * UBAMonitorSlow - type 0x19 - central heating monitor part 2 (27 bytes long)
+ * received every 60 seconds
+ * e.g. 08 00 19 00 80 00 02 41 80 00 00 00 00 00 03 91 7B 05 B8 40 00 00 00 04 92 AD 00 5E EE 80 00 (CRC=C9) #data=27
+ *      08 0B 19 00 FF EA 02 47 80 00 00 00 00 62 03 CA 24 2C D6 23 00 00 00 27 4A B6 03 6E 43 
+ *                  00 01 02 03 04 05 06 07 08 09 10 11 12 13 14 15 16 17 17 19 20 21 22 23 24
+ */
+const _EMS_Field EMS_Fields_UBAMonitorSlow[] PROGMEM = {
+    EMS_FIELD(0, _EMS_Boiler, extTemp),
+    EMS_FIELD(2, _EMS_Boiler, boilTemp),
+    EMS_FIELD(9, _EMS_Boiler, pumpMod),
+    EMS_FIELD(10, _EMS_Boiler, burnStarts),
+    EMS_FIELD(13, _EMS_Boiler, burnWorkMin),
+    EMS_FIELD(19, _EMS_Boiler, heatWorkMin),
+    EMS_FIELD(25, _EMS_Boiler, switchTemp), // only if there is a mixer
+};
+
+void _process_UBAMonitorSlow(_EMS_RxTelegram * EMS_RxTelegram) {
+    _ems_decodeFields(EMS_RxTelegram, EMS_Fields_UBAMonitorSlow, ArraySize(EMS_Fields_UBAMonitorSlow), &EMS_Boiler);
+}
+
+/**
+ * UBAMonitorSlow2 - type 0xE5 - central heating monitor
+ */
+const _EMS_Field EMS_Fields_UBAMonitorSlow2[] PROGMEM = {
+    EMS_FIELD_BIT(2, 2, _EMS_Boiler, fanWork),
+    EMS_FIELD_BIT(2, 3, _EMS_Boiler, ignWork),
+    EMS_FIELD_BIT(2, 5, _EMS_Boiler, heatPmp),
+    EMS_FIELD_BIT(2, 7, _EMS_Boiler, wWCirc),
+    EMS_FIELD(10, _EMS_Boiler, burnStarts),
+    EMS_FIELD(13, _EMS_Boiler, burnWorkMin),
+    EMS_FIELD(19, _EMS_Boiler, heatWorkMin),
+    EMS_FIELD(25, _EMS_Boiler, pumpMod), // or is it switchTemp ?
+};
+
+void _process_UBAMonitorSlow2(_EMS_RxTelegram * EMS_RxTelegram) {
+    _ems_decodeFields(EMS_RxTelegram, EMS_Fields_UBAMonitorSlow2, ArraySize(EMS_Fields_UBAMonitorSlow2), &EMS_Boiler);
+}
+
+/**
+ * UBAOutdoorTemp - type 0xD1 - external temperature
+ */
+const _EMS_Field EMS_Fields_UBAOutdoorTemp[] PROGMEM = {
+    EMS_FIELD(0, _EMS_Boiler, extTemp),
+};
+
+void _process_UBAOutdoorTemp(_EMS_RxTelegram * EMS_RxTelegram) {
+    _ems_decodeFields(EMS_RxTelegram, EMS_Fields_UBAOutdoorTemp, ArraySize(EMS_Fields_UBAOutdoorTemp), &EMS_Boiler);
+}
+
+/**
+ * type 0xB1 - data from the RC10 thermostat (0x17)
+ * For reading the temp values only
+ * received every 60 seconds
+ * e.g. 17 0B 91 00 80 1E 00 CB 27 00 00 00 00 05 01 00 CB 00 (CRC=47), #data=14
+ */
+const _EMS_Field EMS_Fields_RC10StatusMessage[] PROGMEM = {
+    EMS_FIELD_BYTE16(EMS_OFFSET_RC10StatusMessage_setpoint, _EMS_Thermostat_HC, setpoint_roomTemp), // is * 2, force as single byte
+    EMS_FIELD(EMS_OFFSET_RC10StatusMessage_curr, _EMS_Thermostat_HC, curr_roomTemp),                    // is * 10
+};
+
+void _process_RC10StatusMessage(_EMS_RxTelegram * EMS_RxTelegram) {
+    uint8_t hc                   = EMS_THERMOSTAT_DEFAULTHC - 1; // use HC1
+    EMS_Thermostat.hc[hc].active = true;
+
+    _ems_decodeFields(EMS_RxTelegram, EMS_Fields_RC10StatusMessage, ArraySize(EMS_Fields_RC10StatusMessage), &EMS_Thermostat.hc[hc]);
+}
+
+/**
+ * type 0x91 - data from the RC20 thermostat (0x17) - 15 bytes long
+ * For reading the temp values only
+ * received every 60 seconds
+ */
+const _EMS_Field EMS_Fields_RC20StatusMessage[] PROGMEM = {
+    EMS_FIELD_BYTE16(EMS_OFFSET_RC20StatusMessage_setpoint, _EMS_Thermostat_HC, setpoint_roomTemp), // is * 2, force as single byte
+    EMS_FIELD(EMS_OFFSET_RC20StatusMessage_curr, _EMS_Thermostat_HC, curr_roomTemp),                    // is * 10
+};
+
+void _process_RC20StatusMessage(_EMS_RxTelegram * EMS_RxTelegram) {
+    uint8_t hc                   = EMS_THERMOSTAT_DEFAULTHC - 1; // use HC1
+    EMS_Thermostat.hc[hc].active = true;
+
+    _ems_decodeFields(EMS_RxTelegram, EMS_Fields_RC20StatusMessage, ArraySize(EMS_Fields_RC20StatusMessage), &EMS_Thermostat.hc[hc]);
+}
+
+/**
+ * type 0x41 - data from the RC30 thermostat(0x10) - 14 bytes long
+ * For reading the temp values only * received every 60 seconds 
+*/
+const _EMS_Field EMS_Fields_RC30StatusMessage[] PROGMEM = {
+    EMS_FIELD_BYTE16(EMS_OFFSET_RC30StatusMessage_setpoint, _EMS_Thermostat_HC, setpoint_roomTemp), // is * 2, force as single byte
+    EMS_FIELD(EMS_OFFSET_RC30StatusMessage_curr, _EMS_Thermostat_HC, curr_roomTemp),
+};
+
+void _process_RC30StatusMessage(_EMS_RxTelegram * EMS_RxTelegram) {
+    uint8_t hc                   = EMS_THERMOSTAT_DEFAULTHC - 1; // use HC1
+    EMS_Thermostat.hc[hc].active = true;
+
+    _ems_decodeFields(EMS_RxTelegram, EMS_Fields_RC30StatusMessage, ArraySize(EMS_Fields_RC30StatusMessage), &EMS_Thermostat.hc[hc]);
+}
+
+/**
+ * type 0x3E (HC1), 0x48 (HC2), 0x52 (HC3), 0x5C (HC4) - HK1MonitorMessage - data from the RC35 thermostat (0x10) - 16 bytes
+ * examples:
+ * broadcasts when manually setting HC2 to 14 degrees:
+ * 10 00 3E 00   04 03 00 7D 00 00 00 00 00 00 00 00 00 11 05 00
+ * 10 00 48 00   04 13 1C 00 E4 00 00 00 00 00 00 00 64 11 0F 00
+ * 
+ * 10 00 3E 00   80 02 1A 7D 00 00 00 00 00 00 00 00 64 11 16 00
+ *
+ * 10 0B 3E 00   00 00 00 7D 00 00 00 00 00 00 00 00 00 11 05 04
+ * 10 00 48 00   00 00 00 00 E4 00 00 00 00 00 00 00 00 11 05 04
+ * 10 0B 52 00   00 00 00 00 00 00 00 00 00 00 00 00 00 11 00 00
+ * 10 0B 5C 00   00 00 00 00 00 00 00 00 00 00 00 00 00 11 00 00
+ * 
+ * night mode:
+ * 10 00 3E 00   04 03 00 7D 00 00 00 00 00 00 00 00 00 11 05 00
+ * 10 00 48 00   00 00 10 00 E9 00 00 00 00 00 00 00 00 11 05 00
+ * 
+ * day mode:
+ * 10 0B 3E 00   04 03 00 7D 00 00 00 00 00 00 00 00 00 11 05 00
+ * 10 0B 48 00   00 00 10 00 E8 00 00 00 00 00 00 00 00 11 05 00
+ * 
+ * auto day:
+ * 10 00 3E 00   04 03 00 7D 00 00 00 00 00 00 00 00 00 11 05 00
+ * 10 0B 48 00   04 03 00 00 EB 00 00 00 00 00 00 00 00 11 05 00
+ * 
+ * For reading the current room temperature only and picking up the modes
+ * received every 60 seconds
+ */
+const _EMS_Field EMS_Fields_RC35StatusMessage[] PROGMEM = {
+    EMS_FIELD_BIT(EMS_OFFSET_RC35StatusMessage_mode1, 5, _EMS_Thermostat_HC, holiday_mode),
+    EMS_FIELD_BIT(EMS_OFFSET_RC35StatusMessage_mode, 1, _EMS_Thermostat_HC, day_mode),
+    EMS_FIELD_BIT(EMS_OFFSET_RC35StatusMessage_mode, 0, _EMS_Thermostat_HC, summer_mode),
+    EMS_FIELD(EMS_OFFSET_RC35StatusMessage_curr, _EMS_Thermostat_HC, curr_roomTemp), // is * 10
+    EMS_FIELD(EMS_OFFSET_RC35Set_circuitcalctemp, _EMS_Thermostat_HC, circuitcalctemp),
+};
+
+const _EMS_Field EMS_Fields_RC35StatusMessage_setpoint[] PROGMEM = {
+    EMS_FIELD_BYTE16(EMS_OFFSET_RC35StatusMessage_setpoint, _EMS_Thermostat_HC, setpoint_roomTemp), // is * 2, force to single byte
+};
+
+void _process_RC35StatusMessage(_EMS_RxTelegram * EMS_RxTelegram) {
+    // exit if...
+    // - the 15th byte (second from last) is 0x00, which I think is flow temp, means HC is not is use
+    // - its not a broadcast, so destination is 0x00
+    if ((EMS_RxTelegram->data[14] == 0x00) || (EMS_RxTelegram->dest != EMS_ID_NONE)) {
+        return;
+    }
+
+    uint8_t hc_num = _getHeatingCircuit(EMS_RxTelegram); // which HC is it, 0-3
+
+    // ignore if the value is 0 (see https://github.com/proddy/EMS-ESP/commit/ccc30738c00f12ae6c89177113bd15af9826b836)
+    if (EMS_RxTelegram->data[EMS_OFFSET_RC35StatusMessage_setpoint] != 0x00) {
+        _ems_decodeFields(EMS_RxTelegram,
+                          EMS_Fields_RC35StatusMessage_setpoint,
+                          ArraySize(EMS_Fields_RC35StatusMessage_setpoint),
+                          &EMS_Thermostat.hc[hc_num]);
+    }
+
+    // ignore if the value is unset. Hopefully it will be picked up via a later message
+    _ems_decodeFields(EMS_RxTelegram, EMS_Fields_RC35StatusMessage, ArraySize(EMS_Fields_RC35StatusMessage), &EMS_Thermostat.hc[hc_num]);
+}
+
+/**
+ * type 0x0A - data from the Nefit Easy/TC100 thermostat (0x18) - 31 bytes long
+ * The Easy has a digital precision of its floats to 2 decimal places, so values must be divided by 100
+ */
+const _EMS_Field EMS_Fields_EasyStatusMessage[] PROGMEM = {
+    EMS_FIELD(EMS_OFFSET_EasyStatusMessage_curr, _EMS_Thermostat_HC, curr_roomTemp),         // is * 100
+    EMS_FIELD(EMS_OFFSET_EasyStatusMessage_setpoint, _EMS_Thermostat_HC, setpoint_roomTemp), // is * 100
+};
+
+void _process_EasyStatusMessage(_EMS_RxTelegram * EMS_RxTelegram) {
+    uint8_t hc                   = EMS_THERMOSTAT_DEFAULTHC - 1; // use HC1
+    EMS_Thermostat.hc[hc].active = true;
+
+    _ems_decodeFields(EMS_RxTelegram, EMS_Fields_EasyStatusMessage, ArraySize(EMS_Fields_EasyStatusMessage), &EMS_Thermostat.hc[hc]);
+}
+
+const _EMS_Field EMS_Fields_MMPLUSStatusMessage[] PROGMEM = {
+    EMS_FIELD(EMS_OFFSET_MMPLUSStatusMessage_valve_status, _EMS_Mixing_HC, valveStatus),
+    EMS_FIELD(EMS_OFFSET_MMPLUSStatusMessage_flow_temp, _EMS_Mixing_HC, flowTemp),
+    EMS_FIELD(EMS_OFFSET_MMPLUSStatusMessage_pump_mod, _EMS_Mixing_HC, pumpMod),
+};
+
+void _process_MMPLUSStatusMessage(_EMS_RxTelegram * EMS_RxTelegram) {
+    uint8_t hc = (EMS_RxTelegram->type - EMS_TYPE_MMPLUSStatusMessage_HC1); // 0 to 3
+    if (hc >= EMS_THERMOSTAT_MAXHC) {
+        return; // invalid type
+    }
+    EMS_Mixing.hc[hc].active = true;
+
+    _ems_decodeFields(EMS_RxTelegram, EMS_Fields_MMPLUSStatusMessage, ArraySize(EMS_Fields_MMPLUSStatusMessage), &EMS_Mixing.hc[hc]);
+}
+
+/**
+ * type 0x01A5 - data from the Nefit RC1010/3000 thermostat (0x18) and RC300/310s on 0x10
+ * EMS+ messages may come in with different offsets so handle them here
+ */
+const _EMS_Field EMS_Fields_RCPLUSStatusMessage[] PROGMEM = {
+    EMS_FIELD(EMS_OFFSET_RCPLUSStatusMessage_curr, _EMS_Thermostat_HC, curr_roomTemp),              // value is * 10
+    EMS_FIELD_BYTE16(EMS_OFFSET_RCPLUSStatusMessage_setpoint, _EMS_Thermostat_HC, setpoint_roomTemp), // convert to single byte, value is * 2
+    EMS_FIELD_BIT(EMS_OFFSET_RCPLUSStatusMessage_mode, 1, _EMS_Thermostat_HC, day_mode),
+    EMS_FIELD_BIT(EMS_OFFSET_RCPLUSStatusMessage_mode, 0, _EMS_Thermostat_HC, mode), // bit 1, mode (auto=1 or manual=0)
+};
+
+// single values, always at data[0]
+const _EMS_Field EMS_Fields_RCPLUSStatusMessage_curr[] PROGMEM = {
+    EMS_FIELD(0, _EMS_Thermostat_HC, curr_roomTemp), // value is * 10
+};
+
+const _EMS_Field EMS_Fields_RCPLUSStatusMessage_mode[] PROGMEM = {
+    EMS_FIELD_BIT(0, 0, _EMS_Thermostat_HC, mode),     // bit 1, mode (auto=1 or manual=0). Note this may be bit 2 - still need to validate
+    EMS_FIELD_BIT(0, 1, _EMS_Thermostat_HC, day_mode), // get day mode flag
+};
+
+void _process_RCPLUSStatusMessage(_EMS_RxTelegram * EMS_RxTelegram) {
+    // figure out which heating circuit
+    uint8_t hc = (EMS_RxTelegram->type - EMS_TYPE_RCPLUSStatusMessage_HC1); // 0 to 3
+    if (hc >= EMS_THERMOSTAT_MAXHC) {
+        return; // invalid type
+    }
+    EMS_Thermostat.hc[hc].active = true;
+
+    // handle single data values. data will always be at position data[0]
+    if (EMS_RxTelegram->data_length == 1) {
+        switch (EMS_RxTelegram->offset) {
+        case EMS_OFFSET_RCPLUSStatusMessage_curr: // setpoint target temp
+            _ems_decodeFields(EMS_RxTelegram, EMS_Fields_RCPLUSStatusMessage_curr, ArraySize(EMS_Fields_RCPLUSStatusMessage_curr), &EMS_Thermostat.hc[hc]);
+            break;
+        case EMS_OFFSET_RCPLUSStatusMessage_setpoint:                          // current target temp
+            EMS_Thermostat.hc[hc].setpoint_roomTemp = EMS_RxTelegram->data[0]; // convert to single byte, value is * 2
+            break;
+        case EMS_OFFSET_RCPLUSStatusMessage_currsetpoint:                      // current setpoint temp,  e.g. Thermostat -> all, telegram: 10 00 FF 06 01 A5 22
+            EMS_Thermostat.hc[hc].setpoint_roomTemp = EMS_RxTelegram->data[0]; // convert to single byte, value is * 2
+            break;
+        case EMS_OFFSET_RCPLUSStatusMessage_mode: // thermostat mode auto/manual
+                                                  // manual : 10 00 FF 0A 01 A5 02
+                                                  // auto :   10 00 FF 0A 01 A5 03
+            _ems_decodeFields(EMS_RxTelegram, EMS_Fields_RCPLUSStatusMessage_mode, ArraySize(EMS_Fields_RCPLUSStatusMessage_mode), &EMS_Thermostat.hc[hc]);
+            break;
+        }
+    } else if (EMS_RxTelegram->data_length > 20) {
+        // the whole telegram
+        // e.g. Thermostat -> all, telegram: 10 00 FF 00 01 A5 00 D7 21 00 00 00 00 30 01 84 01 01 03 01 84 01 F1 00 00 11 01 00 08 63 00
+        //                                   10 00 FF 00 01 A5 80 00 01 30 28 00 30 28 01 54 03 03 01 01 54 02 A8 00 00 11 01 03 FF FF 00
+        _ems_decodeFields(EMS_RxTelegram, EMS_Fields_RCPLUSStatusMessage, ArraySize(EMS_Fields_RCPLUSStatusMessage), &EMS_Thermostat.hc[hc]);
+    }
+}
+
+/**
+ * type 0x01AF - summer/winter mode from the Nefit RC1010 thermostat (0x18) and RC300/310s on 0x10
+ */
+void _process_RCPLUSStatusMode(_EMS_RxTelegram * EMS_RxTelegram) {
+    // data[0] // 0x00=OFF 0x01=Automatic 0x02=Forced
+}
+
+/**
+ * FR10/FR50/FR100 Junkers - type x006F
+ *    e.g. for FR10:  90 00 FF 00 00 6F   03 01 00 BE 00 BF
+ *         for FW100: 90 00 FF 00 00 6F   03 02 00 D7 00 DA F3 34 00 C4
+ */
+const _EMS_Field EMS_Fields_JunkersStatusMessage[] PROGMEM = {
+    EMS_FIELD(EMS_OFFSET_JunkersStatusMessage_daymode, _EMS_Thermostat_HC, day_mode),           // 3 = day, 2 = night
+    EMS_FIELD(EMS_OFFSET_JunkersStatusMessage_mode, _EMS_Thermostat_HC, mode),                  // 1 = manual, 2 = auto
+    EMS_FIELD(EMS_OFFSET_JunkersStatusMessage_setpoint, _EMS_Thermostat_HC, setpoint_roomTemp), // value is * 10
+    EMS_FIELD(EMS_OFFSET_JunkersStatusMessage_curr, _EMS_Thermostat_HC, curr_roomTemp),         // value is * 10
+};
+
+void _process_JunkersStatusMessage(_EMS_RxTelegram * EMS_RxTelegram) {
+    if (EMS_RxTelegram->offset == 0 && EMS_RxTelegram->data_length > 1) {
+        uint8_t hc                   = EMS_THERMOSTAT_DEFAULTHC - 1; // use HC1
+        EMS_Thermostat.hc[hc].active = true;
+
+        _ems_decodeFields(EMS_RxTelegram, EMS_Fields_JunkersStatusMessage, ArraySize(EMS_Fields_JunkersStatusMessage), &EMS_Thermostat.hc[hc]);
+    }
+}
+
+/**
+ * type 0x01B9 EMS+ for reading the mode from RC300/RC310 thermostat
+ */
+const _EMS_Field EMS_Fields_RCPLUSSetMessage[] PROGMEM = {
+    EMS_FIELD(EMS_OFFSET_RCPLUSSet_mode, _EMS_Thermostat_HC, mode),
+    EMS_FIELD(EMS_OFFSET_RCPLUSSet_temp_comfort2, _EMS_Thermostat_HC, daytemp), // is * 2
+    EMS_FIELD(EMS_OFFSET_RCPLUSSet_temp_eco, _EMS_Thermostat_HC, nighttemp),    // is * 2
+};
+
+const _EMS_Field EMS_Fields_RCPLUSSetMessage_setpoint[] PROGMEM = {
+    EMS_FIELD_BYTE16(0, _EMS_Thermostat_HC, setpoint_roomTemp), // single byte conversion, value is * 2
+};
+
+void _process_RCPLUSSetMessage(_EMS_RxTelegram * EMS_RxTelegram) {
+    // ignore F7 and F9
+    if (EMS_RxTelegram->emsplus_type != 0xFF) {
+        return;
+    }
+
+    uint8_t hc                   = EMS_THERMOSTAT_DEFAULTHC - 1; // use HC1
+    EMS_Thermostat.hc[hc].active = true;
+
+    // check for one data value
+    // but ignore values of 0xFF, e.g.  10 00 FF 08 01 B9 FF
+    if ((EMS_RxTelegram->data_length == 1) && (EMS_RxTelegram->data[0] != 0xFF)) {
+        // check for setpoint temps, e.g. Thermostat -> all, type 0x01B9, telegram: 10 00 FF 08 01 B9 26
+        if ((EMS_RxTelegram->offset == EMS_OFFSET_RCPLUSSet_temp_setpoint) || (EMS_RxTelegram->offset == EMS_OFFSET_RCPLUSSet_manual_setpoint)) {
+            _ems_decodeFields(EMS_RxTelegram,
+                              EMS_Fields_RCPLUSSetMessage_setpoint,
+                              ArraySize(EMS_Fields_RCPLUSSetMessage_setpoint),
+                              &EMS_Thermostat.hc[hc]);
+        } else if (EMS_RxTelegram->offset == EMS_OFFSET_RCPLUSSet_mode) {
+            // check for mode, eg.  10 00 FF 08 01 B9 FF
+            EMS_Thermostat.hc[hc].mode = (EMS_RxTelegram->data[0] == 0xFF); // Auto = xFF, Manual = x00   (auto=1 or manual=0)
+        }
+        return; // quit
+    }
+
+    // check for long broadcasts
+    if (EMS_RxTelegram->offset == 0) {
+        _ems_decodeFields(EMS_RxTelegram, EMS_Fields_RCPLUSSetMessage, ArraySize(EMS_Fields_RCPLUSSetMessage), &EMS_Thermostat.hc[hc]);
+    }
+}
+
+/**
+ * type 0xB0 - for reading the mode from the RC10 thermostat (0x17)
+ * received only after requested
+ */
+void _process_RC10Set(_EMS_RxTelegram * EMS_RxTelegram) {
+    // mode not implemented yet
+}
+
+/**
+ * type 0xA8 - for reading the mode from the RC20 thermostat (0x17)
+ * received only after requested
+ */
+const _EMS_Field EMS_Fields_RC20Set[] PROGMEM = {
+    EMS_FIELD(EMS_OFFSET_RC20Set_mode, _EMS_Thermostat_HC, mode), // note, fixed for HC1
+};
+
+void _process_RC20Set(_EMS_RxTelegram * EMS_RxTelegram) {
+    uint8_t hc                   = EMS_THERMOSTAT_DEFAULTHC - 1; // use HC1
+    EMS_Thermostat.hc[hc].active = true;
+    _ems_decodeFields(EMS_RxTelegram, EMS_Fields_RC20Set, ArraySize(EMS_Fields_RC20Set), &EMS_Thermostat.hc[hc]);
+}
+
+/**
+ * type 0xA7 - for reading the mode from the RC30 thermostat (0x10)
+ * received only after requested
+ */
+const _EMS_Field EMS_Fields_RC30Set[] PROGMEM = {
+    EMS_FIELD(EMS_OFFSET_RC30Set_mode, _EMS_Thermostat_HC, mode), // note, fixed for HC1
+};
+
+void _process_RC30Set(_EMS_RxTelegram * EMS_RxTelegram) {
+    uint8_t hc                   = EMS_THERMOSTAT_DEFAULTHC - 1; // use HC1
+    EMS_Thermostat.hc[hc].active = true;
+    _ems_decodeFields(EMS_RxTelegram, EMS_Fields_RC30Set, ArraySize(EMS_Fields_RC30Set), &EMS_Thermostat.hc[hc]);
+}
+
+// return which heating circuit it is, 0-3 for HC1 to HC4
+// based on type 0x3E (HC1), 0x48 (HC2), 0x52 (HC3), 0x5C (HC4)
+uint8_t _getHeatingCircuit(_EMS_RxTelegram * EMS_RxTelegram) {
+    uint8_t hc_num;
+    switch (EMS_RxTelegram->type) {
+    case EMS_TYPE_RC35StatusMessage_HC1:
+    case EMS_TYPE_RC35Set_HC1:
+    default:
+        hc_num = 1; // also default
+        break;
+    case EMS_TYPE_RC35StatusMessage_HC2:
+    case EMS_TYPE_RC35Set_HC2:
+        hc_num = 2;
+        break;
+    case EMS_TYPE_RC35StatusMessage_HC3:
+    case EMS_TYPE_RC35Set_HC3:
+        hc_num = 3;
+        break;
+    case EMS_TYPE_RC35StatusMessage_HC4:
     case EMS_TYPE_RC35Set_HC4:
         hc_num = 4;
         break;
     }
 
-    hc_num--;
-    EMS_Thermostat.hc[hc_num].active = true;
+    hc_num--;
+    EMS_Thermostat.hc[hc_num].active = true;
+
+    return (hc_num);
+}
+
+/**
+ * type 0x3D (HC1), 0x47 (HC2), 0x51 (HC3), 0x5B (HC4) - Working Mode Heating - for reading the mode from the RC35 thermostat (0x10)
+ * received only after requested
+ * 10 0B 47 00  03 13 15 26 0A 28 00 02 00 05 05 2D 01 01 04 4B 05 4B 01 00 3C FF 0D 05 05 02 02
+ * 10 0B 3D 00  01 2B 39 26 00 28 00 02 00 05 05 2D 01 01 04 3C 06 39 01 00 3C FF 0D 05 05 03 00
+ * 10 0B 51 00  00 13 15 26 00 28 00 02 00 05 05 2D 01 01 04 4B 05 4B 01 00 3C FF 11 05 05 03 02
+ * 10 0B 5B 00  00 13 15 26 00 28 00 02 00 05 05 2D 01 01 04 4B 05 4B 01 00 3C FF 11 05 05 03 02
+ */
+const _EMS_Field EMS_Fields_RC35Set[] PROGMEM = {
+    EMS_FIELD(EMS_OFFSET_RC35Set_heatingtype, _EMS_Thermostat_HC, heatingtype),  // byte 0 bit floor heating = 3
+    EMS_FIELD(EMS_OFFSET_RC35Set_temp_night, _EMS_Thermostat_HC, nighttemp),     // is * 2
+    EMS_FIELD(EMS_OFFSET_RC35Set_temp_day, _EMS_Thermostat_HC, daytemp),         // is * 2
+    EMS_FIELD(EMS_OFFSET_RC35Set_temp_holiday, _EMS_Thermostat_HC, holidaytemp), // is * 2
+    EMS_FIELD(EMS_OFFSET_RC35Set_mode, _EMS_Thermostat_HC, mode),                // night, day, auto
+};
+
+void _process_RC35Set(_EMS_RxTelegram * EMS_RxTelegram) {
+    // check to see we have a valid type
+    // heating: 1 radiator, 2 convectors, 3 floors, 4 room supply
+    if (EMS_RxTelegram->data[0] == 0x00) {
+        return;
+    }
+
+    uint8_t hc_num = _getHeatingCircuit(EMS_RxTelegram); // which HC is it?
+
+    _ems_decodeFields(EMS_RxTelegram, EMS_Fields_RC35Set, ArraySize(EMS_Fields_RC35Set), &EMS_Thermostat.hc[hc_num]);
+}
+
+/**
+ * type 0xA3 - for external temp settings from the the RC* thermostats
+ */
+void _process_RCOutdoorTempMessage(_EMS_RxTelegram * EMS_RxTelegram) {
+    // add support here if you're reading external sensors
+}
+
+/*
+ * SM10Monitor - type 0x97
+ */
+const _EMS_Field EMS_Fields_SM10Monitor[] PROGMEM = {
+    EMS_FIELD(2, _EMS_SolarModule, collectorTemp),  // collector temp from SM10, is *10
+    EMS_FIELD(4, _EMS_SolarModule, pumpModulation), // modulation solar pump
+    EMS_FIELD(5, _EMS_SolarModule, bottomTemp),     // bottom temp from SM10, is *10
+    EMS_FIELD_BIT(7, 1, _EMS_SolarModule, pump),    // active if bit 1 is set
+};
+
+void _process_SM10Monitor(_EMS_RxTelegram * EMS_RxTelegram) {
+    _ems_decodeFields(EMS_RxTelegram, EMS_Fields_SM10Monitor, ArraySize(EMS_Fields_SM10Monitor), &EMS_SolarModule);
+}
+
+/*
+ * SM100Monitor - type 0x0262 EMS+
+ * e.g, 30 00 FF 00 02 62 01 AC
+ *      30 00 FF 18 02 62 80 00
+ *      30 00 FF 00 02 62 01 A1 - for bottom temps
+ */
+const _EMS_Field EMS_Fields_SM100Monitor[] PROGMEM = {
+    EMS_FIELD(0, _EMS_SolarModule, collectorTemp), // is *10
+    EMS_FIELD(2, _EMS_SolarModule, bottomTemp),    // is *10
+};
+
+void _process_SM100Monitor(_EMS_RxTelegram * EMS_RxTelegram) {
+    // only process the complete telegram, not partial
+    if (EMS_RxTelegram->offset) {
+        return;
+    }
+
+    _ems_decodeFields(EMS_RxTelegram, EMS_Fields_SM100Monitor, ArraySize(EMS_Fields_SM100Monitor), &EMS_SolarModule);
+}
+
+/*
+ * SM100Status - type 0x0264 EMS+ for pump modulation
+ * e.g. 30 00 FF 09 02 64 64 = 100%
+ *      30 00 FF 09 02 64 1E = 30%
+ */
+const _EMS_Field EMS_Fields_SM100Status[] PROGMEM = {
+    EMS_FIELD(9, _EMS_SolarModule, pumpModulation), // complete telegram
+};
+
+const _EMS_Field EMS_Fields_SM100Status_offset9[] PROGMEM = {
+    EMS_FIELD(0, _EMS_SolarModule, pumpModulation), // data at offset 09
+};
+
+void _process_SM100Status(_EMS_RxTelegram * EMS_RxTelegram) {
+    if (EMS_RxTelegram->offset == 0) {
+        _ems_decodeFields(EMS_RxTelegram, EMS_Fields_SM100Status, ArraySize(EMS_Fields_SM100Status), &EMS_SolarModule);
+    } else if (EMS_RxTelegram->offset == 0x09) {
+        _ems_decodeFields(EMS_RxTelegram, EMS_Fields_SM100Status_offset9, ArraySize(EMS_Fields_SM100Status_offset9), &EMS_SolarModule);
+    }
+}
+
+/*
+ * SM100Status2 - type 0x026A EMS+ for pump on/off at offset 0x0A
+ */
+const _EMS_Field EMS_Fields_SM100Status2[] PROGMEM = {
+    EMS_FIELD_BIT(10, 2, _EMS_SolarModule, pump), // 03=off 04=on
+};
+
+const _EMS_Field EMS_Fields_SM100Status2_offset10[] PROGMEM = {
+    EMS_FIELD_BIT(0, 2, _EMS_SolarModule, pump), // 03=off 04=on at offset 0A
+};
+
+void _process_SM100Status2(_EMS_RxTelegram * EMS_RxTelegram) {
+    if (EMS_RxTelegram->offset == 0) {
+        _ems_decodeFields(EMS_RxTelegram, EMS_Fields_SM100Status2, ArraySize(EMS_Fields_SM100Status2), &EMS_SolarModule);
+    } else if (EMS_RxTelegram->offset == 0x0A) {
+        _ems_decodeFields(EMS_RxTelegram, EMS_Fields_SM100Status2_offset10, ArraySize(EMS_Fields_SM100Status2_offset10), &EMS_SolarModule);
+    }
+}
+
+/*
+ * SM100Energy - type 0x028E EMS+ for energy readings
+ * e.g. 30 00 FF 00 02 8E 00 00 00 00 00 00 06 C5 00 00 76 35
+ */
+const _EMS_Field EMS_Fields_SM100Energy[] PROGMEM = {
+    EMS_FIELD(2, _EMS_SolarModule, EnergyLastHour), // last hour / 10 in Wh
+    EMS_FIELD(6, _EMS_SolarModule, EnergyToday),    //  todays in Wh
+    EMS_FIELD(10, _EMS_SolarModule, EnergyTotal),   //  total / 10 in kWh
+};
+
+void _process_SM100Energy(_EMS_RxTelegram * EMS_RxTelegram) {
+    _ems_decodeFields(EMS_RxTelegram, EMS_Fields_SM100Energy, ArraySize(EMS_Fields_SM100Energy), &EMS_SolarModule);
+}
+
+/*
+ * Type 0xE3 - HeatPump Monitor 1
+ */
+const _EMS_Field EMS_Fields_HPMonitor1[] PROGMEM = {
+    EMS_FIELD(13, _EMS_HeatPump, HPModulation), // %
+};
+
+void _process_HPMonitor1(_EMS_RxTelegram * EMS_RxTelegram) {
+    _ems_decodeFields(EMS_RxTelegram, EMS_Fields_HPMonitor1, ArraySize(EMS_Fields_HPMonitor1), &EMS_HeatPump);
+}
+
+/*
+ * Type 0xE5 - HeatPump Monitor 2
+ */
+const _EMS_Field EMS_Fields_HPMonitor2[] PROGMEM = {
+    EMS_FIELD(25, _EMS_HeatPump, HPSpeed), // %
+};
+
+void _process_HPMonitor2(_EMS_RxTelegram * EMS_RxTelegram) {
+    _ems_decodeFields(EMS_RxTelegram, EMS_Fields_HPMonitor2, ArraySize(EMS_Fields_HPMonitor2), &EMS_HeatPump);
+}
+
+/*
+ * Junkers ISM1 Solar Module - type 0x0003 EMS+ for energy readings
+ *  e.g. B0 00 FF 00 00 03 32 00 00 00 00 13 00 D6 00 00 00 FB D0 F0
+ */
+const _EMS_Field EMS_Fields_ISM1StatusMessage[] PROGMEM = {
+    EMS_FIELD(2, _EMS_SolarModule, EnergyLastHour), // Solar Energy produced in last hour - is * 10 and handled in ems-esp.cpp
+    EMS_FIELD(4, _EMS_SolarModule, collectorTemp),  // Collector Temperature
+    EMS_FIELD(6, _EMS_SolarModule, bottomTemp),     // Temperature Bottom of Solar Boiler
+    EMS_FIELD_BIT(8, 0, _EMS_SolarModule, pump),    // Solar pump on (1) or off (0)
+    EMS_FIELD(10, _EMS_SolarModule, pumpWorkMin),
+};
+
+const _EMS_Field EMS_Fields_ISM1StatusMessage_offset4[] PROGMEM = {
+    EMS_FIELD(0, _EMS_SolarModule, collectorTemp), // Collector Temperature
+};
+
+void _process_ISM1StatusMessage(_EMS_RxTelegram * EMS_RxTelegram) {
+    if (EMS_RxTelegram->offset == 0) {
+        _ems_decodeFields(EMS_RxTelegram, EMS_Fields_ISM1StatusMessage, ArraySize(EMS_Fields_ISM1StatusMessage), &EMS_SolarModule);
+    }
+
+    if (EMS_RxTelegram->offset == 4) {
+        // e.g. B0 00 FF 04 00 03 02 E5
+        _ems_decodeFields(EMS_RxTelegram, EMS_Fields_ISM1StatusMessage_offset4, ArraySize(EMS_Fields_ISM1StatusMessage_offset4), &EMS_SolarModule);
+    }
+}
+
+
+/*
+ * Junkers ISM1 Solar Module - type 0x0001 EMS+ for setting values
+ */
+void _process_ISM1Set(_EMS_RxTelegram * EMS_RxTelegram) {
+    if (EMS_RxTelegram->offset == 6) {
+        // e.g. 90 30 FF 06 00 01 50 (CRC=2C)
+        // to implement: change max solar boiler temperature
+        EMS_SolarModule.setpoint_maxBottomTemp = EMS_RxTelegram->data[0];
+    }
+}
+
+/**
+ * UBASetPoint 0x1A
+ */
+void _process_SetPoints(_EMS_RxTelegram * EMS_RxTelegram) {
+    if (EMS_Sys_Status.emsLogging == EMS_SYS_LOGGING_VERBOSE) {
+        if (EMS_RxTelegram->data_length) {
+            uint8_t setpoint = EMS_RxTelegram->data[0]; // flow temp
+            //uint8_t ww_power = data[2]; // power in %
+
+            /* use this logic if the value is *2
+            char s[5];
+            char s2[5];
+            strlcpy(s, itoa(setpoint >> 1, s2, 10), 5);
+            strlcat(s, ".", sizeof(s));
+            strlcat(s, ((setpoint & 0x01) ? "5" : "0"), 5);
+            myDebug_P(PSTR(" Boiler flow temp %s C, Warm Water power %d %"), s, ww_power);
+            */
+
+            myDebug_P(PSTR(" Boiler flow temperature is %d C"), setpoint);
+        }
+    }
+}
+
+/**
+ * process_RCTime - type 0x06 - date and time from a thermostat - 14 bytes long
+ * common for all thermostats
+ */
+void _process_RCTime(_EMS_RxTelegram * EMS_RxTelegram) {
+    if ((EMS_Thermostat.device_flags == EMS_DEVICE_FLAG_EASY)) {
+        return; // not supported
+    }
+
+    // render time to HH:MM:SS DD/MM/YYYY
+    char time_sp[25];
+    char buffer[4];
+
+    strlcpy(time_sp, _smallitoa(EMS_RxTelegram->data[2], buffer), sizeof(time_sp)); // hour
+    strlcat(time_sp, ":", sizeof(time_sp));
+    strlcat(time_sp, _smallitoa(EMS_RxTelegram->data[4], buffer), sizeof(time_sp)); // minute
+    strlcat(time_sp, ":", sizeof(time_sp));
+    strlcat(time_sp, _smallitoa(EMS_RxTelegram->data[5], buffer), sizeof(time_sp)); // second
+    strlcat(time_sp, " ", sizeof(time_sp));
+    strlcat(time_sp, _smallitoa(EMS_RxTelegram->data[3], buffer), sizeof(time_sp)); // day
+    strlcat(time_sp, "/", sizeof(time_sp));
+    strlcat(time_sp, _smallitoa(EMS_RxTelegram->data[1], buffer), sizeof(time_sp)); // month
+    strlcat(time_sp, "/", sizeof(time_sp));
+    strlcat(time_sp, itoa(EMS_RxTelegram->data[0] + 2000, buffer, 10), sizeof(time_sp)); // year
+
+    strlcpy(EMS_Thermostat.datetime, time_sp, sizeof(time_sp)); // store
+}
+
+/**
+ * The detected devices. Each 7-bit device ID has its own slot in EMS_DeviceTable, with a bit in EMS_DevicePresent when
+ * it's taken, so a device is found without a search and the list is walked a byte of the bitmap at a time. A second
+ * product at an ID that's taken goes into EMS_DeviceShared. It's all static, so discovery adds nothing to the heap
+ */
+static _Detected_Device EMS_DeviceTable[EMS_DEVICE_SLOTS];
+static uint8_t          EMS_DevicePresent[EMS_DEVICE_SLOTS / 8];
+static _Detected_Device EMS_DeviceShared[EMS_DEVICE_SHARED];
+static uint8_t          EMS_DeviceShared_count = 0;
+static uint8_t          EMS_Device_count       = 0;
+
+/**
+ * the device at an ID, the first product if there's more than one. nullptr if there's none
+ */
+_Detected_Device * ems_getDevice(uint8_t device_id) {
+    device_id &= 0x7F;
+    return (EMS_DevicePresent[device_id >> 3] & (1 << (device_id & 0x07))) ? &EMS_DeviceTable[device_id] : nullptr;
+}
+
+/**
+ * the next device in the list, from i which starts at 0. They come by device ID, followed by the second products
+ * returns nullptr at the end
+ */
+_Detected_Device * ems_nextDevice(uint8_t * i) {
+    while (*i < EMS_DEVICE_SLOTS) {
+        uint8_t device_id = (*i)++;
+        uint8_t present   = EMS_DevicePresent[device_id >> 3];
+        if (!present) {
+            *i = (device_id | 0x07) + 1; // none in this byte
+        } else if (present & (1 << (device_id & 0x07))) {
+            return &EMS_DeviceTable[device_id];
+        }
+    }
+
+    uint8_t n = *i - EMS_DEVICE_SLOTS;
+    if (n < EMS_DeviceShared_count) {
+        (*i)++;
+        return &EMS_DeviceShared[n];
+    }
+    return nullptr;
+}
+
+uint8_t ems_getDeviceCount() {
+    return EMS_Device_count;
+}
+
+/*
+ * Clear devices list
+ */
+void ems_clearDeviceList() {
+    memset(EMS_DevicePresent, 0, sizeof(EMS_DevicePresent));
+    EMS_DeviceShared_count = 0;
+    EMS_Device_count       = 0;
+
+    for (uint8_t i = 0; i < EMS_SYS_DEVICEMAP_LENGTH; i++) {
+        EMS_Sys_Status.emsDeviceMap[i] = 0x00;
+    }
+}
+
+/*
+ * add an EMS device to our list of detected devices if its unique
+ * returns true if already in list, or if it's a second product at an ID and there's no room left for it
+ */
+bool _addDevice(_EMS_DEVICE_TYPE device_type, uint8_t product_id, uint8_t device_id, const char * device_desc_p, const char * version) {
+    _Detected_Device * device = ems_getDevice(device_id);
+
+    // check for duplicates
+    // a combi of product_id and device_id make it unique
+    if (device) {
+        if (device->product_id == product_id) {
+            return (true); // it already exists in the list, don't add
+        }
+        for (uint8_t i = 0; i < EMS_DeviceShared_count; i++) {
+            if ((EMS_DeviceShared[i].device_id == device_id) && (EMS_DeviceShared[i].product_id == product_id)) {
+                return (true);
+            }
+        }
+        // a second product at this ID, if there's room
+        if (EMS_DeviceShared_count >= EMS_DEVICE_SHARED) {
+            if (EMS_Sys_Status.emsLogging != EMS_SYS_LOGGING_NONE) {
+                myDebug_P(PSTR("** Warning, no room for product ID %d at device ID 0x%02X"), product_id, device_id);
+            }
+            return (true);
+        }
+        device = &EMS_DeviceShared[EMS_DeviceShared_count++];
+    } else {
+        uint8_t slot = device_id & 0x7F;
+        EMS_DevicePresent[slot >> 3] |= (1 << (slot & 0x07));
+        device = &EMS_DeviceTable[slot];
+    }
+
+    // create a new record
+    device->device_type   = device_type;
+    device->product_id    = product_id;
+    device->device_id     = device_id;
+    device->device_desc_p = device_desc_p; // pointer to the description in the EMS_Devices table
+    strlcpy(device->version, version, sizeof(device->version));
+    device->known = (device_type != EMS_DEVICE_TYPE_UNKNOWN);
+    EMS_Device_count++;
+
+    char line[500];
+    strlcpy(line, "New EMS device recognized as a ", sizeof(line));
+
+    // get type as a string, from the product as a second one at the ID can be of another type
+    // a product we don't know is described by its ID, unless it's a second one there
+    char type_s[50];
+    strlcpy(type_s, "?", sizeof(type_s));
+    if (device_type == EMS_DEVICE_TYPE_UNKNOWN) {
+        if ((device == &EMS_DeviceTable[device_id & 0x7F]) && !ems_getDeviceTypeDescription(device_id, type_s)) {
+            strlcpy(type_s, "?", sizeof(type_s));
+        }
+    } else {
+        for (uint8_t i = 0; i < _EMS_Devices_Types_max; i++) {
+            if (EMS_Devices_Types[i].device_type == device_type) {
+                strlcpy(type_s, EMS_Devices_Types[i].device_type_string, sizeof(type_s));
+                break;
+            }
+        }
+    }
+    strlcat(line, type_s, sizeof(line));
+
+    char tmp[6] = {0}; // for formatting numbers
+
+    if (device_desc_p != nullptr) {
+        strlcat(line, ": ", sizeof(line));
+        strlcat(line, device_desc_p, sizeof(line));
+    }
+
+    strlcat(line, " (DeviceID:0x", sizeof(line));
+    strlcat(line, _hextoa(device_id, tmp), sizeof(line));
+    strlcat(line, " ProductID:", sizeof(line));
+    strlcat(line, itoa(product_id, tmp, 10), sizeof(line));
+    strlcat(line, " Version:", sizeof(line));
+    strlcat(line, version, sizeof(line));
+    strlcat(line, ")", sizeof(line));
+
+    myDebug(line); // print it
+
+    return false; // added, wasn't a duplicate
+}
+
+/**
+ * type 0x07 - shows us the connected EMS devices
+ * e.g. 08 00 07 00 0B 80 00 00 00 00 00 00 00 00 00 00 00 (CRC=47) #data=13  
+ * Junkers is 15 (I think)
+ */
+void _process_UBADevices(_EMS_RxTelegram * EMS_RxTelegram) {
+    if (EMS_RxTelegram->data_length > EMS_SYS_DEVICEMAP_LENGTH) {
+        return; // should be 13 or 15 bytes long
+    }
+
+    EMS_Discovery.mapPending = false;
+
+    for (uint8_t data_byte = 0; data_byte < EMS_RxTelegram->data_length; data_byte++) {
+        uint8_t byte       = EMS_RxTelegram->data[data_byte];
+        uint8_t saved_byte = EMS_Sys_Status.emsDeviceMap[data_byte];
+
+        // see if this matches what we already have stored
+        if (byte != saved_byte) {
+            // we have something new
+            EMS_Sys_Status.emsDeviceMap[data_byte] = byte; // save new value
+            // go through all bits
+            // myDebug("Byte #%d 0x%02X", data_byte, byte); // for debugging
+            if (byte) {
+                for (uint8_t bit = 0; bit < 8; bit++) {
+                    if ((byte & 0x01) && ((saved_byte & 0x01) == 0)) {
+                        uint8_t device_id = ((data_byte + 1) * 8) + bit;
+                        if (device_id != EMS_ID_ME) {
+                            // myDebug("[EMS] Detected new EMS Device with ID 0x%02X", device_id);
+                            _ems_discoveryProbe(device_id); // get version, but ignore ourselves
+                        }
+                    }
+                    byte       = byte >> 1;
+                    saved_byte = saved_byte >> 1;
+                }
+            }
+        }
+    }
+
+    _ems_discoveryAnswered(EMS_ID_NONE, false); // done if there was nothing new
+}
+
+/**
+ * type 0x02 - get the version and type of an EMS device
+ * look up known devices via the product id and make it active if not already setup
+ */
+static void _ems_processVersion(_EMS_RxTelegram * EMS_RxTelegram) {
+    // ignore short messages that we can't interpret
+    if (EMS_RxTelegram->data_length < 3) {
+        return;
+    }
+
+    uint8_t offset = 0;
+
+    // check for 2nd subscriber
+    // e.g. 18 0B 02 00 00 00 00 5E 02 01
+    if (EMS_RxTelegram->data[0] == 0x00) {
+        // see if we have a 2nd subscriber
+        if (EMS_RxTelegram->data[3] != 0x00) {
+            offset = 3;
+        } else {
+            return; // ignore whole telegram
+        }
+    }
+
+    uint8_t device_id = EMS_RxTelegram->src; // device ID
+
+    // get version as XX.XX
+    char version[10] = {0};
+    char buf[6]      = {0};
+    strlcpy(version, _smallitoa(EMS_RxTelegram->data[offset + 1], buf), sizeof(version));
+    strlcat(version, ".", sizeof(version));
+    strlcat(version, _smallitoa(EMS_RxTelegram->data[offset + 2], buf), sizeof(version));
+
+    // scan through known devices matching the productid
+    uint8_t product_id = EMS_RxTelegram->data[offset];
+    uint8_t i          = 0;
+    bool    typeFound  = false;
+    while (i < _EMS_Devices_max) {
+        if (EMS_Devices[i].product_id == product_id) {
+            typeFound = true; // we have a matching product id. i is the index.
+            break;
+        }
+        i++;
+    }
+
+    // if not found, just add it
+    if (!typeFound) {
+        (void)_addDevice(EMS_DEVICE_TYPE_UNKNOWN, product_id, device_id, nullptr, version);
+        return;
+    }
+
+    const char *     device_desc_p = (EMS_Devices[i].device_desc); // pointer to the full description of the device
+    _EMS_DEVICE_TYPE type          = EMS_Devices[i].type;          // type
+
+    // we recognized it, see if we already have it in our recognized list
+    if (_addDevice(type, product_id, device_id, device_desc_p, version)) {
+        return; // already in list
+    }
+
+    uint8_t flags = EMS_Devices[i].flags; // its a new entry, set the specifics
+    _ems_deviceChanged();                 // how its telegrams are decoded can depend on the model
+
+    if (type == EMS_DEVICE_TYPE_BOILER) {
+        EMS_Boiler.device_id     = device_id;
+        EMS_Boiler.product_id    = product_id;
+        EMS_Boiler.device_flags  = flags;
+        EMS_Boiler.device_desc_p = device_desc_p;
+        strlcpy(EMS_Boiler.version, version, sizeof(EMS_Boiler.version));
+        ems_getBoilerValues(); // get Boiler values that we would usually have to wait for
+    } else if (type == EMS_DEVICE_TYPE_THERMOSTAT) {
+        EMS_Thermostat.device_id       = device_id;
+        EMS_Thermostat.device_flags    = (flags & 0x7F); // remove 7th bit
+        EMS_Thermostat.write_supported = (flags & EMS_DEVICE_FLAG_NO_WRITE) == 0;
+        EMS_Thermostat.product_id      = product_id;
+        EMS_Thermostat.device_desc_p   = device_desc_p;
+        strlcpy(EMS_Thermostat.version, version, sizeof(EMS_Thermostat.version));
+        ems_getThermostatValues(); // get Thermostat values
+    } else if (type == EMS_DEVICE_TYPE_SOLAR) {
+        EMS_SolarModule.device_id     = device_id;
+        EMS_SolarModule.product_id    = product_id;
+        EMS_SolarModule.device_flags  = flags;
+        EMS_SolarModule.device_desc_p = device_desc_p;
+        strlcpy(EMS_SolarModule.version, version, sizeof(EMS_SolarModule.version));
+        ems_getSolarModuleValues(); // fetch Solar Module values
+    } else if (type == EMS_DEVICE_TYPE_HEATPUMP) {
+        EMS_HeatPump.device_id     = device_id;
+        EMS_HeatPump.product_id    = product_id;
+        EMS_HeatPump.device_flags  = flags;
+        EMS_HeatPump.device_desc_p = device_desc_p;
+        strlcpy(EMS_HeatPump.version, version, sizeof(EMS_HeatPump.version));
+    } else if (type == EMS_DEVICE_TYPE_MIXING) {
+        EMS_Mixing.device_id     = device_id;
+        EMS_Mixing.product_id    = product_id;
+        EMS_Mixing.device_desc_p = device_desc_p;
+        EMS_Mixing.device_flags  = flags;
+        EMS_Mixing.detected      = true;
+        ems_doReadCommand(EMS_TYPE_MMPLUSStatusMessage_HC1, device_id); // fetch MM values
+    }
+}
+
+void _process_Version(_EMS_RxTelegram * EMS_RxTelegram) {
+    _ems_processVersion(EMS_RxTelegram);
+    _ems_discoveryAnswered(EMS_RxTelegram->src & 0x7F, true); // once the device has been added
+}
+
+/**
+ * The device discovery. The boiler's 0x07 telegram is a bitmap of the device IDs on the bus, and only those are
+ * probed with a Version read. The reads are queued together in the discovery lane, so they go out on the polls that
+ * follow each other. If there's no bitmap the IDs where devices are usually found are probed instead, and one of
+ * those that doesn't reply isn't read again, see _ems_discoveryQuick(). It's done when every probe has been answered
+ * or given up on, and how long that took is logged and kept for info
+ */
+_EMS_Discovery * ems_getDiscovery() {
+    return &EMS_Discovery;
+}
+
+// the IDs that are probed when there's no device bitmap
+static const uint8_t EMS_Discovery_ids[] = {EMS_ID_BOILER, 0x09, 0x02, 0x10, 0x17, 0x18, 0x20, 0x21, EMS_ID_SM, EMS_ID_HP, 0x48};
+
+static bool _ems_deviceMapHas(uint8_t device_id) {
+    uint8_t data_byte = (device_id >> 3) - 1; // the bitmap starts at 0x08
+    if ((device_id < 8) || (data_byte >= EMS_SYS_DEVICEMAP_LENGTH)) {
+        return false;
+    }
+    return (EMS_Sys_Status.emsDeviceMap[data_byte] >> (device_id & 0x07)) & 0x01;
+}
+
+static bool _ems_deviceMapEmpty() {
+    for (uint8_t i = 0; i < EMS_SYS_DEVICEMAP_LENGTH; i++) {
+        if (EMS_Sys_Status.emsDeviceMap[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void _ems_discoveryStart() {
+    if (EMS_Discovery.running) {
+        return;
+    }
+    memset(EMS_Discovery.pending, 0, sizeof(EMS_Discovery.pending));
+    EMS_Discovery.running    = true;
+    EMS_Discovery.mapPending = false;
+    EMS_Discovery.probed     = 0;
+    EMS_Discovery.found      = 0;
+    EMS_Discovery.absent     = 0;
+    EMS_Discovery.started    = millis();
+    EMS_Discovery.last       = EMS_Discovery.started;
+}
+
+static void _ems_discoveryProbeIds(const uint8_t * ids, uint8_t count) {
+    for (uint8_t i = 0; i < count; i++) {
+        _ems_discoveryProbe(ids[i]);
+    }
+}
+
+/**
+ * read the version of a device, unless it's already being read
+ */
+void _ems_discoveryProbe(uint8_t device_id) {
+    if (ems_getTxDisabled() || (device_id == EMS_ID_ME) || (device_id & 0x80)) {
+        return;
+    }
+
+    _ems_discoveryStart();
+    uint8_t bit = (1 << (device_id & 0x07));
+    if (EMS_Discovery.pending[device_id >> 3] & bit) {
+        return;
+    }
+    EMS_Discovery.pending[device_id >> 3] |= bit;
+    EMS_Discovery.probed++;
+    ems_doReadCommand(EMS_TYPE_Version, device_id);
+}
+
+/**
+ * a probe has been answered, or given up on. With EMS_ID_NONE it only sees if the discovery is done
+ */
+void _ems_discoveryAnswered(uint8_t device_id, bool found) {
+    if (!EMS_Discovery.running) {
+        return;
+    }
+
+    if (device_id != EMS_ID_NONE) {
+        uint8_t bit = (1 << (device_id & 0x07));
+        if (!(EMS_Discovery.pending[device_id >> 3] & bit)) {
+            return; // not one we asked for
+        }
+        EMS_Discovery.pending[device_id >> 3] &= ~bit;
+        if (found) {
+            EMS_Discovery.found++;
+        } else {
+            EMS_Discovery.absent++;
+        }
+        EMS_Discovery.last = millis();
+    }
+
+    if (EMS_Discovery.mapPending) {
+        return;
+    }
+    for (uint8_t i = 0; i < EMS_DISCOVERY_MAP; i++) {
+        if (EMS_Discovery.pending[i]) {
+            return;
+        }
+    }
+
+    EMS_Discovery.running = false;
+    EMS_Discovery.time    = EMS_Discovery.last - EMS_Discovery.started;
+    EMS_Discovery.runs++;
+    myDebug_P(PSTR("Discovery done in %d ms: %d of %d devices replied"), EMS_Discovery.time, EMS_Discovery.found, EMS_Discovery.probed);
+}
+
+/**
+ * the Tx queue has given up on a telegram. If it's one of the discovery's, it's not there
+ * without a device bitmap the usual IDs are probed instead
+ */
+void _ems_discoveryLost(uint16_t type, uint8_t dest) {
+    if (!EMS_Discovery.running) {
+        return;
+    }
+
+    if (type == EMS_TYPE_Version) {
+        _ems_discoveryAnswered(dest & 0x7F, false);
+    } else if ((type == EMS_TYPE_UBADevices) && EMS_Discovery.mapPending) {
+        EMS_Discovery.mapPending = false;
+        _ems_discoveryProbeIds(EMS_Discovery_ids, ArraySize(EMS_Discovery_ids));
+        _ems_discoveryAnswered(EMS_ID_NONE, false);
+    }
+}
+
+/**
+ * true if a read that had no reply shouldn't go again: a probe of an ID that isn't in the device bitmap,
+ * as there's most likely nothing there
+ */
+bool _ems_discoveryQuick(uint16_t type, uint8_t dest) {
+    return (type == EMS_TYPE_Version) && !_ems_deviceMapHas(dest & 0x7F);
+}
+
+/**
+ * called by ems_refreshTick(), closes a discovery that a probe lost some other way has kept open
+ */
+void _ems_discoveryTick() {
+    if (!EMS_Discovery.running || ((millis() - EMS_Discovery.started) < EMS_DISCOVERY_TIMEOUT)) {
+        return;
+    }
+
+    EMS_Discovery.mapPending = false;
+    for (uint8_t device_id = 0; device_id < (EMS_DISCOVERY_MAP * 8); device_id++) {
+        _ems_discoveryAnswered(device_id, false);
+    }
+    _ems_discoveryAnswered(EMS_ID_NONE, false);
+}
+
+/*
+ * Figure out the boiler and thermostat types
+ * the boiler's device bitmap is read first, and each device in it is then probed by _process_UBADevices()
+ */
+void ems_discoverModels() {
+    if (ems_getTxDisabled()) {
+        return;
+    }
+    _ems_discoveryStart();
+    EMS_Discovery.mapPending = true;
+    ems_doReadCommand(EMS_TYPE_UBADevices, EMS_ID_BOILER);
+}
+
+/**
+ * name of a Tx queue lane, for printing
+ */
+const char * ems_getTxLaneName(uint8_t lane) {
+    switch (lane) {
+    case EMS_TX_LANE_INTERACTIVE:
+        return "interactive";
+    case EMS_TX_LANE_VALIDATE:
+        return "validate";
+    case EMS_TX_LANE_DISCOVERY:
+        return "discovery";
+    case EMS_TX_LANE_REFRESH:
+        return "refresh";
+    default:
+        return "?";
+    }
+}
+
+/**
+ * Print the Tx queue - for debugging
+ */
+void ems_printTxQueue() {
+    _EMS_TxTelegram EMS_TxTelegram;
+    char            sType[20] = {0};
+
+    if (EMS_TxQueue.size() == 0) {
+        myDebug_P(PSTR("Tx queue is empty"));
+        return;
+    }
+
+    myDebug_P(PSTR("Tx queue (%d telegrams, %d/%d bytes)"), EMS_TxQueue.size(), EMS_TxQueue.used(), EMS_TxQueue.capacity);
+    for (uint8_t lane = 0; lane < EMS_TX_LANES; lane++) {
+        if (EMS_TxQueue.depth(lane)) {
+            myDebug_P(PSTR(" %d waiting in lane %s"), EMS_TxQueue.depth(lane), ems_getTxLaneName(lane));
+        }
+    }
+
+    for (byte i = 0; i < EMS_TxQueue.size(); i++) {
+        EMS_TxTelegram = EMS_TxQueue[i]; // retrieves the i-th element from the buffer without removing it
+
+        // get action
+        if (EMS_TxTelegram.action == EMS_TX_TELEGRAM_WRITE) {
+            strlcpy(sType, "write", sizeof(sType));
+        } else if (EMS_TxTelegram.action == EMS_TX_TELEGRAM_READ) {
+            strlcpy(sType, "read", sizeof(sType));
+        } else if (EMS_TxTelegram.action == EMS_TX_TELEGRAM_VALIDATE) {
+            strlcpy(sType, "validate", sizeof(sType));
+        } else if (EMS_TxTelegram.action == EMS_TX_TELEGRAM_RAW) {
+            strlcpy(sType, "raw", sizeof(sType));
+        } else {
+            strlcpy(sType, "?", sizeof(sType));
+        }
+
+        char     addedTime[15] = {0};
+        uint32_t upt           = EMS_TxTelegram.timestamp;
+        snprintf(addedTime,
+                 sizeof(addedTime),
+                 "(%02d:%02d:%02d)",
+                 (uint8_t)((upt / (1000 * 60 * 60)) % 24),
+                 (uint8_t)((upt / (1000 * 60)) % 60),
+                 (uint8_t)((upt / 1000) % 60));
+
+        myDebug_P(PSTR(" [%d] action=%s dest=0x%02x type=0x%02x offset=%d length=%d dataValue=%d "
+                       "comparisonValue=%d type_validate=0x%02x comparisonPostRead=0x%02x @ %s"),
+                  i + 1,
+                  sType,
+                  EMS_TxTelegram.dest & 0x7F,
+                  EMS_TxTelegram.type,
+                  EMS_TxTelegram.offset,
+                  EMS_TxTelegram.length,
+                  EMS_TxTelegram.dataValue,
+                  EMS_TxTelegram.comparisonValue,
+                  EMS_TxTelegram.type_validate,
+                  EMS_TxTelegram.comparisonPostRead,
+                  addedTime);
+    }
+}
+
+/**
+ * read a type now, or with scheduled add it to the types the refresh scheduler keeps up to date
+ */
+static void _ems_readType(uint16_t type, uint8_t dest, bool scheduled) {
+    if (scheduled) {
+        _ems_refreshAdd(type, dest);
+    } else if (_ems_cacheFresh(type, dest)) {
+        EMS_Sys_Status.emsCacheHits++; // the values decoded from it are still current
+    } else {
+        EMS_Sys_Status.emsCacheMisses++;
+        ems_doReadCommand(type, dest, true);
+    }
+}
+
+/**
+ * Generic function to return various settings from the thermostat
+ * This is called manually to fetch values which don't come from broadcast messages
+ * When scheduled only the heating circuits that are active are included, or HC1 if none have been seen yet
+ */
+void ems_getThermostatValues(bool scheduled) {
+    if (!ems_getThermostatEnabled()) {
+        return;
+    }
+
+    uint8_t device_flags = EMS_Thermostat.device_flags;
+    uint8_t device_id    = EMS_Thermostat.device_id;
+    uint8_t statusMsg, opMode, timer;
+
+    bool anyActive = false;
+    for (uint8_t hc_num = 0; hc_num < EMS_THERMOSTAT_MAXHC; hc_num++) {
+        anyActive |= EMS_Thermostat.hc[hc_num].active;
+    }
+
+    switch (device_flags) {
+    case EMS_DEVICE_FLAG_RC20:
+        _ems_readType(EMS_TYPE_RC20StatusMessage, device_id, scheduled); // to get the temps
+        _ems_readType(EMS_TYPE_RC20Set, device_id, scheduled);           // to get the mode
+        break;
+    case EMS_DEVICE_FLAG_RC30:
+        _ems_readType(EMS_TYPE_RC30StatusMessage, device_id, scheduled); // to get the temps
+        _ems_readType(EMS_TYPE_RC30Set, device_id, scheduled);           // to get the mode
+        break;
+    case EMS_DEVICE_FLAG_EASY:
+        _ems_readType(EMS_TYPE_EasyStatusMessage, device_id, scheduled);
+        break;
+    case EMS_DEVICE_FLAG_RC35:
+        for (uint8_t hc_num = 1; hc_num <= EMS_THERMOSTAT_MAXHC; hc_num++) {
+            if (scheduled && !EMS_Thermostat.hc[hc_num - 1].active && (anyActive || (hc_num != 1))) {
+                continue;
+            }
+            if (hc_num == 1) {
+                statusMsg = EMS_TYPE_RC35StatusMessage_HC1;
+                opMode    = EMS_TYPE_RC35Set_HC1;
+                timer     = EMS_TYPE_RC35Timer_HC1;
+            } else if (hc_num == 2) {
+                statusMsg = EMS_TYPE_RC35StatusMessage_HC2;
+                opMode    = EMS_TYPE_RC35Set_HC2;
+                timer     = EMS_TYPE_RC35Timer_HC2;
+            } else if (hc_num == 3) {
+                statusMsg = EMS_TYPE_RC35StatusMessage_HC3;
+                opMode    = EMS_TYPE_RC35Set_HC3;
+                timer     = EMS_TYPE_RC35Timer_HC3;
+            } else if (hc_num == 4) {
+                statusMsg = EMS_TYPE_RC35StatusMessage_HC4;
+                opMode    = EMS_TYPE_RC35Set_HC4;
+                timer     = EMS_TYPE_RC35Timer_HC4;
+            }
+            _ems_readType(statusMsg, device_id, scheduled); // to get the temps
+            _ems_readType(opMode, device_id, scheduled);    // to get the mode
+            _ems_blockAdd(timer, device_id, EMS_LENGTH_RC35Timer, scheduled);
+        }
+        break;
+    case EMS_DEVICE_FLAG_RC300:
+        for (uint8_t hc_num = 1; hc_num <= EMS_THERMOSTAT_MAXHC; hc_num++) {
+            if (scheduled && !EMS_Thermostat.hc[hc_num - 1].active && (anyActive || (hc_num != 1))) {
+                continue;
+            }
+            _ems_readType(EMS_TYPE_RCPLUSStatusMessage_HC1 + hc_num - 1, device_id, scheduled);
+        }
+    default:
+        break;
+    }
+
+    _ems_readType(EMS_TYPE_RCTime, device_id, scheduled); // get Thermostat time
+}
+
+/**
+ * Generic function to return various settings from the thermostat
+ */
+void ems_getBoilerValues(bool scheduled) {
+    _ems_readType(EMS_TYPE_UBAMonitorFast, EMS_Boiler.device_id, scheduled);        // get boiler stats, instead of waiting 10secs for the broadcast
+    _ems_readType(EMS_TYPE_UBAMonitorSlow, EMS_Boiler.device_id, scheduled);        // get more boiler stats, instead of waiting 60secs for the broadcast
+    _ems_readType(EMS_TYPE_UBAParameterWW, EMS_Boiler.device_id, scheduled);        // get Warm Water values
+    _ems_readType(EMS_TYPE_UBAParametersMessage, EMS_Boiler.device_id, scheduled);  // get MC10 boiler values
+    _ems_readType(EMS_TYPE_UBATotalUptimeMessage, EMS_Boiler.device_id, scheduled); // get uptime from boiler
+    _ems_blockAdd(EMS_TYPE_UBAErrorMessages, EMS_Boiler.device_id, EMS_LENGTH_UBAErrorMessages, scheduled);
+}
+
+/*
+ * Get other values from EMS devices
+ */
+void ems_getSolarModuleValues(bool scheduled) {
+    if (ems_getSolarModuleEnabled()) {
+        if (EMS_SolarModule.device_flags == EMS_DEVICE_FLAG_SM10) {
+            _ems_readType(EMS_TYPE_SM10Monitor, EMS_ID_SM, scheduled); // fetch all from SM10Monitor
+        } else if (EMS_SolarModule.device_flags == EMS_DEVICE_FLAG_SM100) {
+            _ems_readType(EMS_TYPE_SM100Monitor, EMS_ID_SM, scheduled); // fetch all from SM100Monitor
+        }
+    }
+}
+
+/**
+ * takes a device_id and tries to find the corresponding type name (e.g. Boiler)
+ * If it can't find it, it will use the hex value and function returns false
+ */
+bool ems_getDeviceTypeDescription(uint8_t device_id, char * buffer) {
+    uint8_t i         = 0;
+    bool    typeFound = false;
+
+    // scan through known ID types
+    while (i < _EMS_Devices_Types_max) {
+        if (EMS_Devices_Types[i].device_id == device_id) {
+            typeFound = true; // we have a match
+            break;
+        }
+        i++;
+    }
+
+    if (typeFound) {
+        strlcpy(buffer, EMS_Devices_Types[i].device_type_string, 30);
+        return true;
+    } else {
+        // print as hex value
+        char hexbuffer[16] = {0};
+        strlcpy(buffer, "0x", 30);
+        strlcat(buffer, _hextoa(device_id, hexbuffer), 30);
+        return false;
+    }
+}
+
+
+/**
+ * returns current device details as a string for known thermostat,boiler,solar and heatpump
+ */
+char * ems_getDeviceDescription(_EMS_DEVICE_TYPE device_type, char * buffer, bool name_only) {
+    const uint8_t size    = 128;
+    bool          enabled = false;
+    uint8_t       device_id;
+    uint8_t       product_id;
+    char *        version;
+    const char *  device_desc_p;
+
+    if (device_type == EMS_DEVICE_TYPE_THERMOSTAT) {
+        enabled       = ems_getThermostatEnabled();
+        device_id     = EMS_Thermostat.device_id;
+        product_id    = EMS_Thermostat.product_id;
+        device_desc_p = EMS_Thermostat.device_desc_p;
+        version       = EMS_Thermostat.version;
+    } else if (device_type == EMS_DEVICE_TYPE_BOILER) {
+        enabled       = ems_getBoilerEnabled();
+        device_id     = EMS_Boiler.device_id;
+        product_id    = EMS_Boiler.product_id;
+        device_desc_p = EMS_Boiler.device_desc_p;
+        version       = EMS_Boiler.version;
+    } else if (device_type == EMS_DEVICE_TYPE_SOLAR) {
+        enabled       = ems_getSolarModuleEnabled();
+        device_id     = EMS_SolarModule.device_id;
+        product_id    = EMS_SolarModule.product_id;
+        device_desc_p = EMS_SolarModule.device_desc_p;
+        version       = EMS_SolarModule.version;
+    } else if (device_type == EMS_DEVICE_TYPE_HEATPUMP) {
+        enabled       = ems_getHeatPumpEnabled();
+        device_id     = EMS_HeatPump.device_id;
+        product_id    = EMS_HeatPump.product_id;
+        device_desc_p = EMS_HeatPump.device_desc_p;
+        version       = EMS_HeatPump.version;
+    }
+
+    if (!enabled) {
+        strlcpy(buffer, "<not enabled>", size);
+        return buffer;
+    }
+
+    // assume at this point we have a known device.
+    // get device description
+    if (device_desc_p == nullptr) {
+        strlcpy(buffer, EMS_MODELTYPE_UNKNOWN_STRING, size);
+    } else {
+        strlcpy(buffer, device_desc_p, size);
+    }
+
+    if (name_only) {
+        return buffer; // only interested in the model name
+    }
+
+    strlcat(buffer, " (DeviceID:0x", size);
+    char tmp[6] = {0};
+    strlcat(buffer, _hextoa(device_id, tmp), size);
+    strlcat(buffer, " ProductID:", size);
+    strlcat(buffer, itoa(product_id, tmp, 10), size);
+    strlcat(buffer, " Version:", size);
+    strlcat(buffer, version, size);
+    strlcat(buffer, ")", size);
+
+    return buffer;
+}
+
+/**
+ * Find the versions of our connected devices
+ */
+void ems_scanDevices() {
+    if (ems_getTxDisabled()) {
+        return;
+    }
+
+    myDebug_P(PSTR("Started scanning the EMS bus for known devices"));
+
+    _ems_discoveryStart();
+
+    // only the IDs in the device bitmap, if the boiler has sent one
+    if (_ems_deviceMapEmpty()) {
+        _ems_discoveryProbeIds(EMS_Discovery_ids, ArraySize(EMS_Discovery_ids));
+    } else {
+        for (uint8_t device_id = 8; device_id < (EMS_DISCOVERY_MAP * 8); device_id++) {
+            if (_ems_deviceMapHas(device_id)) {
+                _ems_discoveryProbe(device_id);
+            }
+        }
+    }
+
+    _ems_discoveryAnswered(EMS_ID_NONE, false);
+}
+
+/**
+ * print out contents of the device list that was captured
+ */
+void ems_printDevices() {
+    char s[100];
+    char buffer[16] = {0};
+
+    strlcpy(s, "These device IDs are on the EMS Bus:", sizeof(s));
+    strlcat(s, COLOR_BOLD_ON, sizeof(s));
+
+    for (uint8_t data_byte = 0; data_byte < EMS_SYS_DEVICEMAP_LENGTH; data_byte++) {
+        uint8_t byte = EMS_Sys_Status.emsDeviceMap[data_byte];
+        if (byte) {
+            // go through all bits
+            for (uint8_t bit = 0; bit < 8; bit++) {
+                if (byte & 0x01) {
+                    uint8_t device_id = ((data_byte + 1) * 8) + bit;
+                    if (device_id != EMS_ID_ME) {
+                        strlcat(s, " 0x", sizeof(s));
+                        strlcat(s, _hextoa(device_id, buffer), sizeof(s));
+                    }
+                }
+                byte = byte >> 1;
+            }
+        }
+    }
+
+    strlcat(s, COLOR_BOLD_OFF, sizeof(s));
+    myDebug_P(PSTR("")); // newline
+    myDebug(s);
+
+    // print out the ones we recognized
+    if (EMS_Device_count) {
+        bool               have_unknowns = false;
+        char               device_string[100];
+        uint8_t            i = 0;
+        _Detected_Device * it;
+        myDebug_P(PSTR("and %d were recognized by EMS-ESP as:"), EMS_Device_count);
+        while ((it = ems_nextDevice(&i))) {
+            if ((it)->known) {
+                strlcpy(device_string, (it)->device_desc_p, sizeof(device_string));
+            } else {
+                strlcpy(device_string, EMS_MODELTYPE_UNKNOWN_STRING, sizeof(device_string)); // Unknown
+                have_unknowns = true;
+            }
+
+            myDebug_P(PSTR(" %s%s%s (DeviceID:0x%02X ProductID:%d Version:%s)"),
+                      COLOR_BOLD_ON,
+                      device_string,
+                      COLOR_BOLD_OFF,
+                      (it)->device_id,
+                      (it)->product_id,
+                      (it)->version);
+        }
+
+        myDebug_P(PSTR("")); // newline
+
+        if (have_unknowns) {
+            myDebug_P(
+                PSTR("You have a device is that is not yet known by EMS-ESP. Please report this as a GitHub issue so we can expand the EMS device library."));
+        }
+    } else {
+        myDebug_P(PSTR("No were devices recognized. This may be because Tx is disabled or failing."));
+    }
+
+    myDebug_P(PSTR("")); // newline
+}
+
+/**
+ * Send a raw telegram to the bus
+ * telegram is a string of hex values
+ */
+void ems_sendRawTelegram(char * telegram) {
+    if (EMS_Sys_Status.emsTxDisabled) {
+        if (ems_getLogging() != EMS_SYS_LOGGING_NONE) {
+            myDebug_P(PSTR("in Listen Mode. All Tx is disabled."));
+        }
+        return;
+    }
+
+    uint8_t count = 0;
+    char *  p;
+    char    value[10] = {0};
+
+    _EMS_TxTelegram EMS_TxTelegram = EMS_TX_TELEGRAM_NEW; // create new Tx
+    EMS_TxTelegram.timestamp       = millis();            // set timestamp
+    EMS_Sys_Status.txRetryCount    = 0;                   // reset retry counter
+
+    // get first value, which should be the src
+    if ((p = strtok(telegram, " ,"))) { // delimiter
+        strlcpy(value, p, sizeof(value));
+        EMS_TxTelegram.data[0] = (uint8_t)strtol(value, 0, 16);
+    }
+    // and interate until end
+    while (p != 0) {
+        if ((p = strtok(nullptr, " ,"))) {
+            strlcpy(value, p, sizeof(value));
+            uint8_t val                  = (uint8_t)strtol(value, 0, 16);
+            EMS_TxTelegram.data[++count] = val;
+            if (count == 1) {
+                EMS_TxTelegram.dest = val;
+            } else if (count == 2) {
+                EMS_TxTelegram.type = val;
+            } else if (count == 3) {
+                EMS_TxTelegram.offset = val;
+            }
+        }
+    }
+
+    if (count == 0) {
+        return; // nothing to send
+    }
+
+    EMS_TxTelegram.length        = count + 2;
+    EMS_TxTelegram.type_validate = EMS_ID_NONE;
+    EMS_TxTelegram.action        = EMS_TX_TELEGRAM_RAW;
+
+    // add to Tx queue. Assume it's not full.
+    EMS_TxQueue.push(EMS_TxTelegram);
+}
+
+/**
+ * Set the temperature of the thermostat
+ * hc_num is 1 to 4
+ * temptype 0 = normal, 1=night temp, 2=day temp, 3=holiday temp
+ */
+void ems_setThermostatTemp(float temperature, uint8_t hc_num, uint8_t temptype) {
+    if (!ems_getThermostatEnabled()) {
+        myDebug_P(PSTR("Thermostat not online."));
+        return;
+    }
+
+    if (!EMS_Thermostat.write_supported) {
+        myDebug_P(PSTR("Write not supported yet for this Thermostat model"));
+        return;
+    }
+
+    if (hc_num < 1 || hc_num > EMS_THERMOSTAT_MAXHC) {
+        myDebug_P(PSTR("Invalid HC number"));
+        return;
+    }
+
+    _EMS_TxTelegram EMS_TxTelegram = EMS_TX_TELEGRAM_NEW; // create new Tx
+    EMS_TxTelegram.timestamp       = millis();            // set timestamp
+    EMS_Sys_Status.txRetryCount    = 0;                   // reset retry counter
+
+    uint8_t model     = ems_getThermostatModel();
+    uint8_t device_id = EMS_Thermostat.device_id;
+
+    EMS_TxTelegram.action = EMS_TX_TELEGRAM_WRITE;
+    EMS_TxTelegram.dest   = device_id;
+
+    char s[10] = {0};
+    myDebug_P(PSTR("Setting new thermostat temperature to %s for heating circuit %d type %d (0=auto,1=night,2=day,3=holiday)"),
+              _float_to_char(s, temperature),
+              hc_num,
+              temptype);
+
+    if (model == EMS_DEVICE_FLAG_RC20) {
+        EMS_TxTelegram.type               = EMS_TYPE_RC20Set;
+        EMS_TxTelegram.offset             = EMS_OFFSET_RC20Set_temp;
+        EMS_TxTelegram.comparisonPostRead = EMS_TYPE_RC20StatusMessage;
+        EMS_TxTelegram.type_validate      = EMS_TxTelegram.type;
+
+    } else if (model == EMS_DEVICE_FLAG_RC10) {
+        EMS_TxTelegram.type               = EMS_TYPE_RC10Set;
+        EMS_TxTelegram.offset             = EMS_OFFSET_RC10Set_temp;
+        EMS_TxTelegram.comparisonPostRead = EMS_TYPE_RC10StatusMessage;
+        EMS_TxTelegram.type_validate      = EMS_TxTelegram.type;
+
+    } else if (model == EMS_DEVICE_FLAG_RC30) {
+        EMS_TxTelegram.type               = EMS_TYPE_RC30Set;
+        EMS_TxTelegram.offset             = EMS_OFFSET_RC30Set_temp;
+        EMS_TxTelegram.comparisonPostRead = EMS_TYPE_RC30StatusMessage;
+        EMS_TxTelegram.type_validate      = EMS_TxTelegram.type;
+
+    } else if (model == EMS_DEVICE_FLAG_RC300) {
+        // check mode to determine offset
+        if (EMS_Thermostat.hc[hc_num - 1].mode == 1) {        // auto
+            EMS_TxTelegram.offset = 0x08;                     // auto offset
+        } else if (EMS_Thermostat.hc[hc_num - 1].mode == 0) { // manuaL
+            EMS_TxTelegram.offset = 0x0A;                     // manual offset
+        }
+
+        if (hc_num == 1) {
+            EMS_TxTelegram.type               = EMS_TYPE_RCPLUSSet; // for 3000 and 1010, e.g. 0B 10 FF (0A | 08) 01 89 2B
+            EMS_TxTelegram.comparisonPostRead = EMS_TYPE_RCPLUSStatusMessage_HC1;
+        } else if (hc_num == 2) {
+            EMS_TxTelegram.type               = EMS_TYPE_RCPLUSSet + 1;
+            EMS_TxTelegram.comparisonPostRead = EMS_TYPE_RCPLUSStatusMessage_HC2;
+        } else if (hc_num == 3) {
+            EMS_TxTelegram.type               = EMS_TYPE_RCPLUSSet + 2;
+            EMS_TxTelegram.comparisonPostRead = EMS_TYPE_RCPLUSStatusMessage_HC3;
+        } else if (hc_num == 4) {
+            EMS_TxTelegram.type               = EMS_TYPE_RCPLUSSet + 3;
+            EMS_TxTelegram.comparisonPostRead = EMS_TYPE_RCPLUSStatusMessage_HC4;
+        }
+
+        EMS_TxTelegram.type_validate = EMS_ID_NONE; // validate by reading from a different telegram
+
+    } else if (model == EMS_DEVICE_FLAG_RC35) {
+        switch (temptype) {
+        case 1: // change the night temp
+            EMS_TxTelegram.offset = EMS_OFFSET_RC35Set_temp_night;
+            break;
+        case 2: // change the day temp
+            EMS_TxTelegram.offset = EMS_OFFSET_RC35Set_temp_day;
+            break;
+        case 3: // change the holiday temp
+            EMS_TxTelegram.offset = EMS_OFFSET_RC35Set_temp_holiday;
+            break;
+        default:
+        case 0: // automatic selection, if no type is defined, we use the standard code
+            if (EMS_Thermostat.hc[hc_num - 1].day_mode == 0) {
+                EMS_TxTelegram.offset = EMS_OFFSET_RC35Set_temp_night;
+            } else if (EMS_Thermostat.hc[hc_num - 1].day_mode == 1) {
+                EMS_TxTelegram.offset = EMS_OFFSET_RC35Set_temp_day;
+            }
+            break;
+        }
+
+        if (hc_num == 1) {
+            EMS_TxTelegram.type               = EMS_TYPE_RC35Set_HC1;
+            EMS_TxTelegram.comparisonPostRead = EMS_TYPE_RC35StatusMessage_HC1;
+        } else if (hc_num == 2) {
+            EMS_TxTelegram.type               = EMS_TYPE_RC35Set_HC2;
+            EMS_TxTelegram.comparisonPostRead = EMS_TYPE_RC35StatusMessage_HC2;
+        } else if (hc_num == 3) {
+            EMS_TxTelegram.type               = EMS_TYPE_RC35Set_HC3;
+            EMS_TxTelegram.comparisonPostRead = EMS_TYPE_RC35StatusMessage_HC3;
+        } else if (hc_num == 4) {
+            EMS_TxTelegram.type               = EMS_TYPE_RC35Set_HC4;
+            EMS_TxTelegram.comparisonPostRead = EMS_TYPE_RC35StatusMessage_HC4;
+        }
+        EMS_TxTelegram.type_validate = EMS_TxTelegram.type;
+    }
+
+    EMS_TxTelegram.length           = EMS_MIN_TELEGRAM_LENGTH;
+    EMS_TxTelegram.dataValue        = (uint8_t)((float)temperature * (float)2); // value * 2
+    EMS_TxTelegram.comparisonOffset = EMS_TxTelegram.offset;
+    EMS_TxTelegram.comparisonValue  = EMS_TxTelegram.dataValue;
 
-    return (hc_num);
+    EMS_TxQueue.push(EMS_TxTelegram);
 }
 
 /**
- * type 0x3D (HC1), 0x47 (HC2), 0x51 (HC3), 0x5B (HC4) - Working Mode Heating - for reading the mode from the RC35 thermostat (0x10)
- * received only after requested
- * 10 0B 47 00  03 13 15 26 0A 28 00 02 00 05 05 2D 01 01 04 4B 05 4B 01 00 3C FF 0D 05 05 02 02
- * 10 0B 3D 00  01 2B 39 26 00 28 00 02 00 05 05 2D 01 01 04 3C 06 39 01 00 3C FF 0D 05 05 03 00
- * 10 0B 51 00  00 13 15 26 00 28 00 02 00 05 05 2D 01 01 04 4B 05 4B 01 00 3C FF 11 05 05 03 02
- * 10 0B 5B 00  00 13 15 26 00 28 00 02 00 05 05 2D 01 01 04 4B 05 4B 01 00 3C FF 11 05 05 03 02
+ * Set the thermostat working mode
+ *  0xA8 on a RC20 and 0xA7 on RC30
+ *  0x01B9 for EMS+ 300/1000/3000, Auto=0xFF Manual=0x00. See https://github.com/proddy/EMS-ESP/wiki/RC3xx-Thermostats
+ *  hc_num is 1 to 4
  */
-void _process_RC35Set(_EMS_RxTelegram * EMS_RxTelegram) {
-    // check to see we have a valid type
-    // heating: 1 radiator, 2 convectors, 3 floors, 4 room supply
-    if (EMS_RxTelegram->data[0] == 0x00) {
+void ems_setThermostatMode(uint8_t mode, uint8_t hc_num) {
+    if (!ems_getThermostatEnabled()) {
+        myDebug_P(PSTR("Thermostat not online."));
         return;
     }
 
-    uint8_t hc_num = _getHeatingCircuit(EMS_RxTelegram); // which HC is it?
-
-    _setValue(EMS_RxTelegram, &EMS_Thermostat.hc[hc_num].mode, EMS_OFFSET_RC35Set_mode);                // night, day, auto
-    _setValue(EMS_RxTelegram, &EMS_Thermostat.hc[hc_num].daytemp, EMS_OFFSET_RC35Set_temp_day);         // is * 2
-    _setValue(EMS_RxTelegram, &EMS_Thermostat.hc[hc_num].nighttemp, EMS_OFFSET_RC35Set_temp_night);     // is * 2
-    _setValue(EMS_RxTelegram, &EMS_Thermostat.hc[hc_num].holidaytemp, EMS_OFFSET_RC35Set_temp_holiday); // is * 2
-    _setValue(EMS_RxTelegram, &EMS_Thermostat.hc[hc_num].heatingtype, EMS_OFFSET_RC35Set_heatingtype);  // byte 0 bit floor heating = 3
-}
-
-/**
- * type 0xA3 - for external temp settings from the the RC* thermostats
- */
-void _process_RCOutdoorTempMessage(_EMS_RxTelegram * EMS_RxTelegram) {
-    // add support here if you're reading external sensors
-}
-
-/*
- * SM10Monitor - type 0x97
- */
-void _process_SM10Monitor(_EMS_RxTelegram * EMS_RxTelegram) {
-    _setValue(EMS_RxTelegram, &EMS_SolarModule.collectorTemp, 2);  // collector temp from SM10, is *10
-    _setValue(EMS_RxTelegram, &EMS_SolarModule.bottomTemp, 5);     // bottom temp from SM10, is *10
-    _setValue(EMS_RxTelegram, &EMS_SolarModule.pumpModulation, 4); // modulation solar pump
-    _setValue(EMS_RxTelegram, &EMS_SolarModule.pump, 7, 1);        // active if bit 1 is set
-}
+    if (!EMS_Thermostat.write_supported) {
+        myDebug_P(PSTR("Write not supported for this model Thermostat"));
+        return;
+    }
 
-/*
- * SM100Monitor - type 0x0262 EMS+
- * e.g, 30 00 FF 00 02 62 01 AC
- *      30 00 FF 18 02 62 80 00
- *      30 00 FF 00 02 62 01 A1 - for bottom temps
- */
-void _process_SM100Monitor(_EMS_RxTelegram * EMS_RxTelegram) {
-    // only process the complete telegram, not partial
-    if (EMS_RxTelegram->offset) {
+    if (hc_num < 1 || hc_num > EMS_THERMOSTAT_MAXHC) {
+        myDebug_P(PSTR("Invalid HC number"));
         return;
     }
 
-    _setValue(EMS_RxTelegram, &EMS_SolarModule.collectorTemp, 0); // is *10
-    _setValue(EMS_RxTelegram, &EMS_SolarModule.bottomTemp, 2);    // is *10
-}
+    uint8_t model     = ems_getThermostatModel();
+    uint8_t device_id = EMS_Thermostat.device_id;
+    uint8_t set_mode;
 
-/*
- * SM100Status - type 0x0264 EMS+ for pump modulation
- * e.g. 30 00 FF 09 02 64 64 = 100%
- *      30 00 FF 09 02 64 1E = 30%
- */
-void _process_SM100Status(_EMS_RxTelegram * EMS_RxTelegram) {
-    if (EMS_RxTelegram->offset == 0) {
-        _setValue(EMS_RxTelegram, &EMS_SolarModule.pumpModulation, 9); // check for complete telegram
-    } else if (EMS_RxTelegram->offset == 0x09) {
-        _setValue(EMS_RxTelegram, &EMS_SolarModule.pumpModulation, 0); // data at offset 09
+    // RC300/1000/3000 have different settings
+    if (model == EMS_DEVICE_FLAG_RC300) {
+        if (mode == 1) {
+            set_mode = 0; // manual
+        } else {
+            set_mode = 0xFF; // auto
+        }
+    } else {
+        set_mode = mode;
     }
-}
 
-/*
- * SM100Status2 - type 0x026A EMS+ for pump on/off at offset 0x0A
- */
-void _process_SM100Status2(_EMS_RxTelegram * EMS_RxTelegram) {
-    if (EMS_RxTelegram->offset == 0) {
-        _setValue(EMS_RxTelegram, &EMS_SolarModule.pump, 10, 2); // 03=off 04=on
-    } else if (EMS_RxTelegram->offset == 0x0A) {
-        _setValue(EMS_RxTelegram, &EMS_SolarModule.pump, 0, 2); // 03=off 04=on at offset 0A
+    // 0=off, 1=manual, 2=auto
+    if (mode == 0) {
+        myDebug_P(PSTR("Setting thermostat mode to off for heating circuit %d"), hc_num);
+    } else if (set_mode == 1) {
+        myDebug_P(PSTR("Setting thermostat mode to manual for heating circuit %d"), hc_num);
+    } else if (set_mode == 2) {
+        myDebug_P(PSTR("Setting thermostat mode to auto for heating circuit %d"), hc_num);
     }
-}
-
-/*
- * SM100Energy - type 0x028E EMS+ for energy readings
- * e.g. 30 00 FF 00 02 8E 00 00 00 00 00 00 06 C5 00 00 76 35
- */
-void _process_SM100Energy(_EMS_RxTelegram * EMS_RxTelegram) {
-    _setValue(EMS_RxTelegram, &EMS_SolarModule.EnergyLastHour, 2); // last hour / 10 in Wh
-    _setValue(EMS_RxTelegram, &EMS_SolarModule.EnergyToday, 6);    //  todays in Wh
-    _setValue(EMS_RxTelegram, &EMS_SolarModule.EnergyTotal, 10);   //  total / 10 in kWh
-}
-
-/*
- * Type 0xE3 - HeatPump Monitor 1
- */
-void _process_HPMonitor1(_EMS_RxTelegram * EMS_RxTelegram) {
-    _setValue(EMS_RxTelegram, &EMS_HeatPump.HPModulation, 13); // %
-}
-
-/*
- * Type 0xE5 - HeatPump Monitor 2
- */
-void _process_HPMonitor2(_EMS_RxTelegram * EMS_RxTelegram) {
-    _setValue(EMS_RxTelegram, &EMS_HeatPump.HPSpeed, 25); // %
-}
 
-/*
- * Junkers ISM1 Solar Module - type 0x0003 EMS+ for energy readings
- *  e.g. B0 00 FF 00 00 03 32 00 00 00 00 13 00 D6 00 00 00 FB D0 F0
- */
-void _process_ISM1StatusMessage(_EMS_RxTelegram * EMS_RxTelegram) {
-    if (EMS_RxTelegram->offset == 0) {
-        _setValue(EMS_RxTelegram, &EMS_SolarModule.collectorTemp, 4);  // Collector Temperature
-        _setValue(EMS_RxTelegram, &EMS_SolarModule.bottomTemp, 6);     // Temperature Bottom of Solar Boiler
-        _setValue(EMS_RxTelegram, &EMS_SolarModule.EnergyLastHour, 2); // Solar Energy produced in last hour - is * 10 and handled in ems-esp.cpp
-        _setValue(EMS_RxTelegram, &EMS_SolarModule.pump, 8, 0);        // Solar pump on (1) or off (0)
-        _setValue(EMS_RxTelegram, &EMS_SolarModule.pumpWorkMin, 10);
-    }
+    _EMS_TxTelegram EMS_TxTelegram = EMS_TX_TELEGRAM_NEW; // create new Tx
+    EMS_TxTelegram.timestamp       = millis();            // set timestamp
+    EMS_Sys_Status.txRetryCount    = 0;                   // reset retry counter
 
-    if (EMS_RxTelegram->offset == 4) {
-        // e.g. B0 00 FF 04 00 03 02 E5
-        _setValue(EMS_RxTelegram, &EMS_SolarModule.collectorTemp, 0); // Collector Temperature
-    }
-}
+    EMS_TxTelegram.action    = EMS_TX_TELEGRAM_WRITE;
+    EMS_TxTelegram.dest      = device_id;
+    EMS_TxTelegram.length    = EMS_MIN_TELEGRAM_LENGTH;
+    EMS_TxTelegram.dataValue = set_mode;
 
+    // handle different thermostat types
+    if (model == EMS_DEVICE_FLAG_RC20) {
+        EMS_TxTelegram.type               = EMS_TYPE_RC20Set;
+        EMS_TxTelegram.offset             = EMS_OFFSET_RC20Set_mode;
+        EMS_TxTelegram.type_validate      = EMS_TYPE_RC20Set;
+        EMS_TxTelegram.comparisonPostRead = EMS_TYPE_RC20StatusMessage;
 
-/*
- * Junkers ISM1 Solar Module - type 0x0001 EMS+ for setting values
- */
-void _process_ISM1Set(_EMS_RxTelegram * EMS_RxTelegram) {
-    if (EMS_RxTelegram->offset == 6) {
-        // e.g. 90 30 FF 06 00 01 50 (CRC=2C)
-        // to implement: change max solar boiler temperature
-        EMS_SolarModule.setpoint_maxBottomTemp = EMS_RxTelegram->data[0];
-    }
-}
+    } else if (model == EMS_DEVICE_FLAG_RC30) {
+        EMS_TxTelegram.type               = EMS_TYPE_RC30Set;
+        EMS_TxTelegram.offset             = EMS_OFFSET_RC30Set_mode;
+        EMS_TxTelegram.type_validate      = EMS_TYPE_RC30Set;
+        EMS_TxTelegram.comparisonPostRead = EMS_TYPE_RC30StatusMessage;
 
-/**
- * UBASetPoint 0x1A
- */
-void _process_SetPoints(_EMS_RxTelegram * EMS_RxTelegram) {
-    if (EMS_Sys_Status.emsLogging == EMS_SYS_LOGGING_VERBOSE) {
-        if (EMS_RxTelegram->data_length) {
-            uint8_t setpoint = EMS_RxTelegram->data[0]; // flow temp
-            //uint8_t ww_power = data[2]; // power in %
+    } else if (model == EMS_DEVICE_FLAG_RC35) {
+        if (hc_num == 1) {
+            EMS_TxTelegram.type               = EMS_TYPE_RC35Set_HC1;
+            EMS_TxTelegram.comparisonPostRead = EMS_TYPE_RC35StatusMessage_HC1;
+        } else if (hc_num == 2) {
+            EMS_TxTelegram.type               = EMS_TYPE_RC35Set_HC2;
+            EMS_TxTelegram.comparisonPostRead = EMS_TYPE_RC35StatusMessage_HC2;
+        } else if (hc_num == 3) {
+            EMS_TxTelegram.type               = EMS_TYPE_RC35Set_HC3;
+            EMS_TxTelegram.comparisonPostRead = EMS_TYPE_RC35StatusMessage_HC3;
+        } else if (hc_num == 4) {
+            EMS_TxTelegram.type               = EMS_TYPE_RC35Set_HC4;
+            EMS_TxTelegram.comparisonPostRead = EMS_TYPE_RC35StatusMessage_HC4;
+        }
+        EMS_TxTelegram.offset        = EMS_OFFSET_RC35Set_mode;
+        EMS_TxTelegram.type_validate = EMS_TxTelegram.type;
 
-            /* use this logic if the value is *2
-            char s[5];
-            char s2[5];
-            strlcpy(s, itoa(setpoint >> 1, s2, 10), 5);
-            strlcat(s, ".", sizeof(s));
-            strlcat(s, ((setpoint & 0x01) ? "5" : "0"), 5);
-            myDebug_P(PSTR(" Boiler flow temp %s C, Warm Water power %d %"), s, ww_power);
-            */
+    } else if (model == EMS_DEVICE_FLAG_RC300) {
+        EMS_TxTelegram.offset = EMS_OFFSET_RCPLUSSet_mode;
 
-            myDebug_P(PSTR(" Boiler flow temperature is %d C"), setpoint);
+        if (hc_num == 1) {
+            EMS_TxTelegram.type               = EMS_TYPE_RCPLUSSet;
+            EMS_TxTelegram.comparisonPostRead = EMS_TYPE_RCPLUSStatusMessage_HC1;
+        } else if (hc_num == 2) {
+            EMS_TxTelegram.type               = EMS_TYPE_RCPLUSSet + 1;
+            EMS_TxTelegram.comparisonPostRead = EMS_TYPE_RCPLUSStatusMessage_HC2;
+        } else if (hc_num == 3) {
+            EMS_TxTelegram.type               = EMS_TYPE_RCPLUSSet + 2;
+            EMS_TxTelegram.comparisonPostRead = EMS_TYPE_RCPLUSStatusMessage_HC3;
+        } else if (hc_num == 4) {
+            EMS_TxTelegram.type               = EMS_TYPE_RCPLUSSet + 3;
+            EMS_TxTelegram.comparisonPostRead = EMS_TYPE_RCPLUSStatusMessage_HC4;
         }
-    }
-}
 
-/**
- * process_RCTime - type 0x06 - date and time from a thermostat - 14 bytes long
- * common for all thermostats
- */
-void _process_RCTime(_EMS_RxTelegram * EMS_RxTelegram) {
-    if ((EMS_Thermostat.device_flags == EMS_DEVICE_FLAG_EASY)) {
-        return; // not supported
+        EMS_TxTelegram.type_validate = EMS_ID_NONE; // don't validate after the write
     }
 
-    // render time to HH:MM:SS DD/MM/YYYY
-    char time_sp[25];
-    char buffer[4];
-
-    strlcpy(time_sp, _smallitoa(EMS_RxTelegram->data[2], buffer), sizeof(time_sp)); // hour
-    strlcat(time_sp, ":", sizeof(time_sp));
-    strlcat(time_sp, _smallitoa(EMS_RxTelegram->data[4], buffer), sizeof(time_sp)); // minute
-    strlcat(time_sp, ":", sizeof(time_sp));
-    strlcat(time_sp, _smallitoa(EMS_RxTelegram->data[5], buffer), sizeof(time_sp)); // second
-    strlcat(time_sp, " ", sizeof(time_sp));
-    strlcat(time_sp, _smallitoa(EMS_RxTelegram->data[3], buffer), sizeof(time_sp)); // day
-    strlcat(time_sp, "/", sizeof(time_sp));
-    strlcat(time_sp, _smallitoa(EMS_RxTelegram->data[1], buffer), sizeof(time_sp)); // month
-    strlcat(time_sp, "/", sizeof(time_sp));
-    strlcat(time_sp, itoa(EMS_RxTelegram->data[0] + 2000, buffer, 10), sizeof(time_sp)); // year
+    EMS_TxTelegram.comparisonOffset = EMS_TxTelegram.offset;
+    EMS_TxTelegram.comparisonValue  = EMS_TxTelegram.dataValue;
 
-    strlcpy(EMS_Thermostat.datetime, time_sp, sizeof(time_sp)); // store
+    EMS_TxQueue.push(EMS_TxTelegram);
 }
 
-/*
- * Clear devices list
+/**
+ * Set the warm water temperature 0x33
  */
-void ems_clearDeviceList() {
-    Devices.clear();
-
-    for (uint8_t i = 0; i < EMS_SYS_DEVICEMAP_LENGTH; i++) {
-        EMS_Sys_Status.emsDeviceMap[i] = 0x00;
+void ems_setWarmWaterTemp(uint8_t temperature) {
+    // check for invalid temp values
+    if ((temperature < 30) || (temperature > EMS_BOILER_TAPWATER_TEMPERATURE_MAX)) {
+        return;
     }
-}
 
-/*
- * add an EMS device to our list of detected devices if its unique
- * returns true if already in list
- */
-bool _addDevice(_EMS_DEVICE_TYPE device_type, uint8_t product_id, uint8_t device_id, const char * device_desc_p, const char * version) {
-    _Detected_Device device;
+    myDebug_P(PSTR("Setting boiler warm water temperature to %d C"), temperature);
 
-    // check for duplicates
-    // a combi of product_id and device_id make it unique
-    for (std::list<_Detected_Device>::iterator it = Devices.begin(); it != Devices.end(); ++it) {
-        if (((it)->product_id == product_id) && ((it)->device_id == device_id)) {
-            return (true); // it already exists in the list, don't add
-        }
-    }
+    _EMS_TxTelegram EMS_TxTelegram = EMS_TX_TELEGRAM_NEW; // create new Tx
+    EMS_TxTelegram.timestamp       = millis();            // set timestamp
+    EMS_Sys_Status.txRetryCount    = 0;                   // reset retry counter
 
-    // create a new record and add it to list
-    device.device_type   = device_type;
-    device.product_id    = product_id;
-    device.device_id     = device_id;
-    device.device_desc_p = device_desc_p; // pointer to the description in the EMS_Devices table
-    strlcpy(device.version, version, sizeof(device.version));
-    device.known = (device_type != EMS_DEVICE_TYPE_UNKNOWN);
-    Devices.push_back(device);
+    EMS_TxTelegram.action    = EMS_TX_TELEGRAM_WRITE;
+    EMS_TxTelegram.dest      = EMS_Boiler.device_id;
+    EMS_TxTelegram.type      = EMS_TYPE_UBAParameterWW;
+    EMS_TxTelegram.offset    = EMS_OFFSET_UBAParameterWW_wwtemp;
+    EMS_TxTelegram.length    = EMS_MIN_TELEGRAM_LENGTH;
+    EMS_TxTelegram.dataValue = temperature; // int value to compare against
 
-    char line[500];
-    strlcpy(line, "New EMS device recognized as a ", sizeof(line));
+    EMS_TxTelegram.type_validate      = EMS_TYPE_UBAParameterWW; // validate
+    EMS_TxTelegram.comparisonOffset   = EMS_OFFSET_UBAParameterWW_wwtemp;
+    EMS_TxTelegram.comparisonValue    = temperature;
+    EMS_TxTelegram.comparisonPostRead = EMS_TYPE_UBAParameterWW;
 
-    // get type as a string
-    char type_s[50];
-    if (ems_getDeviceTypeDescription(device_id, type_s)) {
-        strlcat(line, type_s, sizeof(line));
-    } else {
-        strlcat(line, "?", sizeof(line));
-    }
+    EMS_TxQueue.push(EMS_TxTelegram);
+}
 
-    char tmp[6] = {0}; // for formatting numbers
+/**
+ * Set the boiler flow temp
+ */
+void ems_setFlowTemp(uint8_t temperature) {
+    myDebug_P(PSTR("Setting boiler flow temperature to %d C"), temperature);
 
-    if (device_desc_p != nullptr) {
-        strlcat(line, ": ", sizeof(line));
-        strlcat(line, device_desc_p, sizeof(line));
-    }
+    _EMS_TxTelegram EMS_TxTelegram = EMS_TX_TELEGRAM_NEW; // create new Tx
+    EMS_TxTelegram.timestamp       = millis();            // set timestamp
+    EMS_Sys_Status.txRetryCount    = 0;                   // reset retry counter
 
-    strlcat(line, " (DeviceID:0x", sizeof(line));
-    strlcat(line, _hextoa(device_id, tmp), sizeof(line));
-    strlcat(line, " ProductID:", sizeof(line));
-    strlcat(line, itoa(product_id, tmp, 10), sizeof(line));
-    strlcat(line, " Version:", sizeof(line));
-    strlcat(line, version, sizeof(line));
-    strlcat(line, ")", sizeof(line));
+    EMS_TxTelegram.action    = EMS_TX_TELEGRAM_WRITE;
+    EMS_TxTelegram.dest      = EMS_Boiler.device_id;
+    EMS_TxTelegram.type      = EMS_TYPE_UBASetPoints;
+    EMS_TxTelegram.offset    = EMS_OFFSET_UBASetPoints_flowtemp;
+    EMS_TxTelegram.length    = EMS_MIN_TELEGRAM_LENGTH;
+    EMS_TxTelegram.dataValue = temperature; // int value to compare against
 
-    myDebug(line); // print it
+    EMS_TxTelegram.type_validate      = EMS_TYPE_UBASetPoints; // validate
+    EMS_TxTelegram.comparisonOffset   = EMS_OFFSET_UBASetPoints_flowtemp;
+    EMS_TxTelegram.comparisonValue    = temperature;
+    EMS_TxTelegram.comparisonPostRead = EMS_TYPE_UBASetPoints;
 
-    return false; // added, wasn't a duplicate
+    EMS_TxQueue.push(EMS_TxTelegram);
 }
 
 /**
- * type 0x07 - shows us the connected EMS devices
- * e.g. 08 00 07 00 0B 80 00 00 00 00 00 00 00 00 00 00 00 (CRC=47) #data=13  
- * Junkers is 15 (I think)
+ * Set the warm water mode to comfort to Eco/Comfort
+ * 1 = Hot, 2 = Eco, 3 = Intelligent
  */
-void _process_UBADevices(_EMS_RxTelegram * EMS_RxTelegram) {
-    if (EMS_RxTelegram->data_length > EMS_SYS_DEVICEMAP_LENGTH) {
-        return; // should be 13 or 15 bytes long
+void ems_setWarmWaterModeComfort(uint8_t comfort) {
+    _EMS_TxTelegram EMS_TxTelegram = EMS_TX_TELEGRAM_NEW; // create new Tx
+    EMS_TxTelegram.timestamp       = millis();            // set timestamp
+    EMS_Sys_Status.txRetryCount    = 0;                   // reset retry counter
+
+    if (comfort == 1) {
+        myDebug_P(PSTR("Setting boiler warm water comfort mode to Hot"));
+        EMS_TxTelegram.dataValue = EMS_VALUE_UBAParameterWW_wwComfort_Hot;
+    } else if (comfort == 2) {
+        myDebug_P(PSTR("Setting boiler warm water comfort mode to Eco"));
+        EMS_TxTelegram.dataValue = EMS_VALUE_UBAParameterWW_wwComfort_Eco;
+    } else if (comfort == 3) {
+        myDebug_P(PSTR("Setting boiler warm water comfort mode to Intelligent"));
+        EMS_TxTelegram.dataValue = EMS_VALUE_UBAParameterWW_wwComfort_Intelligent;
+    } else {
+        return; // invalid comfort value
     }
 
-    for (uint8_t data_byte = 0; data_byte < EMS_RxTelegram->data_length; data_byte++) {
-        uint8_t byte       = EMS_RxTelegram->data[data_byte];
-        uint8_t saved_byte = EMS_Sys_Status.emsDeviceMap[data_byte];
+    EMS_TxTelegram.action        = EMS_TX_TELEGRAM_WRITE;
+    EMS_TxTelegram.dest          = EMS_Boiler.device_id;
+    EMS_TxTelegram.type          = EMS_TYPE_UBAParameterWW;
+    EMS_TxTelegram.offset        = EMS_OFFSET_UBAParameterWW_wwComfort;
+    EMS_TxTelegram.length        = EMS_MIN_TELEGRAM_LENGTH;
+    EMS_TxTelegram.type_validate = EMS_ID_NONE; // don't validate
 
-        // see if this matches what we already have stored
-        if (byte != saved_byte) {
-            // we have something new
-            EMS_Sys_Status.emsDeviceMap[data_byte] = byte; // save new value
-            // go through all bits
-            // myDebug("Byte #%d 0x%02X", data_byte, byte); // for debugging
-            if (byte) {
-                for (uint8_t bit = 0; bit < 8; bit++) {
-                    if ((byte & 0x01) && ((saved_byte & 0x01) == 0)) {
-                        uint8_t device_id = ((data_byte + 1) * 8) + bit;
-                        if (device_id != EMS_ID_ME) {
-                            // myDebug("[EMS] Detected new EMS Device with ID 0x%02X", device_id);
-                            if (!ems_getTxDisabled()) {
-                                ems_doReadCommand(EMS_TYPE_Version, device_id); // get version, but ignore ourselves
-                            }
-                        }
-                    }
-                    byte       = byte >> 1;
-                    saved_byte = saved_byte >> 1;
-                }
-            }
-        }
-    }
+    EMS_TxQueue.push(EMS_TxTelegram);
 }
 
 /**
- * type 0x02 - get the version and type of an EMS device
- * look up known devices via the product id and make it active if not already setup
+ * Activate / De-activate the Warm Water 0x33
+ * true = on, false = off
  */
-void _process_Version(_EMS_RxTelegram * EMS_RxTelegram) {
-    // ignore short messages that we can't interpret
-    if (EMS_RxTelegram->data_length < 3) {
-        return;
-    }
+void ems_setWarmWaterActivated(bool activated) {
+    myDebug_P(PSTR("Setting boiler warm water %s"), activated ? "on" : "off");
 
-    uint8_t offset = 0;
+    _EMS_TxTelegram EMS_TxTelegram = EMS_TX_TELEGRAM_NEW; // create new Tx
+    EMS_TxTelegram.timestamp       = millis();            // set timestamp
+    EMS_Sys_Status.txRetryCount    = 0;                   // reset retry counter
 
-    // check for 2nd subscriber
-    // e.g. 18 0B 02 00 00 00 00 5E 02 01
-    if (EMS_RxTelegram->data[0] == 0x00) {
-        // see if we have a 2nd subscriber
-        if (EMS_RxTelegram->data[3] != 0x00) {
-            offset = 3;
-        } else {
-            return; // ignore whole telegram
-        }
-    }
+    EMS_TxTelegram.action        = EMS_TX_TELEGRAM_WRITE;
+    EMS_TxTelegram.dest          = EMS_Boiler.device_id;
+    EMS_TxTelegram.type          = EMS_TYPE_UBAParameterWW;
+    EMS_TxTelegram.offset        = EMS_OFFSET_UBAParameterWW_wwactivated;
+    EMS_TxTelegram.length        = EMS_MIN_TELEGRAM_LENGTH;
+    EMS_TxTelegram.type_validate = EMS_ID_NONE;               // don't validate
+    EMS_TxTelegram.dataValue     = (activated ? 0xFF : 0x00); // 0xFF is on, 0x00 is off
 
-    uint8_t device_id = EMS_RxTelegram->src; // device ID
+    EMS_TxQueue.push(EMS_TxTelegram);
+}
 
-    // get version as XX.XX
-    char version[10] = {0};
-    char buf[6]      = {0};
-    strlcpy(version, _smallitoa(EMS_RxTelegram->data[offset + 1], buf), sizeof(version));
-    strlcat(version, ".", sizeof(version));
-    strlcat(version, _smallitoa(EMS_RxTelegram->data[offset + 2], buf), sizeof(version));
+/**
+ * Activate / De-activate the Warm Tap Water
+ * true = on, false = off
+ * Using the type 0x1D to put the boiler into Test mode. This may be shown on the boiler with a flashing 'T'
+ */
+void ems_setWarmTapWaterActivated(bool activated) {
+    myDebug_P(PSTR("Setting boiler warm tap water %s"), activated ? "on" : "off");
 
-    // scan through known devices matching the productid
-    uint8_t product_id = EMS_RxTelegram->data[offset];
-    uint8_t i          = 0;
-    bool    typeFound  = false;
-    while (i < _EMS_Devices_max) {
-        if (EMS_Devices[i].product_id == product_id) {
-            typeFound = true; // we have a matching product id. i is the index.
-            break;
-        }
-        i++;
-    }
+    _EMS_TxTelegram EMS_TxTelegram = EMS_TX_TELEGRAM_NEW; // create new Tx
+    EMS_TxTelegram.timestamp       = millis();            // set timestamp
+    EMS_Sys_Status.txRetryCount    = 0;                   // reset retry counter
 
-    // if not found, just add it
-    if (!typeFound) {
-        (void)_addDevice(EMS_DEVICE_TYPE_UNKNOWN, product_id, device_id, nullptr, version);
-        return;
+    // clear Tx to make sure all data is set to 0x00
+    for (int i = 0; (i < EMS_MAX_TELEGRAM_LENGTH); i++) {
+        EMS_TxTelegram.data[i] = 0x00;
     }
 
-    const char *     device_desc_p = (EMS_Devices[i].device_desc); // pointer to the full description of the device
-    _EMS_DEVICE_TYPE type          = EMS_Devices[i].type;          // type
+    EMS_TxTelegram.action = EMS_TX_TELEGRAM_WRITE;
+    EMS_TxTelegram.dest   = EMS_Boiler.device_id;
+    EMS_TxTelegram.type   = EMS_TYPE_UBAFunctionTest;
+    EMS_TxTelegram.offset = 0;
 
-    // we recognized it, see if we already have it in our recognized list
-    if (_addDevice(type, product_id, device_id, device_desc_p, version)) {
-        return; // already in list
-    }
+    EMS_TxTelegram.type_validate      = EMS_TxTelegram.type;
+    EMS_TxTelegram.comparisonOffset   = 0;                   // 1st byte
+    EMS_TxTelegram.comparisonValue    = (activated ? 0 : 1); // value is 1 if in Test mode (not activated)
+    EMS_TxTelegram.comparisonPostRead = EMS_TxTelegram.type;
 
-    uint8_t flags = EMS_Devices[i].flags; // its a new entry, set the specifics
+    // create header
+    EMS_TxTelegram.data[0] = EMS_ID_ME;             // src
+    EMS_TxTelegram.data[1] = EMS_TxTelegram.dest;   // dest
+    EMS_TxTelegram.data[2] = EMS_TxTelegram.type;   // type
+    EMS_TxTelegram.data[3] = EMS_TxTelegram.offset; // offset
 
-    if (type == EMS_DEVICE_TYPE_BOILER) {
-        EMS_Boiler.device_id     = device_id;
-        EMS_Boiler.product_id    = product_id;
-        EMS_Boiler.device_flags  = flags;
-        EMS_Boiler.device_desc_p = device_desc_p;
-        strlcpy(EMS_Boiler.version, version, sizeof(EMS_Boiler.version));
-        ems_getBoilerValues(); // get Boiler values that we would usually have to wait for
-    } else if (type == EMS_DEVICE_TYPE_THERMOSTAT) {
-        EMS_Thermostat.device_id       = device_id;
-        EMS_Thermostat.device_flags    = (flags & 0x7F); // remove 7th bit
-        EMS_Thermostat.write_supported = (flags & EMS_DEVICE_FLAG_NO_WRITE) == 0;
-        EMS_Thermostat.product_id      = product_id;
-        EMS_Thermostat.device_desc_p   = device_desc_p;
-        strlcpy(EMS_Thermostat.version, version, sizeof(EMS_Thermostat.version));
-        ems_getThermostatValues(); // get Thermostat values
-    } else if (type == EMS_DEVICE_TYPE_SOLAR) {
-        EMS_SolarModule.device_id     = device_id;
-        EMS_SolarModule.product_id    = product_id;
-        EMS_SolarModule.device_flags  = flags;
-        EMS_SolarModule.device_desc_p = device_desc_p;
-        strlcpy(EMS_SolarModule.version, version, sizeof(EMS_SolarModule.version));
-        ems_getSolarModuleValues(); // fetch Solar Module values
-    } else if (type == EMS_DEVICE_TYPE_HEATPUMP) {
-        EMS_HeatPump.device_id     = device_id;
-        EMS_HeatPump.product_id    = product_id;
-        EMS_HeatPump.device_flags  = flags;
-        EMS_HeatPump.device_desc_p = device_desc_p;
-        strlcpy(EMS_HeatPump.version, version, sizeof(EMS_HeatPump.version));
-    } else if (type == EMS_DEVICE_TYPE_MIXING) {
-        EMS_Mixing.device_id     = device_id;
-        EMS_Mixing.product_id    = product_id;
-        EMS_Mixing.device_desc_p = device_desc_p;
-        EMS_Mixing.device_flags  = flags;
-        EMS_Mixing.detected      = true;
-        ems_doReadCommand(EMS_TYPE_MMPLUSStatusMessage_HC1, device_id); // fetch MM values
+    // we use the special test mode 0x1D for this. Setting the first data to 5A puts the system into test mode and
+    // a setting of 0x00 puts it back into normal operarting mode
+    // when in test mode we're able to mess around with the 3-way valve settings
+    if (!activated) {
+        // on
+        EMS_TxTelegram.data[4] = 0x5A; // test mode on
+        EMS_TxTelegram.data[5] = 0x00; // burner output 0%
+        EMS_TxTelegram.data[7] = 0x64; // boiler pump capacity 100%
+        EMS_TxTelegram.data[8] = 0xFF; // 3-way valve hot water only
+        EMS_TxTelegram.length  = 22;   // 17 bytes of data including header and CRC. We send all zeros just to be sure.
+    } else {
+        // get out of test mode
+        // telegram: 0B 08 1D 00 00
+        EMS_TxTelegram.data[4] = 0x00; // test mode off
+        EMS_TxTelegram.length  = EMS_MIN_TELEGRAM_LENGTH;
     }
-}
 
-/*
- * Figure out the boiler and thermostat types
- */
-void ems_discoverModels() {
-    //myDebug_P(PSTR("Starting auto discover of EMS devices..."));
-    ems_doReadCommand(EMS_TYPE_UBADevices, EMS_ID_BOILER);
+    EMS_TxQueue.push(EMS_TxTelegram); // add to queue
 }
 
 /**
- * Print the Tx queue - for debugging
+ * Start up sequence for UBA Master, hopefully to initialize a handshake
+ * Still experimental and not used yet!
  */
-void ems_printTxQueue() {
-    _EMS_TxTelegram EMS_TxTelegram;
-    char            sType[20] = {0};
-
-    if (EMS_TxQueue.size() == 0) {
-        myDebug_P(PSTR("Tx queue is empty"));
-        return;
+void ems_startupTelegrams() {
+    if ((ems_getTxDisabled()) || (!ems_getBusConnected())) {
+        myDebug_P(PSTR("Unable to send startup sequence when in listen mode or the bus is disabled"));
     }
 
-    myDebug_P(PSTR("Tx queue (%d/%d)"), EMS_TxQueue.size(), EMS_TxQueue.capacity);
-
-    for (byte i = 0; i < EMS_TxQueue.size(); i++) {
-        EMS_TxTelegram = EMS_TxQueue[i]; // retrieves the i-th element from the buffer without removing it
-
-        // get action
-        if (EMS_TxTelegram.action == EMS_TX_TELEGRAM_WRITE) {
-            strlcpy(sType, "write", sizeof(sType));
-        } else if (EMS_TxTelegram.action == EMS_TX_TELEGRAM_READ) {
-            strlcpy(sType, "read", sizeof(sType));
-        } else if (EMS_TxTelegram.action == EMS_TX_TELEGRAM_VALIDATE) {
-            strlcpy(sType, "validate", sizeof(sType));
-        } else if (EMS_TxTelegram.action == EMS_TX_TELEGRAM_RAW) {
-            strlcpy(sType, "raw", sizeof(sType));
-        } else {
-            strlcpy(sType, "?", sizeof(sType));
-        }
+    myDebug_P(PSTR("Sending startup sequence..."));
+    char s[20] = {0};
 
-        char     addedTime[15] = {0};
-        uint32_t upt           = EMS_TxTelegram.timestamp;
-        snprintf(addedTime,
-                 sizeof(addedTime),
-                 "(%02d:%02d:%02d)",
-                 (uint8_t)((upt / (1000 * 60 * 60)) % 24),
-                 (uint8_t)((upt / (1000 * 60)) % 60),
-                 (uint8_t)((upt / 1000) % 60));
+    // Write type 0x1D to get out of function test mode
+    snprintf(s, sizeof(s), "%02X %02X 1D 00 00", EMS_ID_ME, EMS_Boiler.device_id);
+    ems_sendRawTelegram(s);
 
-        myDebug_P(PSTR(" [%d] action=%s dest=0x%02x type=0x%02x offset=%d length=%d dataValue=%d "
-                       "comparisonValue=%d type_validate=0x%02x comparisonPostRead=0x%02x @ %s"),
-                  i + 1,
-                  sType,
-                  EMS_TxTelegram.dest & 0x7F,
-                  EMS_TxTelegram.type,
-                  EMS_TxTelegram.offset,
-                  EMS_TxTelegram.length,
-                  EMS_TxTelegram.dataValue,
-                  EMS_TxTelegram.comparisonValue,
-                  EMS_TxTelegram.type_validate,
-                  EMS_TxTelegram.comparisonPostRead,
-                  addedTime);
-    }
+    // Read type 0x01
+    snprintf(s, sizeof(s), "%02X %02X 01 00 1B", EMS_ID_ME, EMS_Boiler.device_id | 0x80);
+    ems_sendRawTelegram(s);
 }
 
 /**
- * Generic function to return various settings from the thermostat
- * This is called manually to fetch values which don't come from broadcast messages
+ * Test parsing of telgrams by injecting fake telegrams and simulating the response
  */
-void ems_getThermostatValues() {
-    if (!ems_getThermostatEnabled()) {
+void ems_testTelegram(uint8_t test_num) {
+#ifdef TESTS
+    if ((test_num == 0) || (test_num > _TEST_DATA_max)) {
+        myDebug_P(PSTR("Invalid test. Pick between 1 and %d"), _TEST_DATA_max);
         return;
     }
 
-    uint8_t device_flags = EMS_Thermostat.device_flags;
-    uint8_t device_id    = EMS_Thermostat.device_id;
-    uint8_t statusMsg, opMode;
-
-    switch (device_flags) {
-    case EMS_DEVICE_FLAG_RC20:
-        ems_doReadCommand(EMS_TYPE_RC20StatusMessage, device_id); // to get the temps
-        ems_doReadCommand(EMS_TYPE_RC20Set, device_id);           // to get the mode
-        break;
-    case EMS_DEVICE_FLAG_RC30:
-        ems_doReadCommand(EMS_TYPE_RC30StatusMessage, device_id); // to get the temps
-        ems_doReadCommand(EMS_TYPE_RC30Set, device_id);           // to get the mode
-        break;
-    case EMS_DEVICE_FLAG_EASY:
-        ems_doReadCommand(EMS_TYPE_EasyStatusMessage, device_id);
-        break;
-    case EMS_DEVICE_FLAG_RC35:
-        for (uint8_t hc_num = 1; hc_num <= EMS_THERMOSTAT_MAXHC; hc_num++) {
-            if (hc_num == 1) {
-                statusMsg = EMS_TYPE_RC35StatusMessage_HC1;
-                opMode    = EMS_TYPE_RC35Set_HC1;
-            } else if (hc_num == 2) {
-                statusMsg = EMS_TYPE_RC35StatusMessage_HC2;
-                opMode    = EMS_TYPE_RC35Set_HC2;
-            } else if (hc_num == 3) {
-                statusMsg = EMS_TYPE_RC35StatusMessage_HC3;
-                opMode    = EMS_TYPE_RC35Set_HC3;
-            } else if (hc_num == 4) {
-                statusMsg = EMS_TYPE_RC35StatusMessage_HC4;
-                opMode    = EMS_TYPE_RC35Set_HC4;
-            }
-            ems_doReadCommand(statusMsg, device_id); // to get the temps
-            ems_doReadCommand(opMode, device_id);    // to get the mode
-        }
-        break;
-    case EMS_DEVICE_FLAG_RC300:
-        ems_doReadCommand(EMS_TYPE_RCPLUSStatusMessage_HC1, device_id);
-        ems_doReadCommand(EMS_TYPE_RCPLUSStatusMessage_HC2, device_id);
-        ems_doReadCommand(EMS_TYPE_RCPLUSStatusMessage_HC3, device_id);
-        ems_doReadCommand(EMS_TYPE_RCPLUSStatusMessage_HC4, device_id);
-    default:
-        break;
+    // stop all Tx
+    if (!EMS_TxQueue.isEmpty()) {
+        EMS_TxQueue.clear();
+        EMS_Sys_Status.emsTxStatus = EMS_TX_STATUS_IDLE;
     }
 
-    ems_doReadCommand(EMS_TYPE_RCTime, device_id); // get Thermostat time
-}
+    static uint8_t * telegram = (uint8_t *)malloc(EMS_MAX_TELEGRAM_LENGTH); // warning, memory is never set free so use only for debugging
 
-/**
- * Generic function to return various settings from the thermostat
- */
-void ems_getBoilerValues() {
-    ems_doReadCommand(EMS_TYPE_UBAMonitorFast, EMS_Boiler.device_id);        // get boiler stats, instead of waiting 10secs for the broadcast
-    ems_doReadCommand(EMS_TYPE_UBAMonitorSlow, EMS_Boiler.device_id);        // get more boiler stats, instead of waiting 60secs for the broadcast
-    ems_doReadCommand(EMS_TYPE_UBAParameterWW, EMS_Boiler.device_id);        // get Warm Water values
-    ems_doReadCommand(EMS_TYPE_UBAParametersMessage, EMS_Boiler.device_id);  // get MC10 boiler values
-    ems_doReadCommand(EMS_TYPE_UBATotalUptimeMessage, EMS_Boiler.device_id); // get uptime from boiler
-}
+    char telegram_string[200];
+    strlcpy(telegram_string, TEST_DATA[test_num - 1], sizeof(telegram_string));
 
-/*
- * Get other values from EMS devices
- */
-void ems_getSolarModuleValues() {
-    if (ems_getSolarModuleEnabled()) {
-        if (EMS_SolarModule.device_flags == EMS_DEVICE_FLAG_SM10) {
-            ems_doReadCommand(EMS_TYPE_SM10Monitor, EMS_ID_SM); // fetch all from SM10Monitor
-        } else if (EMS_SolarModule.device_flags == EMS_DEVICE_FLAG_SM100) {
-            ems_doReadCommand(EMS_TYPE_SM100Monitor, EMS_ID_SM); // fetch all from SM100Monitor
+    uint8_t length = 0;
+    char *  p;
+    char    value[10] = {0};
+
+    // get first value, which should be the src
+    if ((p = strtok(telegram_string, " ,"))) {
+        strlcpy(value, p, sizeof(value));
+        telegram[0] = (uint8_t)strtol(value, 0, 16);
+    }
+
+    // and interate until end
+    while (p != 0) {
+        if ((p = strtok(nullptr, " ,"))) {
+            strlcpy(value, p, sizeof(value));
+            uint8_t val        = (uint8_t)strtol(value, 0, 16);
+            telegram[++length] = val;
         }
     }
+
+    length++;                                                // this is the total amount of bytes
+    telegram[length] = _crcCalculator(telegram, length + 1); // add the CRC
+
+    myDebug_P(PSTR("[TEST %d] Injecting telegram %s"), test_num, TEST_DATA[test_num - 1]);
+
+    // go an parse it
+    ems_parseTelegram(telegram, length + 1, true); // include CRC in length
+#else
+    myDebug_P(PSTR("Firmware not compiled with test data. Use -DTESTS"));
+#endif
 }
 
 /**
- * takes a device_id and tries to find the corresponding type name (e.g. Boiler)
- * If it can't find it, it will use the hex value and function returns false
+ * Recognized EMS types and the functions they call to process the telegrams
  */
-bool ems_getDeviceTypeDescription(uint8_t device_id, char * buffer) {
-    uint8_t i         = 0;
-    bool    typeFound = false;
+const _EMS_Type EMS_Types[] = {
 
-    // scan through known ID types
-    while (i < _EMS_Devices_Types_max) {
-        if (EMS_Devices_Types[i].device_id == device_id) {
-            typeFound = true; // we have a match
-            break;
-        }
-        i++;
-    }
+    // common
+    {EMS_DEVICE_UPDATE_FLAG_NONE, EMS_TYPE_Version, "Version", _process_Version},
+    {EMS_DEVICE_UPDATE_FLAG_NONE, EMS_TYPE_UBADevices, "UBADevices", _process_UBADevices},
+    {EMS_DEVICE_UPDATE_FLAG_NONE, EMS_TYPE_RCTime, "RCTime", _process_RCTime},
+    {EMS_DEVICE_UPDATE_FLAG_THERMOSTAT, EMS_TYPE_RCOutdoorTempMessage, "RCOutdoorTempMessage", _process_RCOutdoorTempMessage},
 
-    if (typeFound) {
-        strlcpy(buffer, EMS_Devices_Types[i].device_type_string, 30);
-        return true;
-    } else {
-        // print as hex value
-        char hexbuffer[16] = {0};
-        strlcpy(buffer, "0x", 30);
-        strlcat(buffer, _hextoa(device_id, hexbuffer), 30);
-        return false;
-    }
-}
+    // UBA/Boiler
+    {EMS_DEVICE_UPDATE_FLAG_BOILER, EMS_TYPE_UBAMonitorFast, "UBAMonitorFast", _process_UBAMonitorFast},
+    {EMS_DEVICE_UPDATE_FLAG_BOILER, EMS_TYPE_UBAMonitorSlow, "UBAMonitorSlow", _process_UBAMonitorSlow},
+    {EMS_DEVICE_UPDATE_FLAG_BOILER, EMS_TYPE_UBAMonitorWWMessage, "UBAMonitorWWMessage", _process_UBAMonitorWWMessage},
+    {EMS_DEVICE_UPDATE_FLAG_BOILER, EMS_TYPE_UBAParameterWW, "UBAParameterWW", _process_UBAParameterWW},
+    {EMS_DEVICE_UPDATE_FLAG_BOILER, EMS_TYPE_UBATotalUptimeMessage, "UBATotalUptimeMessage", _process_UBATotalUptimeMessage},
+    {EMS_DEVICE_UPDATE_FLAG_BOILER, EMS_TYPE_UBAParametersMessage, "UBAParametersMessage", _process_UBAParametersMessage},
+    {EMS_DEVICE_UPDATE_FLAG_BOILER, EMS_TYPE_UBASetPoints, "UBASetPoints", _process_SetPoints},
 
+    // UBA/Boiler EMS+
+    {EMS_DEVICE_UPDATE_FLAG_BOILER, EMS_TYPE_UBAOutdoorTemp, "UBAOutdoorTemp", _process_UBAOutdoorTemp},
+    {EMS_DEVICE_UPDATE_FLAG_BOILER, EMS_TYPE_UBAMonitorFast2, "UBAMonitorFast2", _process_UBAMonitorFast2},
+    {EMS_DEVICE_UPDATE_FLAG_BOILER, EMS_TYPE_UBAMonitorSlow2, "UBAMonitorSlow2", _process_UBAMonitorSlow2},
 
-/**
- * returns current device details as a string for known thermostat,boiler,solar and heatpump
- */
-char * ems_getDeviceDescription(_EMS_DEVICE_TYPE device_type, char * buffer, bool name_only) {
-    const uint8_t size    = 128;
-    bool          enabled = false;
-    uint8_t       device_id;
-    uint8_t       product_id;
-    char *        version;
-    const char *  device_desc_p;
+    // Solar Module devices
+    {EMS_DEVICE_UPDATE_FLAG_SOLAR, EMS_TYPE_SM10Monitor, "SM10Monitor", _process_SM10Monitor},
+    {EMS_DEVICE_UPDATE_FLAG_SOLAR, EMS_TYPE_SM100Monitor, "SM100Monitor", _process_SM100Monitor},
+    {EMS_DEVICE_UPDATE_FLAG_SOLAR, EMS_TYPE_SM100Status, "SM100Status", _process_SM100Status},
+    {EMS_DEVICE_UPDATE_FLAG_SOLAR, EMS_TYPE_SM100Status2, "SM100Status2", _process_SM100Status2},
+    {EMS_DEVICE_UPDATE_FLAG_SOLAR, EMS_TYPE_SM100Energy, "SM100Energy", _process_SM100Energy},
+    {EMS_DEVICE_UPDATE_FLAG_SOLAR, EMS_TYPE_ISM1StatusMessage, "ISM1StatusMessage", _process_ISM1StatusMessage},
+    {EMS_DEVICE_UPDATE_FLAG_SOLAR, EMS_TYPE_ISM1Set, "ISM1Set", _process_ISM1Set},
 
-    if (device_type == EMS_DEVICE_TYPE_THERMOSTAT) {
-        enabled       = ems_getThermostatEnabled();
-        device_id     = EMS_Thermostat.device_id;
-        product_id    = EMS_Thermostat.product_id;
-        device_desc_p = EMS_Thermostat.device_desc_p;
-        version       = EMS_Thermostat.version;
-    } else if (device_type == EMS_DEVICE_TYPE_BOILER) {
-        enabled       = ems_getBoilerEnabled();
-        device_id     = EMS_Boiler.device_id;
-        product_id    = EMS_Boiler.product_id;
-        device_desc_p = EMS_Boiler.device_desc_p;
-        version       = EMS_Boiler.version;
-    } else if (device_type == EMS_DEVICE_TYPE_SOLAR) {
-        enabled       = ems_getSolarModuleEnabled();
-        device_id     = EMS_SolarModule.device_id;
-        product_id    = EMS_SolarModule.product_id;
-        device_desc_p = EMS_SolarModule.device_desc_p;
-        version       = EMS_SolarModule.version;
-    } else if (device_type == EMS_DEVICE_TYPE_HEATPUMP) {
-        enabled       = ems_getHeatPumpEnabled();
-        device_id     = EMS_HeatPump.device_id;
-        product_id    = EMS_HeatPump.product_id;
-        device_desc_p = EMS_HeatPump.device_desc_p;
-        version       = EMS_HeatPump.version;
-    }
+    // heatpumps
+    {EMS_DEVICE_UPDATE_FLAG_HEATPUMP, EMS_TYPE_HPMonitor1, "HeatPumpMonitor1", _process_HPMonitor1},
+    {EMS_DEVICE_UPDATE_FLAG_HEATPUMP, EMS_TYPE_HPMonitor2, "HeatPumpMonitor2", _process_HPMonitor2},
+
+    // RC10
+    {EMS_DEVICE_UPDATE_FLAG_THERMOSTAT, EMS_TYPE_RC10Set, "RC10Set", _process_RC10Set},
+    {EMS_DEVICE_UPDATE_FLAG_THERMOSTAT, EMS_TYPE_RC10StatusMessage, "RC10StatusMessage", _process_RC10StatusMessage},
+
+    // RC20 and RC20RF
+    {EMS_DEVICE_UPDATE_FLAG_THERMOSTAT, EMS_TYPE_RC20Set, "RC20Set", _process_RC20Set},
+    {EMS_DEVICE_UPDATE_FLAG_THERMOSTAT, EMS_TYPE_RC20StatusMessage, "RC20StatusMessage", _process_RC20StatusMessage},
+
+    // RC30
+    {EMS_DEVICE_UPDATE_FLAG_THERMOSTAT, EMS_TYPE_RC30Set, "RC30Set", _process_RC30Set},
+    {EMS_DEVICE_UPDATE_FLAG_THERMOSTAT, EMS_TYPE_RC30StatusMessage, "RC30StatusMessage", _process_RC30StatusMessage},
+
+    // RC35 and ES71
+    {EMS_DEVICE_UPDATE_FLAG_THERMOSTAT, EMS_TYPE_RC35Set_HC1, "RC35Set_HC1", _process_RC35Set},
+    {EMS_DEVICE_UPDATE_FLAG_THERMOSTAT, EMS_TYPE_RC35StatusMessage_HC1, "RC35StatusMessage_HC1", _process_RC35StatusMessage},
+    {EMS_DEVICE_UPDATE_FLAG_THERMOSTAT, EMS_TYPE_RC35Set_HC2, "RC35Set_HC2", _process_RC35Set},
+    {EMS_DEVICE_UPDATE_FLAG_THERMOSTAT, EMS_TYPE_RC35StatusMessage_HC2, "RC35StatusMessage_HC2", _process_RC35StatusMessage},
+    {EMS_DEVICE_UPDATE_FLAG_THERMOSTAT, EMS_TYPE_RC35Set_HC3, "RC35Set_HC2", _process_RC35Set},
+    {EMS_DEVICE_UPDATE_FLAG_THERMOSTAT, EMS_TYPE_RC35StatusMessage_HC3, "RC35StatusMessage_HC3", _process_RC35StatusMessage},
+    {EMS_DEVICE_UPDATE_FLAG_THERMOSTAT, EMS_TYPE_RC35Set_HC4, "RC35Set_HC4", _process_RC35Set},
+    {EMS_DEVICE_UPDATE_FLAG_THERMOSTAT, EMS_TYPE_RC35StatusMessage_HC4, "RC35StatusMessage_HC4", _process_RC35StatusMessage},
 
-    if (!enabled) {
-        strlcpy(buffer, "<not enabled>", size);
-        return buffer;
-    }
+    // Easy
+    {EMS_DEVICE_UPDATE_FLAG_THERMOSTAT, EMS_TYPE_EasyStatusMessage, "EasyStatusMessage", _process_EasyStatusMessage},
 
-    // assume at this point we have a known device.
-    // get device description
-    if (device_desc_p == nullptr) {
-        strlcpy(buffer, EMS_MODELTYPE_UNKNOWN_STRING, size);
-    } else {
-        strlcpy(buffer, device_desc_p, size);
-    }
+    // Nefit 1010, RC300, RC310 (EMS Plus)
+    {EMS_DEVICE_UPDATE_FLAG_THERMOSTAT, EMS_TYPE_RCPLUSStatusMessage_HC1, "RCPLUSStatusMessage_HC1", _process_RCPLUSStatusMessage},
+    {EMS_DEVICE_UPDATE_FLAG_THERMOSTAT, EMS_TYPE_RCPLUSStatusMessage_HC2, "RCPLUSStatusMessage_HC2", _process_RCPLUSStatusMessage},
+    {EMS_DEVICE_UPDATE_FLAG_THERMOSTAT, EMS_TYPE_RCPLUSStatusMessage_HC3, "RCPLUSStatusMessage_HC3", _process_RCPLUSStatusMessage},
+    {EMS_DEVICE_UPDATE_FLAG_THERMOSTAT, EMS_TYPE_RCPLUSStatusMessage_HC4, "RCPLUSStatusMessage_HC4", _process_RCPLUSStatusMessage},
+    {EMS_DEVICE_UPDATE_FLAG_THERMOSTAT, EMS_TYPE_RCPLUSSet, "RCPLUSSetMessage", _process_RCPLUSSetMessage},
+    {EMS_DEVICE_UPDATE_FLAG_THERMOSTAT, EMS_TYPE_RCPLUSStatusMode, "RCPLUSStatusMode", _process_RCPLUSStatusMode},
 
-    if (name_only) {
-        return buffer; // only interested in the model name
-    }
+    // Junkers FR10
+    {EMS_DEVICE_UPDATE_FLAG_THERMOSTAT, EMS_TYPE_JunkersStatusMessage, "JunkersStatusMessage", _process_JunkersStatusMessage},
 
-    strlcat(buffer, " (DeviceID:0x", size);
-    char tmp[6] = {0};
-    strlcat(buffer, _hextoa(device_id, tmp), size);
-    strlcat(buffer, " ProductID:", size);
-    strlcat(buffer, itoa(product_id, tmp, 10), size);
-    strlcat(buffer, " Version:", size);
-    strlcat(buffer, version, size);
-    strlcat(buffer, ")", size);
+    // Mixing devices
+    {EMS_DEVICE_UPDATE_FLAG_MIXING, EMS_TYPE_MMPLUSStatusMessage_HC1, "MMPLUSStatusMessage_HC1", _process_MMPLUSStatusMessage},
+    {EMS_DEVICE_UPDATE_FLAG_MIXING, EMS_TYPE_MMPLUSStatusMessage_HC2, "MMPLUSStatusMessage_HC2", _process_MMPLUSStatusMessage}
 
-    return buffer;
-}
+};
+
+// calculate sizes of arrays at compile time
+uint8_t _EMS_Types_max = ArraySize(EMS_Types);
 
 /**
- * Find the versions of our connected devices
+ * Hash table over EMS_Types so _ems_findType() doesn't have to scan the whole list for each telegram
+ * Each bucket holds the index + 1 of the first EMS_Types entry with that hash (0 is empty), and
+ * EMS_Types_next[] chains entries with the same hash. With the current types no chain is longer than 2.
  */
-void ems_scanDevices() {
-    myDebug_P(PSTR("Started scanning the EMS bus for known devices"));
-
-    std::list<uint8_t> Device_Ids; // create a new list
+#define EMS_TYPES_HASH_SIZE 64 // power of 2, at least the number of EMS_Types
+uint8_t EMS_Types_hash[EMS_TYPES_HASH_SIZE];
+uint8_t EMS_Types_next[ArraySize(EMS_Types)];
 
-    Device_Ids.push_back(EMS_ID_BOILER); // UBAMaster/Boilers - 0x08
-    Device_Ids.push_back(EMS_ID_HP);     // HeatPump - 0x38
-    Device_Ids.push_back(EMS_ID_SM);     // Solar Module - 0x30
-    Device_Ids.push_back(0x09);          // Controllers - 0x09
-    Device_Ids.push_back(0x02);          // Connect - 0x02
-    Device_Ids.push_back(0x48);          // Gateway - 0x48
-    Device_Ids.push_back(0x20);          // Mixing Devices - 0x20, 0x21
-    Device_Ids.push_back(0x21);          // Mixing Devices - 0x20, 0x21
-    Device_Ids.push_back(0x10);          // Thermostats - 0x10, 0x17, 0x18
-    Device_Ids.push_back(0x17);          // Thermostats - 0x10, 0x17, 0x18
-    Device_Ids.push_back(0x18);          // Thermostats - 0x10, 0x17, 0x18
-
-    // remove duplicates and reserved IDs (like our own device)
-    Device_Ids.sort();
-    // Device_Ids.unique();
+static inline uint8_t _ems_hashType(uint16_t type) {
+    return (type ^ (type >> 6)) & (EMS_TYPES_HASH_SIZE - 1);
+}
 
-    // send the read command with Version command
-    for (uint8_t device_id : Device_Ids) {
-        ems_doReadCommand(EMS_TYPE_Version, device_id);
+/**
+ * Build the hash table. Called once from ems_init()
+ * Entries are added from the end so each chain is in EMS_Types order. Types listed twice keep the first one
+ * as the one found, e.g. 0xE5 is both UBAMonitorSlow2 and HeatPumpMonitor2
+ */
+void _ems_hashTypes() {
+    memset(EMS_Types_hash, 0, sizeof(EMS_Types_hash));
+    for (uint8_t i = _EMS_Types_max; i > 0; i--) {
+        uint8_t hash          = _ems_hashType(EMS_Types[i - 1].type);
+        EMS_Types_next[i - 1] = EMS_Types_hash[hash];
+        EMS_Types_hash[hash]  = i;
     }
 }
 
 /**
- * print out contents of the device list that was captured
+ * Find the pointer to the EMS_Types array for a given type ID
+ * or -1 if not found
  */
-void ems_printDevices() {
-    char s[100];
-    char buffer[16] = {0};
-
-    strlcpy(s, "These device IDs are on the EMS Bus:", sizeof(s));
-    strlcat(s, COLOR_BOLD_ON, sizeof(s));
-
-    for (uint8_t data_byte = 0; data_byte < EMS_SYS_DEVICEMAP_LENGTH; data_byte++) {
-        uint8_t byte = EMS_Sys_Status.emsDeviceMap[data_byte];
-        if (byte) {
-            // go through all bits
-            for (uint8_t bit = 0; bit < 8; bit++) {
-                if (byte & 0x01) {
-                    uint8_t device_id = ((data_byte + 1) * 8) + bit;
-                    if (device_id != EMS_ID_ME) {
-                        strlcat(s, " 0x", sizeof(s));
-                        strlcat(s, _hextoa(device_id, buffer), sizeof(s));
-                    }
-                }
-                byte = byte >> 1;
-            }
+int8_t _ems_findType(uint16_t type) {
+    uint8_t i = EMS_Types_hash[_ems_hashType(type)];
+    while (i) {
+        if (EMS_Types[i - 1].type == type) {
+            return i - 1; // we have a match
         }
+        i = EMS_Types_next[i - 1];
     }
 
-    strlcat(s, COLOR_BOLD_OFF, sizeof(s));
-    myDebug_P(PSTR("")); // newline
-    myDebug(s);
-
-    // print out the ones we recognized
-    if (!Devices.empty()) {
-        bool have_unknowns = false;
-        char device_string[100];
-        myDebug_P(PSTR("and %d were recognized by EMS-ESP as:"), Devices.size());
-        for (std::list<_Detected_Device>::iterator it = Devices.begin(); it != Devices.end(); ++it) {
-            if ((it)->known) {
-                strlcpy(device_string, (it)->device_desc_p, sizeof(device_string));
-            } else {
-                strlcpy(device_string, EMS_MODELTYPE_UNKNOWN_STRING, sizeof(device_string)); // Unknown
-                have_unknowns = true;
-            }
+    return -1;
+}
 
-            myDebug_P(PSTR(" %s%s%s (DeviceID:0x%02X ProductID:%d Version:%s)"),
-                      COLOR_BOLD_ON,
-                      device_string,
-                      COLOR_BOLD_OFF,
-                      (it)->device_id,
-                      (it)->product_id,
-                      (it)->version);
-        }
+/**
+ * The last copy of the telegrams that come in regularly, by source, destination, type and offset
+ * Once they are all taken the copy that has gone longest without coming in is re-used, so the ones that keep
+ * coming in stay
+ */
+_EMS_Shadow EMS_Shadows[EMS_SHADOWS_MAX];
 
-        myDebug_P(PSTR("")); // newline
+void _ems_clearShadows() {
+    memset(EMS_Shadows, 0, sizeof(EMS_Shadows));
+}
 
-        if (have_unknowns) {
-            myDebug_P(
-                PSTR("You have a device is that is not yet known by EMS-ESP. Please report this as a GitHub issue so we can expand the EMS device library."));
+static _EMS_Shadow * _ems_findShadow(uint8_t src, uint8_t dest, uint16_t type, uint8_t offset) {
+    for (uint8_t i = 0; i < EMS_SHADOWS_MAX; i++) {
+        if ((EMS_Shadows[i].type == type) && (EMS_Shadows[i].src == src) && (EMS_Shadows[i].dest == dest) && (EMS_Shadows[i].offset == offset)
+            && (EMS_Shadows[i].data_length)) {
+            return &EMS_Shadows[i];
         }
-    } else {
-        myDebug_P(PSTR("No were devices recognized. This may be because Tx is disabled or failing."));
     }
-
-    myDebug_P(PSTR("")); // newline
+    return nullptr;
 }
 
 /**
- * Send a raw telegram to the bus
- * telegram is a string of hex values
+ * an empty slot, or else the copy that came in longest ago
  */
-void ems_sendRawTelegram(char * telegram) {
-    if (EMS_Sys_Status.emsTxDisabled) {
-        if (ems_getLogging() != EMS_SYS_LOGGING_NONE) {
-            myDebug_P(PSTR("in Listen Mode. All Tx is disabled."));
+static _EMS_Shadow * _ems_oldestShadow() {
+    uint32_t      now    = millis();
+    _EMS_Shadow * oldest = &EMS_Shadows[0];
+    for (uint8_t i = 0; i < EMS_SHADOWS_MAX; i++) {
+        if (!EMS_Shadows[i].data_length) {
+            return &EMS_Shadows[i];
         }
-        return;
-    }
-
-    uint8_t count = 0;
-    char *  p;
-    char    value[10] = {0};
-
-    _EMS_TxTelegram EMS_TxTelegram = EMS_TX_TELEGRAM_NEW; // create new Tx
-    EMS_TxTelegram.timestamp       = millis();            // set timestamp
-    EMS_Sys_Status.txRetryCount    = 0;                   // reset retry counter
-
-    // get first value, which should be the src
-    if ((p = strtok(telegram, " ,"))) { // delimiter
-        strlcpy(value, p, sizeof(value));
-        EMS_TxTelegram.data[0] = (uint8_t)strtol(value, 0, 16);
-    }
-    // and interate until end
-    while (p != 0) {
-        if ((p = strtok(nullptr, " ,"))) {
-            strlcpy(value, p, sizeof(value));
-            uint8_t val                  = (uint8_t)strtol(value, 0, 16);
-            EMS_TxTelegram.data[++count] = val;
-            if (count == 1) {
-                EMS_TxTelegram.dest = val;
-            } else if (count == 2) {
-                EMS_TxTelegram.type = val;
-            } else if (count == 3) {
-                EMS_TxTelegram.offset = val;
-            }
+        if ((now - EMS_Shadows[i].timestamp) > (now - oldest->timestamp)) {
+            oldest = &EMS_Shadows[i];
         }
     }
-
-    if (count == 0) {
-        return; // nothing to send
-    }
-
-    EMS_TxTelegram.length        = count + 2;
-    EMS_TxTelegram.type_validate = EMS_ID_NONE;
-    EMS_TxTelegram.action        = EMS_TX_TELEGRAM_RAW;
-
-    // add to Tx queue. Assume it's not full.
-    EMS_TxQueue.push(EMS_TxTelegram);
+    return oldest;
 }
 
 /**
- * Set the temperature of the thermostat
- * hc_num is 1 to 4
- * temptype 0 = normal, 1=night temp, 2=day temp, 3=holiday temp
+ * save the telegram data as the last copy of the telegram, and set shadow to the copy or nullptr if it can't be kept
+ * returns true if it's the same as the copy it replaces
  */
-void ems_setThermostatTemp(float temperature, uint8_t hc_num, uint8_t temptype) {
-    if (!ems_getThermostatEnabled()) {
-        myDebug_P(PSTR("Thermostat not online."));
-        return;
-    }
+bool _ems_shadowTelegram(_EMS_RxTelegram * EMS_RxTelegram, _EMS_Shadow ** shadow) {
+    uint8_t data_length = EMS_RxTelegram->data_length;
 
-    if (!EMS_Thermostat.write_supported) {
-        myDebug_P(PSTR("Write not supported yet for this Thermostat model"));
-        return;
+    *shadow = nullptr;
+    if ((!data_length) || (data_length > EMS_MAX_TELEGRAM_LENGTH)) {
+        return false;
     }
 
-    if (hc_num < 1 || hc_num > EMS_THERMOSTAT_MAXHC) {
-        myDebug_P(PSTR("Invalid HC number"));
-        return;
+    _EMS_Shadow * copy = _ems_findShadow(EMS_RxTelegram->src, EMS_RxTelegram->dest, EMS_RxTelegram->type, EMS_RxTelegram->offset);
+    bool          same = false;
+    if (!copy) {
+        copy          = _ems_oldestShadow();
+        copy->src     = EMS_RxTelegram->src;
+        copy->dest    = EMS_RxTelegram->dest;
+        copy->type    = EMS_RxTelegram->type;
+        copy->offset  = EMS_RxTelegram->offset;
+        copy->changes = 0;
+    } else if (copy->data_length == data_length) {
+        same = (memcmp(copy->data, EMS_RxTelegram->data, data_length) == 0);
     }
 
-    _EMS_TxTelegram EMS_TxTelegram = EMS_TX_TELEGRAM_NEW; // create new Tx
-    EMS_TxTelegram.timestamp       = millis();            // set timestamp
-    EMS_Sys_Status.txRetryCount    = 0;                   // reset retry counter
-
-    uint8_t model     = ems_getThermostatModel();
-    uint8_t device_id = EMS_Thermostat.device_id;
-
-    EMS_TxTelegram.action = EMS_TX_TELEGRAM_WRITE;
-    EMS_TxTelegram.dest   = device_id;
-
-    char s[10] = {0};
-    myDebug_P(PSTR("Setting new thermostat temperature to %s for heating circuit %d type %d (0=auto,1=night,2=day,3=holiday)"),
-              _float_to_char(s, temperature),
-              hc_num,
-              temptype);
-
-    if (model == EMS_DEVICE_FLAG_RC20) {
-        EMS_TxTelegram.type               = EMS_TYPE_RC20Set;
-        EMS_TxTelegram.offset             = EMS_OFFSET_RC20Set_temp;
-        EMS_TxTelegram.comparisonPostRead = EMS_TYPE_RC20StatusMessage;
-        EMS_TxTelegram.type_validate      = EMS_TxTelegram.type;
-
-    } else if (model == EMS_DEVICE_FLAG_RC10) {
-        EMS_TxTelegram.type               = EMS_TYPE_RC10Set;
-        EMS_TxTelegram.offset             = EMS_OFFSET_RC10Set_temp;
-        EMS_TxTelegram.comparisonPostRead = EMS_TYPE_RC10StatusMessage;
-        EMS_TxTelegram.type_validate      = EMS_TxTelegram.type;
-
-    } else if (model == EMS_DEVICE_FLAG_RC30) {
-        EMS_TxTelegram.type               = EMS_TYPE_RC30Set;
-        EMS_TxTelegram.offset             = EMS_OFFSET_RC30Set_temp;
-        EMS_TxTelegram.comparisonPostRead = EMS_TYPE_RC30StatusMessage;
-        EMS_TxTelegram.type_validate      = EMS_TxTelegram.type;
-
-    } else if (model == EMS_DEVICE_FLAG_RC300) {
-        // check mode to determine offset
-        if (EMS_Thermostat.hc[hc_num - 1].mode == 1) {        // auto
-            EMS_TxTelegram.offset = 0x08;                     // auto offset
-        } else if (EMS_Thermostat.hc[hc_num - 1].mode == 0) { // manuaL
-            EMS_TxTelegram.offset = 0x0A;                     // manual offset
-        }
-
-        if (hc_num == 1) {
-            EMS_TxTelegram.type               = EMS_TYPE_RCPLUSSet; // for 3000 and 1010, e.g. 0B 10 FF (0A | 08) 01 89 2B
-            EMS_TxTelegram.comparisonPostRead = EMS_TYPE_RCPLUSStatusMessage_HC1;
-        } else if (hc_num == 2) {
-            EMS_TxTelegram.type               = EMS_TYPE_RCPLUSSet + 1;
-            EMS_TxTelegram.comparisonPostRead = EMS_TYPE_RCPLUSStatusMessage_HC2;
-        } else if (hc_num == 3) {
-            EMS_TxTelegram.type               = EMS_TYPE_RCPLUSSet + 2;
-            EMS_TxTelegram.comparisonPostRead = EMS_TYPE_RCPLUSStatusMessage_HC3;
-        } else if (hc_num == 4) {
-            EMS_TxTelegram.type               = EMS_TYPE_RCPLUSSet + 3;
-            EMS_TxTelegram.comparisonPostRead = EMS_TYPE_RCPLUSStatusMessage_HC4;
-        }
+    if (!same) {
+        copy->data_length = data_length;
+        memcpy(copy->data, EMS_RxTelegram->data, data_length);
+    }
+    copy->timestamp = millis();
 
-        EMS_TxTelegram.type_validate = EMS_ID_NONE; // validate by reading from a different telegram
+    *shadow = copy;
+    return same;
+}
 
-    } else if (model == EMS_DEVICE_FLAG_RC35) {
-        switch (temptype) {
-        case 1: // change the night temp
-            EMS_TxTelegram.offset = EMS_OFFSET_RC35Set_temp_night;
-            break;
-        case 2: // change the day temp
-            EMS_TxTelegram.offset = EMS_OFFSET_RC35Set_temp_day;
-            break;
-        case 3: // change the holiday temp
-            EMS_TxTelegram.offset = EMS_OFFSET_RC35Set_temp_holiday;
-            break;
-        default:
-        case 0: // automatic selection, if no type is defined, we use the standard code
-            if (EMS_Thermostat.hc[hc_num - 1].day_mode == 0) {
-                EMS_TxTelegram.offset = EMS_OFFSET_RC35Set_temp_night;
-            } else if (EMS_Thermostat.hc[hc_num - 1].day_mode == 1) {
-                EMS_TxTelegram.offset = EMS_OFFSET_RC35Set_temp_day;
-            }
-            break;
-        }
+/**
+ * Every field list, so _ems_checkFields() can see they're all sorted by index
+ */
+const _EMS_FieldList EMS_FieldLists[] PROGMEM = {
+    {EMS_TYPE_UBAParameterWW, EMS_Fields_UBAParameterWW, ArraySize(EMS_Fields_UBAParameterWW)},
+    {EMS_TYPE_UBATotalUptimeMessage, EMS_Fields_UBATotalUptimeMessage, ArraySize(EMS_Fields_UBATotalUptimeMessage)},
+    {EMS_TYPE_UBAParametersMessage, EMS_Fields_UBAParametersMessage, ArraySize(EMS_Fields_UBAParametersMessage)},
+    {EMS_TYPE_UBAMonitorWWMessage, EMS_Fields_UBAMonitorWWMessage, ArraySize(EMS_Fields_UBAMonitorWWMessage)},
+    {EMS_TYPE_UBAMonitorFast, EMS_Fields_UBAMonitorFast, ArraySize(EMS_Fields_UBAMonitorFast)},
+    {EMS_TYPE_UBAMonitorFast2, EMS_Fields_UBAMonitorFast2, ArraySize(EMS_Fields_UBAMonitorFast2)},
+    {EMS_TYPE_UBAMonitorSlow, EMS_Fields_UBAMonitorSlow, ArraySize(EMS_Fields_UBAMonitorSlow)},
+    {EMS_TYPE_UBAMonitorSlow2, EMS_Fields_UBAMonitorSlow2, ArraySize(EMS_Fields_UBAMonitorSlow2)},
+    {EMS_TYPE_UBAOutdoorTemp, EMS_Fields_UBAOutdoorTemp, ArraySize(EMS_Fields_UBAOutdoorTemp)},
+    {EMS_TYPE_RC10StatusMessage, EMS_Fields_RC10StatusMessage, ArraySize(EMS_Fields_RC10StatusMessage)},
+    {EMS_TYPE_RC20StatusMessage, EMS_Fields_RC20StatusMessage, ArraySize(EMS_Fields_RC20StatusMessage)},
+    {EMS_TYPE_RC30StatusMessage, EMS_Fields_RC30StatusMessage, ArraySize(EMS_Fields_RC30StatusMessage)},
+    {EMS_TYPE_RC35StatusMessage_HC1, EMS_Fields_RC35StatusMessage, ArraySize(EMS_Fields_RC35StatusMessage)},
+    {EMS_TYPE_RC35StatusMessage_HC1, EMS_Fields_RC35StatusMessage_setpoint, ArraySize(EMS_Fields_RC35StatusMessage_setpoint)},
+    {EMS_TYPE_EasyStatusMessage, EMS_Fields_EasyStatusMessage, ArraySize(EMS_Fields_EasyStatusMessage)},
+    {EMS_TYPE_MMPLUSStatusMessage_HC1, EMS_Fields_MMPLUSStatusMessage, ArraySize(EMS_Fields_MMPLUSStatusMessage)},
+    {EMS_TYPE_RCPLUSStatusMessage_HC1, EMS_Fields_RCPLUSStatusMessage, ArraySize(EMS_Fields_RCPLUSStatusMessage)},
+    {EMS_TYPE_RCPLUSStatusMessage_HC1, EMS_Fields_RCPLUSStatusMessage_curr, ArraySize(EMS_Fields_RCPLUSStatusMessage_curr)},
+    {EMS_TYPE_RCPLUSStatusMessage_HC1, EMS_Fields_RCPLUSStatusMessage_mode, ArraySize(EMS_Fields_RCPLUSStatusMessage_mode)},
+    {EMS_TYPE_JunkersStatusMessage, EMS_Fields_JunkersStatusMessage, ArraySize(EMS_Fields_JunkersStatusMessage)},
+    {EMS_TYPE_RCPLUSSet, EMS_Fields_RCPLUSSetMessage, ArraySize(EMS_Fields_RCPLUSSetMessage)},
+    {EMS_TYPE_RCPLUSSet, EMS_Fields_RCPLUSSetMessage_setpoint, ArraySize(EMS_Fields_RCPLUSSetMessage_setpoint)},
+    {EMS_TYPE_RC20Set, EMS_Fields_RC20Set, ArraySize(EMS_Fields_RC20Set)},
+    {EMS_TYPE_RC30Set, EMS_Fields_RC30Set, ArraySize(EMS_Fields_RC30Set)},
+    {EMS_TYPE_RC35Set_HC1, EMS_Fields_RC35Set, ArraySize(EMS_Fields_RC35Set)},
+    {EMS_TYPE_SM10Monitor, EMS_Fields_SM10Monitor, ArraySize(EMS_Fields_SM10Monitor)},
+    {EMS_TYPE_SM100Monitor, EMS_Fields_SM100Monitor, ArraySize(EMS_Fields_SM100Monitor)},
+    {EMS_TYPE_SM100Status, EMS_Fields_SM100Status, ArraySize(EMS_Fields_SM100Status)},
+    {EMS_TYPE_SM100Status, EMS_Fields_SM100Status_offset9, ArraySize(EMS_Fields_SM100Status_offset9)},
+    {EMS_TYPE_SM100Status2, EMS_Fields_SM100Status2, ArraySize(EMS_Fields_SM100Status2)},
+    {EMS_TYPE_SM100Status2, EMS_Fields_SM100Status2_offset10, ArraySize(EMS_Fields_SM100Status2_offset10)},
+    {EMS_TYPE_SM100Energy, EMS_Fields_SM100Energy, ArraySize(EMS_Fields_SM100Energy)},
+    {EMS_TYPE_HPMonitor1, EMS_Fields_HPMonitor1, ArraySize(EMS_Fields_HPMonitor1)},
+    {EMS_TYPE_HPMonitor2, EMS_Fields_HPMonitor2, ArraySize(EMS_Fields_HPMonitor2)},
+    {EMS_TYPE_ISM1StatusMessage, EMS_Fields_ISM1StatusMessage, ArraySize(EMS_Fields_ISM1StatusMessage)},
+    {EMS_TYPE_ISM1StatusMessage, EMS_Fields_ISM1StatusMessage_offset4, ArraySize(EMS_Fields_ISM1StatusMessage_offset4)},
+};
 
-        if (hc_num == 1) {
-            EMS_TxTelegram.type               = EMS_TYPE_RC35Set_HC1;
-            EMS_TxTelegram.comparisonPostRead = EMS_TYPE_RC35StatusMessage_HC1;
-        } else if (hc_num == 2) {
-            EMS_TxTelegram.type               = EMS_TYPE_RC35Set_HC2;
-            EMS_TxTelegram.comparisonPostRead = EMS_TYPE_RC35StatusMessage_HC2;
-        } else if (hc_num == 3) {
-            EMS_TxTelegram.type               = EMS_TYPE_RC35Set_HC3;
-            EMS_TxTelegram.comparisonPostRead = EMS_TYPE_RC35StatusMessage_HC3;
-        } else if (hc_num == 4) {
-            EMS_TxTelegram.type               = EMS_TYPE_RC35Set_HC4;
-            EMS_TxTelegram.comparisonPostRead = EMS_TYPE_RC35StatusMessage_HC4;
+/**
+ * _ems_decodeFields() stops at the first field past the end of a telegram, which is only right if every list is sorted
+ * by index. Logs each list that isn't and returns how many there are
+ */
+uint8_t _ems_checkFields() {
+    uint8_t unsorted = 0;
+
+    for (uint8_t i = 0; i < ArraySize(EMS_FieldLists); i++) {
+        _EMS_FieldList list;
+        memcpy_P(&list, &EMS_FieldLists[i], sizeof(_EMS_FieldList));
+        for (uint8_t f = 1; f < list.count; f++) {
+            if (_ems_readField(list.fields, f).index < _ems_readField(list.fields, f - 1).index) {
+                myDebug_P(PSTR("** error: field list %d for type 0x%02X is not sorted by index"), i, list.type);
+                unsorted++;
+                break;
+            }
         }
-        EMS_TxTelegram.type_validate = EMS_TxTelegram.type;
     }
 
-    EMS_TxTelegram.length           = EMS_MIN_TELEGRAM_LENGTH;
-    EMS_TxTelegram.dataValue        = (uint8_t)((float)temperature * (float)2); // value * 2
-    EMS_TxTelegram.comparisonOffset = EMS_TxTelegram.offset;
-    EMS_TxTelegram.comparisonValue  = EMS_TxTelegram.dataValue;
+    return unsorted;
+}
 
-    EMS_TxQueue.push(EMS_TxTelegram);
+/**
+ * The read planner. The types here are decoded only from their field lists, so they are read from the first
+ * to the last byte the fields use instead of as a whole. The reply is put into the last whole copy of the telegram,
+ * which is then decoded as if it had all come in. Until there's a whole copy, and if it's been re-used, the whole
+ * telegram is read
+ */
+const _EMS_ReadPlan EMS_ReadPlans[] PROGMEM = {
+    {EMS_TYPE_UBAParameterWW, EMS_Fields_UBAParameterWW, ArraySize(EMS_Fields_UBAParameterWW)},
+    {EMS_TYPE_UBATotalUptimeMessage, EMS_Fields_UBATotalUptimeMessage, ArraySize(EMS_Fields_UBATotalUptimeMessage)},
+    {EMS_TYPE_UBAParametersMessage, EMS_Fields_UBAParametersMessage, ArraySize(EMS_Fields_UBAParametersMessage)},
+    {EMS_TYPE_RC20Set, EMS_Fields_RC20Set, ArraySize(EMS_Fields_RC20Set)},
+    {EMS_TYPE_RC30Set, EMS_Fields_RC30Set, ArraySize(EMS_Fields_RC30Set)},
+    {EMS_TYPE_RC35Set_HC1, EMS_Fields_RC35Set, ArraySize(EMS_Fields_RC35Set)},
+    {EMS_TYPE_RC35Set_HC2, EMS_Fields_RC35Set, ArraySize(EMS_Fields_RC35Set)},
+    {EMS_TYPE_RC35Set_HC3, EMS_Fields_RC35Set, ArraySize(EMS_Fields_RC35Set)},
+    {EMS_TYPE_RC35Set_HC4, EMS_Fields_RC35Set, ArraySize(EMS_Fields_RC35Set)},
+    {EMS_TYPE_RCPLUSSet, EMS_Fields_RCPLUSSetMessage, ArraySize(EMS_Fields_RCPLUSSetMessage)},
+};
+
+static bool _ems_findReadPlan(uint16_t type, _EMS_ReadPlan * plan) {
+    for (uint8_t i = 0; i < ArraySize(EMS_ReadPlans); i++) {
+        memcpy_P(plan, &EMS_ReadPlans[i], sizeof(_EMS_ReadPlan));
+        if (plan->type == type) {
+            return true;
+        }
+    }
+    return false;
 }
 
 /**
- * Set the thermostat working mode
- *  0xA8 on a RC20 and 0xA7 on RC30
- *  0x01B9 for EMS+ 300/1000/3000, Auto=0xFF Manual=0x00. See https://github.com/proddy/EMS-ESP/wiki/RC3xx-Thermostats
- *  hc_num is 1 to 4
+ * the bytes to read of a type from a device, if it can be read in part
  */
-void ems_setThermostatMode(uint8_t mode, uint8_t hc_num) {
-    if (!ems_getThermostatEnabled()) {
-        myDebug_P(PSTR("Thermostat not online."));
-        return;
+bool _ems_readPlan(uint16_t type, uint8_t dest, uint8_t * offset, uint8_t * length) {
+    _EMS_ReadPlan plan;
+    if (!_ems_findReadPlan(type, &plan)) {
+        return false;
     }
 
-    if (!EMS_Thermostat.write_supported) {
-        myDebug_P(PSTR("Write not supported for this model Thermostat"));
-        return;
+    uint8_t start = 0xFF;
+    uint8_t end   = 0;
+    for (uint8_t i = 0; i < plan.count; i++) {
+        _EMS_Field field = _ems_readField(plan.fields, i);
+        if (field.index < start) {
+            start = field.index;
+        }
+        if ((field.index + EMS_Field_width[field.format]) > end) {
+            end = field.index + EMS_Field_width[field.format];
+        }
     }
 
-    if (hc_num < 1 || hc_num > EMS_THERMOSTAT_MAXHC) {
-        myDebug_P(PSTR("Invalid HC number"));
-        return;
+    // the rest comes from the last whole copy
+    _EMS_Shadow * shadow = _ems_findShadow(dest & 0x7F, EMS_ID_ME, type, 0);
+    if ((!shadow) || (shadow->data_length < end) || ((end - start) >= shadow->data_length)) {
+        return false;
     }
 
-    uint8_t model     = ems_getThermostatModel();
-    uint8_t device_id = EMS_Thermostat.device_id;
-    uint8_t set_mode;
+    *offset = start;
+    *length = end - start;
+    return true;
+}
 
-    // RC300/1000/3000 have different settings
-    if (model == EMS_DEVICE_FLAG_RC300) {
-        if (mode == 1) {
-            set_mode = 0; // manual
-        } else {
-            set_mode = 0xFF; // auto
-        }
-    } else {
-        set_mode = mode;
+/**
+ * a reply to a planned read is put into the last whole copy of the telegram, and the telegram then points to
+ * that copy. See _ems_readPlan()
+ */
+uint8_t _ems_mergeShadow(_EMS_RxTelegram * EMS_RxTelegram) {
+    _EMS_ReadPlan plan;
+    if ((EMS_RxTelegram->dest != EMS_ID_ME) || !_ems_findReadPlan(EMS_RxTelegram->type, &plan)) {
+        return EMS_MERGE_NONE;
     }
 
-    // 0=off, 1=manual, 2=auto
-    if (mode == 0) {
-        myDebug_P(PSTR("Setting thermostat mode to off for heating circuit %d"), hc_num);
-    } else if (set_mode == 1) {
-        myDebug_P(PSTR("Setting thermostat mode to manual for heating circuit %d"), hc_num);
-    } else if (set_mode == 2) {
-        myDebug_P(PSTR("Setting thermostat mode to auto for heating circuit %d"), hc_num);
+    _EMS_Shadow * shadow = _ems_findShadow(EMS_RxTelegram->src, EMS_RxTelegram->dest, EMS_RxTelegram->type, 0);
+    uint8_t       offset = EMS_RxTelegram->offset;
+    if ((!shadow) || ((offset + EMS_RxTelegram->data_length) > shadow->data_length)) {
+        return offset ? EMS_MERGE_LOST : EMS_MERGE_NONE; // the next read is whole
+    }
+    if ((!offset) && (EMS_RxTelegram->data_length == shadow->data_length)) {
+        return EMS_MERGE_NONE; // a whole read
     }
 
-    _EMS_TxTelegram EMS_TxTelegram = EMS_TX_TELEGRAM_NEW; // create new Tx
-    EMS_TxTelegram.timestamp       = millis();            // set timestamp
-    EMS_Sys_Status.txRetryCount    = 0;                   // reset retry counter
+    memcpy(&shadow->data[offset], EMS_RxTelegram->data, EMS_RxTelegram->data_length);
+    shadow->timestamp = millis();
 
-    EMS_TxTelegram.action    = EMS_TX_TELEGRAM_WRITE;
-    EMS_TxTelegram.dest      = device_id;
-    EMS_TxTelegram.length    = EMS_MIN_TELEGRAM_LENGTH;
-    EMS_TxTelegram.dataValue = set_mode;
+    EMS_RxTelegram->offset      = 0;
+    EMS_RxTelegram->data        = shadow->data;
+    EMS_RxTelegram->data_length = shadow->data_length;
+    return EMS_MERGE_DONE;
+}
 
-    // handle different thermostat types
-    if (model == EMS_DEVICE_FLAG_RC20) {
-        EMS_TxTelegram.type               = EMS_TYPE_RC20Set;
-        EMS_TxTelegram.offset             = EMS_OFFSET_RC20Set_mode;
-        EMS_TxTelegram.type_validate      = EMS_TYPE_RC20Set;
-        EMS_TxTelegram.comparisonPostRead = EMS_TYPE_RC20StatusMessage;
+/**
+ * The block reader. Switching programs, holidays and the error log are longer than a telegram, so they are read in
+ * chunks of EMS_BLOCK_CHUNK bytes at increasing offsets. All the chunks of a block are queued at once and go out
+ * on the polls that follow each other, and the replies are put together in the block's buffer. Chunks that don't
+ * come are read again, up to EMS_BLOCK_ROUNDS times in all. One block is read at a time, when no refresh read is due
+ */
+_EMS_Block EMS_Blocks[EMS_BLOCK_MAX];
+uint8_t    EMS_Blocks_count = 0;
 
-    } else if (model == EMS_DEVICE_FLAG_RC30) {
-        EMS_TxTelegram.type               = EMS_TYPE_RC30Set;
-        EMS_TxTelegram.offset             = EMS_OFFSET_RC30Set_mode;
-        EMS_TxTelegram.type_validate      = EMS_TYPE_RC30Set;
-        EMS_TxTelegram.comparisonPostRead = EMS_TYPE_RC30StatusMessage;
+void _ems_clearBlocks() {
+    memset(EMS_Blocks, 0, sizeof(EMS_Blocks));
+    EMS_Blocks_count = 0;
+}
 
-    } else if (model == EMS_DEVICE_FLAG_RC35) {
-        if (hc_num == 1) {
-            EMS_TxTelegram.type               = EMS_TYPE_RC35Set_HC1;
-            EMS_TxTelegram.comparisonPostRead = EMS_TYPE_RC35StatusMessage_HC1;
-        } else if (hc_num == 2) {
-            EMS_TxTelegram.type               = EMS_TYPE_RC35Set_HC2;
-            EMS_TxTelegram.comparisonPostRead = EMS_TYPE_RC35StatusMessage_HC2;
-        } else if (hc_num == 3) {
-            EMS_TxTelegram.type               = EMS_TYPE_RC35Set_HC3;
-            EMS_TxTelegram.comparisonPostRead = EMS_TYPE_RC35StatusMessage_HC3;
-        } else if (hc_num == 4) {
-            EMS_TxTelegram.type               = EMS_TYPE_RC35Set_HC4;
-            EMS_TxTelegram.comparisonPostRead = EMS_TYPE_RC35StatusMessage_HC4;
-        }
-        EMS_TxTelegram.offset        = EMS_OFFSET_RC35Set_mode;
-        EMS_TxTelegram.type_validate = EMS_TxTelegram.type;
+uint8_t ems_getBlockCount() {
+    return EMS_Blocks_count;
+}
 
-    } else if (model == EMS_DEVICE_FLAG_RC300) {
-        EMS_TxTelegram.offset = EMS_OFFSET_RCPLUSSet_mode;
+_EMS_Block * ems_getBlock(uint8_t i) {
+    return &EMS_Blocks[i];
+}
 
-        if (hc_num == 1) {
-            EMS_TxTelegram.type               = EMS_TYPE_RCPLUSSet;
-            EMS_TxTelegram.comparisonPostRead = EMS_TYPE_RCPLUSStatusMessage_HC1;
-        } else if (hc_num == 2) {
-            EMS_TxTelegram.type               = EMS_TYPE_RCPLUSSet + 1;
-            EMS_TxTelegram.comparisonPostRead = EMS_TYPE_RCPLUSStatusMessage_HC2;
-        } else if (hc_num == 3) {
-            EMS_TxTelegram.type               = EMS_TYPE_RCPLUSSet + 2;
-            EMS_TxTelegram.comparisonPostRead = EMS_TYPE_RCPLUSStatusMessage_HC3;
-        } else if (hc_num == 4) {
-            EMS_TxTelegram.type               = EMS_TYPE_RCPLUSSet + 3;
-            EMS_TxTelegram.comparisonPostRead = EMS_TYPE_RCPLUSStatusMessage_HC4;
+static _EMS_Block * _ems_findBlock(uint16_t type, uint8_t dest) {
+    for (uint8_t i = 0; i < EMS_Blocks_count; i++) {
+        if ((EMS_Blocks[i].type == type) && (EMS_Blocks[i].dest == dest)) {
+            return &EMS_Blocks[i];
         }
-
-        EMS_TxTelegram.type_validate = EMS_ID_NONE; // don't validate after the write
     }
+    return nullptr;
+}
 
-    EMS_TxTelegram.comparisonOffset = EMS_TxTelegram.offset;
-    EMS_TxTelegram.comparisonValue  = EMS_TxTelegram.dataValue;
-
-    EMS_TxQueue.push(EMS_TxTelegram);
+// # chunks in a block of length bytes
+static inline uint8_t _ems_blockChunks(uint8_t length) {
+    return (length + EMS_BLOCK_CHUNK - 1) / EMS_BLOCK_CHUNK;
 }
 
 /**
- * Set the warm water temperature 0x33
+ * add a block to be read, or keep it if it's already there. Unless scheduled it's read as soon as it can be
  */
-void ems_setWarmWaterTemp(uint8_t temperature) {
-    // check for invalid temp values
-    if ((temperature < 30) || (temperature > EMS_BOILER_TAPWATER_TEMPERATURE_MAX)) {
+void _ems_blockAdd(uint16_t type, uint8_t dest, uint8_t length, bool scheduled) {
+    if ((type == EMS_ID_NONE) || (dest == EMS_ID_NONE)) {
         return;
     }
 
-    myDebug_P(PSTR("Setting boiler warm water temperature to %d C"), temperature);
+    _EMS_Block * block = _ems_findBlock(type, dest);
+    if (!block) {
+        if (EMS_Blocks_count >= EMS_BLOCK_MAX) {
+            return;
+        }
+        block = &EMS_Blocks[EMS_Blocks_count++];
+        memset(block, 0, sizeof(_EMS_Block));
+        block->type   = type;
+        block->dest   = dest;
+        block->length = (length < EMS_BLOCK_LENGTH_MAX) ? length : EMS_BLOCK_LENGTH_MAX;
+        block->due    = millis();
+    } else if (!scheduled && !block->started) {
+        block->due = millis();
+    }
+    block->wanted = true;
+}
 
-    _EMS_TxTelegram EMS_TxTelegram = EMS_TX_TELEGRAM_NEW; // create new Tx
-    EMS_TxTelegram.timestamp       = millis();            // set timestamp
-    EMS_Sys_Status.txRetryCount    = 0;                   // reset retry counter
+/**
+ * queue the reads of the chunks that haven't come in yet
+ */
+static void _ems_blockRead(_EMS_Block * block) {
+    block->rounds++;
 
-    EMS_TxTelegram.action    = EMS_TX_TELEGRAM_WRITE;
-    EMS_TxTelegram.dest      = EMS_Boiler.device_id;
-    EMS_TxTelegram.type      = EMS_TYPE_UBAParameterWW;
-    EMS_TxTelegram.offset    = EMS_OFFSET_UBAParameterWW_wwtemp;
-    EMS_TxTelegram.length    = EMS_MIN_TELEGRAM_LENGTH;
-    EMS_TxTelegram.dataValue = temperature; // int value to compare against
+    for (uint8_t chunk = 0; chunk < _ems_blockChunks(block->length); chunk++) {
+        if (block->valid & (1 << chunk)) {
+            continue;
+        }
 
-    EMS_TxTelegram.type_validate      = EMS_TYPE_UBAParameterWW; // validate
-    EMS_TxTelegram.comparisonOffset   = EMS_OFFSET_UBAParameterWW_wwtemp;
-    EMS_TxTelegram.comparisonValue    = temperature;
-    EMS_TxTelegram.comparisonPostRead = EMS_TYPE_UBAParameterWW;
+        uint8_t offset = chunk * EMS_BLOCK_CHUNK;
+        uint8_t length = block->length - offset;
+
+        _EMS_TxTelegram EMS_TxTelegram    = EMS_TX_TELEGRAM_NEW;
+        EMS_TxTelegram.timestamp          = millis();
+        EMS_TxTelegram.action             = EMS_TX_TELEGRAM_READ;
+        EMS_TxTelegram.dest               = block->dest;
+        EMS_TxTelegram.type               = block->type;
+        EMS_TxTelegram.offset             = offset;
+        EMS_TxTelegram.length             = EMS_MIN_TELEGRAM_LENGTH;
+        EMS_TxTelegram.dataValue          = (length < EMS_BLOCK_CHUNK) ? length : EMS_BLOCK_CHUNK; // # bytes we want back
+        EMS_TxTelegram.type_validate      = EMS_ID_NONE;
+        EMS_TxTelegram.comparisonPostRead = EMS_ID_NONE;
+        EMS_TxQueue.push(EMS_TxTelegram);
+    }
+}
 
-    EMS_TxQueue.push(EMS_TxTelegram);
+/**
+ * the block ends before the chunk at offset, take out the reads of the chunks from there on
+ * the one at the front is left alone if it's already on the bus
+ */
+static void _ems_blockTruncate(_EMS_Block * block, uint8_t offset) {
+    for (uint8_t chunk = _ems_blockChunks(offset); chunk < _ems_blockChunks(block->length); chunk++) {
+        int8_t i = EMS_TxQueue.find(EMS_TX_TELEGRAM_READ, block->dest, block->type, chunk * EMS_BLOCK_CHUNK);
+        if ((i > 0) || ((i == 0) && !EMS_TxQueue.frontLocked())) {
+            EMS_TxQueue.remove(i);
+        }
+    }
 }
 
 /**
- * Set the boiler flow temp
+ * a telegram has come in, see if it's a chunk of a block being read
+ * A reply to us with fewer bytes than asked for means the device has no more, so the block is shorter. An empty
+ * reply to the first chunk means it doesn't have the type at all
  */
-void ems_setFlowTemp(uint8_t temperature) {
-    myDebug_P(PSTR("Setting boiler flow temperature to %d C"), temperature);
+void _ems_blockSeen(_EMS_RxTelegram * EMS_RxTelegram) {
+    if ((EMS_RxTelegram->dest != EMS_ID_ME) && (EMS_RxTelegram->dest != EMS_ID_NONE)) {
+        return;
+    }
 
-    _EMS_TxTelegram EMS_TxTelegram = EMS_TX_TELEGRAM_NEW; // create new Tx
-    EMS_TxTelegram.timestamp       = millis();            // set timestamp
-    EMS_Sys_Status.txRetryCount    = 0;                   // reset retry counter
+    _EMS_Block * block  = _ems_findBlock(EMS_RxTelegram->type, EMS_RxTelegram->src);
+    uint8_t      offset = EMS_RxTelegram->offset;
+    if ((!block) || (!block->started) || (offset % EMS_BLOCK_CHUNK) || (offset >= block->length)) {
+        return;
+    }
 
-    EMS_TxTelegram.action    = EMS_TX_TELEGRAM_WRITE;
-    EMS_TxTelegram.dest      = EMS_Boiler.device_id;
-    EMS_TxTelegram.type      = EMS_TYPE_UBASetPoints;
-    EMS_TxTelegram.offset    = EMS_OFFSET_UBASetPoints_flowtemp;
-    EMS_TxTelegram.length    = EMS_MIN_TELEGRAM_LENGTH;
-    EMS_TxTelegram.dataValue = temperature; // int value to compare against
+    uint8_t chunk = offset / EMS_BLOCK_CHUNK;
+    uint8_t want  = ((block->length - offset) < EMS_BLOCK_CHUNK) ? (block->length - offset) : EMS_BLOCK_CHUNK;
+    uint8_t n     = (EMS_RxTelegram->data_length < want) ? EMS_RxTelegram->data_length : want;
 
-    EMS_TxTelegram.type_validate      = EMS_TYPE_UBASetPoints; // validate
-    EMS_TxTelegram.comparisonOffset   = EMS_OFFSET_UBASetPoints_flowtemp;
-    EMS_TxTelegram.comparisonValue    = temperature;
-    EMS_TxTelegram.comparisonPostRead = EMS_TYPE_UBASetPoints;
+    if ((n < want) && (EMS_RxTelegram->dest == EMS_ID_ME)) {
+        _ems_blockTruncate(block, offset + n);
+        if ((offset + n) == 0) {
+            block->started = 0;
+            block->failed++;
+            block->due = millis() + EMS_BLOCK_TTL;
+            if (EMS_Sys_Status.emsLogging >= EMS_SYS_LOGGING_BASIC) {
+                myDebug_P(PSTR("-> Block 0x%02X not known by 0x%02X"), block->type, block->dest);
+            }
+            return;
+        }
+        block->length = offset + n;
+    } else if (n < want) {
+        return; // a broadcast that doesn't have the whole chunk
+    }
 
-    EMS_TxQueue.push(EMS_TxTelegram);
+    if (memcmp(&block->data[offset], EMS_RxTelegram->data, n)) {
+        memcpy(&block->data[offset], EMS_RxTelegram->data, n);
+        block->changed = true;
+    }
+    block->valid |= (1 << chunk);
+
+    uint8_t all = (1 << _ems_blockChunks(block->length)) - 1;
+    if ((block->valid & all) != all) {
+        return;
+    }
+
+    // the whole block is in
+    uint32_t now    = millis();
+    block->timeLast = now - block->started;
+    if (block->timeLast > block->timeMax) {
+        block->timeMax = block->timeLast;
+    }
+    block->transfers++;
+    block->complete = true;
+    block->started  = 0;
+    block->due      = now + EMS_BLOCK_TTL;
+    if (block->changed) {
+        ems_Device_add_flags(EMS_DEVICE_UPDATE_FLAG_BLOCK);
+    }
+
+    if (EMS_Sys_Status.emsLogging >= EMS_SYS_LOGGING_BASIC) {
+        myDebug_P(PSTR("-> Block 0x%02X from 0x%02X: %d bytes in %d ms%s"),
+                  block->type,
+                  block->dest,
+                  block->length,
+                  block->timeLast,
+                  block->changed ? "" : ", unchanged");
+    }
 }
 
 /**
- * Set the warm water mode to comfort to Eco/Comfort
- * 1 = Hot, 2 = Eco, 3 = Intelligent
+ * called from ems_refreshTick() when the refresh lane of the Tx queue is empty
+ * reads the missing chunks of the block being read again once its reads have gone, or starts the block most overdue
  */
-void ems_setWarmWaterModeComfort(uint8_t comfort) {
-    _EMS_TxTelegram EMS_TxTelegram = EMS_TX_TELEGRAM_NEW; // create new Tx
-    EMS_TxTelegram.timestamp       = millis();            // set timestamp
-    EMS_Sys_Status.txRetryCount    = 0;                   // reset retry counter
+void _ems_blockTick() {
+    uint32_t now = millis();
 
-    if (comfort == 1) {
-        myDebug_P(PSTR("Setting boiler warm water comfort mode to Hot"));
-        EMS_TxTelegram.dataValue = EMS_VALUE_UBAParameterWW_wwComfort_Hot;
-    } else if (comfort == 2) {
-        myDebug_P(PSTR("Setting boiler warm water comfort mode to Eco"));
-        EMS_TxTelegram.dataValue = EMS_VALUE_UBAParameterWW_wwComfort_Eco;
-    } else if (comfort == 3) {
-        myDebug_P(PSTR("Setting boiler warm water comfort mode to Intelligent"));
-        EMS_TxTelegram.dataValue = EMS_VALUE_UBAParameterWW_wwComfort_Intelligent;
-    } else {
-        return; // invalid comfort value
+    for (uint8_t i = 0; i < EMS_Blocks_count; i++) {
+        _EMS_Block * block = &EMS_Blocks[i];
+        if (!block->started) {
+            continue;
+        }
+
+        for (uint8_t chunk = 0; chunk < _ems_blockChunks(block->length); chunk++) {
+            if (!(block->valid & (1 << chunk)) && (EMS_TxQueue.find(EMS_TX_TELEGRAM_READ, block->dest, block->type, chunk * EMS_BLOCK_CHUNK) != -1)) {
+                return; // still to go
+            }
+        }
+
+        if (block->rounds < EMS_BLOCK_ROUNDS) {
+            _ems_blockRead(block);
+        } else {
+            block->started = 0;
+            block->failed++;
+            block->due = now + EMS_REFRESH_TTL;
+            if (EMS_Sys_Status.emsLogging >= EMS_SYS_LOGGING_BASIC) {
+                myDebug_P(PSTR("-> Block 0x%02X from 0x%02X incomplete after %d reads. Giving up"), block->type, block->dest, block->rounds);
+            }
+        }
+        return;
     }
 
-    EMS_TxTelegram.action        = EMS_TX_TELEGRAM_WRITE;
-    EMS_TxTelegram.dest          = EMS_Boiler.device_id;
-    EMS_TxTelegram.type          = EMS_TYPE_UBAParameterWW;
-    EMS_TxTelegram.offset        = EMS_OFFSET_UBAParameterWW_wwComfort;
-    EMS_TxTelegram.length        = EMS_MIN_TELEGRAM_LENGTH;
-    EMS_TxTelegram.type_validate = EMS_ID_NONE; // don't validate
+    _EMS_Block * overdue = nullptr;
+    uint32_t     most    = 0;
+    for (uint8_t i = 0; i < EMS_Blocks_count; i++) {
+        _EMS_Block * block = &EMS_Blocks[i];
+        int32_t      late  = (int32_t)(now - block->due);
+        if ((late >= 0) && ((uint32_t)late >= most)) {
+            most    = late;
+            overdue = block;
+        }
+    }
 
-    EMS_TxQueue.push(EMS_TxTelegram);
+    if (overdue) {
+        overdue->started = now ? now : 1; // 0 is no transfer
+        overdue->valid   = 0;
+        overdue->rounds  = 0;
+        overdue->changed = !overdue->complete;
+        _ems_blockRead(overdue);
+    }
 }
 
 /**
- * Activate / De-activate the Warm Water 0x33
- * true = on, false = off
+ * The refresh scheduler. It keeps the types that ems_getThermostatValues(), ems_getBoilerValues() and
+ * ems_getSolarModuleValues() read up to date, by reading each one only when it hasn't been received for its TTL.
+ * A type that is broadcast has its interval learned from the broadcasts, and is only read when two are missed.
+ * ems_refreshTick() adds at most one read at a time, so they are spread over the polls instead of all at once
  */
-void ems_setWarmWaterActivated(bool activated) {
-    myDebug_P(PSTR("Setting boiler warm water %s"), activated ? "on" : "off");
+_EMS_Refresh EMS_Refresh[EMS_REFRESH_MAX];
+uint8_t      EMS_Refresh_count = 0;
 
-    _EMS_TxTelegram EMS_TxTelegram = EMS_TX_TELEGRAM_NEW; // create new Tx
-    EMS_TxTelegram.timestamp       = millis();            // set timestamp
-    EMS_Sys_Status.txRetryCount    = 0;                   // reset retry counter
+void _ems_clearRefresh() {
+    memset(EMS_Refresh, 0, sizeof(EMS_Refresh));
+    EMS_Refresh_count = 0;
+}
 
-    EMS_TxTelegram.action        = EMS_TX_TELEGRAM_WRITE;
-    EMS_TxTelegram.dest          = EMS_Boiler.device_id;
-    EMS_TxTelegram.type          = EMS_TYPE_UBAParameterWW;
-    EMS_TxTelegram.offset        = EMS_OFFSET_UBAParameterWW_wwactivated;
-    EMS_TxTelegram.length        = EMS_MIN_TELEGRAM_LENGTH;
-    EMS_TxTelegram.type_validate = EMS_ID_NONE;               // don't validate
-    EMS_TxTelegram.dataValue     = (activated ? 0xFF : 0x00); // 0xFF is on, 0x00 is off
+uint8_t ems_getRefreshCount() {
+    return EMS_Refresh_count;
+}
 
-    EMS_TxQueue.push(EMS_TxTelegram);
+_EMS_Refresh * ems_getRefresh(uint8_t i) {
+    return &EMS_Refresh[i];
+}
+
+static _EMS_Refresh * _ems_findRefresh(uint16_t type, uint8_t dest) {
+    for (uint8_t i = 0; i < EMS_Refresh_count; i++) {
+        if ((EMS_Refresh[i].type == type) && (EMS_Refresh[i].dest == dest)) {
+            return &EMS_Refresh[i];
+        }
+    }
+    return nullptr;
+}
+
+// ms a type can go without being received before it's read
+static uint32_t _ems_refreshTTL(_EMS_Refresh * refresh) {
+    if (!refresh->interval) {
+        return EMS_REFRESH_TTL;
+    }
+    return (refresh->interval > (EMS_REFRESH_TTL_MAX / 2)) ? EMS_REFRESH_TTL_MAX : (refresh->interval * 2);
 }
 
 /**
- * Activate / De-activate the Warm Tap Water
- * true = on, false = off
- * Using the type 0x1D to put the boiler into Test mode. This may be shown on the boiler with a flashing 'T'
+ * add a type to the scheduler, or keep it if it's already there
  */
-void ems_setWarmTapWaterActivated(bool activated) {
-    myDebug_P(PSTR("Setting boiler warm tap water %s"), activated ? "on" : "off");
-
-    _EMS_TxTelegram EMS_TxTelegram = EMS_TX_TELEGRAM_NEW; // create new Tx
-    EMS_TxTelegram.timestamp       = millis();            // set timestamp
-    EMS_Sys_Status.txRetryCount    = 0;                   // reset retry counter
-
-    // clear Tx to make sure all data is set to 0x00
-    for (int i = 0; (i < EMS_MAX_TELEGRAM_LENGTH); i++) {
-        EMS_TxTelegram.data[i] = 0x00;
+void _ems_refreshAdd(uint16_t type, uint8_t dest) {
+    if ((type == EMS_ID_NONE) || (dest == EMS_ID_NONE)) {
+        return;
     }
 
-    EMS_TxTelegram.action = EMS_TX_TELEGRAM_WRITE;
-    EMS_TxTelegram.dest   = EMS_Boiler.device_id;
-    EMS_TxTelegram.type   = EMS_TYPE_UBAFunctionTest;
-    EMS_TxTelegram.offset = 0;
+    _EMS_Refresh * refresh = _ems_findRefresh(type, dest);
+    if (!refresh) {
+        if (EMS_Refresh_count >= EMS_REFRESH_MAX) {
+            return;
+        }
+        refresh = &EMS_Refresh[EMS_Refresh_count++];
+        memset(refresh, 0, sizeof(_EMS_Refresh));
+        refresh->type     = type;
+        refresh->dest     = dest;
+        refresh->lastSeen = millis(); // it was read when the device was found
+    }
+    refresh->wanted = true;
+}
 
-    EMS_TxTelegram.type_validate      = EMS_TxTelegram.type;
-    EMS_TxTelegram.comparisonOffset   = 0;                   // 1st byte
-    EMS_TxTelegram.comparisonValue    = (activated ? 0 : 1); // value is 1 if in Test mode (not activated)
-    EMS_TxTelegram.comparisonPostRead = EMS_TxTelegram.type;
+/**
+ * a telegram has come in, see if it's one we're keeping up to date and learn how often it's broadcast
+ */
+void _ems_refreshSeen(_EMS_RxTelegram * EMS_RxTelegram) {
+    _EMS_Refresh * refresh = _ems_findRefresh(EMS_RxTelegram->type, EMS_RxTelegram->src);
+    if (!refresh) {
+        return;
+    }
 
-    // create header
-    EMS_TxTelegram.data[0] = EMS_ID_ME;             // src
-    EMS_TxTelegram.data[1] = EMS_TxTelegram.dest;   // dest
-    EMS_TxTelegram.data[2] = EMS_TxTelegram.type;   // type
-    EMS_TxTelegram.data[3] = EMS_TxTelegram.offset; // offset
+    uint32_t now      = millis();
+    refresh->lastSeen = now;
 
-    // we use the special test mode 0x1D for this. Setting the first data to 5A puts the system into test mode and
-    // a setting of 0x00 puts it back into normal operarting mode
-    // when in test mode we're able to mess around with the 3-way valve settings
-    if (!activated) {
-        // on
-        EMS_TxTelegram.data[4] = 0x5A; // test mode on
-        EMS_TxTelegram.data[5] = 0x00; // burner output 0%
-        EMS_TxTelegram.data[7] = 0x64; // boiler pump capacity 100%
-        EMS_TxTelegram.data[8] = 0xFF; // 3-way valve hot water only
-        EMS_TxTelegram.length  = 22;   // 17 bytes of data including header and CRC. We send all zeros just to be sure.
-    } else {
-        // get out of test mode
-        // telegram: 0B 08 1D 00 00
-        EMS_TxTelegram.data[4] = 0x00; // test mode off
-        EMS_TxTelegram.length  = EMS_MIN_TELEGRAM_LENGTH;
+    if (EMS_RxTelegram->dest == EMS_ID_NONE) {
+        if (refresh->lastBroadcast) {
+            uint32_t interval = now - refresh->lastBroadcast;
+            refresh->interval = (refresh->interval) ? ((refresh->interval * 3 + interval) / 4) : interval; // smoothed
+        }
+        refresh->lastBroadcast = now;
     }
+}
 
-    EMS_TxQueue.push(EMS_TxTelegram); // add to queue
+/**
+ * true if the device is known to broadcast the type
+ */
+bool _ems_refreshBroadcast(uint16_t type, uint8_t dest) {
+    _EMS_Refresh * refresh = _ems_findRefresh(type, dest);
+    return (refresh && refresh->lastBroadcast);
 }
 
 /**
- * Start up sequence for UBA Master, hopefully to initialize a handshake
- * Still experimental and not used yet!
+ * The value cache for on-demand reads, such as the telnet refresh. The last copy of each telegram is kept in
+ * EMS_Shadows, and the values decoded from it are current as long as it's newer than the cache TTL, or than the
+ * interval the type is broadcast at if that's longer. A read of a stale type that is already queued is merged
+ * into the one in the Tx queue
  */
-void ems_startupTelegrams() {
-    if ((ems_getTxDisabled()) || (!ems_getBusConnected())) {
-        myDebug_P(PSTR("Unable to send startup sequence when in listen mode or the bus is disabled"));
+bool _ems_cacheFresh(uint16_t type, uint8_t dest) {
+    uint32_t ttl = EMS_Sys_Status.emsCacheTTL;
+    if (!ttl) {
+        return false; // always read
     }
 
-    myDebug_P(PSTR("Sending startup sequence..."));
-    char s[20] = {0};
+    _EMS_Refresh * refresh = _ems_findRefresh(type, dest);
+    if (refresh && (refresh->interval > ttl)) {
+        ttl = refresh->interval;
+    }
 
-    // Write type 0x1D to get out of function test mode
-    snprintf(s, sizeof(s), "%02X %02X 1D 00 00", EMS_ID_ME, EMS_Boiler.device_id);
-    ems_sendRawTelegram(s);
+    // a reply to us or a broadcast, whichever came last
+    uint32_t      now   = millis();
+    _EMS_Shadow * reply = _ems_findShadow(dest & 0x7F, EMS_ID_ME, type, 0);
+    _EMS_Shadow * bcast = _ems_findShadow(dest & 0x7F, EMS_ID_NONE, type, 0);
+    return ((reply && ((now - reply->timestamp) < ttl)) || (bcast && ((now - bcast->timestamp) < ttl)));
+}
 
-    // Read type 0x01
-    snprintf(s, sizeof(s), "%02X %02X 01 00 1B", EMS_ID_ME, EMS_Boiler.device_id | 0x80);
-    ems_sendRawTelegram(s);
+void ems_setCacheTTL(uint32_t ms) {
+    EMS_Sys_Status.emsCacheTTL = ms;
 }
 
 /**
- * Test parsing of telgrams by injecting fake telegrams and simulating the response
+ * called every EMS_REFRESH_TICK_TIME seconds
+ * works out which types are wanted for the devices we have, and reads the one that is most overdue
+ * as long as the last one has gone, so only one scheduled read is ever waiting in the Tx queue
  */
-void ems_testTelegram(uint8_t test_num) {
-#ifdef TESTS
-    if ((test_num == 0) || (test_num > _TEST_DATA_max)) {
-        myDebug_P(PSTR("Invalid test. Pick between 1 and %d"), _TEST_DATA_max);
+void ems_refreshTick() {
+    if (!ems_getBusConnected() || ems_getTxDisabled()) {
         return;
     }
 
-    // stop all Tx
-    if (!EMS_TxQueue.isEmpty()) {
-        EMS_TxQueue.clear();
-        EMS_Sys_Status.emsTxStatus = EMS_TX_STATUS_IDLE;
+    _ems_discoveryTick();
+
+    // what's wanted can change as devices and heating circuits are found
+    for (uint8_t i = 0; i < EMS_Refresh_count; i++) {
+        EMS_Refresh[i].wanted = false;
     }
+    for (uint8_t i = 0; i < EMS_Blocks_count; i++) {
+        EMS_Blocks[i].wanted = false;
+    }
+    ems_getThermostatValues(true);
+    if (ems_getBoilerEnabled()) {
+        ems_getBoilerValues(true);
+    }
+    ems_getSolarModuleValues(true);
 
-    static uint8_t * telegram = (uint8_t *)malloc(EMS_MAX_TELEGRAM_LENGTH); // warning, memory is never set free so use only for debugging
+    // drop what's no longer wanted
+    uint8_t n = 0;
+    for (uint8_t i = 0; i < EMS_Refresh_count; i++) {
+        if (EMS_Refresh[i].wanted) {
+            EMS_Refresh[n++] = EMS_Refresh[i];
+        }
+    }
+    EMS_Refresh_count = n;
 
-    char telegram_string[200];
-    strlcpy(telegram_string, TEST_DATA[test_num - 1], sizeof(telegram_string));
+    n = 0;
+    for (uint8_t i = 0; i < EMS_Blocks_count; i++) {
+        if (EMS_Blocks[i].wanted) {
+            EMS_Blocks[n++] = EMS_Blocks[i];
+        }
+    }
+    EMS_Blocks_count = n;
 
-    uint8_t length = 0;
-    char *  p;
-    char    value[10] = {0};
+    if (EMS_TxQueue.depth(EMS_TX_LANE_REFRESH)) {
+        return;
+    }
 
-    // get first value, which should be the src
-    if ((p = strtok(telegram_string, " ,"))) {
-        strlcpy(value, p, sizeof(value));
-        telegram[0] = (uint8_t)strtol(value, 0, 16);
+    // while the Tx timing is being calibrated keep a read going out, so there is something to measure
+    if ((emsuart_getCalibrateState() == EMSUART_CALIBRATE_RUNNING) && EMS_TxQueue.isEmpty() && ems_getBoilerEnabled()) {
+        ems_doReadCommand(EMS_TYPE_UBAMonitorFast, EMS_Boiler.device_id);
+        return;
     }
 
-    // and interate until end
-    while (p != 0) {
-        if ((p = strtok(nullptr, " ,"))) {
-            strlcpy(value, p, sizeof(value));
-            uint8_t val        = (uint8_t)strtol(value, 0, 16);
-            telegram[++length] = val;
+    uint32_t       now     = millis();
+    _EMS_Refresh * overdue = nullptr;
+    uint32_t       most    = 0;
+    for (uint8_t i = 0; i < EMS_Refresh_count; i++) {
+        _EMS_Refresh * refresh = &EMS_Refresh[i];
+        uint32_t       ttl     = _ems_refreshTTL(refresh);
+        uint32_t       age     = now - refresh->lastSeen;
+        // don't ask again while a read that hasn't been answered is still within its TTL
+        if ((age >= ttl) && ((now - refresh->lastRead) >= ttl) && ((age - ttl) >= most)) {
+            most    = age - ttl;
+            overdue = refresh;
         }
     }
 
-    length++;                                                // this is the total amount of bytes
-    telegram[length] = _crcCalculator(telegram, length + 1); // add the CRC
-
-    myDebug_P(PSTR("[TEST %d] Injecting telegram %s"), test_num, TEST_DATA[test_num - 1]);
+    if (overdue) {
+        overdue->lastRead = now;
+        overdue->reads++;
+        EMS_Sys_Status.emsRefreshReads++;
+        ems_doReadCommand(overdue->type, overdue->dest, true);
+        return;
+    }
 
-    // go an parse it
-    ems_parseTelegram(telegram, length + 1); // include CRC in length
-#else
-    myDebug_P(PSTR("Firmware not compiled with test data. Use -DTESTS"));
-#endif
+    // nothing else to read, so on with the blocks
+    _ems_blockTick();
 }
 
 /**
- * Recognized EMS types and the functions they call to process the telegrams
+ * Bus accounting. Every telegram on the bus goes through ems_parseTelegram(), including polls and the echo of our own,
+ * so counting them there shows how busy the bus is and who is using it.
+ * The occupancy is the time the bytes and <BRK>s take at 9600 baud. It's sampled every EMS_BUSSTATS_SAMPLE ms into
+ * 1, 5 and 15 minute averages, worked out the same way as the load average of a Unix kernel
  */
-const _EMS_Type EMS_Types[] = {
+static _EMS_BusStats EMS_BusStats;
 
-    // common
-    {EMS_DEVICE_UPDATE_FLAG_NONE, EMS_TYPE_Version, "Version", _process_Version},
-    {EMS_DEVICE_UPDATE_FLAG_NONE, EMS_TYPE_UBADevices, "UBADevices", _process_UBADevices},
-    {EMS_DEVICE_UPDATE_FLAG_NONE, EMS_TYPE_RCTime, "RCTime", _process_RCTime},
-    {EMS_DEVICE_UPDATE_FLAG_THERMOSTAT, EMS_TYPE_RCOutdoorTempMessage, "RCOutdoorTempMessage", _process_RCOutdoorTempMessage},
+// e^(-5/60), e^(-5/300) and e^(-5/900) in EMS_BUSSTATS_FSHIFT fixed point, for a 5 second sample
+static const uint16_t _ems_busStatsExp[3] = {1884, 2014, 2037};
 
-    // UBA/Boiler
-    {EMS_DEVICE_UPDATE_FLAG_BOILER, EMS_TYPE_UBAMonitorFast, "UBAMonitorFast", _process_UBAMonitorFast},
-    {EMS_DEVICE_UPDATE_FLAG_BOILER, EMS_TYPE_UBAMonitorSlow, "UBAMonitorSlow", _process_UBAMonitorSlow},
-    {EMS_DEVICE_UPDATE_FLAG_BOILER, EMS_TYPE_UBAMonitorWWMessage, "UBAMonitorWWMessage", _process_UBAMonitorWWMessage},
-    {EMS_DEVICE_UPDATE_FLAG_BOILER, EMS_TYPE_UBAParameterWW, "UBAParameterWW", _process_UBAParameterWW},
-    {EMS_DEVICE_UPDATE_FLAG_BOILER, EMS_TYPE_UBATotalUptimeMessage, "UBATotalUptimeMessage", _process_UBATotalUptimeMessage},
-    {EMS_DEVICE_UPDATE_FLAG_BOILER, EMS_TYPE_UBAParametersMessage, "UBAParametersMessage", _process_UBAParametersMessage},
-    {EMS_DEVICE_UPDATE_FLAG_BOILER, EMS_TYPE_UBASetPoints, "UBASetPoints", _process_SetPoints},
+_EMS_BusStats * ems_getBusStats() {
+    return &EMS_BusStats;
+}
 
-    // UBA/Boiler EMS+
-    {EMS_DEVICE_UPDATE_FLAG_BOILER, EMS_TYPE_UBAOutdoorTemp, "UBAOutdoorTemp", _process_UBAOutdoorTemp},
-    {EMS_DEVICE_UPDATE_FLAG_BOILER, EMS_TYPE_UBAMonitorFast2, "UBAMonitorFast2", _process_UBAMonitorFast2},
-    {EMS_DEVICE_UPDATE_FLAG_BOILER, EMS_TYPE_UBAMonitorSlow2, "UBAMonitorSlow2", _process_UBAMonitorSlow2},
+void ems_clearBusStats() {
+    memset(&EMS_BusStats, 0, sizeof(_EMS_BusStats));
+    EMS_BusStats.start       = millis();
+    EMS_BusStats.sampleStart = EMS_BusStats.start;
+}
 
-    // Solar Module devices
-    {EMS_DEVICE_UPDATE_FLAG_SOLAR, EMS_TYPE_SM10Monitor, "SM10Monitor", _process_SM10Monitor},
-    {EMS_DEVICE_UPDATE_FLAG_SOLAR, EMS_TYPE_SM100Monitor, "SM100Monitor", _process_SM100Monitor},
-    {EMS_DEVICE_UPDATE_FLAG_SOLAR, EMS_TYPE_SM100Status, "SM100Status", _process_SM100Status},
-    {EMS_DEVICE_UPDATE_FLAG_SOLAR, EMS_TYPE_SM100Status2, "SM100Status2", _process_SM100Status2},
-    {EMS_DEVICE_UPDATE_FLAG_SOLAR, EMS_TYPE_SM100Energy, "SM100Energy", _process_SM100Energy},
-    {EMS_DEVICE_UPDATE_FLAG_SOLAR, EMS_TYPE_ISM1StatusMessage, "ISM1StatusMessage", _process_ISM1StatusMessage},
-    {EMS_DEVICE_UPDATE_FLAG_SOLAR, EMS_TYPE_ISM1Set, "ISM1Set", _process_ISM1Set},
+// the average of the occupancy in % over a sample, in EMS_BUSSTATS_FSHIFT fixed point
+static uint32_t _ems_busStatsLoad(uint32_t busy) {
+    return (uint32_t)((((uint64_t)busy * 100) << EMS_BUSSTATS_FSHIFT) / (EMS_BUSSTATS_SAMPLE * 1000UL));
+}
 
-    // heatpumps
-    {EMS_DEVICE_UPDATE_FLAG_HEATPUMP, EMS_TYPE_HPMonitor1, "HeatPumpMonitor1", _process_HPMonitor1},
-    {EMS_DEVICE_UPDATE_FLAG_HEATPUMP, EMS_TYPE_HPMonitor2, "HeatPumpMonitor2", _process_HPMonitor2},
+// close the sample and add it to the averages
+static void _ems_busStatsSample() {
+    uint32_t load    = _ems_busStatsLoad(EMS_BusStats.sampleBusy);
+    uint32_t ourLoad = _ems_busStatsLoad(EMS_BusStats.sampleOurs);
 
-    // RC10
-    {EMS_DEVICE_UPDATE_FLAG_THERMOSTAT, EMS_TYPE_RC10Set, "RC10Set", _process_RC10Set},
-    {EMS_DEVICE_UPDATE_FLAG_THERMOSTAT, EMS_TYPE_RC10StatusMessage, "RC10StatusMessage", _process_RC10StatusMessage},
+    for (uint8_t i = 0; i < 3; i++) {
+        uint32_t e              = _ems_busStatsExp[i];
+        EMS_BusStats.load[i]    = (EMS_BusStats.load[i] * e + load * ((1 << EMS_BUSSTATS_FSHIFT) - e)) >> EMS_BUSSTATS_FSHIFT;
+        EMS_BusStats.ourLoad[i] = (EMS_BusStats.ourLoad[i] * e + ourLoad * ((1 << EMS_BUSSTATS_FSHIFT) - e)) >> EMS_BUSSTATS_FSHIFT;
+    }
 
-    // RC20 and RC20RF
-    {EMS_DEVICE_UPDATE_FLAG_THERMOSTAT, EMS_TYPE_RC20Set, "RC20Set", _process_RC20Set},
-    {EMS_DEVICE_UPDATE_FLAG_THERMOSTAT, EMS_TYPE_RC20StatusMessage, "RC20StatusMessage", _process_RC20StatusMessage},
+    EMS_BusStats.lastTelegrams = EMS_BusStats.sampleTelegrams;
+    EMS_BusStats.lastBytes     = EMS_BusStats.sampleBytes;
+    EMS_BusStats.lastBusy      = (load * 10) >> EMS_BUSSTATS_FSHIFT;
+    EMS_BusStats.lastOurs      = (ourLoad * 10) >> EMS_BUSSTATS_FSHIFT;
+    EMS_BusStats.busy += (EMS_BusStats.sampleBusy + 500) / 1000;
 
-    // RC30
-    {EMS_DEVICE_UPDATE_FLAG_THERMOSTAT, EMS_TYPE_RC30Set, "RC30Set", _process_RC30Set},
-    {EMS_DEVICE_UPDATE_FLAG_THERMOSTAT, EMS_TYPE_RC30StatusMessage, "RC30StatusMessage", _process_RC30StatusMessage},
+    EMS_BusStats.sampleStart += EMS_BUSSTATS_SAMPLE;
+    EMS_BusStats.sampleBusy      = 0;
+    EMS_BusStats.sampleOurs      = 0;
+    EMS_BusStats.sampleTelegrams = 0;
+    EMS_BusStats.sampleBytes     = 0;
+}
 
-    // RC35 and ES71
-    {EMS_DEVICE_UPDATE_FLAG_THERMOSTAT, EMS_TYPE_RC35Set_HC1, "RC35Set_HC1", _process_RC35Set},
-    {EMS_DEVICE_UPDATE_FLAG_THERMOSTAT, EMS_TYPE_RC35StatusMessage_HC1, "RC35StatusMessage_HC1", _process_RC35StatusMessage},
-    {EMS_DEVICE_UPDATE_FLAG_THERMOSTAT, EMS_TYPE_RC35Set_HC2, "RC35Set_HC2", _process_RC35Set},
-    {EMS_DEVICE_UPDATE_FLAG_THERMOSTAT, EMS_TYPE_RC35StatusMessage_HC2, "RC35StatusMessage_HC2", _process_RC35StatusMessage},
-    {EMS_DEVICE_UPDATE_FLAG_THERMOSTAT, EMS_TYPE_RC35Set_HC3, "RC35Set_HC2", _process_RC35Set},
-    {EMS_DEVICE_UPDATE_FLAG_THERMOSTAT, EMS_TYPE_RC35StatusMessage_HC3, "RC35StatusMessage_HC3", _process_RC35StatusMessage},
-    {EMS_DEVICE_UPDATE_FLAG_THERMOSTAT, EMS_TYPE_RC35Set_HC4, "RC35Set_HC4", _process_RC35Set},
-    {EMS_DEVICE_UPDATE_FLAG_THERMOSTAT, EMS_TYPE_RC35StatusMessage_HC4, "RC35StatusMessage_HC4", _process_RC35StatusMessage},
+/**
+ * close the samples that are due. When the bus has been quiet for a while these are all 0
+ * after 15 minutes of nothing the averages have decayed anyway, so that's as far as it catches up
+ */
+void ems_busStatsTick() {
+    uint32_t now = millis();
+    uint8_t  n   = 0;
+    while ((now - EMS_BusStats.sampleStart) >= EMS_BUSSTATS_SAMPLE) {
+        if (++n > (900000 / EMS_BUSSTATS_SAMPLE)) {
+            EMS_BusStats.sampleStart = now;
+            break;
+        }
+        _ems_busStatsSample();
+    }
+}
 
-    // Easy
-    {EMS_DEVICE_UPDATE_FLAG_THERMOSTAT, EMS_TYPE_EasyStatusMessage, "EasyStatusMessage", _process_EasyStatusMessage},
+// the counter for a source or type ID. When they're all used the last one is for the rest
+static _EMS_BusCount * _ems_busCount(_EMS_BusCount * counts, uint8_t * used, uint8_t max, uint16_t id) {
+    for (uint8_t i = 0; i < *used; i++) {
+        if (counts[i].id == id) {
+            return &counts[i];
+        }
+    }
+    if (*used == max) {
+        return &counts[max - 1];
+    }
+    counts[*used].id = (*used == (max - 1)) ? EMS_BUSSTATS_OTHER : id;
+    return &counts[(*used)++];
+}
 
-    // Nefit 1010, RC300, RC310 (EMS Plus)
-    {EMS_DEVICE_UPDATE_FLAG_THERMOSTAT, EMS_TYPE_RCPLUSStatusMessage_HC1, "RCPLUSStatusMessage_HC1", _process_RCPLUSStatusMessage},
-    {EMS_DEVICE_UPDATE_FLAG_THERMOSTAT, EMS_TYPE_RCPLUSStatusMessage_HC2, "RCPLUSStatusMessage_HC2", _process_RCPLUSStatusMessage},
-    {EMS_DEVICE_UPDATE_FLAG_THERMOSTAT, EMS_TYPE_RCPLUSStatusMessage_HC3, "RCPLUSStatusMessage_HC3", _process_RCPLUSStatusMessage},
-    {EMS_DEVICE_UPDATE_FLAG_THERMOSTAT, EMS_TYPE_RCPLUSStatusMessage_HC4, "RCPLUSStatusMessage_HC4", _process_RCPLUSStatusMessage},
-    {EMS_DEVICE_UPDATE_FLAG_THERMOSTAT, EMS_TYPE_RCPLUSSet, "RCPLUSSetMessage", _process_RCPLUSSetMessage},
-    {EMS_DEVICE_UPDATE_FLAG_THERMOSTAT, EMS_TYPE_RCPLUSStatusMode, "RCPLUSStatusMode", _process_RCPLUSStatusMode},
+// the type ID of a telegram of 5 bytes or more, the same as in _ems_parseTelegram()
+static uint16_t _ems_busType(uint8_t * telegram, uint8_t length) {
+    if (telegram[2] < 0xF0) {
+        return telegram[2];
+    }
+    if (telegram[2] == 0xFF) {
+        return (length > 6) ? ((telegram[4] << 8) + telegram[5]) : EMS_BUSSTATS_OTHER;
+    }
+    uint8_t shift = (telegram[4] != 0xFF);
+    return (length > (7 + shift)) ? ((telegram[5 + shift] << 8) + telegram[6 + shift]) : EMS_BUSSTATS_OTHER;
+}
 
-    // Junkers FR10
-    {EMS_DEVICE_UPDATE_FLAG_THERMOSTAT, EMS_TYPE_JunkersStatusMessage, "JunkersStatusMessage", _process_JunkersStatusMessage},
+/**
+ * count a telegram, called from ems_parseTelegram() for everything on the bus
+ * length is the number of bytes including the CRC, the <BRK> is added for the time it took
+ * a corrupt telegram still took up the bus, but isn't counted by source and type as they could be anything
+ */
+void _ems_busStatsAdd(uint8_t * telegram, uint8_t length, bool crcOk) {
+    ems_busStatsTick();
 
-    // Mixing devices
-    {EMS_DEVICE_UPDATE_FLAG_MIXING, EMS_TYPE_MMPLUSStatusMessage_HC1, "MMPLUSStatusMessage_HC1", _process_MMPLUSStatusMessage},
-    {EMS_DEVICE_UPDATE_FLAG_MIXING, EMS_TYPE_MMPLUSStatusMessage_HC2, "MMPLUSStatusMessage_HC2", _process_MMPLUSStatusMessage}
+    uint32_t busy = (length * EMSUART_TX_WAIT_BYTE) + EMSUART_TX_WAIT_BRK;
+    bool     ours;
 
-};
+    if (length == 1) {
+        EMS_BusStats.polls++;
+        ours = (telegram[0] == EMS_Sys_Status.emsPollAck[0]);
+    } else {
+        ours = ((telegram[0] & 0x7F) == EMS_ID_ME);
+    }
 
-// calculate sizes of arrays at compile time
-uint8_t _EMS_Types_max = ArraySize(EMS_Types);
+    EMS_BusStats.telegrams++;
+    EMS_BusStats.bytes += length;
+    EMS_BusStats.sampleTelegrams++;
+    EMS_BusStats.sampleBytes += length;
+    EMS_BusStats.sampleBusy += busy;
+    if (ours) {
+        EMS_BusStats.ourTelegrams++;
+        EMS_BusStats.ourBytes += length;
+        EMS_BusStats.sampleOurs += busy;
+    }
+
+    // by source and type, only for proper telegrams
+    if ((length < 5) || !crcOk) {
+        return;
+    }
+
+    _EMS_BusCount * count = _ems_busCount(EMS_BusStats.sources, &EMS_BusStats.sourceCount, EMS_BUSSTATS_SOURCES, telegram[0] & 0x7F);
+    count->telegrams++;
+    count->bytes += length;
+
+    count = _ems_busCount(EMS_BusStats.types, &EMS_BusStats.typeCount, EMS_BUSSTATS_TYPES, _ems_busType(telegram, length));
+    count->telegrams++;
+    count->bytes += length;
+}
+
+// the values of the device a telegram updates, as they were before it was decoded
+static union {
+    _EMS_Boiler      boiler;
+    _EMS_Thermostat  thermostat;
+    _EMS_Mixing      mixing;
+    _EMS_SolarModule solar;
+    _EMS_HeatPump    heatpump;
+} EMS_DeviceBefore;
+
+// for each device, how many times a telegram has changed its values. Indexed by _ems_deviceValues()
+static uint32_t EMS_DeviceChanges[5];
 
 /**
- * Find the pointer to the EMS_Types array for a given type ID
- * or -1 if not found
+ * the values a device update flag stands for, or nullptr if it isn't for a single device
+ * changes is set to the device's count of value changes
  */
-int8_t _ems_findType(uint16_t type) {
-    uint8_t i         = 0;
-    bool    typeFound = false;
-    // scan through known ID types
-    while (i < _EMS_Types_max) {
-        if (EMS_Types[i].type == type) {
-            typeFound = true; // we have a match
-            break;
-        }
-        i++;
+static void * _ems_deviceValues(_EMS_DEVICE_UPDATE_FLAG flag, size_t * size, uint32_t ** changes) {
+    switch (flag) {
+    case EMS_DEVICE_UPDATE_FLAG_BOILER:
+        *size    = sizeof(EMS_Boiler);
+        *changes = &EMS_DeviceChanges[0];
+        return &EMS_Boiler;
+    case EMS_DEVICE_UPDATE_FLAG_THERMOSTAT:
+        *size    = sizeof(EMS_Thermostat);
+        *changes = &EMS_DeviceChanges[1];
+        return &EMS_Thermostat;
+    case EMS_DEVICE_UPDATE_FLAG_MIXING:
+        *size    = sizeof(EMS_Mixing);
+        *changes = &EMS_DeviceChanges[2];
+        return &EMS_Mixing;
+    case EMS_DEVICE_UPDATE_FLAG_SOLAR:
+        *size    = sizeof(EMS_SolarModule);
+        *changes = &EMS_DeviceChanges[3];
+        return &EMS_SolarModule;
+    case EMS_DEVICE_UPDATE_FLAG_HEATPUMP:
+        *size    = sizeof(EMS_HeatPump);
+        *changes = &EMS_DeviceChanges[4];
+        return &EMS_HeatPump;
+    default:
+        return nullptr;
     }
+}
 
-    return (typeFound ? i : -1);
+/**
+ * a device's values may have been changed other than by its telegrams, so the next copy of each is decoded again
+ */
+void _ems_deviceChanged() {
+    for (uint8_t i = 0; i < ArraySize(EMS_DeviceChanges); i++) {
+        EMS_DeviceChanges[i]++;
+    }
 }
 
 /**
  * print detailed telegram
  * and then call its callback if there is one defined
+ * A telegram that doesn't change any of the device's values is not flagged to be published
+ * A telegram that is the same as its last copy isn't decoded again, unless one of the device's values has changed since that
+ * copy was decoded. Several types can set the same value, and a value can depend on another type's, so any change counts
  */
 void _ems_processTelegram(_EMS_RxTelegram * EMS_RxTelegram) {
     // print out the telegram for verbose mode
@@ -2729,6 +4840,9 @@ void _ems_processTelegram(_EMS_RxTelegram * EMS_RxTelegram) {
         _printMessage(EMS_RxTelegram);
     }
 
+    // a chunk of a block being read, which is empty if the block ended before it
+    _ems_blockSeen(EMS_RxTelegram);
+
     // ignore telegrams that don't have any data
     if (EMS_RxTelegram->data_length == 0) {
         return;
@@ -2747,6 +4861,17 @@ void _ems_processTelegram(_EMS_RxTelegram * EMS_RxTelegram) {
         return; // not found
     }
 
+    // the reply to a planned read is decoded as the whole telegram
+    uint8_t merge = _ems_mergeShadow(EMS_RxTelegram);
+    if (merge == EMS_MERGE_LOST) {
+        return;
+    }
+
+    // keeps the refresh scheduler from reading types that have just come in
+    if (EMS_RxTelegram->offset == 0) {
+        _ems_refreshSeen(EMS_RxTelegram);
+    }
+
     // if it's a common type (across ems devices) or something specifically for us process it.
     // dest will be EMS_ID_NONE and offset 0x00 for a broadcast message
     if ((EMS_Types[i].processType_cb) != nullptr) {
@@ -2754,14 +4879,43 @@ void _ems_processTelegram(_EMS_RxTelegram * EMS_RxTelegram) {
         if (EMS_Sys_Status.emsLogging == EMS_SYS_LOGGING_BASIC) {
             myDebug_P(PSTR("<--- %s(0x%02X)"), EMS_Types[i].typeString, type);
         }
+
+        _EMS_DEVICE_UPDATE_FLAG flag    = EMS_Types[i].device_flag;
+        size_t                  size    = 0;
+        uint32_t *              changes = nullptr;
+        void *                  values  = _ems_deviceValues(flag, &size, &changes);
+
+        // keep the last copy, for planned reads and the value cache
+        _EMS_Shadow * shadow = nullptr;
+        if ((merge == EMS_MERGE_NONE) && values) {
+            if (_ems_shadowTelegram(EMS_RxTelegram, &shadow) && (shadow->changes == *changes)) {
+                EMS_Sys_Status.emsRxUnchanged++;
+                EMS_Sys_Status.emsRxSkipped++;
+                return; // decoding it again would give the values it gave last time
+            }
+        }
+
+        if (values) {
+            memcpy(&EMS_DeviceBefore, values, size);
+        }
+
         // call callback function to process the telegram
         (void)EMS_Types[i].processType_cb(EMS_RxTelegram);
 
         // see if we need to flag something has changed
-        ems_Device_add_flags(EMS_Types[i].device_flag);
-    }
+        if (!values) {
+            ems_Device_add_flags(flag);
+        } else if (memcmp(&EMS_DeviceBefore, values, size)) {
+            ems_Device_add_flags(flag);
+            (*changes)++;
+        } else {
+            EMS_Sys_Status.emsRxUnchanged++;
+        }
 
-    EMS_Sys_Status.emsTxStatus = EMS_TX_STATUS_IDLE;
+        if (shadow) {
+            shadow->changes = *changes;
+        }
+    }
 }
 
 /**
@@ -2779,8 +4933,13 @@ void _processType(_EMS_RxTelegram * EMS_RxTelegram) {
         return;
     }
 
-    // if its a broadcast and we didn't just send anything, process it and exit
-    if (EMS_Sys_Status.emsTxStatus == EMS_TX_STATUS_IDLE) {
+    // a broadcast can confirm a write, so it doesn't need to be read back
+    if (EMS_RxTelegram->dest == EMS_ID_NONE) {
+        _ems_validateSeen(EMS_RxTelegram);
+    }
+
+    // if its a broadcast and we're not waiting for a reply, process it and exit
+    if (EMS_Sys_Status.emsTxStatus != EMS_TX_STATUS_WAIT) {
         _ems_processTelegram(EMS_RxTelegram);
         return;
     }
@@ -2790,13 +4949,16 @@ void _processType(_EMS_RxTelegram * EMS_RxTelegram) {
 
     // at this point we can assume TxStatus was EMS_TX_STATUS_WAIT as we just sent a read or validate telegram
     // for READ or VALIDATE the dest (telegram[1]) is always us, so check for this
-    // and if not we probably didn't get any response so remove the last Tx from the queue and process the telegram anyway
+    // and if not we probably didn't get any response. Try again later, and process the telegram anyway
     if ((telegram[1] & 0x7F) != EMS_ID_ME) {
-        _removeTxQueue();
+        _ems_txNoReply();
         _ems_processTelegram(EMS_RxTelegram);
         return;
     }
 
+    // the reply to our read, from the end of the read to the end of the reply
+    _histogram_add(&emsuart_getTiming()->readLatency, emsuart_rx_time() - emsuart_tx_time());
+
     // first double check we actually have something in the Tx queue that we're waiting upon
     if (EMS_TxQueue.isEmpty()) {
         _ems_processTelegram(EMS_RxTelegram);
@@ -2821,20 +4983,25 @@ void _processType(_EMS_RxTelegram * EMS_RxTelegram) {
             // read not OK, we didn't get back a telegram we expected.
             // first see if we got a response back from the sender saying its an unknown command
             if (EMS_RxTelegram->data_length == 0) {
+                _ems_txFailed(EMS_TX_FAIL_REJECTED, false);
                 _removeTxQueue();
+                _ems_discoveryLost(EMS_TxTelegram.type, EMS_TxTelegram.dest);
             } else {
-                // leave on queue and try again, but continue to process what we received as it may be important
+                // leave on queue and try again after the backoff, but continue to process what we received as it may be important
                 EMS_Sys_Status.txRetryCount++;
                 // if retried too many times, give up and remove it
                 if (EMS_Sys_Status.txRetryCount >= TX_WRITE_TIMEOUT_COUNT) {
                     if (EMS_Sys_Status.emsLogging >= EMS_SYS_LOGGING_BASIC) {
                         myDebug_P(PSTR("-> Read failed. Giving up and removing write from queue"));
                     }
+                    _ems_txFailed(EMS_TX_FAIL_WRONG, false);
                     _removeTxQueue();
+                    _ems_discoveryLost(EMS_TxTelegram.type, EMS_TxTelegram.dest);
                 } else {
                     if (EMS_Sys_Status.emsLogging >= EMS_SYS_LOGGING_BASIC) {
                         myDebug_P(PSTR("-> Read failed. Retrying (%d/%d)..."), EMS_Sys_Status.txRetryCount, TX_WRITE_TIMEOUT_COUNT);
                     }
+                    _ems_txFailed(EMS_TX_FAIL_WRONG, true);
                 }
             }
         }
@@ -2853,14 +5020,21 @@ void _processType(_EMS_RxTelegram * EMS_RxTelegram) {
         // See https://github.com/proddy/EMS-ESP/wiki/RC3xx-Thermostats
         uint8_t dataReceived = (EMS_RxTelegram->emsplus) ? telegram[6] : telegram[4];
 
-        if (EMS_TxTelegram.comparisonValue == dataReceived) {
+        // compare all the bytes written, unless the write has been forgotten. See _createValidate()
+        _EMS_PendingValidate * pending = _ems_findValidate(EMS_TxTelegram.dest, EMS_TxTelegram.type, EMS_TxTelegram.offset);
+        bool                   valid   = pending ? _ems_validateMatch(pending, EMS_RxTelegram) : (EMS_TxTelegram.comparisonValue == dataReceived);
+
+        if (valid) {
             // validate was successful, the write changed the value
+            if (pending) {
+                pending->dest = 0;
+            }
             _removeTxQueue(); // now we can remove the Tx validate command the queue
             if (EMS_Sys_Status.emsLogging >= EMS_SYS_LOGGING_BASIC) {
                 myDebug_P(PSTR("-> Validate confirmed, last Write to 0x%02X was successful"), EMS_TxTelegram.dest);
             }
             // follow up with the post read command
-            ems_doReadCommand(EMS_TxTelegram.comparisonPostRead, EMS_TxTelegram.dest);
+            ems_doReadCommand(EMS_TxTelegram.comparisonPostRead, EMS_TxTelegram.dest, true);
         } else {
             // write failed
             if (EMS_Sys_Status.emsLogging >= EMS_SYS_LOGGING_BASIC) {
@@ -2870,6 +5044,10 @@ void _processType(_EMS_RxTelegram * EMS_RxTelegram) {
                 if (EMS_Sys_Status.emsLogging >= EMS_SYS_LOGGING_BASIC) {
                     myDebug_P(PSTR("-> Write failed. Giving up, removing from queue"));
                 }
+                if (pending) {
+                    pending->dest = 0;
+                }
+                _ems_txFailed(EMS_TX_FAIL_WRONG, false);
                 _removeTxQueue();
             } else {
                 // retry, turn the validate back into a write and try again
@@ -2880,9 +5058,13 @@ void _processType(_EMS_RxTelegram * EMS_RxTelegram) {
                 EMS_TxTelegram.dataValue = EMS_TxTelegram.comparisonValue;  // restore old value
                 EMS_TxTelegram.offset    = EMS_TxTelegram.comparisonOffset; // restore old value
                 EMS_TxTelegram.type      = EMS_TxTelegram.type_validate;    // restore old value, we swapped them to save the original type
+                if (pending && (pending->length > 1)) {
+                    EMS_TxTelegram.length = EMS_MIN_TELEGRAM_LENGTH + pending->length - 1; // a combined write, with all its bytes
+                    memcpy(&EMS_TxTelegram.data[4], pending->value, pending->length);
+                }
 
-                EMS_TxQueue.shift();                 // remove validate from queue
-                EMS_TxQueue.unshift(EMS_TxTelegram); // add back to queue making it next in line
+                EMS_TxQueue.replaceFront(EMS_TxTelegram); // the write goes in place of the validate, making it next in line
+                _ems_txFailed(EMS_TX_FAIL_WRONG, true);
             }
         }
     }
@@ -2893,8 +5075,9 @@ void _processType(_EMS_RxTelegram * EMS_RxTelegram) {
 /**
  * Send a command to UART Tx to Read from another device
  * Read commands when sent must respond by the destination (target) immediately (or within 10ms)
+ * planned reads only the bytes that are decoded, see _ems_readPlan()
  */
-void ems_doReadCommand(uint16_t type, uint8_t dest) {
+void ems_doReadCommand(uint16_t type, uint8_t dest, bool planned) {
     // if not a valid type of boiler is not accessible then quits
     if ((type == EMS_ID_NONE) || (dest == EMS_ID_NONE)) {
         return;
@@ -2933,5 +5116,10 @@ void ems_doReadCommand(uint16_t type, uint8_t dest) {
     EMS_TxTelegram.comparisonOffset   = 0;
     EMS_TxTelegram.comparisonPostRead = EMS_ID_NONE;
 
+    // only the bytes that are decoded
+    if (planned && _ems_readPlan(type, dest, &EMS_TxTelegram.offset, &EMS_TxTelegram.dataValue)) {
+        EMS_Sys_Status.emsTxReadsPlanned++;
+    }
+
     EMS_TxQueue.push(EMS_TxTelegram);
 }
@@ -10,7 +10,7 @@
 #pragma once
 
 #include <Arduino.h>
-#include <list> // std::list
+#include <stddef.h> // offsetof
 
 // EMS tx_mode types
 #define EMS_TXMODE_DEFAULT 1 // Default (was previously known as tx_mode 2 in v1.8.x)
@@ -69,7 +69,7 @@ typedef enum {
 // define maximum setable tapwater temperature
 #define EMS_BOILER_TAPWATER_TEMPERATURE_MAX 60
 
-#define EMS_TX_TELEGRAM_QUEUE_MAX 50 // max size of Tx FIFO queue. Number of Tx records to send.
+#define EMS_TX_QUEUE_SIZE 2048 // bytes for the Tx FIFO queue, see EMSTxQueue. Holds about 80 read requests
 
 //#define EMS_SYS_LOGGING_DEFAULT EMS_SYS_LOGGING_VERBOSE // turn on for debugging
 #define EMS_SYS_LOGGING_DEFAULT EMS_SYS_LOGGING_NONE
@@ -86,11 +86,13 @@ typedef enum {
 
 typedef enum {
     EMS_TX_STATUS_OK,
-    EMS_TX_STATUS_IDLE, // ready
-    EMS_TX_STATUS_WAIT, // waiting for response from last Tx
-    EMS_TX_WTD_TIMEOUT, // watchdog timeout during send
-    EMS_TX_BRK_DETECT,  // incoming BRK during Tx
-    EMS_TX_REV_DETECT   // waiting to detect reverse bit
+    EMS_TX_STATUS_IDLE,   // ready
+    EMS_TX_STATUS_WAIT,   // waiting for response from last Tx
+    EMS_TX_WTD_TIMEOUT,   // watchdog timeout during send
+    EMS_TX_BRK_DETECT,    // incoming BRK during Tx
+    EMS_TX_REV_DETECT,    // waiting to detect reverse bit
+    EMS_TX_BUSY,          // the last Tx is still going out on the bus
+    EMS_TX_STATUS_BACKOFF // holding the next Tx, after a failure or while a broadcast may confirm a write. See ems_txTick()
 } _EMS_TX_STATUS;
 
 #define EMS_TX_SUCCESS 0x01 // EMS single byte after a Tx Write indicating a success
@@ -123,6 +125,18 @@ typedef struct {
     uint16_t         emsRxPgks;                              // # successfull received
     uint16_t         emsTxPkgs;                              // # successfull sent
     uint16_t         emxCrcErr;                              // CRC errors
+    uint16_t         emsCrcErrSrc[0x80];                     // CRC errors by source ID
+    uint32_t         emsRxUnchanged;                         // telegrams that didn't change any device values
+    uint32_t         emsRxSkipped;                           // of those, the ones not decoded as nothing could have changed
+    uint16_t         emsTxReadsMerged;                       // reads not queued because the same read was already waiting
+    uint16_t         emsTxReadsPlanned;                      // reads of only the bytes that are decoded, see _ems_readPlan()
+    uint16_t         emsTxWritesReplaced;                    // waiting writes overwritten by a newer value for the same offset
+    uint16_t         emsTxWritesCombined;                    // writes combined with a waiting write to the bytes next to them
+    uint16_t         emsTxValidatesSkipped;                  // writes confirmed by a broadcast, without reading the value back
+    uint16_t         emsRefreshReads;                        // reads issued by the refresh scheduler
+    uint16_t         emsCacheHits;                           // on-demand reads answered from the last copy, see _ems_cacheFresh()
+    uint16_t         emsCacheMisses;                         // on-demand reads that went to the bus
+    uint32_t         emsCacheTTL;                            // ms the last copy of a type is fresh enough for an on-demand read, 0 to always read
     bool             emsPollEnabled;                         // flag enable the response to poll messages
     _EMS_SYS_LOGGING emsLogging;                             // logging
     uint16_t         emsLogging_typeID;                      // the typeID to watch
@@ -170,6 +184,262 @@ typedef struct {
     uint8_t       emsplus_type; // FF, F7 or F9
 } _EMS_RxTelegram;
 
+// The last copy of a telegram, that a planned read is merged into. It's also the value cache, see _ems_cacheFresh()
+#define EMS_SHADOWS_MAX 32  // number of telegrams that are kept
+#define EMS_CACHE_TTL 30000 // ms, the default for EMS_Sys_Status.emsCacheTTL
+
+typedef struct {
+    uint32_t timestamp; // ms, when it last came in
+    uint32_t changes;   // the device's value changes when it was last decoded, see _ems_processTelegram()
+    uint16_t type;      // type ID
+    uint8_t  src;       // source ID
+    uint8_t  dest;      // destination ID, as broadcasts and replies to us are handled differently
+    uint8_t  offset;    // offset
+    uint8_t  data_length;
+    uint8_t  data[EMS_MAX_TELEGRAM_LENGTH];
+} _EMS_Shadow;
+
+// what _ems_mergeShadow() did with a telegram
+typedef enum {
+    EMS_MERGE_NONE, // not the reply to a planned read, it's decoded as it is
+    EMS_MERGE_DONE, // put into the last whole copy, which is decoded instead
+    EMS_MERGE_LOST  // a part whose whole copy has been re-used, so it can't be decoded
+} _EMS_MERGE;
+
+// The types that are read regularly, and when they were last seen
+#define EMS_REFRESH_MAX 24          // number of types that can be scheduled
+#define EMS_REFRESH_TTL 60000       // ms before a type that isn't broadcast is read again
+#define EMS_REFRESH_TTL_MAX 600000  // ms, the longest a broadcast type can go without being read
+#define EMS_REFRESH_TICK_TIME 1     // seconds between calls to ems_refreshTick()
+
+typedef struct {
+    uint16_t type;          // type ID
+    uint8_t  dest;          // device ID to read it from
+    bool     wanted;        // still needed after the last ems_refreshTick()
+    uint32_t lastSeen;      // ms, when it was last received as a broadcast or reply
+    uint32_t lastBroadcast; // ms, when it was last received as a broadcast
+    uint32_t interval;      // ms, the learned broadcast interval or 0 if it's not broadcast
+    uint32_t lastRead;      // ms, when it was last read by the scheduler
+    uint16_t reads;         // # reads issued by the scheduler
+} _EMS_Refresh;
+
+// Datasets longer than a telegram, read in chunks at increasing offsets. See ems_getBlock()
+#define EMS_BLOCK_MAX 6         // number of blocks that are kept
+#define EMS_BLOCK_LENGTH_MAX 96 // bytes in the longest block
+#define EMS_BLOCK_CHUNK 25      // data bytes in each read, what fits in an EMS+ reply
+#define EMS_BLOCK_TTL 3600000   // ms before a complete block is read again
+#define EMS_BLOCK_ROUNDS 3      // times the missing chunks of a transfer are read before it's given up
+
+typedef struct {
+    uint16_t type;                       // type ID
+    uint8_t  dest;                       // device ID to read it from
+    uint8_t  length;                     // # bytes, less than asked for if the device sent a shorter block
+    uint8_t  valid;                      // bitmap of the chunks received in the current transfer
+    uint8_t  rounds;                     // # times the chunks have been read in the current transfer
+    bool     wanted;                     // still needed after the last ems_refreshTick()
+    bool     complete;                   // data holds a whole block
+    bool     changed;                    // data has changed in the current transfer
+    uint32_t started;                    // ms, when the current transfer started, 0 if there isn't one
+    uint32_t due;                        // ms, when the next transfer should start
+    uint32_t timeLast;                   // ms the last complete transfer took
+    uint32_t timeMax;                    // ms, longest
+    uint16_t transfers;                  // # complete transfers
+    uint16_t failed;                     // # transfers given up
+    uint8_t  data[EMS_BLOCK_LENGTH_MAX]; // the last whole block, with the chunks of the current transfer as they come in
+} _EMS_Block;
+
+// The discovery of the devices on the bus, see ems_discoverModels()
+#define EMS_DISCOVERY_MAP 16        // bytes in a bitmap of all 128 device IDs
+#define EMS_DISCOVERY_TIMEOUT 60000 // ms before a discovery is closed, with the probes that are still open counted as not there
+
+typedef struct {
+    bool     running;                    // a discovery is in progress
+    bool     mapPending;                 // the 0x07 read of the device bitmap is still to be answered
+    uint8_t  pending[EMS_DISCOVERY_MAP]; // bitmap of the device IDs with a Version read still to be answered
+    uint8_t  probed;                     // # Version reads sent
+    uint8_t  found;                      // # that replied
+    uint8_t  absent;                     // # that didn't
+    uint32_t started;                    // ms, when it started
+    uint32_t last;                       // ms, when the last probe was answered or given up on
+    uint32_t time;                       // ms the last complete discovery took, from the start to the last probe
+    uint16_t runs;                       // # discoveries completed
+} _EMS_Discovery;
+
+// Bus accounting, of everything seen on the bus. See _ems_busStatsAdd()
+#define EMS_BUSSTATS_SOURCES 16  // number of source IDs that are counted separately
+#define EMS_BUSSTATS_TYPES 24    // number of type IDs that are counted separately, the rest go under EMS_BUSSTATS_OTHER
+#define EMS_BUSSTATS_OTHER 0xFFFF
+#define EMS_BUSSTATS_SAMPLE 5000 // ms, how often the occupancy is sampled for the 1, 5 and 15 minute averages
+#define EMS_BUSSTATS_FSHIFT 11   // bits of fraction in the averages
+
+typedef struct {
+    uint16_t id;        // source ID or type ID
+    uint32_t telegrams; // # telegrams
+    uint32_t bytes;     // # bytes including the CRC
+} _EMS_BusCount;
+
+typedef struct {
+    uint32_t      start;                         // ms, when counting started
+    uint32_t      sampleStart;                   // ms, when the current sample started
+    uint32_t      sampleBusy;                    // us the bus was busy in the current sample
+    uint32_t      sampleOurs;                    // us of that with our own telegrams
+    uint32_t      sampleTelegrams;               // # telegrams in the current sample
+    uint32_t      sampleBytes;                   // # bytes in the current sample
+    uint16_t      lastTelegrams;                 // # telegrams in the last complete sample
+    uint16_t      lastBytes;                     // # bytes in the last complete sample
+    uint16_t      lastBusy;                      // occupancy of the last complete sample, in 0.1%
+    uint16_t      lastOurs;                      // our share of it, in 0.1%
+    uint32_t      load[3];                       // 1, 5 and 15 minute averages of the occupancy in %, EMS_BUSSTATS_FSHIFT fixed point
+    uint32_t      ourLoad[3];                    // the same for our own telegrams
+    uint32_t      telegrams;                     // # telegrams including polls
+    uint32_t      bytes;                         // # bytes including the CRC
+    uint32_t      busy;                          // ms the bus was busy
+    uint32_t      polls;                         // # single byte telegrams: polls, poll acknowledgements and write replies
+    uint32_t      ourTelegrams;                  // # telegrams sent by us
+    uint32_t      ourBytes;                      // # bytes sent by us
+    uint8_t       sourceCount;                   // # entries used in sources
+    uint8_t       typeCount;                     // # entries used in types
+    _EMS_BusCount sources[EMS_BUSSTATS_SOURCES]; // telegrams of 5 bytes or more by source ID
+    _EMS_BusCount types[EMS_BUSSTATS_TYPES];     // the same by type ID
+} _EMS_BusStats;
+
+// Tx queue lanes, highest priority first
+typedef enum : uint8_t {
+    EMS_TX_LANE_INTERACTIVE, // writes and raw telegrams, as asked for by the user
+    EMS_TX_LANE_VALIDATE,    // reading back a write
+    EMS_TX_LANE_DISCOVERY,   // finding the devices on the bus and their versions
+    EMS_TX_LANE_REFRESH,     // the regular reads
+    EMS_TX_LANES             // number of lanes
+} _EMS_TX_LANE;
+
+#define EMS_TX_LANE_AGING 10000 // ms a telegram waits before it moves up a lane, so the lower lanes are never starved
+
+// statistics for each Tx queue lane
+typedef struct {
+    uint32_t telegrams; // # taken off the queue
+    uint32_t waitTotal; // ms from being queued until taken off, added up
+    uint32_t waitMax;   // ms, longest
+} _EMS_TxLaneStats;
+
+// how a telegram we sent can fail, see ems_txTick()
+typedef enum : uint8_t {
+    EMS_TX_FAIL_BRK,      // cancelled by a <BRK> from the bus master while it went out
+    EMS_TX_FAIL_WDTO,     // the bus master stopped echoing it
+    EMS_TX_FAIL_NOREPLY,  // no reply by the deadline, or another telegram came instead
+    EMS_TX_FAIL_WRONG,    // a read answered with another type, or a validate with another value
+    EMS_TX_FAIL_REJECTED, // a write answered with 04
+    EMS_TX_FAILS          // number of failure classes
+} _EMS_TX_FAIL;
+
+#define EMS_TX_REPLY_MIN 200    // ms we wait for a reply at least, two poll intervals are added to it
+#define EMS_TX_REPLY_MAX 5000   // ms we wait for a reply at most
+#define EMS_TX_BACKOFF_MIN 100  // ms before a telegram goes again after its first failure, or the poll interval if that's longer
+#define EMS_TX_BACKOFF_MAX 5000 // ms, the wait doubles with each failure in a row up to this
+#define EMS_TX_FAIL_MAX 6       // failures in a row of a telegram the bus didn't take, before it's dropped
+
+// writes to bytes next to each other are combined into one telegram, see EMSTxQueue::_combine()
+#define EMS_TX_WRITE_BATCH_WINDOW 100 // ms a new write is held back, so the writes that follow it can join it
+#define EMS_TX_WRITE_BATCH_MAX 8      // most bytes in a combined write
+
+// a write that has been acknowledged and is waiting to be validated, see _ems_validateSeen()
+#define EMS_VALIDATE_PENDING_MAX 4
+
+typedef struct {
+    uint16_t type;                          // the type the value is read back from, type_validate of the write
+    uint16_t postRead;                      // comparisonPostRead of the write
+    uint8_t  dest;                          // device ID, 0 if the slot is free
+    uint8_t  offset;                        // comparisonOffset
+    uint8_t  length;                        // # bytes written
+    uint8_t  value[EMS_TX_WRITE_BATCH_MAX]; // the bytes written, or comparisonValue
+} _EMS_PendingValidate;
+
+// statistics for each failure class
+typedef struct {
+    uint32_t count; // # failures
+    uint32_t lost;  // ms from sending the telegram until it could go again, or was dropped, added up
+} _EMS_TxFailStats;
+
+// histogram of times in microseconds, with 4 buckets per power of 2 from 16 us to 16 s. See _histogram_add()
+#define EMS_HISTOGRAM_BUCKETS 80
+
+typedef struct {
+    uint32_t count; // # values added
+    uint32_t max;
+    uint16_t buckets[EMS_HISTOGRAM_BUCKETS]; // all are halved when one is full, so they keep the shape
+} _EMS_Histogram;
+
+// A Tx telegram in the queue, encoded and ready to send. The telegram bytes follow straight after it
+typedef struct {
+    uint32_t timestamp; // when created
+    uint16_t type;
+    uint16_t type_validate;
+    uint16_t comparisonPostRead;
+    uint8_t  action; // _EMS_TX_TELEGRAM_ACTION, in a byte
+    uint8_t  dest;
+    uint8_t  offset;
+    uint8_t  dataValue;
+    uint8_t  comparisonValue;
+    uint8_t  comparisonOffset;
+    uint8_t  emsIDMask; // the emsIDMask the header was encoded with
+    uint8_t  lane;      // _EMS_TX_LANE
+    uint8_t  length;    // # bytes that follow, including the CRC
+} _EMS_TxQueueEntry;
+
+/*
+ * FIFO queue for the Tx telegrams. Each telegram is encoded when it is added, with its header, EMS+ type bytes and CRC,
+ * and stored as an _EMS_TxQueueEntry followed by its bytes. Entries are packed from the start of the arena so
+ * the one to send next is always at the front, and only take up the bytes they need
+ * Same calls as the CircularBuffer it replaces, with replaceFront() for unshift(). first() and [] return a decoded copy
+ * push() merges a read with the same read already waiting, and replaces a waiting write to the same offset with the new value
+ * or combines it with a waiting write to the bytes next to it
+ * Each telegram is in a lane, see _EMS_TX_LANE. Whenever the front changes the telegram in the highest lane is brought to the
+ * front, moving up one lane for every EMS_TX_LANE_AGING ms it has waited. Within a lane it is first in, first out
+ * find() returns the index of a waiting telegram with that action, device, type and offset, or -1
+ */
+class EMSTxQueue {
+  public:
+    bool                push(const _EMS_TxTelegram & EMS_TxTelegram);         // add to the back, false if full
+    bool                replaceFront(const _EMS_TxTelegram & EMS_TxTelegram); // swap the front for another, false if locked or full
+    void                shift();                                              // remove from the front
+    void                remove(uint8_t index);                                // remove the i-th
+    int8_t              find(uint8_t action, uint8_t dest, uint16_t type, uint8_t offset);
+    void                clear();
+    _EMS_TxTelegram     first();
+    _EMS_TxTelegram     operator[](uint8_t index);
+    _EMS_TxQueueEntry * front(); // the first entry, with its encoded bytes
+    bool                frontLocked();
+    bool                isEmpty() {
+        return (_count == 0);
+    }
+    uint8_t size() {
+        return _count;
+    }
+    uint16_t used() {
+        return _used;
+    }
+    uint8_t                  depth(uint8_t lane); // # telegrams waiting in a lane
+    const _EMS_TxLaneStats * laneStats(uint8_t lane) {
+        return &_laneStats[lane];
+    }
+
+    static const uint16_t capacity = EMS_TX_QUEUE_SIZE; // in bytes
+
+  private:
+    bool                _insert(uint16_t pos, const _EMS_TxTelegram & EMS_TxTelegram);
+    void                _remove(uint16_t pos);
+    bool                _coalesce(const _EMS_TxTelegram & EMS_TxTelegram, bool frontLocked);
+    bool                _combine(uint16_t pos, const _EMS_TxTelegram & EMS_TxTelegram);
+    void                _schedule();
+    void                _leave();
+    _EMS_TxQueueEntry * _entry(uint8_t index);
+
+    uint32_t _arena[EMS_TX_QUEUE_SIZE / 4]; // uint32_t so the entries are aligned
+    uint16_t _used  = 0;                    // bytes
+    uint8_t  _count = 0;                    // telegrams
+
+    _EMS_TxLaneStats _laneStats[EMS_TX_LANES];
+};
+
 // default empty Tx, must match struct
 const _EMS_TxTelegram EMS_TX_TELEGRAM_NEW = {
     EMS_TX_TELEGRAM_INIT, // action
@@ -193,7 +463,8 @@ typedef enum : uint8_t {
     EMS_DEVICE_UPDATE_FLAG_THERMOSTAT = (1 << 1),
     EMS_DEVICE_UPDATE_FLAG_MIXING     = (1 << 2),
     EMS_DEVICE_UPDATE_FLAG_SOLAR      = (1 << 3),
-    EMS_DEVICE_UPDATE_FLAG_HEATPUMP   = (1 << 4)
+    EMS_DEVICE_UPDATE_FLAG_HEATPUMP   = (1 << 4),
+    EMS_DEVICE_UPDATE_FLAG_BLOCK      = (1 << 5)
 } _EMS_DEVICE_UPDATE_FLAG;
 
 typedef enum : uint8_t {
@@ -227,14 +498,17 @@ typedef struct {
     char             device_type_string[30];
 } _EMS_Device_Types;
 
-// for storing all recognised EMS devices
+// for storing all recognised EMS devices, see ems_getDevice()
+#define EMS_DEVICE_SLOTS 128 // one for each 7-bit device ID
+#define EMS_DEVICE_SHARED 4  // for a second product at an ID that is already taken, from a 2nd subscriber
+
 typedef struct {
     _EMS_DEVICE_TYPE device_type;   // type (see above)
     uint8_t          product_id;    // product id
     uint8_t          device_id;     // device_id
-    const char *     device_desc_p; // pointer to description string in EMS_Devices table
-    char             version[10];   // the version number XX.XX
     bool             known;         // is this a known device?
+    const char *     device_desc_p; // pointer to description string in EMS_Devices table
+    char             version[8];    // the version number XX.XX
 } _Detected_Device;
 
 /*
@@ -393,14 +667,67 @@ typedef struct {
     EMS_processType_cb      processType_cb;
 } _EMS_Type;
 
+// how a value is stored in the telegram data, see _ems_decodeFields()
+typedef enum : uint8_t {
+    EMS_FIELD_FORMAT_UBYTE,  // 1 byte into a uint8_t
+    EMS_FIELD_FORMAT_BYTE16, // 1 byte into an int16_t, for setpoints that are stored * 2 in a single byte
+    EMS_FIELD_FORMAT_USHORT, // 2 bytes into a uint16_t, skipped if 0x8000
+    EMS_FIELD_FORMAT_SHORT,  // 2 bytes into an int16_t, skipped if 0x8000 or the first byte is 0x7D
+    EMS_FIELD_FORMAT_ULONG,  // 3 bytes into a uint32_t
+    EMS_FIELD_FORMAT_BIT     // a single bit into a uint8_t
+} _EMS_FIELD_FORMAT;
+
+// Definition of a value in a telegram and where it goes. Lists of these are kept in flash, 4 bytes an entry
+// aligned so an entry is read with a single pgm_read_dword(), and sorted by index
+typedef struct {
+    uint8_t index;  // position in the telegram data
+    uint8_t format; // _EMS_FIELD_FORMAT
+    uint8_t bit;    // for EMS_FIELD_FORMAT_BIT
+    uint8_t value;  // offset of the value in its struct, e.g. _EMS_Boiler
+} __attribute__((aligned(4))) _EMS_Field;
+
+static_assert(sizeof(_EMS_Field) == 4, "_EMS_Field must be read from flash as one word");
+
+// the format follows from the type of the value
+constexpr uint8_t _ems_fieldFormat(uint8_t *) {
+    return EMS_FIELD_FORMAT_UBYTE;
+}
+constexpr uint8_t _ems_fieldFormat(uint16_t *) {
+    return EMS_FIELD_FORMAT_USHORT;
+}
+constexpr uint8_t _ems_fieldFormat(int16_t *) {
+    return EMS_FIELD_FORMAT_SHORT;
+}
+constexpr uint8_t _ems_fieldFormat(uint32_t *) {
+    return EMS_FIELD_FORMAT_ULONG;
+}
+
+#define EMS_FIELD(index, type, value) \
+    { index, _ems_fieldFormat((decltype(type::value) *)nullptr), 0, offsetof(type, value) }
+#define EMS_FIELD_BIT(index, bit, type, value) \
+    { index, EMS_FIELD_FORMAT_BIT, bit, offsetof(type, value) }
+#define EMS_FIELD_BYTE16(index, type, value) \
+    { index, EMS_FIELD_FORMAT_BYTE16, 0, offsetof(type, value) }
+
+// A field list and the type it's decoded from, see _ems_checkFields()
+typedef struct {
+    uint16_t           type;
+    const _EMS_Field * fields;
+    uint8_t            count;
+} _EMS_FieldList;
+
+// The fields decoded from a type that is read regularly, so a read asks only for the bytes they cover. See _ems_readPlan()
+typedef _EMS_FieldList _EMS_ReadPlan;
+
 // function definitions
 void             ems_dumpBuffer(const char * prefix, uint8_t * telegram, uint8_t length);
-void             ems_parseTelegram(uint8_t * telegram, uint8_t len);
+void             ems_parseTelegram(uint8_t * telegram, uint8_t len, bool crcOk);
 void             ems_init();
-void             ems_doReadCommand(uint16_t type, uint8_t dest);
+void             ems_doReadCommand(uint16_t type, uint8_t dest, bool planned = false);
 void             ems_sendRawTelegram(char * telegram);
 void             ems_scanDevices();
 void             ems_printDevices();
+uint8_t          ems_getDeviceCount();
 uint8_t          ems_printDevices_s(char * buffer, uint16_t len);
 void             ems_printTxQueue();
 void             ems_testTelegram(uint8_t test_num);
@@ -420,11 +747,12 @@ void             ems_setWarmWaterModeComfort(uint8_t comfort);
 void             ems_setModels();
 void             ems_setTxDisabled(bool b);
 void             ems_setTxMode(uint8_t mode);
+void             ems_setCacheTTL(uint32_t ms);
 char *           ems_getDeviceDescription(_EMS_DEVICE_TYPE device_type, char * buffer, bool name_only = false);
 bool             ems_getDeviceTypeDescription(uint8_t device_id, char * buffer);
-void             ems_getThermostatValues();
-void             ems_getBoilerValues();
-void             ems_getSolarModuleValues();
+void             ems_getThermostatValues(bool scheduled = false);
+void             ems_getBoilerValues(bool scheduled = false);
+void             ems_getSolarModuleValues(bool scheduled = false);
 bool             ems_getPoll();
 bool             ems_getTxEnabled();
 bool             ems_getThermostatEnabled();
@@ -437,20 +765,73 @@ _EMS_SYS_LOGGING ems_getLogging();
 uint8_t          ems_getThermostatModel();
 uint8_t          ems_getSolarModuleModel();
 void             ems_discoverModels();
+_EMS_Discovery * ems_getDiscovery();
 bool             ems_getTxCapable();
+const char *     ems_getTxLaneName(uint8_t lane);
+void             ems_txTick();
+const char *     ems_getTxFailName(uint8_t fail);
+void             ems_refreshTick();
+void             ems_stageTx();
+uint8_t          ems_getRefreshCount();
+_EMS_Refresh *   ems_getRefresh(uint8_t i);
+uint8_t          ems_getBlockCount();
+_EMS_Block *     ems_getBlock(uint8_t i);
 uint32_t         ems_getPollFrequency();
+_EMS_BusStats *  ems_getBusStats();
+void             ems_clearBusStats();
+void             ems_busStatsTick();
 bool             ems_getTxDisabled();
 void             ems_Device_add_flags(unsigned int flags);
 bool             ems_Device_has_flags(unsigned int flags);
 void             ems_Device_remove_flags(unsigned int flags);
 
+_EMS_TxFailStats * ems_getTxFailStats(uint8_t fail);
+_Detected_Device * ems_getDevice(uint8_t device_id);
+_Detected_Device * ems_nextDevice(uint8_t * i);
+
 // private functions
-uint8_t _crcCalculator(uint8_t * data, uint8_t len);
-void    _processType(_EMS_RxTelegram * EMS_RxTelegram);
-void    _debugPrintPackage(const char * prefix, _EMS_RxTelegram * EMS_RxTelegram, const char * color);
-void    _ems_clearTxData();
-void    _removeTxQueue();
-uint8_t _getHeatingCircuit(_EMS_RxTelegram * EMS_RxTelegram);
+uint8_t   _crcCalculator(uint8_t * data, uint8_t len);
+void      _processType(_EMS_RxTelegram * EMS_RxTelegram);
+void      _ems_processTelegram(_EMS_RxTelegram * EMS_RxTelegram);
+void      _debugPrintPackage(const char * prefix, _EMS_RxTelegram * EMS_RxTelegram, const char * color);
+void      _ems_clearTxData();
+void      _ems_encodeTx(const _EMS_TxTelegram * EMS_TxTelegram, _EMS_TxQueueEntry * entry);
+uint8_t * _ems_txData(_EMS_TxQueueEntry * entry);
+void      _removeTxQueue();
+uint8_t   _getHeatingCircuit(_EMS_RxTelegram * EMS_RxTelegram);
+void      _ems_decodeFields(_EMS_RxTelegram * EMS_RxTelegram, const _EMS_Field * fields, uint8_t count, void * dest);
+uint8_t   _ems_checkFields();
+void      _ems_hashTypes();
+int8_t    _ems_findType(uint16_t type);
+void      _ems_clearShadows();
+bool      _ems_shadowTelegram(_EMS_RxTelegram * EMS_RxTelegram, _EMS_Shadow ** shadow);
+void      _ems_deviceChanged();
+bool      _ems_readPlan(uint16_t type, uint8_t dest, uint8_t * offset, uint8_t * length);
+uint8_t   _ems_mergeShadow(_EMS_RxTelegram * EMS_RxTelegram);
+bool      _ems_cacheFresh(uint16_t type, uint8_t dest);
+void      _ems_clearRefresh();
+void      _ems_refreshAdd(uint16_t type, uint8_t dest);
+void      _ems_refreshSeen(_EMS_RxTelegram * EMS_RxTelegram);
+bool      _ems_refreshBroadcast(uint16_t type, uint8_t dest);
+void      _ems_clearBlocks();
+void      _ems_blockAdd(uint16_t type, uint8_t dest, uint8_t length, bool scheduled);
+void      _ems_blockSeen(_EMS_RxTelegram * EMS_RxTelegram);
+void      _ems_blockTick();
+void      _ems_discoveryProbe(uint8_t device_id);
+void      _ems_discoveryAnswered(uint8_t device_id, bool found);
+void      _ems_discoveryLost(uint16_t type, uint8_t dest);
+bool      _ems_discoveryQuick(uint16_t type, uint8_t dest);
+void      _ems_discoveryTick();
+void      _ems_parseTelegram(uint8_t * telegram, uint8_t length, bool crcOk);
+void      _ems_txSetMask(_EMS_TxQueueEntry * entry);
+void      _ems_txPrint(_EMS_TxQueueEntry * entry);
+void      _ems_txStaged(uint8_t tag);
+void      _ems_txWait();
+void      _ems_txFailed(uint8_t fail, bool retry);
+void      _ems_txNoReply();
+void      _ems_txHold(uint32_t ms);
+void      _ems_validateSeen(_EMS_RxTelegram * EMS_RxTelegram);
+void      _ems_busStatsAdd(uint8_t * telegram, uint8_t length, bool crcOk);
 
 // global so can referenced in other classes
 extern _EMS_Sys_Status  EMS_Sys_Status;
@@ -460,4 +841,10 @@ extern _EMS_SolarModule EMS_SolarModule;
 extern _EMS_HeatPump    EMS_HeatPump;
 extern _EMS_Mixing      EMS_Mixing;
 
-extern std::list<_Detected_Device> Devices;
+extern EMSTxQueue                  EMS_TxQueue;
+
+extern const uint8_t    ems_crc_table[];
+extern const _EMS_Type  EMS_Types[];
+extern uint8_t          _EMS_Types_max;
+extern const _EMS_Field EMS_Fields_UBAMonitorFast[];
+extern const uint8_t    EMS_Fields_UBAMonitorFast_max;
@@ -84,6 +84,10 @@ const _EMS_Device_Types EMS_Devices_Types[] = {
 
 #define EMS_OFFSET_UBASetPoints_flowtemp 0 // flow temp
 
+// longer than a telegram, read as a block. See ems_getBlock()
+#define EMS_TYPE_UBAErrorMessages 0x10 // error log
+#define EMS_LENGTH_UBAErrorMessages 60 // 5 entries of 12 bytes, a boiler with fewer sends a shorter block
+
 // SM and HP Types
 #define EMS_TYPE_SM10Monitor 0x97    // SM10Monitor
 #define EMS_TYPE_SM100Monitor 0x0262 // SM100Monitor
@@ -155,6 +159,12 @@ const _EMS_Device_Types EMS_Devices_Types[] = {
 #define EMS_OFFSET_RC35Set_heatingtype 0      // floor heating = 3 0x47
 #define EMS_OFFSET_RC35Set_circuitcalctemp 14 // calculated circuit temperature 0x48
 
+#define EMS_TYPE_RC35Timer_HC1 0x3F // switching program and holidays of HC1, read as a block
+#define EMS_TYPE_RC35Timer_HC2 0x49 // switching program and holidays of HC2
+#define EMS_TYPE_RC35Timer_HC3 0x53 // switching program and holidays of HC3
+#define EMS_TYPE_RC35Timer_HC4 0x5D // switching program and holidays of HC4
+#define EMS_LENGTH_RC35Timer 93     // 42 switch points of 2 bytes, then the pause and party hours and the holiday dates
+
 // Easy specific
 #define EMS_TYPE_EasyStatusMessage 0x0A          // reading values on an Easy Thermostat
 #define EMS_OFFSET_EasyStatusMessage_setpoint 10 // setpoint temp
@@ -295,3 +295,56 @@ char * _readWord() {
     char * word = strtok(nullptr, ", \n");
     return word;
 }
+
+// the bucket for a value, 4 per power of 2 so each is at most 25% wide
+static uint8_t ICACHE_RAM_ATTR _histogram_bucket(uint32_t value) {
+    if (value < 16) {
+        return 0;
+    }
+    uint8_t msb    = 31 - __builtin_clz(value);
+    uint8_t bucket = ((msb - 4) << 2) | ((value >> (msb - 2)) & 0x03);
+    return (bucket < EMS_HISTOGRAM_BUCKETS) ? bucket : EMS_HISTOGRAM_BUCKETS - 1;
+}
+
+// the smallest value that no longer fits in a bucket
+static uint32_t _histogram_bucketLimit(uint8_t bucket) {
+    return (uint32_t)(5 + (bucket & 0x03)) << ((bucket >> 2) + 2);
+}
+
+// add a time to a histogram. Also called from the Rx interrupt
+void ICACHE_RAM_ATTR _histogram_add(_EMS_Histogram * histogram, uint32_t value) {
+    uint16_t * bucket = &histogram->buckets[_histogram_bucket(value)];
+    if (*bucket == 0xFFFF) {
+        for (uint8_t i = 0; i < EMS_HISTOGRAM_BUCKETS; i++) {
+            histogram->buckets[i] >>= 1;
+        }
+    }
+    (*bucket)++;
+
+    histogram->count++;
+    if (value > histogram->max) {
+        histogram->max = value;
+    }
+}
+
+// the time that percent of the times are at or below, rounded up to the top of its bucket and capped by the max. 0 if it's empty
+uint32_t _histogram_percentile(const _EMS_Histogram * histogram, uint8_t percent) {
+    uint32_t total = 0;
+    for (uint8_t i = 0; i < EMS_HISTOGRAM_BUCKETS; i++) {
+        total += histogram->buckets[i];
+    }
+    if (!total) {
+        return 0;
+    }
+
+    uint32_t rank = (total * percent + 99) / 100; // the n-th value, counting from 1
+    uint32_t seen = 0;
+    for (uint8_t i = 0; i < EMS_HISTOGRAM_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        if (seen >= rank) {
+            uint32_t limit = _histogram_bucketLimit(i);
+            return (limit < histogram->max) ? limit : histogram->max;
+        }
+    }
+    return histogram->max;
+}
@@ -31,3 +31,5 @@ uint8_t  _readIntNumber();
 float    _readFloatNumber();
 uint16_t _readHexNumber();
 char *   _readWord();
+void     _histogram_add(_EMS_Histogram * histogram, uint32_t value);
+uint32_t _histogram_percentile(const _EMS_Histogram * histogram, uint8_t percent);
@@ -1,298 +1,636 @@
 /*
  * emsuart.cpp
  *
- * The low level UART code for ESP8266 to read and write to the EMS bus via uart
+ * The UART layer between ems.cpp and the EMS bus. Calls are passed on to the selected backend,
+ * which is the ESP8266 UART0 on the device (emsuart_esp8266.cpp) or a serial port, TCP socket
+ * or capture file on a PC (emsuart_posix.cpp).
+ * Received telegrams go through a single-producer/single-consumer ring. The producer is the Rx interrupt
+ * on the ESP8266, which writes each telegram straight into a slot, and the consumer is emsuart_rx_drain().
+ * From there emsuart_rx() decides what goes on to ems_parseTelegram().
+ * Tx is asynchronous. emsuart_tx_buffer() hands the telegram to the backend, which calls emsuart_tx_done() once it's out.
+ * ems.cpp stages what it will send on the next poll with emsuart_tx_stage(), and the Rx interrupt sends it as soon as
+ * the poll's <BRK> is seen, without waiting for the main loop.
+ *
  * Paul Derbyshire - https://github.com/proddy/EMS-ESP
  */
 
 #include "emsuart.h"
 #include "ems.h"
-#include <user_interface.h>
-
-_EMSRxBuf * pEMSRxBuf;
-_EMSRxBuf * paEMSRxBuf[EMS_MAXBUFFERS];
-uint8_t     emsRxBufIdx  = 0;
-uint8_t     phantomBreak = 0;
-
-os_event_t recvTaskQueue[EMSUART_recvTaskQueueLen]; // our Rx queue
-
-//
-// Main interrupt handler
-// Important: do not use ICACHE_FLASH_ATTR !
-//
-static void emsuart_rx_intr_handler(void * para) {
-    static uint8_t length;
-    static uint8_t uart_buffer[EMS_MAXBUFFERSIZE + 2];
-
-    // is a new buffer? if so init the thing for a new telegram
-    if (EMS_Sys_Status.emsRxStatus == EMS_RX_STATUS_IDLE) {
-        EMS_Sys_Status.emsRxStatus = EMS_RX_STATUS_BUSY; // status set to busy
-        length                     = 0;
-    }
-    // fill IRQ buffer, by emptying Rx FIFO
-    if (USIS(EMSUART_UART) & ((1 << UIFF) | (1 << UITO) | (1 << UIBD))) {
-        while ((USS(EMSUART_UART) >> USRXC) & 0xFF) {
-            uint8_t rx = USF(EMSUART_UART);
-            if (length < EMS_MAXBUFFERSIZE)
-                uart_buffer[length++] = rx;
-        }
+#include "ems_utils.h"
+
+#ifdef ESP8266
+static const _EMSUART_Backend * _backend = &EMSUART_Backend_ESP8266;
+#else
+static const _EMSUART_Backend * _backend = nullptr; // must be set with emsuart_setBackend()
+#endif
+
+// the Rx ring. _rx_head is only written by the producer and _rx_tail only by the consumer
+static _EMSRxBuf        _rx_ring[EMSUART_RXRING_SIZE];
+static volatile uint8_t _rx_head         = 0;
+static volatile uint8_t _rx_tail         = 0;
+static uint16_t         _rx_seq          = 0; // next sequence number, set by the producer
+static uint16_t         _rx_seq_expected = 0; // next sequence number the consumer should see
+static _EMSUART_RxStats _rx_stats;
+
+// the telegram being sent
+static volatile bool    _tx_busy    = false;
+static uint32_t         _tx_start   = 0;                // micros() when it was handed to the backend
+static uint32_t         _tx_end     = 0;                // micros() when the last one was out
+static volatile uint8_t _tx_failure = EMS_TX_STATUS_OK; // how the last one failed, until ems.cpp takes it with emsuart_tx_failure()
+static _EMSUART_TxStats _tx_stats;
+static _EMSUART_Timing  _timing;
+
+// the telegram staged for the next poll for us, see emsuart_tx_stage()
+static uint8_t          _stage_buf[EMS_MAXBUFFERSIZE];
+static uint8_t          _stage_len;
+static volatile uint8_t _stage_tag   = EMSUART_STAGE_NONE; // not none while a telegram is staged
+static volatile uint8_t _stage_sent  = EMSUART_STAGE_NONE; // sent by the Rx interrupt, until its poll has come out of the Rx ring
+static uint8_t          _rx_answered = EMSUART_STAGE_NONE; // for the telegram being processed, see emsuart_rx_answered()
+static uint32_t         _rx_time     = 0;                  // for the telegram being processed, see emsuart_rx_time()
+
+// the last poll for us, to see how quickly it was answered
+typedef enum {
+    EMSUART_POLL_NONE,    // answered, or no poll for us yet
+    EMSUART_POLL_PENDING, // waiting for our answer
+    EMSUART_POLL_MISSED   // not answered before the next telegram on the bus
+} _EMSUART_POLL_STATE;
+
+static volatile uint8_t _poll_state = EMSUART_POLL_NONE;
+static uint32_t         _poll_time; // micros() at the poll's <BRK>
+
+// our last telegram is checked against what comes back from the bus, see _emsuart_tx_check()
+typedef enum {
+    EMSUART_CHECK_NONE,    // nothing to check
+    EMSUART_CHECK_PENDING, // waiting for the telegram to come back
+    EMSUART_CHECK_FAILED   // the backend couldn't send it
+} _EMSUART_CHECK_STATE;
+
+static volatile uint8_t _check_state = EMSUART_CHECK_NONE;
+static uint16_t         _check_seq; // sequence number of the first telegram that can be the echo
+static uint8_t          _check_len;
+static uint8_t          _check_last; // the last byte, the CRC
+
+// the EMS+ and HT3 Tx timing, and its calibration. See emsuart_calibrate()
+static _EMSUART_TxTiming _tx_timing         = {EMSUART_TX_BRK_WAIT, EMSUART_TX_WAIT_GAP};
+static bool              _tx_timing_changed = false; // to be saved
+static uint8_t           _cal_state         = EMSUART_CALIBRATE_OFF;
+static uint16_t          _cal_good;                  // shortest setting that worked
+static uint16_t          _cal_bad;                   // longest setting that failed, or the least it can be
+static uint8_t           _cal_tries;                 // # telegrams out at the current setting
+static uint8_t           _backoff_window    = 0;     // # telegrams since the failures were last counted from 0
+static uint8_t           _backoff_failures  = 0;
+
+// the Rx interrupt can send too, to answer a poll, so a Tx from the main loop claims the UART with interrupts off
+// the level they were at is put back, so it can also be used from an interrupt. The POSIX backend has no interrupts
+#ifdef ESP8266
+#define EMSUART_LOCK() uint32_t _savedPS = xt_rsil(15)
+#define EMSUART_UNLOCK() xt_wsr_ps(_savedPS)
+#else
+#define EMSUART_LOCK()
+#define EMSUART_UNLOCK()
+#endif
+
+static _EMS_TX_STATUS _emsuart_tx_start(uint8_t * buf, uint8_t len);
+static void           _emsuart_tx_check(_EMSRxBuf * slot);
+
+/*
+ * select the UART backend. Must be called before emsuart_init()
+ */
+void ICACHE_FLASH_ATTR emsuart_setBackend(const _EMSUART_Backend * backend) {
+    _backend = backend;
+}
 
-        // clear Rx FIFO full and Rx FIFO timeout interrupts
-        USIC(EMSUART_UART) = (1 << UIFF) | (1 << UITO);
+const char * emsuart_getBackendName() {
+    return (_backend) ? _backend->name : "none";
+}
+
+/*
+ * init the UART backend. Returns false if it could not be opened
+ */
+bool ICACHE_FLASH_ATTR emsuart_init() {
+    if (!_backend) {
+        return false;
     }
+    return _backend->init();
+}
 
-    // BREAK detection = End of EMS data block
-    if (USIS(EMSUART_UART) & ((1 << UIBD))) {
-        ETS_UART_INTR_DISABLE();          // disable all interrupts and clear them
-        USIC(EMSUART_UART) = (1 << UIBD); // INT clear the BREAK detect interrupt
+/*
+ * stop UART0 driver
+ * This is called prior to an OTA upload and also before a save to SPIFFS to prevent conflicts
+ */
+void ICACHE_FLASH_ATTR emsuart_stop() {
+    if (_backend) {
+        _backend->stop();
+    }
+}
 
-        pEMSRxBuf->length = (length > EMS_MAXBUFFERSIZE) ? EMS_MAXBUFFERSIZE : length;
-        os_memcpy((void *)pEMSRxBuf->buffer, (void *)&uart_buffer, pEMSRxBuf->length); // copy data into transfer buffer, including the BRK 0x00 at the end
-        length                     = 0;
-        EMS_Sys_Status.emsRxStatus = EMS_RX_STATUS_IDLE; // set the status flag stating BRK has been received and we can start a new package
-        ETS_UART_INTR_ENABLE();                          // re-enable UART interrupts
+/*
+ * re-start UART0 driver
+ */
+void ICACHE_FLASH_ATTR emsuart_start() {
+    if (_backend) {
+        _backend->start();
+    }
+}
 
-        system_os_post(EMSUART_recvTaskPrio, 0, 0); // call emsuart_recvTask() at next opportunity
+/*
+ * called from the main loop, for backends that have to poll for incoming data
+ */
+void emsuart_loop() {
+    if (_backend && _backend->loop) {
+        _backend->loop();
     }
 }
 
 /*
- * system task triggered on BRK interrupt
- * incoming received messages are always asynchronous
- * The full buffer is sent to the ems_parseTelegram() function in ems.cpp.
+ * Rx hand-off, called for each telegram taken from the Rx ring, excluding the <BRK> at the end
+ * a single byte is a poll or status code and is ok to send on
+ * anything else must be at least a header plus CRC. This also drops a double BRK at the end, possibly from the Tx loopback
  */
-static void ICACHE_FLASH_ATTR emsuart_recvTask(os_event_t * events) {
-    _EMSRxBuf * pCurrent = pEMSRxBuf;
-    pEMSRxBuf            = paEMSRxBuf[++emsRxBufIdx % EMS_MAXBUFFERS]; // next free EMS Receive buffer
-    uint8_t length       = pCurrent->length;                           // number of bytes including the BRK at the end
-    pCurrent->length     = 0;
+void emsuart_rx(uint8_t * telegram, uint8_t length, bool crcOk) {
+    if (length == 1) {
+        ems_parseTelegram(telegram, 1, crcOk);
+    } else if ((length > 3) && (length <= EMS_MAXBUFFERSIZE)) {
+        ems_parseTelegram(telegram, length, crcOk);
+    } else if (length == 0) {
+        _rx_stats.breaks++;
+    } else {
+        _rx_stats.runts++;
+    }
+}
 
-    if (phantomBreak) {
-        phantomBreak = 0;
-        length--; // remove phantom break from Rx buffer
+/*
+ * Producer, called from the Rx interrupt at the start of a telegram
+ * returns the slot to write the telegram into, or nullptr if the ring is full and the telegram must be dropped
+ */
+_EMSRxBuf * ICACHE_RAM_ATTR emsuart_rx_begin() {
+    if ((uint8_t)(_rx_head - _rx_tail) >= EMSUART_RXRING_SIZE) {
+        return nullptr;
     }
+    return &_rx_ring[_rx_head & (EMSUART_RXRING_SIZE - 1)];
+}
 
-    if (length == 2) {
-        // it's a poll or status code, single byte and ok to send on
-        ems_parseTelegram((uint8_t *)pCurrent->buffer, 1);
-    } else if ((length > 4) && (length <= EMS_MAXBUFFERSIZE + 1)) {
-        // ignore double BRK at the end, possibly from the Tx loopback
-        // also telegrams with no data value
-        ems_parseTelegram((uint8_t *)pCurrent->buffer, length - 1); // transmit EMS buffer, excluding the BRK
+/*
+ * called from the Rx interrupt for a telegram of one byte
+ * if it's a poll for us send the staged telegram straight away, and return its tag
+ */
+static uint8_t ICACHE_RAM_ATTR _emsuart_rx_poll(uint8_t value) {
+    if ((EMS_Sys_Status.emsTxStatus == EMS_TX_REV_DETECT) || (value != (EMS_Sys_Status.emsPollAck[0] ^ 0x80))) {
+        return EMSUART_STAGE_NONE;
     }
+
+    _poll_state = EMSUART_POLL_PENDING;
+    _poll_time  = micros();
+
+    uint8_t tag = _stage_tag;
+    if ((tag == EMSUART_STAGE_NONE) || _tx_busy) {
+        return EMSUART_STAGE_NONE; // ems.cpp answers it from the main loop
+    }
+
+    _stage_tag = EMSUART_STAGE_NONE; // only once
+    if (_emsuart_tx_start(_stage_buf, _stage_len) != EMS_TX_STATUS_OK) {
+        return EMSUART_STAGE_NONE;
+    }
+
+    _stage_sent = tag;
+    _tx_stats.pollsStaged++;
+    return tag;
 }
 
 /*
- * flush everything left over in buffer, this clears both rx and tx FIFOs
+ * Producer, called from the Rx interrupt on the <BRK> ending a telegram
+ * length is the number of bytes received including the BRK, which can be more than was written to the slot
+ * crc is the running CRC of the bytes before the CRC byte, see emsuart_rx_crc()
  */
-static inline void ICACHE_FLASH_ATTR emsuart_flush_fifos() {
-    uint32_t tmp = ((1 << UCRXRST) | (1 << UCTXRST)); // bit mask
-    USC0(EMSUART_UART) |= (tmp);                      // set bits
-    USC0(EMSUART_UART) &= ~(tmp);                     // clear bits
+void ICACHE_RAM_ATTR emsuart_rx_end(_EMSRxBuf * slot, uint8_t length, uint8_t crc) {
+    bool crcOk = (length >= 2) && (length <= EMS_MAXBUFFERSIZE);
+    uint16_t seq = _rx_seq++;
+    uint8_t  answered = EMSUART_STAGE_NONE;
+
+    if (_poll_state == EMSUART_POLL_PENDING) {
+        _poll_state = EMSUART_POLL_MISSED; // the bus has moved on
+    }
+
+    // a single byte, which could be a poll for us
+    if ((length == 2) && slot) {
+        answered = _emsuart_rx_poll(slot->buffer[0]);
+    }
+
+    _rx_stats.telegrams++;
+
+    if (length > EMS_MAXBUFFERSIZE) {
+        _rx_stats.overflows++;
+        length = EMS_MAXBUFFERSIZE;
+    }
+
+    if (!slot) {
+        _rx_stats.dropped++;
+        return;
+    }
+
+    slot->seq      = seq;
+    slot->length   = length;
+    slot->crcOk    = crcOk && (slot->buffer[length - 2] == crc);
+    slot->answered = answered;
+    slot->time     = micros();
+    __sync_synchronize(); // the slot must be complete before the consumer can see it
+    _rx_head++;
+
+    uint8_t depth = _rx_head - _rx_tail;
+    if (depth > _rx_stats.depthMax) {
+        _rx_stats.depthMax = depth;
+    }
 }
 
 /*
- * init UART0 driver
+ * Consumer, hands every telegram waiting in the ring to emsuart_rx()
+ * The slot is only given back to the producer once the telegram has been processed, so it is never copied
  */
-void ICACHE_FLASH_ATTR emsuart_init() {
-    ETS_UART_INTR_DISABLE();
-    ETS_UART_INTR_ATTACH(nullptr, nullptr);
+void emsuart_rx_drain() {
+    while (_rx_tail != _rx_head) {
+        _EMSRxBuf * slot = &_rx_ring[_rx_tail & (EMSUART_RXRING_SIZE - 1)];
+
+        // a gap in the sequence numbers means telegrams were dropped while the ring was full
+        if (slot->seq != _rx_seq_expected) {
+            if (EMS_Sys_Status.emsLogging > EMS_SYS_LOGGING_NONE) {
+                myDebug_P(PSTR("** Warning, %d telegrams lost, Rx ring full"), (uint16_t)(slot->seq - _rx_seq_expected));
+            }
+        } else if (_rx_time && slot->length) {
+            // the bus was idle from the <BRK> of the last telegram until the first byte of this one
+            uint32_t duration = ((slot->length - 1) * EMSUART_TX_WAIT_BYTE) + EMSUART_TX_WAIT_BRK;
+            uint32_t elapsed  = slot->time - _rx_time;
+            _histogram_add(&_timing.gap, (elapsed > duration) ? elapsed - duration : 0);
+        }
+        _rx_seq_expected = slot->seq + 1;
+        _rx_time         = slot->time;
+
+        if (slot->length) {
+            _emsuart_tx_check(slot);
+            _rx_answered = slot->answered;
+            emsuart_rx(slot->buffer, slot->length - 1, slot->crcOk); // excluding the BRK
+            _rx_answered = EMSUART_STAGE_NONE;
+        } else {
+            _rx_stats.breaks++; // only our own <BRK>, taken off as a phantom break
+        }
+        if (slot->answered != EMSUART_STAGE_NONE) {
+            _stage_sent = EMSUART_STAGE_NONE; // ems.cpp knows, it can stage the next one
+        }
 
-    // allocate and preset EMS Receive buffers
-    for (int i = 0; i < EMS_MAXBUFFERS; i++) {
-        _EMSRxBuf * p = (_EMSRxBuf *)malloc(sizeof(_EMSRxBuf));
-        paEMSRxBuf[i] = p;
+        __sync_synchronize(); // finished with the slot before the producer can have it back
+        _rx_tail++;
     }
-    pEMSRxBuf = paEMSRxBuf[0]; // preset EMS Rx Buffer
+}
 
-    // pin settings
-    PIN_PULLUP_DIS(PERIPHS_IO_MUX_U0TXD_U);
-    PIN_FUNC_SELECT(PERIPHS_IO_MUX_U0TXD_U, FUNC_U0TXD);
-    PIN_PULLUP_DIS(PERIPHS_IO_MUX_U0RXD_U);
-    PIN_FUNC_SELECT(PERIPHS_IO_MUX_U0RXD_U, FUNC_U0RXD);
+// also called from the Rx interrupt, for the UART driver counters
+_EMSUART_RxStats * ICACHE_RAM_ATTR emsuart_getRxStats() {
+    return &_rx_stats;
+}
 
-    // set 9600, 8 bits, no parity check, 1 stop bit
-    USD(EMSUART_UART)  = (UART_CLK_FREQ / EMSUART_BAUD);
-    USC0(EMSUART_UART) = EMSUART_CONFIG; // 8N1
+/*
+ * hand a telegram to the backend, from emsuart_tx_buffer() or from the Rx interrupt to answer a poll
+ */
+static _EMS_TX_STATUS ICACHE_RAM_ATTR _emsuart_tx_start(uint8_t * buf, uint8_t len) {
+    EMSUART_LOCK();
+    bool busy = _tx_busy;
+    _tx_busy  = true;
+    EMSUART_UNLOCK();
+
+    if (busy) {
+        _tx_stats.busy++;
+        return EMS_TX_BUSY;
+    }
 
-    emsuart_flush_fifos();
+    _tx_start   = micros();
+    _tx_failure = EMS_TX_STATUS_OK; // only the last one counts
+    _tx_stats.telegrams++;
 
-    // conf1 params
-    // UCTOE = RX TimeOut enable (default is 1)
-    // UCTOT = RX TimeOut Threshold (7 bit) = want this when no more data after 1 characters (default is 2)
-    // UCFFT = RX FIFO Full Threshold (7 bit) = want this to be 31 for 32 bytes of buffer (default was 127)
-    // see https://www.espressif.com/sites/default/files/documentation/esp8266-technical_reference_en.pdf
-    //
-    // change: we set UCFFT to 1 to get an immediate indicator about incoming traffic.
-    //         Otherwise, we're only noticed by UCTOT or RxBRK!
-    USC1(EMSUART_UART) = 0;                                                // reset config first
-    USC1(EMSUART_UART) = (0x01 << UCFFT) | (0x01 << UCTOT) | (0 << UCTOE); // enable interupts
+    // it should come back as the next telegram on the bus
+    if (len) {
+        _check_seq   = _rx_seq;
+        _check_len   = len;
+        _check_last  = buf[len - 1];
+        _check_state = EMSUART_CHECK_PENDING;
+    }
 
-    // set interrupts for triggers
-    USIC(EMSUART_UART) = 0xFFFF; // clear all interupts
-    USIE(EMSUART_UART) = 0;      // disable all interrupts
+    // every Tx answers a poll, or the reply to our last write. See how long the poll waited
+    if (_poll_state != EMSUART_POLL_NONE) {
+        uint32_t latency   = _tx_start - _poll_time;
+        _tx_stats.pollLast = latency;
+        _histogram_add(&_timing.pollLatency, latency);
+        if (latency > _tx_stats.pollMax) {
+            _tx_stats.pollMax = latency;
+        }
+        if ((_poll_state == EMSUART_POLL_PENDING) && (latency <= EMSUART_POLL_DEADLINE)) {
+            _tx_stats.pollsOnTime++;
+        } else {
+            _tx_stats.pollsLate++;
+        }
+        _poll_state = EMSUART_POLL_NONE;
+    }
 
-    // enable rx break, fifo full and timeout.
-    // but not frame error UIFR (because they are too frequent) or overflow UIOF because our buffer is only max 32 bytes
-    // change: we don't care about Rx Timeout - it may lead to wrong readouts
-    USIE(EMSUART_UART) = (1 << UIBD) | (1 << UIFF) | (0 << UITO);
+    _EMS_TX_STATUS result = _backend->tx(buf, len);
 
-    // set up interrupt callbacks for Rx
-    system_os_task(emsuart_recvTask, EMSUART_recvTaskPrio, recvTaskQueue, EMSUART_recvTaskQueueLen);
+    uint32_t blocked = micros() - _tx_start;
+    _tx_stats.blockedLast = blocked;
+    if (blocked > _tx_stats.blockedMax) {
+        _tx_stats.blockedMax = blocked;
+    }
 
-    // disable esp debug which will go to Tx and mess up the line - see https://github.com/espruino/Espruino/issues/655
-    system_set_os_print(0);
+    if (result != EMS_TX_STATUS_OK) {
+        _tx_busy     = false; // nothing went out
+        _check_state = EMSUART_CHECK_NONE;
+    }
+
+    return result;
+}
 
-    // swap Rx and Tx pins to use GPIO13 (D7) and GPIO15 (D8) respectively
-    system_uart_swap();
+/*
+ * Send to Tx, ending with a <BRK>
+ * The backend may still be sending when this returns, see emsuart_tx_done()
+ */
+_EMS_TX_STATUS ICACHE_FLASH_ATTR emsuart_tx_buffer(uint8_t * buf, uint8_t len) {
+    if (EMS_Sys_Status.emsLogging == EMS_SYS_LOGGING_JABBER) {
+        ems_dumpBuffer("emsuart_tx_buffer: ", buf, len); // validate and transmit the EMS buffer, excluding the BRK
+    }
 
-    ETS_UART_INTR_ATTACH(emsuart_rx_intr_handler, nullptr);
-    ETS_UART_INTR_ENABLE();
+    if (!_backend) {
+        return EMS_TX_STATUS_OK;
+    }
+
+    // what's staged has been answered by the main loop instead, it mustn't go again on the next poll
+    emsuart_tx_stage(nullptr, 0, EMSUART_STAGE_NONE);
+
+    return _emsuart_tx_start(buf, len);
 }
 
 /*
- * stop UART0 driver
- * This is called prior to an OTA upload and also before a save to SPIFFS to prevent conflicts
+ * Stage the telegram to send on the next poll for us, replacing the one before. A len of 0 stages nothing
+ * tag is handed back by emsuart_rx_answered() for the poll it was sent on
+ * returns false if the last one staged has been sent and its poll hasn't come out of the Rx ring yet
  */
-void ICACHE_FLASH_ATTR emsuart_stop() {
-    ETS_UART_INTR_DISABLE();
+bool emsuart_tx_stage(uint8_t * buf, uint8_t len, uint8_t tag) {
+    _stage_tag = EMSUART_STAGE_NONE; // the Rx interrupt can't use it while it's being copied
+    __sync_synchronize();
+
+    if (_stage_sent != EMSUART_STAGE_NONE) {
+        return false;
+    }
+
+    if (!_backend || !len || (len > EMS_MAXBUFFERSIZE) || (tag == EMSUART_STAGE_NONE)) {
+        return true;
+    }
+
+    memcpy(_stage_buf, buf, len);
+    _stage_len = len;
+    __sync_synchronize();
+    _stage_tag = tag;
+
+    if (_backend->staged) {
+        _backend->staged(tag);
+    }
+
+    return true;
 }
 
 /*
- * re-start UART0 driver
+ * for the telegram being processed by ems_parseTelegram(), the tag of the staged telegram the Rx interrupt answered it with
+ * EMSUART_STAGE_NONE if it wasn't a poll for us, or it still has to be answered
  */
-void ICACHE_FLASH_ATTR emsuart_start() {
-    ETS_UART_INTR_ENABLE();
+uint8_t emsuart_rx_answered() {
+    return _rx_answered;
 }
 
 /*
- * Send a BRK signal
- * Which is a 11-bit set of zero's (11 cycles)
+ * Called by the backend when the telegram and its <BRK> are out on the bus, or sending failed. Can be called from an interrupt
+ * A failure that comes after emsuart_tx_buffer() has returned is picked up by ems.cpp with emsuart_tx_failure()
  */
-void ICACHE_FLASH_ATTR emsuart_tx_brk() {
-    uint32_t tmp;
+void ICACHE_RAM_ATTR emsuart_tx_done(_EMS_TX_STATUS status) {
+    _tx_end      = micros();
+    uint32_t bus = _tx_end - _tx_start;
+    _tx_stats.busLast = bus;
+    if (bus > _tx_stats.busMax) {
+        _tx_stats.busMax = bus;
+    }
+
+    if (status == EMS_TX_BRK_DETECT) {
+        _tx_stats.collisions++;
+    } else if (status == EMS_TX_WTD_TIMEOUT) {
+        _tx_stats.timeouts++;
+    }
+
+    if (status != EMS_TX_STATUS_OK) {
+        _tx_failure = status; // no reply is coming, see ems_txTick()
+        if (_check_state == EMSUART_CHECK_PENDING) {
+            _check_state = EMSUART_CHECK_FAILED;
+        }
+    }
 
-    // must make sure Tx FIFO is empty
-    while (((USS(EMSUART_UART) >> USTXC) & 0xFF))
-        ;
+    _tx_busy = false;
+}
 
-    tmp = ((1 << UCRXRST) | (1 << UCTXRST)); // bit mask
-    USC0(EMSUART_UART) |= (tmp);             // set bits
-    USC0(EMSUART_UART) &= ~(tmp);            // clear bits
+bool emsuart_tx_busy() {
+    return _tx_busy;
+}
 
-    // To create a 11-bit <BRK> we set TXD_BRK bit so the break signal will
-    // automatically be sent when the tx fifo is empty
-    tmp = (1 << UCBRK);
-    USC0(EMSUART_UART) |= (tmp); // set bit
+/*
+ * how the last telegram handed to the backend failed, EMS_TX_BRK_DETECT or EMS_TX_WTD_TIMEOUT
+ * EMS_TX_STATUS_OK if it went out or is still going out. Cleared once read
+ */
+_EMS_TX_STATUS emsuart_tx_failure() {
+    _EMS_TX_STATUS status = (_EMS_TX_STATUS)_tx_failure;
+    _tx_failure           = EMS_TX_STATUS_OK;
+    return status;
+}
 
-    if (EMS_Sys_Status.emsTxMode == EMS_TXMODE_EMSPLUS) { // EMS+ mode
-        delayMicroseconds(EMSUART_TX_BRK_WAIT);
-    } else if (EMS_Sys_Status.emsTxMode == EMS_TXMODE_HT3) {     // junkers mode
-        delayMicroseconds(EMSUART_TX_WAIT_BRK - EMSUART_TX_LAG); // 1144 (11 Bits)
+_EMSUART_TxStats * emsuart_getTxStats() {
+    return &_tx_stats;
+}
+
+/*
+ * micros() at the <BRK> of the telegram being processed by ems_parseTelegram()
+ */
+uint32_t emsuart_rx_time() {
+    return _rx_time;
+}
+
+/*
+ * micros() when the last telegram we sent was out on the bus
+ */
+uint32_t emsuart_tx_time() {
+    return _tx_end;
+}
+
+_EMSUART_Timing * emsuart_getTiming() {
+    return &_timing;
+}
+
+void emsuart_clearTiming() {
+    memset(&_timing, 0, sizeof(_timing));
+}
+
+/*
+ * Called by the backend with the time from writing a byte until it came back from the bus. Can be called from an interrupt
+ */
+void ICACHE_RAM_ATTR emsuart_tx_echo(uint32_t us) {
+    _tx_stats.echoLast = us;
+    if (us > _tx_stats.echoMax) {
+        _tx_stats.echoMax = us;
     }
+}
+
+/*
+ * The EMS+ and HT3 Tx timing. The defaults are safe on every bus we know of, but most bus masters take shorter gaps
+ * which makes every telegram shorter. emsuart_calibrate() searches for the shortest timing that works on this bus,
+ * by halving the distance between the shortest setting that worked and the longest that didn't.
+ * A telegram works if it comes back from the bus as it was sent.
+ * After that, or with a timing that was loaded from the config, too many failures make it back off towards the default.
+ * The backend reads the timing from its interrupts, so this is in RAM
+ */
+_EMSUART_TxTiming * ICACHE_RAM_ATTR emsuart_getTxTiming() {
+    return &_tx_timing;
+}
 
-    USC0(EMSUART_UART) &= ~(tmp); // clear bit
+// the setting for the current tx_mode, nullptr if it doesn't have one
+static uint16_t * _emsuart_txSetting() {
+    if (EMS_Sys_Status.emsTxMode == EMS_TXMODE_EMSPLUS) {
+        return &_tx_timing.brkWait;
+    } else if (EMS_Sys_Status.emsTxMode == EMS_TXMODE_HT3) {
+        return &_tx_timing.gap;
+    }
+    return nullptr;
+}
+
+static uint16_t _emsuart_txDefault() {
+    return (EMS_Sys_Status.emsTxMode == EMS_TXMODE_EMSPLUS) ? EMSUART_TX_BRK_WAIT : EMSUART_TX_WAIT_GAP;
+}
+
+// the least the setting can be. The bus master has to have echoed a byte before the next one is sent
+static uint16_t _emsuart_txFloor() {
+    uint32_t echo = min(_tx_stats.echoMax, (uint32_t)0xFFFF);
+    if (EMS_Sys_Status.emsTxMode == EMS_TXMODE_EMSPLUS) {
+        return max(echo, (uint32_t)EMSUART_TX_WAIT_BYTE);
+    }
+    return (echo > (EMSUART_TX_WAIT_BYTE - EMSUART_TX_LAG)) ? (echo - (EMSUART_TX_WAIT_BYTE - EMSUART_TX_LAG)) : 0;
 }
 
 /*
- * Send to Tx, ending with a <BRK>
+ * set the timing loaded from the config, 0 for the default
  */
-_EMS_TX_STATUS ICACHE_FLASH_ATTR emsuart_tx_buffer(uint8_t * buf, uint8_t len) {
-    _EMS_TX_STATUS result = EMS_TX_STATUS_OK;
+void emsuart_setTxTiming(uint16_t brkWait, uint16_t gap) {
+    _tx_timing.brkWait = brkWait ? brkWait : EMSUART_TX_BRK_WAIT;
+    _tx_timing.gap     = gap ? gap : EMSUART_TX_WAIT_GAP;
+    _cal_state         = ((_tx_timing.brkWait == EMSUART_TX_BRK_WAIT) && (_tx_timing.gap == EMSUART_TX_WAIT_GAP)) ? EMSUART_CALIBRATE_OFF : EMSUART_CALIBRATE_DONE;
+    _backoff_window    = 0;
+    _backoff_failures  = 0;
+}
 
-    if (EMS_Sys_Status.emsLogging == EMS_SYS_LOGGING_JABBER) {
-        ems_dumpBuffer("emsuart_tx_buffer: ", buf, len); // validate and transmit the EMS buffer, excluding the BRK
+// try the setting halfway between the good and the bad one, or finish when they're close enough
+static void _emsuart_calibrateNext(uint16_t * setting) {
+    _cal_tries = 0;
+    if ((_cal_good - _cal_bad) > EMSUART_CALIBRATE_STEP) {
+        *setting = (_cal_good + _cal_bad) / 2;
+        return;
     }
 
-    if (len) {
-        if (EMS_Sys_Status.emsTxMode == EMS_TXMODE_EMSPLUS) { // With extra tx delay for EMS+
-            for (uint8_t i = 0; i < len; i++) {
-                USF(EMSUART_UART) = buf[i];
-                delayMicroseconds(EMSUART_TX_BRK_WAIT); // https://github.com/proddy/EMS-ESP/issues/23#
-            }
-            emsuart_tx_brk();                                    // send <BRK>
-        } else if (EMS_Sys_Status.emsTxMode == EMS_TXMODE_HT3) { // Junkers logic by @philrich
-            for (uint8_t i = 0; i < len; i++) {
-                USF(EMSUART_UART) = buf[i];
+    *setting           = min((uint16_t)(_cal_good + EMSUART_CALIBRATE_MARGIN), _emsuart_txDefault());
+    _cal_state         = EMSUART_CALIBRATE_DONE;
+    _tx_timing_changed = true;
+    _backoff_window    = 0;
+    _backoff_failures  = 0;
+    myDebug_P(PSTR("[UART] Tx timing calibrated, %s=%d us"), (EMS_Sys_Status.emsTxMode == EMS_TXMODE_EMSPLUS) ? "brk_wait" : "gap", *setting);
+}
 
-                // just to be safe wait for tx fifo empty (needed?)
-                while (((USS(EMSUART_UART) >> USTXC) & 0xff))
-                    ;
+/*
+ * start the calibration for the current tx_mode. Returns false if it doesn't have a timing to calibrate
+ * it runs on the telegrams that go out anyway, and those that ems.cpp adds while it's running
+ */
+bool emsuart_calibrate() {
+    uint16_t * setting = _emsuart_txSetting();
+    if (!setting) {
+        return false;
+    }
 
-                // wait until bits are sent on wire
-                delayMicroseconds(EMSUART_TX_WAIT_BYTE - EMSUART_TX_LAG + EMSUART_TX_WAIT_GAP);
-            }
-            emsuart_tx_brk(); // send <BRK>
-        } else if (EMS_Sys_Status.emsTxMode == EMS_TXMODE_DEFAULT) {
-            /* 
-        * based on code from https://github.com/proddy/EMS-ESP/issues/103 by @susisstrolch
-        * we emit the whole telegram, with Rx interrupt disabled, collecting busmaster response in FIFO.
-        * after sending the last char we poll the Rx status until either
-        * - size(Rx FIFO) == size(Tx-Telegram)
-        * - <BRK> is detected
-        * At end of receive we re-enable Rx-INT and send a Tx-BRK in loopback mode.
-        * 
-        * EMS-Bus error handling
-        * 1. Busmaster stops echoing on Tx w/o permission
-        * 2. Busmaster cancel telegram by sending a BRK
-        * 
-        * Case 1. is handled by a watchdog counter which is reset on each
-        * Tx attempt. The timeout should be 20x EMSUART_BIT_TIME plus 
-        * some smart guess for processing time on targeted EMS device.
-        * We set EMS_Sys_Status.emsTxStatus to EMS_TX_WTD_TIMEOUT and return
-        * 
-        * Case 2. is handled via a BRK chk during transmission.
-        * We set EMS_Sys_Status.emsTxStatus to EMS_TX_BRK_DETECT and return
-        * 
-        */
-            uint16_t wdc = EMS_TX_TO_COUNT;
-            ETS_UART_INTR_DISABLE(); // disable rx interrupt
-
-            // clear Rx status register
-            USC0(EMSUART_UART) |= (1 << UCRXRST); // reset uart rx fifo
-            emsuart_flush_fifos();
-
-            // throw out the telegram...
-            for (uint8_t i = 0; i < len && result == EMS_TX_STATUS_OK;) {
-                wdc                     = EMS_TX_TO_COUNT;
-                volatile uint8_t _usrxc = (USS(EMSUART_UART) >> USRXC) & 0xFF;
-                USF(EMSUART_UART)       = buf[i++]; // send each Tx byte
-                // wait for echo from busmaster
-                while (((USS(EMSUART_UART) >> USRXC) & 0xFF) == _usrxc) {
-                    delayMicroseconds(EMSUART_BUSY_WAIT); // burn CPU cycles...
-                    if (--wdc == 0) {
-                        EMS_Sys_Status.emsTxStatus = result = EMS_TX_WTD_TIMEOUT;
-                        break;
-                    }
-                    if (USIR(EMSUART_UART) & (1 << UIBD)) {
-                        USIC(EMSUART_UART)         = (1 << UIBD); // clear BRK detect IRQ
-                        EMS_Sys_Status.emsTxStatus = result = EMS_TX_BRK_DETECT;
-                    }
-                }
-            }
+    _cal_good  = _emsuart_txDefault();
+    _cal_bad   = min(_emsuart_txFloor(), _cal_good);
+    _cal_state = EMSUART_CALIBRATE_RUNNING;
+    _emsuart_calibrateNext(setting);
+    return true;
+}
 
-            // we got the whole telegram in the Rx buffer
-            // on Rx-BRK (bus collision), we simply enable Rx and leave it
-            // otherwise we send the final Tx-BRK in the loopback and re=enable Rx-INT.
-            // worst case, we'll see an additional Rx-BRK...
-            if (result == EMS_TX_STATUS_OK) {
-                // neither bus collision nor timeout - send terminating BRK signal
-                if (!(USIS(EMSUART_UART) & (1 << UIBD))) {
-                    // no bus collision - send terminating BRK signal
-                    USC0(EMSUART_UART) |= (1 << UCLBE) | (1 << UCBRK); // enable loopback & set <BRK>
-
-                    // wait until BRK detected...
-                    while (!(USIR(EMSUART_UART) & (1 << UIBD))) {
-                        delayMicroseconds(EMSUART_BIT_TIME);
-                    }
-
-                    USC0(EMSUART_UART) &= ~((1 << UCBRK) | (1 << UCLBE)); // disable loopback & clear <BRK>
-                    USIC(EMSUART_UART) = (1 << UIBD);                     // clear BRK detect IRQ
-                    phantomBreak       = 1;
-                }
-            }
-            ETS_UART_INTR_ENABLE(); // receive anything from FIFO...
+uint8_t emsuart_getCalibrateState() {
+    return _cal_state;
+}
+
+/*
+ * true once when the timing has changed and should be saved
+ */
+bool emsuart_txTimingChanged() {
+    bool changed       = _tx_timing_changed;
+    _tx_timing_changed = false;
+    return changed;
+}
+
+/*
+ * a telegram we sent came back right or not
+ */
+static void _emsuart_tx_result(bool ok) {
+    if (ok) {
+        _tx_stats.echoOk++;
+    } else {
+        _tx_stats.echoErrors++;
+    }
+
+    // the timing is only between the bytes
+    uint16_t * setting = _emsuart_txSetting();
+    if (!setting || (_check_len < 2)) {
+        return;
+    }
+
+    if (_cal_state == EMSUART_CALIBRATE_RUNNING) {
+        if (ok && (++_cal_tries < EMSUART_CALIBRATE_TRIES)) {
+            return;
+        }
+        if (ok) {
+            _cal_good = *setting;
+        } else {
+            _cal_bad = *setting;
         }
+        _emsuart_calibrateNext(setting);
+        return;
+    }
+
+    if (!ok && (++_backoff_failures >= EMSUART_BACKOFF_FAILURES)) {
+        if (*setting < _emsuart_txDefault()) {
+            *setting           = min((uint16_t)(*setting + EMSUART_CALIBRATE_MARGIN), _emsuart_txDefault());
+            _tx_timing_changed = true;
+            myDebug_P(PSTR("[UART] Too many Tx failures, backing off to %d us"), *setting);
+        }
+        _backoff_window   = 0;
+        _backoff_failures = 0;
+    } else if (++_backoff_window >= EMSUART_BACKOFF_WINDOW) {
+        _backoff_window   = 0;
+        _backoff_failures = 0;
+    }
+}
+
+/*
+ * called from emsuart_rx_drain() for each telegram, to see if it's the echo of the one we sent
+ * it should be the next telegram to end after it was sent, one more is allowed for a telegram that was already coming in
+ */
+static void _emsuart_tx_check(_EMSRxBuf * slot) {
+    if (_check_state == EMSUART_CHECK_FAILED) {
+        _check_state = EMSUART_CHECK_NONE;
+        _emsuart_tx_result(false);
+        return;
+    }
+
+    if ((_check_state != EMSUART_CHECK_PENDING) || ((int16_t)(slot->seq - _check_seq) < 0)) {
+        return;
+    }
+
+    bool ok = ((slot->length - 1) == _check_len) && (slot->buffer[_check_len - 1] == _check_last) && ((_check_len == 1) || slot->crcOk);
+    if (ok || (slot->seq != _check_seq)) {
+        _check_state = EMSUART_CHECK_NONE;
+        _emsuart_tx_result(ok);
     }
-    return result;
 }
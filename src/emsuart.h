@@ -1,7 +1,7 @@
 /*
  * emsuart.h
  * 
- * Header file for emsuart.cpp
+ * Header file for emsuart.cpp and its UART backends
  * 
  * Paul Derbyshire - https://github.com/proddy/EMS-ESP
  */
@@ -13,30 +13,189 @@
 #define EMSUART_CONFIG 0x1C // 8N1 (8 bits, no stop bits, 1 parity)
 #define EMSUART_BAUD 9600   // uart baud rate for the EMS circuit
 
-#define EMS_MAXBUFFERS 3                                // buffers for circular filling to avoid collisions
 #define EMS_MAXBUFFERSIZE (EMS_MAX_TELEGRAM_LENGTH + 2) // max size of the buffer. EMS packets are max 32 bytes, plus extra 2 for BRKs
 
 #define EMSUART_BIT_TIME 104 // bit time @9600 baud
 
-#define EMSUART_TX_BRK_WAIT 2070 // the BRK from Boiler master is roughly 1.039ms, so accounting for hardware lag using around 2078 (for half-duplex) - 8 (lag)
+#define EMSUART_TX_BRK_WAIT 2070 // default EMS+ wait. The BRK from Boiler master is roughly 1.039ms, so accounting for hardware lag using around 2078 (for half-duplex) - 8 (lag)
 #define EMSUART_TX_WAIT_BYTE (EMSUART_BIT_TIME * 10) // Time to send one Byte (8 Bits, 1 Start Bit, 1 Stop Bit)
 #define EMSUART_TX_WAIT_BRK (EMSUART_BIT_TIME * 11)  // Time to send a BRK Signal (11 Bit)
-#define EMSUART_TX_WAIT_GAP (EMSUART_BIT_TIME * 7)   // Gap between to Bytes
+#define EMSUART_TX_WAIT_GAP (EMSUART_BIT_TIME * 7)   // default HT3 gap between to Bytes
 #define EMSUART_TX_LAG 8
 
 #define EMSUART_BUSY_WAIT (EMSUART_BIT_TIME / 8)
 #define EMS_TX_TO_CHARS (2 + 20)
 #define EMS_TX_TO_COUNT ((EMS_TX_TO_CHARS)*10 * 8)
 
+// how long after its poll the bus master waits for us to start answering, in microseconds. Can be set in the build_flags
+#ifndef EMSUART_POLL_DEADLINE
+#define EMSUART_POLL_DEADLINE 4000
+#endif
+
+// calibration of the EMS+ and HT3 Tx timing, see emsuart_calibrate()
+#define EMSUART_CALIBRATE_TRIES 16                // telegrams that must go out at a setting before it counts as good
+#define EMSUART_CALIBRATE_STEP 16                 // us, the search ends when the good and bad settings are this close
+#define EMSUART_CALIBRATE_MARGIN EMSUART_BIT_TIME // us added to the shortest good setting, and the step when backing off
+#define EMSUART_BACKOFF_WINDOW 32                 // telegrams over which failures are counted
+#define EMSUART_BACKOFF_FAILURES 3                // failures in the window that make the timing back off
+
+// tags for the telegram staged by emsuart_tx_stage(). ems.cpp uses the others to tell its staged telegrams apart
+#define EMSUART_STAGE_NONE 0    // nothing staged, or the poll wasn't answered from the interrupt
+#define EMSUART_STAGE_POLLACK 1 // the poll acknowledgement
+
 #define EMSUART_recvTaskPrio 1
 #define EMSUART_recvTaskQueueLen 64
 
+// depth of the Rx ring in telegrams, must be a power of 2. Can be set in the build_flags
+#ifndef EMSUART_RXRING_SIZE
+#define EMSUART_RXRING_SIZE 8
+#endif
+
+// the slot is the uint8_t head or tail masked with the size, and a full ring must not look empty
+static_assert(((EMSUART_RXRING_SIZE & (EMSUART_RXRING_SIZE - 1)) == 0) && (EMSUART_RXRING_SIZE > 0) && (EMSUART_RXRING_SIZE <= 128),
+              "EMSUART_RXRING_SIZE must be a power of 2, up to 128");
+
+// a slot in the Rx ring. The Rx interrupt writes the telegram straight into it
 typedef struct {
-    uint8_t length;
-    uint8_t buffer[EMS_MAXBUFFERSIZE];
+    uint16_t seq;      // sequence number, one for every telegram ended by a <BRK>
+    uint8_t  length;   // number of bytes including the BRK at the end
+    bool     crcOk;    // the last byte before the BRK matches the CRC worked out as the bytes came in
+    uint8_t  answered; // a poll for us, tag of the staged telegram the Rx interrupt answered it with
+    uint32_t time;     // micros() at the <BRK>
+    uint8_t  buffer[EMS_MAXBUFFERSIZE];
 } _EMSRxBuf;
 
-void ICACHE_FLASH_ATTR emsuart_init();
+// Rx counters since the last power on, for every path where received data is lost or thrown away
+// the UART driver ones, from phantomBreaks on, are counted by the backend. The ESP8266 counts them all, the tty only frame errors
+typedef struct {
+    uint32_t telegrams;     // # telegrams ended by a <BRK>
+    uint32_t dropped;       // # telegrams lost because the ring was full
+    uint32_t overflows;     // # telegrams longer than a slot, these are cut short
+    uint8_t  depthMax;      // most telegrams waiting in the ring at once
+    uint32_t runts;         // # too short for a telegram and more than a single byte, not passed on by emsuart_rx()
+    uint32_t breaks;        // # a <BRK> with nothing before it, a double <BRK>. Not passed on by emsuart_rx()
+    uint32_t phantomBreaks; // # times our own <BRK> from the Tx loopback was taken off a telegram, default mode only
+    uint32_t overruns;      // # times the UART Rx FIFO overflowed and bytes were lost
+    uint32_t frameErrors;   // # times a byte had no stop bit without being a <BRK>, usually noise on the bus
+    uint8_t  fifoMax;       // most bytes waiting in the UART Rx FIFO at an interrupt
+    uint32_t isrCalls;      // # Rx interrupts
+    uint64_t isrCycles;     // CPU cycles spent in the Rx interrupt, from ESP.getCycleCount()
+    uint32_t isrCyclesMax;  // longest Rx interrupt, in CPU cycles
+} _EMSUART_RxStats;
+
+// Tx counters since the last power on. Times are in microseconds
+typedef struct {
+    uint32_t telegrams;   // # telegrams handed to the backend
+    uint32_t collisions;  // # stopped by a <BRK> from another device
+    uint32_t timeouts;    // # stopped because the echo didn't come back
+    uint32_t busy;        // # not sent because the last one was still going out
+    uint32_t blockedLast; // how long emsuart_tx_buffer() held up the main loop, for the last telegram
+    uint32_t blockedMax;
+    uint32_t busLast;     // from emsuart_tx_buffer() until the <BRK> was out, for the last telegram
+    uint32_t busMax;
+    uint32_t pollsStaged; // # polls for us answered straight from the Rx interrupt with the staged telegram
+    uint32_t pollsOnTime; // # polls answered within EMSUART_POLL_DEADLINE
+    uint32_t pollsLate;   // # polls answered after EMSUART_POLL_DEADLINE, or after the bus master had moved on
+    uint32_t pollLast;    // from the end of the poll to the start of our answer, for the last poll
+    uint32_t pollMax;
+    uint32_t echoOk;      // # telegrams that came back from the bus as they were sent
+    uint32_t echoErrors;  // # that didn't, or failed to go out
+    uint32_t echoLast;    // from writing a byte until it came back from the bus, EMS+ and HT3 only
+    uint32_t echoMax;
+} _EMSUART_TxStats;
+
+// Tx timing for EMS+ and HT3, in microseconds. Starts at the defaults, and can be shortened by emsuart_calibrate()
+typedef struct {
+    uint16_t brkWait; // EMS+, from writing one byte to the next and the length of the <BRK>. Default EMSUART_TX_BRK_WAIT
+    uint16_t gap;     // HT3, added after each byte has gone out. Default EMSUART_TX_WAIT_GAP
+} _EMSUART_TxTiming;
+
+// where the calibration is
+typedef enum : uint8_t {
+    EMSUART_CALIBRATE_OFF,     // never run, or set back to the defaults
+    EMSUART_CALIBRATE_RUNNING, // searching, see emsuart_calibrate()
+    EMSUART_CALIBRATE_DONE     // found the shortest timing, and backing off on failures since
+} _EMSUART_CALIBRATE_STATE;
+
+// bus timing, in microseconds. Measured from the micros() taken by the Rx interrupt at each <BRK>
+typedef struct {
+    _EMS_Histogram pollInterval; // between two polls for us
+    _EMS_Histogram pollLatency;  // from a poll for us to the start of our answer
+    _EMS_Histogram readLatency;  // from the end of a read we sent to the end of the reply, added by ems.cpp
+    _EMS_Histogram gap;          // the bus is idle between the end of a telegram and the start of the next
+} _EMSUART_Timing;
+
+/*
+ * Running CRC of a telegram, updated for each byte as it arrives. The last 4 values are kept, the newest in the
+ * lowest byte, as which byte is the CRC is only known at the <BRK>. (crcs >> 16) & 0xFF is the CRC of all bytes
+ * except the last 2, which are the CRC byte itself and the BRK.
+ */
+static inline uint32_t emsuart_rx_crc(uint32_t crcs, uint8_t data) {
+    return (crcs << 8) | (uint8_t)(ems_crc_table[crcs & 0xFF] ^ data);
+}
+
+/*
+ * A UART backend moves bytes between the EMS bus and ems.cpp.
+ * tx starts sending a telegram followed by a <BRK>. It can return before the telegram is out, and calls emsuart_tx_done()
+ * once it is, or has failed. If tx returns anything but EMS_TX_STATUS_OK nothing was sent and emsuart_tx_done() isn't called.
+ * tx is also called from emsuart_rx_end(), in the Rx interrupt, to answer a poll with the staged telegram.
+ * Received frames go into the Rx ring with emsuart_rx_begin() and emsuart_rx_end(), and are taken out by emsuart_rx_drain().
+ * loop is for backends without an Rx interrupt and is called from the main loop, it can be nullptr.
+ * staged is called with the tag each time a telegram has been staged with emsuart_tx_stage(), it can be nullptr. The simulator uses it
+ * to have a poll for us come in at that moment.
+ */
+typedef struct {
+    const char * name;
+    bool (*init)();
+    void (*stop)();
+    void (*start)();
+    _EMS_TX_STATUS (*tx)(uint8_t * buf, uint8_t len);
+    void (*loop)();
+    void (*staged)(uint8_t tag);
+} _EMSUART_Backend;
+
+// the backends. The ESP8266 one is the default on the device.
+#ifdef ESP8266
+extern const _EMSUART_Backend EMSUART_Backend_ESP8266;
+#else
+extern const _EMSUART_Backend EMSUART_Backend_TTY;
+extern const _EMSUART_Backend EMSUART_Backend_TCP;
+extern const _EMSUART_Backend EMSUART_Backend_Replay;
+#endif
+
+void ICACHE_FLASH_ATTR emsuart_setBackend(const _EMSUART_Backend * backend);
+const char *           emsuart_getBackendName();
+bool ICACHE_FLASH_ATTR emsuart_init();
 void ICACHE_FLASH_ATTR emsuart_stop();
 void ICACHE_FLASH_ATTR emsuart_start();
+void                   emsuart_loop();
+void                   emsuart_rx(uint8_t * telegram, uint8_t length, bool crcOk);
+_EMSRxBuf *            emsuart_rx_begin();
+void                   emsuart_rx_end(_EMSRxBuf * slot, uint8_t length, uint8_t crc);
+void                   emsuart_rx_drain();
+_EMSUART_RxStats *     emsuart_getRxStats();
 _EMS_TX_STATUS ICACHE_FLASH_ATTR emsuart_tx_buffer(uint8_t * buf, uint8_t len);
+void                   emsuart_tx_done(_EMS_TX_STATUS status);
+bool                   emsuart_tx_busy();
+_EMS_TX_STATUS         emsuart_tx_failure();
+_EMSUART_TxStats *     emsuart_getTxStats();
+bool                   emsuart_tx_stage(uint8_t * buf, uint8_t len, uint8_t tag);
+uint8_t                emsuart_rx_answered();
+uint32_t               emsuart_rx_time();
+uint32_t               emsuart_tx_time();
+_EMSUART_Timing *      emsuart_getTiming();
+void                   emsuart_clearTiming();
+void                   emsuart_tx_echo(uint32_t us);
+_EMSUART_TxTiming *    emsuart_getTxTiming();
+void                   emsuart_setTxTiming(uint16_t brkWait, uint16_t gap);
+bool                   emsuart_calibrate();
+uint8_t                emsuart_getCalibrateState();
+bool                   emsuart_txTimingChanged();
+
+#ifndef ESP8266
+// settings for the host backends, see emsuart_posix.cpp
+void emsuart_posix_setDevice(const char * device);       // tty/pty path, host:port or capture file to replay
+bool emsuart_posix_setCapture(const char * filename);     // record every received frame, in the format the replay backend reads
+bool emsuart_posix_isOpen();                              // false once the connection is lost or the replay has finished
+void emsuart_posix_rx(uint8_t * telegram, uint8_t length); // capture, then through the Rx ring
+#endif
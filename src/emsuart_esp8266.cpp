@@ -0,0 +1,401 @@
+/*
+ * emsuart_esp8266.cpp
+ *
+ * The low level UART code for ESP8266 to read and write to the EMS bus via uart
+ * This is the default UART backend on the device, see emsuart.cpp
+ * Tx runs in the background as a state machine, driven by the UART interrupt and hardware timer1, so the main loop,
+ * WiFi, MQTT and telnet carry on while a telegram goes out. emsuart_tx_done() is called when it's finished.
+ * Paul Derbyshire - https://github.com/proddy/EMS-ESP
+ */
+
+#ifdef ESP8266
+
+#include "emsuart.h"
+#include "ems.h"
+#include <user_interface.h>
+
+uint8_t phantomBreak = 0;
+
+// Tx state machine
+typedef enum {
+    EMSUART_TX_IDLE,  // nothing to send
+    EMSUART_TX_BYTES, // sending the telegram, a byte at a time
+    EMSUART_TX_BRK    // sending the closing <BRK>
+} _EMSUART_TX_STATE;
+
+static volatile uint8_t _tx_state = EMSUART_TX_IDLE;
+static uint8_t          _tx_buf[EMS_MAXBUFFERSIZE];
+static uint8_t          _tx_len;
+static uint8_t          _tx_pos;  // next byte to send
+static uint32_t         _tx_byte; // micros() when the last byte was written, to time its echo
+
+// timer1 runs at 80MHz / 16, 5 ticks per microsecond
+#define EMSUART_TIMER_TICKS(us) ((us)*5)
+
+static void ICACHE_RAM_ATTR emsuart_tx_timer(uint32_t us) {
+    timer1_write(EMSUART_TIMER_TICKS(us));
+}
+
+os_event_t recvTaskQueue[EMSUART_recvTaskQueueLen]; // our Rx queue
+
+/*
+ * the Tx is over, successful or not
+ */
+static void ICACHE_RAM_ATTR emsuart_tx_finish(_EMS_TX_STATUS status) {
+    timer1_disable();
+    USIE(EMSUART_UART) &= ~(1 << UIFE); // no more Tx FIFO empty interrupts
+    _tx_state = EMSUART_TX_IDLE;
+    emsuart_tx_done(status);
+}
+
+/*
+ * start the <BRK> at the end of the telegram, once the Tx FIFO is empty
+ * it is ended by the timer in EMS+ and HT3 mode, and by the loopback in default mode, see emsuart_rx_intr_handler()
+ */
+static void ICACHE_RAM_ATTR emsuart_tx_brk_start() {
+    _tx_state = EMSUART_TX_BRK;
+
+    if (EMS_Sys_Status.emsTxMode == EMS_TXMODE_DEFAULT) {
+        USC0(EMSUART_UART) |= (1 << UCLBE) | (1 << UCBRK); // enable loopback & set <BRK>
+        emsuart_tx_timer(EMS_TX_TO_COUNT * EMSUART_BUSY_WAIT); // watchdog, in case the <BRK> isn't seen
+        return;
+    }
+
+    uint32_t tmp = ((1 << UCRXRST) | (1 << UCTXRST)); // bit mask
+    USC0(EMSUART_UART) |= (tmp);                      // set bits
+    USC0(EMSUART_UART) &= ~(tmp);                     // clear bits
+
+    // To create a 11-bit <BRK> we set TXD_BRK bit so the break signal will
+    // automatically be sent when the tx fifo is empty
+    USC0(EMSUART_UART) |= (1 << UCBRK);
+
+    if (EMS_Sys_Status.emsTxMode == EMS_TXMODE_EMSPLUS) {
+        emsuart_tx_timer(emsuart_getTxTiming()->brkWait);
+    } else {
+        emsuart_tx_timer(EMSUART_TX_WAIT_BRK - EMSUART_TX_LAG); // 1144 (11 Bits)
+    }
+}
+
+/*
+ * send the next byte of the telegram, or the <BRK> after the last one
+ * EMS+ waits brkWait after each byte, see https://github.com/proddy/EMS-ESP/issues/23#
+ * HT3 waits for the Tx FIFO to empty and then for the byte and a gap to go out on the wire (Junkers logic by @philrich)
+ * brkWait and the gap are EMSUART_TX_BRK_WAIT and EMSUART_TX_WAIT_GAP, unless they've been calibrated. See emsuart_calibrate()
+ * default mode waits for the bus master to echo each byte, with a watchdog
+ */
+static void ICACHE_RAM_ATTR emsuart_tx_next() {
+    if (_tx_pos >= _tx_len) {
+        emsuart_tx_brk_start();
+        return;
+    }
+
+    USF(EMSUART_UART) = _tx_buf[_tx_pos++];
+    _tx_byte          = micros();
+
+    if (EMS_Sys_Status.emsTxMode == EMS_TXMODE_EMSPLUS) {
+        emsuart_tx_timer(emsuart_getTxTiming()->brkWait);
+    } else if (EMS_Sys_Status.emsTxMode == EMS_TXMODE_HT3) {
+        USIC(EMSUART_UART) = (1 << UIFE);
+        USIE(EMSUART_UART) |= (1 << UIFE); // continues in emsuart_rx_intr_handler()
+    } else {
+        emsuart_tx_timer(EMS_TX_TO_COUNT * EMSUART_BUSY_WAIT); // watchdog for the echo
+    }
+}
+
+/*
+ * timer1 interrupt, for the waits between the bytes, the length of the <BRK> and the default mode watchdog
+ */
+static void ICACHE_RAM_ATTR emsuart_tx_timer_intr_handler() {
+    if (_tx_state == EMSUART_TX_IDLE) {
+        return;
+    }
+
+    if (EMS_Sys_Status.emsTxMode == EMS_TXMODE_DEFAULT) {
+        // the watchdog, the bus master has stopped echoing
+        USC0(EMSUART_UART) &= ~((1 << UCBRK) | (1 << UCLBE)); // disable loopback & clear <BRK>
+        emsuart_tx_finish(EMS_TX_WTD_TIMEOUT);
+        return;
+    }
+
+    if (_tx_state == EMSUART_TX_BRK) {
+        USC0(EMSUART_UART) &= ~(1 << UCBRK); // clear <BRK>
+        emsuart_tx_finish(EMS_TX_STATUS_OK);
+        return;
+    }
+
+    emsuart_tx_next();
+}
+
+/*
+ * the Rx interrupt, see emsuart_rx_intr_handler()
+ */
+static void ICACHE_RAM_ATTR emsuart_rx_intr(_EMSUART_RxStats * stats) {
+    static uint8_t     length;
+    static uint32_t    crcs; // running CRC, see emsuart_rx_crc()
+    static _EMSRxBuf * pEMSRxBuf;
+
+    // HT3 Tx, the byte has left the Tx FIFO. Wait for it and the gap to go out on the wire
+    if (USIS(EMSUART_UART) & (1 << UIFE)) {
+        USIE(EMSUART_UART) &= ~(1 << UIFE);
+        USIC(EMSUART_UART) = (1 << UIFE);
+        if (_tx_state == EMSUART_TX_BYTES) {
+            emsuart_tx_timer(EMSUART_TX_WAIT_BYTE - EMSUART_TX_LAG + emsuart_getTxTiming()->gap);
+        }
+        if (!(USIS(EMSUART_UART) & ((1 << UIFF) | (1 << UITO) | (1 << UIBD)))) {
+            return; // nothing received
+        }
+    }
+
+    // is a new buffer? if so take the next slot in the Rx ring for a new telegram
+    if (EMS_Sys_Status.emsRxStatus == EMS_RX_STATUS_IDLE) {
+        EMS_Sys_Status.emsRxStatus = EMS_RX_STATUS_BUSY; // status set to busy
+        length                     = 0;
+        crcs                       = 0;
+        pEMSRxBuf                  = emsuart_rx_begin(); // nullptr if the ring is full, the telegram is then dropped
+    }
+    // fill the slot, by emptying Rx FIFO
+    if (USIS(EMSUART_UART) & ((1 << UIFF) | (1 << UITO) | (1 << UIBD))) {
+        while ((USS(EMSUART_UART) >> USRXC) & 0xFF) {
+            uint8_t rx = USF(EMSUART_UART);
+            if (pEMSRxBuf && (length < EMS_MAXBUFFERSIZE))
+                pEMSRxBuf->buffer[length] = rx;
+            crcs = emsuart_rx_crc(crcs, rx);
+            if (length < 0xFF)
+                length++; // keep counting so too long telegrams show up in the stats
+        }
+
+        // clear Rx FIFO full and Rx FIFO timeout interrupts
+        USIC(EMSUART_UART) = (1 << UIFF) | (1 << UITO);
+
+        // default mode Tx, send the next byte once the last one has been echoed by the bus master
+        // EMS+ and HT3 send them on a timer, time the echo for the calibration
+        if ((_tx_state == EMSUART_TX_BYTES) && (length >= _tx_pos)) {
+            if (EMS_Sys_Status.emsTxMode == EMS_TXMODE_DEFAULT) {
+                emsuart_tx_next();
+            } else if (length == _tx_pos) {
+                emsuart_tx_echo(micros() - _tx_byte);
+            }
+        }
+    }
+
+    // BREAK detection = End of EMS data block
+    if (USIS(EMSUART_UART) & ((1 << UIBD))) {
+        ETS_UART_INTR_DISABLE();          // disable all interrupts and clear them
+        USIC(EMSUART_UART) = (1 << UIBD); // INT clear the BREAK detect interrupt
+
+        if ((_tx_state != EMSUART_TX_IDLE) && (EMS_Sys_Status.emsTxMode == EMS_TXMODE_DEFAULT)) {
+            if (_tx_state == EMSUART_TX_BRK) {
+                // our own <BRK> in the loopback, the telegram is out. The frame ends with the next <BRK>
+                USC0(EMSUART_UART) &= ~((1 << UCBRK) | (1 << UCLBE)); // disable loopback & clear <BRK>
+                phantomBreak = 1;
+                emsuart_tx_finish(EMS_TX_STATUS_OK);
+                ETS_UART_INTR_ENABLE();
+                return;
+            }
+            emsuart_tx_finish(EMS_TX_BRK_DETECT); // bus collision, the master cancelled our telegram
+        }
+
+        if (phantomBreak) {
+            phantomBreak = 0;
+            stats->phantomBreaks++;
+            crcs >>= 8; // the CRC is one byte further back
+            if (length)
+                length--; // remove phantom break from Rx buffer
+        }
+
+        emsuart_rx_end(pEMSRxBuf, length, (uint8_t)(crcs >> 16)); // hand the slot, including the BRK 0x00 at the end, to the consumer
+        length                     = 0;
+        EMS_Sys_Status.emsRxStatus = EMS_RX_STATUS_IDLE; // set the status flag stating BRK has been received and we can start a new package
+        ETS_UART_INTR_ENABLE();                          // re-enable UART interrupts
+
+        system_os_post(EMSUART_recvTaskPrio, 0, 0); // call emsuart_recvTask() at next opportunity
+    }
+}
+
+//
+// Main interrupt handler
+// Important: do not use ICACHE_FLASH_ATTR ! It and everything it calls must be in RAM, as it can come in
+// while the flash is being written, e.g. when the settings are saved
+//
+// Counts what the UART driver loses, and the time spent in here. The Rx FIFO overflow and frame error interrupts stay
+// disabled, so they're read from the raw interrupt status and several between two Rx interrupts count once.
+// A <BRK> is a frame error too, so one seen with the <BRK> isn't counted.
+//
+static void ICACHE_RAM_ATTR emsuart_rx_intr_handler(void * para) {
+    uint32_t           start = ESP.getCycleCount();
+    _EMSUART_RxStats * stats = emsuart_getRxStats();
+
+    uint32_t raw = USIR(EMSUART_UART);
+    if (raw & ((1 << UIOF) | (1 << UIFR))) {
+        USIC(EMSUART_UART) = (1 << UIOF) | (1 << UIFR);
+        if (raw & (1 << UIOF)) {
+            stats->overruns++;
+        }
+        if ((raw & (1 << UIFR)) && !(raw & (1 << UIBD))) {
+            stats->frameErrors++;
+        }
+    }
+
+    uint8_t fifo = (USS(EMSUART_UART) >> USRXC) & 0xFF;
+    if (fifo > stats->fifoMax) {
+        stats->fifoMax = fifo;
+    }
+
+    emsuart_rx_intr(stats);
+
+    uint32_t cycles = ESP.getCycleCount() - start;
+    stats->isrCalls++;
+    stats->isrCycles += cycles;
+    if (cycles > stats->isrCyclesMax) {
+        stats->isrCyclesMax = cycles;
+    }
+}
+
+/*
+ * system task triggered on BRK interrupt
+ * incoming received messages are always asynchronous
+ * Every telegram waiting in the Rx ring is handed to emsuart_rx() and from there to ems_parseTelegram() in ems.cpp.
+ */
+static void ICACHE_FLASH_ATTR emsuart_recvTask(os_event_t * events) {
+    emsuart_rx_drain();
+}
+
+/*
+ * flush everything left over in buffer, this clears both rx and tx FIFOs
+ */
+static inline void ICACHE_RAM_ATTR emsuart_flush_fifos() {
+    uint32_t tmp = ((1 << UCRXRST) | (1 << UCTXRST)); // bit mask
+    USC0(EMSUART_UART) |= (tmp);                      // set bits
+    USC0(EMSUART_UART) &= ~(tmp);                     // clear bits
+}
+
+/*
+ * init UART0 driver
+ */
+static bool ICACHE_FLASH_ATTR emsuart_esp8266_init() {
+    ETS_UART_INTR_DISABLE();
+    ETS_UART_INTR_ATTACH(nullptr, nullptr);
+
+    // pin settings
+    PIN_PULLUP_DIS(PERIPHS_IO_MUX_U0TXD_U);
+    PIN_FUNC_SELECT(PERIPHS_IO_MUX_U0TXD_U, FUNC_U0TXD);
+    PIN_PULLUP_DIS(PERIPHS_IO_MUX_U0RXD_U);
+    PIN_FUNC_SELECT(PERIPHS_IO_MUX_U0RXD_U, FUNC_U0RXD);
+
+    // set 9600, 8 bits, no parity check, 1 stop bit
+    USD(EMSUART_UART)  = (UART_CLK_FREQ / EMSUART_BAUD);
+    USC0(EMSUART_UART) = EMSUART_CONFIG; // 8N1
+
+    emsuart_flush_fifos();
+
+    // conf1 params
+    // UCTOE = RX TimeOut enable (default is 1)
+    // UCTOT = RX TimeOut Threshold (7 bit) = want this when no more data after 1 characters (default is 2)
+    // UCFFT = RX FIFO Full Threshold (7 bit) = want this to be 31 for 32 bytes of buffer (default was 127)
+    // see https://www.espressif.com/sites/default/files/documentation/esp8266-technical_reference_en.pdf
+    //
+    // UCFET = TX FIFO Empty Threshold (7 bit) = 1, so UIFE fires once the last byte has left the FIFO (HT3 Tx)
+    //
+    // change: we set UCFFT to 1 to get an immediate indicator about incoming traffic.
+    //         Otherwise, we're only noticed by UCTOT or RxBRK!
+    USC1(EMSUART_UART) = 0;                                                                    // reset config first
+    USC1(EMSUART_UART) = (0x01 << UCFFT) | (0x01 << UCTOT) | (0 << UCTOE) | (0x01 << UCFET); // enable interupts
+
+    // set interrupts for triggers
+    USIC(EMSUART_UART) = 0xFFFF; // clear all interupts
+    USIE(EMSUART_UART) = 0;      // disable all interrupts
+
+    // enable rx break, fifo full and timeout.
+    // but not frame error UIFR (because they are too frequent) or overflow UIOF because our buffer is only max 32 bytes
+    // both are still counted by emsuart_rx_intr_handler(), from the raw interrupt status
+    // change: we don't care about Rx Timeout - it may lead to wrong readouts
+    USIE(EMSUART_UART) = (1 << UIBD) | (1 << UIFF) | (0 << UITO);
+
+    // set up interrupt callbacks for Rx
+    system_os_task(emsuart_recvTask, EMSUART_recvTaskPrio, recvTaskQueue, EMSUART_recvTaskQueueLen);
+
+    // timer1 for the Tx state machine
+    timer1_isr_init();
+    timer1_attachInterrupt(emsuart_tx_timer_intr_handler);
+    timer1_disable();
+
+    // disable esp debug which will go to Tx and mess up the line - see https://github.com/espruino/Espruino/issues/655
+    system_set_os_print(0);
+
+    // swap Rx and Tx pins to use GPIO13 (D7) and GPIO15 (D8) respectively
+    system_uart_swap();
+
+    ETS_UART_INTR_ATTACH(emsuart_rx_intr_handler, nullptr);
+    ETS_UART_INTR_ENABLE();
+
+    return true;
+}
+
+/*
+ * stop UART0 driver
+ * This is called prior to an OTA upload and also before a save to SPIFFS to prevent conflicts
+ */
+static void ICACHE_FLASH_ATTR emsuart_esp8266_stop() {
+    ETS_UART_INTR_DISABLE();
+    if (_tx_state != EMSUART_TX_IDLE) {
+        USC0(EMSUART_UART) &= ~((1 << UCBRK) | (1 << UCLBE));
+        emsuart_tx_finish(EMS_TX_WTD_TIMEOUT);
+    }
+}
+
+/*
+ * re-start UART0 driver
+ */
+static void ICACHE_FLASH_ATTR emsuart_esp8266_start() {
+    ETS_UART_INTR_ENABLE();
+}
+
+/*
+ * Start sending a telegram, ending with a <BRK>
+ * The rest is done by the interrupts, this returns after the first byte is in the Tx FIFO
+ * Also called from the Rx interrupt to answer a poll, so it and everything it calls is in RAM, and the interrupts
+ * are put back to the level they were at instead of being enabled
+ *
+ * In default mode (based on code from https://github.com/proddy/EMS-ESP/issues/103 by @susisstrolch)
+ * each byte is sent when the bus master has echoed the one before, and the <BRK> is sent in loopback mode.
+ * EMS-Bus error handling
+ * 1. Busmaster stops echoing on Tx w/o permission
+ *    handled by the timer1 watchdog, which is restarted for every byte. emsuart_tx_done() gets EMS_TX_WTD_TIMEOUT
+ * 2. Busmaster cancel telegram by sending a BRK
+ *    handled by the BRK detect in the Rx interrupt. emsuart_tx_done() gets EMS_TX_BRK_DETECT
+ */
+static _EMS_TX_STATUS ICACHE_RAM_ATTR emsuart_esp8266_tx(uint8_t * buf, uint8_t len) {
+    if (!len) {
+        emsuart_tx_done(EMS_TX_STATUS_OK);
+        return EMS_TX_STATUS_OK;
+    }
+
+    if (len > EMS_MAXBUFFERSIZE) {
+        len = EMS_MAXBUFFERSIZE;
+    }
+    memcpy(_tx_buf, buf, len); // the caller's buffer can change while we're sending
+
+    uint32_t savedPS = xt_rsil(15); // no UART or timer1 interrupt until it's started
+
+    _tx_len   = len;
+    _tx_pos   = 0;
+    _tx_state = EMSUART_TX_BYTES;
+
+    if (EMS_Sys_Status.emsTxMode == EMS_TXMODE_DEFAULT) {
+        // start a new Rx frame with an empty Rx FIFO, so what comes back is our echo
+        emsuart_flush_fifos();
+        EMS_Sys_Status.emsRxStatus = EMS_RX_STATUS_IDLE;
+    }
+
+    timer1_enable(TIM_DIV16, TIM_EDGE, TIM_SINGLE);
+    emsuart_tx_next();
+
+    xt_wsr_ps(savedPS);
+
+    return EMS_TX_STATUS_OK;
+}
+
+const _EMSUART_Backend EMSUART_Backend_ESP8266 =
+    {"esp8266", emsuart_esp8266_init, emsuart_esp8266_stop, emsuart_esp8266_start, emsuart_esp8266_tx, nullptr, nullptr};
+
+#endif
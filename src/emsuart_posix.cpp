@@ -0,0 +1,440 @@
+/*
+ * emsuart_posix.cpp
+ *
+ * UART backends for running ems.cpp on a PC, see emsuart.cpp
+ *
+ *  tty    - a serial port with an EMS bus adapter, or a pty. Set with emsuart_posix_setDevice("/dev/ttyUSB0")
+ *           The port runs at 9600 8N1 with PARMRK so a <BRK> reads as FF 00 00 and a data byte FF as FF FF.
+ *           A pty has no <BRK>, so until the first <BRK> is seen a frame also ends when the line has been idle for EMSUART_POSIX_IDLE_GAP.
+ *  tcp    - a raw TCP stream from a serial server, e.g. "192.168.1.10:7000".
+ *           Uses the same encoding as the tty in both directions: <BRK> is FF 00 00, a data byte FF is sent as FF FF.
+ *  replay - reads a capture file made with emsuart_posix_setCapture(), one frame per line:
+ *           <micros> <hex bytes>, lines starting with # are ignored. Frames are replayed at their recorded times, Tx is discarded.
+ *
+ * Paul Derbyshire - https://github.com/proddy/EMS-ESP
+ */
+
+#ifndef ESP8266
+
+#include "emsuart.h"
+#include "MyESP.h"
+#include "ems.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <termios.h>
+#include <unistd.h>
+
+#define EMSUART_POSIX_IDLE_GAP (EMSUART_TX_WAIT_BYTE * 4) // end a frame after this many microseconds without data
+#define EMSUART_POSIX_POLL_TIMEOUT 1                      // ms to wait for data in emsuart_loop()
+
+typedef enum {
+    EMSUART_POSIX_RX_DATA, // plain data
+    EMSUART_POSIX_RX_FF,   // seen FF, next is either FF (data byte FF) or 00 (a mark)
+    EMSUART_POSIX_RX_MARK  // seen FF 00, next is 00 for a <BRK> or the byte that had a framing error
+} _EMSUART_POSIX_RX_STATE;
+
+static char                    _device[128] = "";
+static int                     _fd          = -1;
+static bool                    _enabled     = false;
+static FILE *                  _capture     = nullptr;
+static FILE *                  _replay      = nullptr;
+static uint32_t                _replay_due;  // micros() when the next replayed frame is due
+static uint32_t                _replay_last; // capture timestamp of the last replayed frame
+static bool                    _replay_first;
+static uint8_t                 _rx_buffer[EMS_MAXBUFFERSIZE];
+static uint8_t                 _rx_length = 0;
+static uint32_t                _rx_last   = 0;     // micros() of the last byte received
+static bool                    _rx_brk    = false; // a <BRK> has been seen, frames no longer end on an idle line
+static _EMSUART_POSIX_RX_STATE _rx_state  = EMSUART_POSIX_RX_DATA;
+
+/*
+ * set the tty/pty path, host:port or capture file, before emsuart_init()
+ */
+void emsuart_posix_setDevice(const char * device) {
+    strlcpy(_device, device, sizeof(_device));
+}
+
+/*
+ * record all received frames to a file, which can be played back later with the replay backend
+ */
+bool emsuart_posix_setCapture(const char * filename) {
+    if (_capture) {
+        fclose(_capture);
+    }
+
+    _capture = fopen(filename, "w");
+    if (!_capture) {
+        return false;
+    }
+
+    fprintf(_capture, "# EMS-ESP capture, micros and frame bytes without the <BRK>\n");
+    return true;
+}
+
+bool emsuart_posix_isOpen() {
+    return (_fd != -1) || (_replay != nullptr);
+}
+
+/*
+ * Rx hand-off for the host backends, writes the frame to the capture file first
+ * The frame goes through the Rx ring like on the ESP8266, but is taken out again straight away
+ */
+void emsuart_posix_rx(uint8_t * telegram, uint8_t length) {
+    if (_capture && length) {
+        fprintf(_capture, "%u", micros());
+        for (uint8_t i = 0; i < length; i++) {
+            fprintf(_capture, " %02X", telegram[i]);
+        }
+        fprintf(_capture, "\n");
+        fflush(_capture);
+    }
+
+    _EMSRxBuf * slot = emsuart_rx_begin();
+    uint32_t    crcs = 0;
+    for (uint8_t i = 0; i < length; i++) {
+        if (slot && (i < EMS_MAXBUFFERSIZE)) {
+            slot->buffer[i] = telegram[i];
+        }
+        crcs = emsuart_rx_crc(crcs, telegram[i]);
+    }
+    emsuart_rx_end(slot, length + 1, (uint8_t)(crcs >> 8)); // the length includes the BRK, as on the ESP8266
+    emsuart_rx_drain();
+}
+
+/*
+ * a frame has ended with a <BRK> or an idle line
+ */
+static void emsuart_posix_frame() {
+    uint8_t length = _rx_length;
+
+    _rx_length = 0;
+    _rx_state  = EMSUART_POSIX_RX_DATA;
+
+    if (length && _enabled) {
+        emsuart_posix_rx(_rx_buffer, length);
+    }
+}
+
+static void emsuart_posix_byte(uint8_t c) {
+    if (_rx_length < EMS_MAXBUFFERSIZE) {
+        _rx_buffer[_rx_length++] = c;
+    }
+}
+
+/*
+ * decode the PARMRK stream from the tty, also used on tcp
+ */
+static void emsuart_posix_decode(const uint8_t * data, ssize_t length) {
+    for (ssize_t i = 0; i < length; i++) {
+        uint8_t c = data[i];
+        switch (_rx_state) {
+        case EMSUART_POSIX_RX_DATA:
+            if (c == 0xFF) {
+                _rx_state = EMSUART_POSIX_RX_FF;
+            } else {
+                emsuart_posix_byte(c);
+            }
+            break;
+        case EMSUART_POSIX_RX_FF:
+            if (c == 0x00) {
+                _rx_state = EMSUART_POSIX_RX_MARK;
+            } else {
+                emsuart_posix_byte(0xFF);
+                _rx_state = EMSUART_POSIX_RX_DATA;
+            }
+            break;
+        case EMSUART_POSIX_RX_MARK:
+            if (c == 0x00) {
+                _rx_brk = true;
+                emsuart_posix_frame(); // <BRK>
+            } else {
+                emsuart_getRxStats()->frameErrors++;
+                emsuart_posix_byte(c); // framing or parity error, keep the byte like the ESP8266 does
+                _rx_state = EMSUART_POSIX_RX_DATA;
+            }
+            break;
+        }
+    }
+    _rx_last = micros();
+}
+
+/*
+ * wait a short while for data, then decode it. Ends the frame if the line has gone idle
+ */
+static void emsuart_posix_loop() {
+    uint8_t       data[64];
+    struct pollfd pfd;
+
+    if (_fd == -1) {
+        return;
+    }
+
+    pfd.fd     = _fd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, EMSUART_POSIX_POLL_TIMEOUT) > 0) {
+        ssize_t n = read(_fd, data, sizeof(data));
+        if (n > 0) {
+            emsuart_posix_decode(data, n);
+        } else if ((n == 0) || ((errno != EAGAIN) && (errno != EINTR))) {
+            myESP.myDebug_P(PSTR("[UART] %s closed"), _device);
+            close(_fd);
+            _fd = -1;
+            return;
+        }
+    }
+
+    if (_rx_length && !_rx_brk && ((micros() - _rx_last) > EMSUART_POSIX_IDLE_GAP)) {
+        emsuart_posix_frame();
+    }
+}
+
+static void emsuart_posix_stop() {
+    _enabled = false;
+}
+
+static void emsuart_posix_start() {
+    _enabled = true;
+}
+
+/*
+ * write all bytes, waiting if the fd is full
+ */
+static bool emsuart_posix_write(const uint8_t * data, size_t length) {
+    while (length) {
+        ssize_t n = write(_fd, data, length);
+        if (n < 0) {
+            if ((errno != EAGAIN) && (errno != EINTR)) {
+                return false;
+            }
+            struct pollfd pfd = {_fd, POLLOUT, 0};
+            poll(&pfd, 1, EMSUART_POSIX_POLL_TIMEOUT);
+            continue;
+        }
+        data += n;
+        length -= n;
+    }
+    return true;
+}
+
+/*
+ * init the tty, 9600 8N1 raw, with <BRK> and errors marked in the input stream
+ */
+static bool emsuart_tty_init() {
+    struct termios tio;
+
+    _fd = open(_device, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (_fd == -1) {
+        myESP.myDebug_P(PSTR("[UART] Cannot open %s: %s"), _device, strerror(errno));
+        return false;
+    }
+
+    tcgetattr(_fd, &tio);
+    cfmakeraw(&tio);
+    tio.c_iflag &= ~(IGNBRK | BRKINT | IGNPAR | ISTRIP | INPCK);
+    tio.c_iflag |= PARMRK;
+    tio.c_cflag |= (CLOCAL | CREAD);
+    tio.c_cc[VMIN]  = 0;
+    tio.c_cc[VTIME] = 0;
+    cfsetispeed(&tio, B9600);
+    cfsetospeed(&tio, B9600);
+    tcsetattr(_fd, TCSANOW, &tio);
+    tcflush(_fd, TCIOFLUSH);
+
+    _rx_length = 0;
+    _rx_state  = EMSUART_POSIX_RX_DATA;
+    _rx_brk    = false;
+    _enabled   = true;
+    return true;
+}
+
+/*
+ * the host backends send synchronously, so the telegram is out by the time tx returns
+ */
+static _EMS_TX_STATUS emsuart_posix_txDone() {
+    emsuart_tx_done(EMS_TX_STATUS_OK);
+    return EMS_TX_STATUS_OK;
+}
+
+/*
+ * Send to Tx, ending with a <BRK>
+ * the bus echoes the telegram back to us, which arrives on Rx like on the ESP8266
+ */
+static _EMS_TX_STATUS emsuart_tty_tx(uint8_t * buf, uint8_t len) {
+    if (!len || !_enabled || (_fd == -1)) {
+        return emsuart_posix_txDone();
+    }
+
+    if (!emsuart_posix_write(buf, len)) {
+        return EMS_TX_WTD_TIMEOUT;
+    }
+    tcdrain(_fd);
+
+    // a pty has no line, setting the <BRK> on it does nothing
+    ioctl(_fd, TIOCSBRK);
+    usleep(EMSUART_TX_WAIT_BRK);
+    ioctl(_fd, TIOCCBRK);
+
+    return emsuart_posix_txDone();
+}
+
+/*
+ * connect to host:port
+ */
+static bool emsuart_tcp_init() {
+    char             host[sizeof(_device)];
+    char *           port;
+    struct addrinfo  hints;
+    struct addrinfo *result, *rp;
+
+    strlcpy(host, _device, sizeof(host));
+    port = strrchr(host, ':');
+    if (!port) {
+        myESP.myDebug_P(PSTR("[UART] %s is not host:port"), _device);
+        return false;
+    }
+    *port++ = '\0';
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &result) != 0) {
+        myESP.myDebug_P(PSTR("[UART] Cannot resolve %s"), host);
+        return false;
+    }
+
+    for (rp = result; rp != nullptr; rp = rp->ai_next) {
+        _fd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+        if (_fd == -1) {
+            continue;
+        }
+        if (connect(_fd, rp->ai_addr, rp->ai_addrlen) == 0) {
+            break;
+        }
+        close(_fd);
+        _fd = -1;
+    }
+    freeaddrinfo(result);
+
+    if (_fd == -1) {
+        myESP.myDebug_P(PSTR("[UART] Cannot connect to %s"), _device);
+        return false;
+    }
+
+    fcntl(_fd, F_SETFL, fcntl(_fd, F_GETFL) | O_NONBLOCK);
+
+    _rx_length = 0;
+    _rx_state  = EMSUART_POSIX_RX_DATA;
+    _rx_brk    = false;
+    _enabled   = true;
+    return true;
+}
+
+/*
+ * Send to Tx, escaping FF and ending with the FF 00 00 <BRK> mark
+ */
+static _EMS_TX_STATUS emsuart_tcp_tx(uint8_t * buf, uint8_t len) {
+    uint8_t out[(EMS_MAXBUFFERSIZE * 2) + 3];
+    uint8_t n = 0;
+
+    if (!len || !_enabled || (_fd == -1)) {
+        return emsuart_posix_txDone();
+    }
+
+    for (uint8_t i = 0; (i < len) && (i < EMS_MAXBUFFERSIZE); i++) {
+        out[n++] = buf[i];
+        if (buf[i] == 0xFF) {
+            out[n++] = 0xFF;
+        }
+    }
+    out[n++] = 0xFF;
+    out[n++] = 0x00;
+    out[n++] = 0x00;
+
+    return emsuart_posix_write(out, n) ? emsuart_posix_txDone() : EMS_TX_WTD_TIMEOUT;
+}
+
+static bool emsuart_replay_init() {
+    _replay = fopen(_device, "r");
+    if (!_replay) {
+        myESP.myDebug_P(PSTR("[UART] Cannot open %s: %s"), _device, strerror(errno));
+        return false;
+    }
+
+    _replay_first = true;
+    _enabled      = true;
+    return true;
+}
+
+/*
+ * read the next frame from the capture and hand it on when its time has come
+ * times are taken relative to the previous frame so a wrap of micros() in the capture does no harm
+ */
+static void emsuart_replay_loop() {
+    char     line[256];
+    char *   p;
+    char *   end;
+    uint8_t  length = 0;
+    uint32_t timestamp;
+
+    if (!_replay) {
+        return;
+    }
+
+    if (!fgets(line, sizeof(line), _replay)) {
+        myESP.myDebug_P(PSTR("[UART] End of replay %s"), _device);
+        fclose(_replay);
+        _replay = nullptr;
+        return;
+    }
+
+    if (line[0] == '#') {
+        return;
+    }
+
+    timestamp = strtoul(line, &p, 10);
+    if (p == line) {
+        return; // empty line
+    }
+
+    while (length < EMS_MAXBUFFERSIZE) {
+        unsigned long value = strtoul(p, &end, 16);
+        if (end == p) {
+            break;
+        }
+        _rx_buffer[length++] = (uint8_t)value;
+        p                    = end;
+    }
+
+    if (_replay_first) {
+        _replay_first = false;
+        _replay_due   = micros();
+    } else {
+        _replay_due += (timestamp - _replay_last);
+    }
+    _replay_last = timestamp;
+
+    int32_t wait = (int32_t)(_replay_due - micros());
+    if (wait > 0) {
+        delayMicroseconds(wait);
+    }
+
+    if (_enabled) {
+        emsuart_posix_rx(_rx_buffer, length);
+    }
+}
+
+static _EMS_TX_STATUS emsuart_replay_tx(uint8_t * buf, uint8_t len) {
+    return emsuart_posix_txDone(); // nothing to send to
+}
+
+const _EMSUART_Backend EMSUART_Backend_TTY    = {"tty", emsuart_tty_init, emsuart_posix_stop, emsuart_posix_start, emsuart_tty_tx, emsuart_posix_loop, nullptr};
+const _EMSUART_Backend EMSUART_Backend_TCP    = {"tcp", emsuart_tcp_init, emsuart_posix_stop, emsuart_posix_start, emsuart_tcp_tx, emsuart_posix_loop, nullptr};
+const _EMSUART_Backend EMSUART_Backend_Replay =
+    {"replay", emsuart_replay_init, emsuart_posix_stop, emsuart_posix_start, emsuart_replay_tx, emsuart_replay_loop, nullptr};
+
+#endif
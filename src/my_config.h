@@ -75,6 +75,14 @@
 #define TOPIC_SHOWER_COLDSHOT "coldshot" // used to trigger a coldshot from an MQTT command
 #define TOPIC_SHOWER_DURATION "duration" // duration of the last shower
 
+// bus timing and traffic, and the UART
+#define TOPIC_BUS_TIMING "bus_timing" // for sending the bus timing percentiles, in microseconds
+#define TOPIC_BUS_STATS "bus_stats"   // for sending the bus occupancy and traffic by source and type
+#define TOPIC_UART_STATS "uart_stats" // for sending the UART counters of lost and discarded data, and the Rx interrupt time
+
+// blocks read in chunks, like the switching programs and the error log
+#define TOPIC_BLOCK_DATA "block_%02X_%02X" // for sending a block as one object, by device ID and type ID
+
 // MQTT for External Sensors
 #define TOPIC_EXTERNAL_SENSORS "sensors"   // for sending sensor values to MQTT
 #define PAYLOAD_EXTERNAL_SENSORS "temp_%d" // for formatting the payload for each external dallas sensor
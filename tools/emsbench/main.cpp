@@ -0,0 +1,372 @@
+/*
+ * main.cpp
+ *
+ * Host benchmarks for the hot paths in ems.cpp, built with the emssim host shims.
+ *
+ *   emsbench [-n iterations]
+ *
+ * types - _ems_findType() against the linear scan of EMS_Types it replaced, on a realistic mix of
+ *         telegram types as seen on a bus with a UBA boiler, RC35 thermostat, SM100 and MM100.
+ *         Also checks that both give the same answer for every type ID.
+ * decode - the UBAMonitorFast field list through _ems_decodeFields() against the _setValue() calls it replaced.
+ * shadow - _ems_processTelegram() for a UBAMonitorFast that is the same as last time, and one that has changed.
+ *          Only a changed one is flagged to be published, and both are decoded.
+ * txqueue - how many read requests fit in EMS_TxQueue compared to the 50 full _EMS_TxTelegram it replaced,
+ *           that each one comes back out as it went in, and that duplicate reads and writes are coalesced and
+ *           the write goes first, and that a read that has waited long enough moves up.
+ *
+ * Paul Derbyshire - https://github.com/proddy/EMS-ESP
+ */
+
+#include "emssim.h"
+#include "ems_devices.h"
+
+#include <chrono>
+#include <unistd.h>
+
+/*
+ * telegram types in the order and rough proportion they show up on the bus.
+ * Most telegrams on a real bus are types we don't know, which is the worst case for a linear scan
+ */
+static const uint16_t BENCH_TYPES_MIX[] = {
+    EMS_TYPE_UBAMonitorFast,
+    EMS_TYPE_RCTime,
+    EMS_TYPE_RC35StatusMessage_HC1,
+    EMS_TYPE_UBAMonitorWWMessage,
+    0x02BF, // RC300 monitor, not known
+    EMS_TYPE_SM100Monitor,
+    EMS_TYPE_MMPLUSStatusMessage_HC1,
+    EMS_TYPE_UBAMonitorFast,
+    0x0047, // RC35 HC2 monitor, not known
+    EMS_TYPE_RCOutdoorTempMessage,
+    EMS_TYPE_UBAMonitorSlow,
+    0x0031, // UBA settings, not known
+    EMS_TYPE_RC35Set_HC1,
+    EMS_TYPE_SM100Status,
+    EMS_TYPE_RCPLUSStatusMessage_HC1,
+    0x0010, // error log, not known
+    EMS_TYPE_UBAMonitorSlow2,
+    EMS_TYPE_UBAMonitorFast2,
+    EMS_TYPE_Version,
+    0x01E5, // not known
+};
+
+static volatile int32_t _sink; // keeps the compiler from dropping the lookups
+
+/*
+ * the original scan through EMS_Types, for comparison
+ */
+static int8_t _bench_findTypeLinear(uint16_t type) {
+    uint8_t i         = 0;
+    bool    typeFound = false;
+    while (i < _EMS_Types_max) {
+        if (EMS_Types[i].type == type) {
+            typeFound = true;
+            break;
+        }
+        i++;
+    }
+    return (typeFound ? i : -1);
+}
+
+static double _bench_run(int8_t (*find)(uint16_t), uint32_t iterations) {
+    const uint8_t count = ArraySize(BENCH_TYPES_MIX);
+    int32_t       sum   = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t n = 0; n < iterations; n++) {
+        for (uint8_t i = 0; i < count; i++) {
+            sum += find(BENCH_TYPES_MIX[i]);
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    _sink = sum;
+    return std::chrono::duration<double, std::nano>(end - start).count() / ((double)iterations * count);
+}
+
+static bool _bench_types(uint32_t iterations) {
+    uint32_t mismatches = 0;
+
+    // same answer for every possible type ID, including the first-match rule for types listed twice
+    for (uint32_t type = 0; type <= 0xFFFF; type++) {
+        if (_ems_findType(type) != _bench_findTypeLinear(type)) {
+            printf("  mismatch for type 0x%04X: %d != %d\n", type, _ems_findType(type), _bench_findTypeLinear(type));
+            mismatches++;
+        }
+    }
+
+    double linear = _bench_run(_bench_findTypeLinear, iterations);
+    double hashed = _bench_run(_ems_findType, iterations);
+
+    printf("types: %u entries in EMS_Types, %u telegrams in the mix\n", _EMS_Types_max, (uint32_t)ArraySize(BENCH_TYPES_MIX));
+    printf("  linear scan    %6.2f ns/telegram\n", linear);
+    printf("  hash table     %6.2f ns/telegram (%.1fx)\n", hashed, hashed ? (linear / hashed) : 0.0);
+    printf("  all 65536 type IDs give the same result: %s\n", mismatches ? "FAILED" : "ok");
+
+    return (mismatches == 0);
+}
+
+/*
+ * UBAMonitorFast, 08 00 18 00 ...
+ */
+static uint8_t BENCH_UBAMonitorFast[] = {0x2D, 0x01, 0x9A, 0x64, 0x1E, 0x00, 0x00, 0x21, 0x00, 0x00, 0x00, 0x80, 0x00,
+                                         0x01, 0x2C, 0x00, 0x34, 0x0F, 0x2D, 0x48, 0x00, 0xC8, 0x00, 0x00, 0x00};
+
+/*
+ * the hand-written decoding of UBAMonitorFast before the field lists, for comparison
+ */
+static void _bench_setValue(_EMS_RxTelegram * EMS_RxTelegram, uint8_t * param_op, uint8_t index) {
+    if (index >= EMS_RxTelegram->data_length) {
+        return;
+    }
+    *param_op = (uint8_t)EMS_RxTelegram->data[index];
+}
+
+static void _bench_setValue(_EMS_RxTelegram * EMS_RxTelegram, uint16_t * param_op, uint8_t index) {
+    if (index >= EMS_RxTelegram->data_length) {
+        return;
+    }
+    uint16_t value = (EMS_RxTelegram->data[index] << 8) + EMS_RxTelegram->data[index + 1];
+    if (value == EMS_VALUE_USHORT_NOTSET) {
+        return;
+    }
+    *param_op = value;
+}
+
+static void _bench_setValue(_EMS_RxTelegram * EMS_RxTelegram, uint8_t * param_op, uint8_t index, uint8_t bit) {
+    if (index >= EMS_RxTelegram->data_length) {
+        return;
+    }
+    *param_op = (uint8_t)(((EMS_RxTelegram->data[index]) >> (bit)) & 0x01);
+}
+
+static void _bench_decodeOld(_EMS_RxTelegram * EMS_RxTelegram) {
+    _bench_setValue(EMS_RxTelegram, &EMS_Boiler.selFlowTemp, 0);
+    _bench_setValue(EMS_RxTelegram, &EMS_Boiler.curFlowTemp, 1);
+    _bench_setValue(EMS_RxTelegram, &EMS_Boiler.selBurnPow, 3);
+    _bench_setValue(EMS_RxTelegram, &EMS_Boiler.curBurnPow, 4);
+    _bench_setValue(EMS_RxTelegram, &EMS_Boiler.burnGas, 7, 0);
+    _bench_setValue(EMS_RxTelegram, &EMS_Boiler.fanWork, 7, 2);
+    _bench_setValue(EMS_RxTelegram, &EMS_Boiler.ignWork, 7, 3);
+    _bench_setValue(EMS_RxTelegram, &EMS_Boiler.heatPmp, 7, 5);
+    _bench_setValue(EMS_RxTelegram, &EMS_Boiler.wWHeat, 7, 6);
+    _bench_setValue(EMS_RxTelegram, &EMS_Boiler.wWCirc, 7, 7);
+    _bench_setValue(EMS_RxTelegram, &EMS_Boiler.boilTemp, 11);
+    _bench_setValue(EMS_RxTelegram, &EMS_Boiler.retTemp, 13);
+    _bench_setValue(EMS_RxTelegram, &EMS_Boiler.flameCurr, 15);
+    _bench_setValue(EMS_RxTelegram, &EMS_Boiler.serviceCode, 20);
+    _bench_setValue(EMS_RxTelegram, &EMS_Boiler.sysPress, 17);
+}
+
+static void _bench_decodeNew(_EMS_RxTelegram * EMS_RxTelegram) {
+    _ems_decodeFields(EMS_RxTelegram, EMS_Fields_UBAMonitorFast, EMS_Fields_UBAMonitorFast_max, &EMS_Boiler);
+}
+
+static double _bench_runDecode(void (*decode)(_EMS_RxTelegram *), _EMS_RxTelegram * telegram, uint32_t iterations) {
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t n = 0; n < iterations; n++) {
+        telegram->data[1] = n; // so the compiler can't hoist the decoding out of the loop
+        decode(telegram);
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+}
+
+static bool _bench_decode(uint32_t iterations) {
+    _EMS_RxTelegram telegram;
+    _EMS_Boiler     decodedOld, decodedNew;
+
+    memset(&telegram, 0, sizeof(telegram));
+    telegram.src         = EMS_ID_BOILER;
+    telegram.type        = EMS_TYPE_UBAMonitorFast;
+    telegram.data        = BENCH_UBAMonitorFast;
+    telegram.data_length = sizeof(BENCH_UBAMonitorFast);
+
+    // both must decode to the same values
+    ems_init();
+    _bench_decodeOld(&telegram);
+    decodedOld = EMS_Boiler;
+    ems_init();
+    _bench_decodeNew(&telegram);
+    decodedNew = EMS_Boiler;
+    bool same   = (memcmp(&decodedOld, &decodedNew, sizeof(_EMS_Boiler)) == 0);
+    bool sorted = (_ems_checkFields() == 0);
+
+    double before = _bench_runDecode(_bench_decodeOld, &telegram, iterations);
+    double after  = _bench_runDecode(_bench_decodeNew, &telegram, iterations);
+
+    printf("decode: UBAMonitorFast, %u fields, %u bytes\n", EMS_Fields_UBAMonitorFast_max, telegram.data_length);
+    printf("  _setValue() calls  %6.2f ns/telegram\n", before);
+    printf("  field list         %6.2f ns/telegram (%.1fx)\n", after, after ? (before / after) : 0.0);
+    printf("  same values decoded: %s\n", same ? "ok" : "FAILED");
+    printf("  every field list sorted by index: %s\n", sorted ? "ok" : "FAILED");
+
+    return same && sorted;
+}
+
+static double _bench_runProcess(_EMS_RxTelegram * telegram, uint32_t iterations, bool changing) {
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t n = 0; n < iterations; n++) {
+        if (changing) {
+            telegram->data[1] = n; // current flow temp
+        }
+        _ems_processTelegram(telegram);
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+}
+
+static bool _bench_shadow(uint32_t iterations) {
+    _EMS_RxTelegram telegram;
+
+    uint8_t fast[sizeof(BENCH_UBAMonitorFast)];
+    memcpy(fast, BENCH_UBAMonitorFast, sizeof(fast));
+    fast[11] = 0x02; // a boiler temp of 54.0 C, which UBAMonitorSlow sets too
+    fast[12] = 0x1C;
+
+    memset(&telegram, 0, sizeof(telegram));
+    telegram.src         = EMS_ID_BOILER;
+    telegram.type        = EMS_TYPE_UBAMonitorFast;
+    telegram.data        = fast;
+    telegram.data_length = sizeof(fast);
+
+    ems_init();
+    double changing  = _bench_runProcess(&telegram, iterations, true);
+    double unchanged = _bench_runProcess(&telegram, iterations, false);
+
+    // the same telegram again is not decoded, nor flagged to be published
+    uint16_t curFlowTemp = (fast[1] << 8) + fast[2];
+    uint16_t boilTemp    = (fast[11] << 8) + fast[12];
+    bool     ok          = (EMS_Boiler.curFlowTemp == curFlowTemp);
+    ok &= (EMS_Sys_Status.emsRxUnchanged == iterations) && (EMS_Sys_Status.emsRxSkipped == iterations);
+
+    // UBAMonitorSlow sets boilTemp too, after which the same UBAMonitorFast is decoded again
+    uint8_t         slow[27] = {0x80, 0x00, 0x02, 0x41};
+    _EMS_RxTelegram other    = telegram;
+    other.type               = EMS_TYPE_UBAMonitorSlow;
+    other.data               = slow;
+    other.data_length        = sizeof(slow);
+    _ems_processTelegram(&other);
+    ok &= (EMS_Boiler.boilTemp == 0x0241);
+
+    _ems_processTelegram(&telegram);
+    ok &= (EMS_Boiler.boilTemp == boilTemp) && (EMS_Sys_Status.emsRxSkipped == iterations);
+    _ems_processTelegram(&telegram);
+    ok &= (EMS_Sys_Status.emsRxSkipped == iterations + 1);
+
+    printf("shadow: UBAMonitorFast through _ems_processTelegram()\n");
+    printf("  changed each time  %6.2f ns/telegram\n", changing);
+    printf("  same as last time  %6.2f ns/telegram (%.1fx)\n", unchanged, unchanged ? (changing / unchanged) : 0.0);
+    printf("  repeats skipped, decoded again once another type has set one of its values: %s\n", ok ? "ok" : "FAILED");
+
+    return ok;
+}
+
+static bool _bench_txqueue() {
+    const uint8_t   mix            = ArraySize(BENCH_TYPES_MIX);
+    _EMS_TxTelegram EMS_TxTelegram = EMS_TX_TELEGRAM_NEW;
+    EMS_TxTelegram.action          = EMS_TX_TELEGRAM_READ;
+    EMS_TxTelegram.dest            = EMS_ID_BOILER | 0x80;
+    EMS_TxTelegram.length          = EMS_MIN_TELEGRAM_LENGTH;
+    EMS_TxTelegram.dataValue       = EMS_MAX_TELEGRAM_LENGTH;
+
+    ems_init();
+    _EMS_SYS_LOGGING logging  = EMS_Sys_Status.emsLogging;
+    EMS_Sys_Status.emsLogging = EMS_SYS_LOGGING_NONE; // no warning when it's full
+
+    // a different offset each time, so none are merged
+    uint16_t n = 0;
+    do {
+        EMS_TxTelegram.type   = BENCH_TYPES_MIX[n % mix];
+        EMS_TxTelegram.offset = n;
+        n++;
+    } while (EMS_TxQueue.push(EMS_TxTelegram));
+
+    // the discovery reads are moved to the front, so look them up by their offset
+    bool     ok      = (EMS_TxQueue.size() == n - 1);
+    uint32_t offsets = 0;
+    for (uint8_t i = 0; i < EMS_TxQueue.size(); i++) {
+        _EMS_TxTelegram out = EMS_TxQueue[i];
+        ok &= (out.type == BENCH_TYPES_MIX[out.offset % mix]) && (out.length == EMS_MIN_TELEGRAM_LENGTH)
+              && (out.dest == EMS_TxTelegram.dest) && (out.dataValue == EMS_TxTelegram.dataValue);
+        offsets += out.offset;
+    }
+    ok &= (offsets == (uint32_t)(n - 1) * (n - 2) / 2); // each one once
+
+    printf("txqueue: read requests\n");
+    printf("  CircularBuffer  %4u bytes, 50 telegrams\n", (uint32_t)(50 * sizeof(_EMS_TxTelegram)));
+    printf("  EMSTxQueue      %4u bytes, %u telegrams\n", (uint32_t)sizeof(EMSTxQueue), EMS_TxQueue.size());
+    printf("  telegrams come back out as queued: %s\n", ok ? "ok" : "FAILED");
+
+    // the same read twice, and two writes to the same offset, which go ahead of the reads
+    EMS_TxQueue.clear();
+    EMS_TxTelegram.offset = 0;
+    EMS_TxTelegram.type   = EMS_TYPE_UBAMonitorFast;
+    EMS_TxQueue.push(EMS_TxTelegram);
+    EMS_TxTelegram.type = EMS_TYPE_UBAMonitorSlow;
+    EMS_TxQueue.push(EMS_TxTelegram);
+    EMS_TxTelegram.type = EMS_TYPE_UBAMonitorFast;
+    EMS_TxQueue.push(EMS_TxTelegram);
+    EMS_TxTelegram.action    = EMS_TX_TELEGRAM_WRITE;
+    EMS_TxTelegram.dest      = EMS_ID_BOILER;
+    EMS_TxTelegram.type      = EMS_TYPE_UBAParameterWW;
+    EMS_TxTelegram.offset    = 2;
+    EMS_TxTelegram.dataValue = 55;
+    EMS_TxQueue.push(EMS_TxTelegram);
+    EMS_TxTelegram.dataValue = 58;
+    EMS_TxQueue.push(EMS_TxTelegram);
+    EMS_Sys_Status.emsLogging = logging;
+
+    bool merged = (EMS_TxQueue.size() == 3) && (EMS_TxQueue[0].action == EMS_TX_TELEGRAM_WRITE) && (EMS_TxQueue[0].dataValue == 58);
+    merged &= (EMS_Sys_Status.emsTxReadsMerged == 1) && (EMS_Sys_Status.emsTxWritesReplaced == 1);
+    printf("  duplicate read merged, write replaced and sent first: %s\n", merged ? "ok" : "FAILED");
+
+    // a refresh read that has waited long enough goes ahead of a new discovery read
+    EMS_TxQueue.clear();
+    EMS_TxTelegram           = EMS_TX_TELEGRAM_NEW;
+    EMS_TxTelegram.action    = EMS_TX_TELEGRAM_READ;
+    EMS_TxTelegram.dest      = EMS_ID_BOILER;
+    EMS_TxTelegram.length    = EMS_MIN_TELEGRAM_LENGTH;
+    EMS_TxTelegram.dataValue = EMS_MAX_TELEGRAM_LENGTH;
+    EMS_TxTelegram.type      = EMS_TYPE_Version;
+    EMS_TxTelegram.timestamp = millis();
+    EMS_TxQueue.push(EMS_TxTelegram);
+    EMS_TxTelegram.type      = EMS_TYPE_UBAMonitorSlow;
+    EMS_TxTelegram.timestamp = millis() - EMS_TX_LANE_AGING * EMS_TX_LANE_REFRESH;
+    EMS_TxQueue.push(EMS_TxTelegram);
+
+    bool aged = (EMS_TxQueue.first().type == EMS_TYPE_UBAMonitorSlow);
+    printf("  refresh read that has waited goes first: %s\n", aged ? "ok" : "FAILED");
+
+    EMS_TxQueue.clear();
+    return ok && merged && aged;
+}
+
+int main(int argc, char * argv[]) {
+    uint32_t iterations = 1000000;
+    int      opt;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+        case 'n':
+            iterations = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n iterations]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    myESP.quiet = true;
+    ems_init();
+
+    bool ok = _bench_types(iterations);
+    ok &= _bench_decode(iterations);
+    ok &= _bench_shadow(iterations);
+    ok &= _bench_txqueue();
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,66 @@
+/*
+ * Arduino.h
+ *
+ * Minimal host stand-in for the ESP8266 Arduino core, just enough to compile ems.cpp and ems_utils.cpp
+ * natively for the EMS bus simulator. Time comes from the simulator's virtual clock, not the wall clock.
+ *
+ * Paul Derbyshire - https://github.com/proddy/EMS-ESP
+ */
+
+#pragma once
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+typedef uint8_t byte;
+typedef bool    boolean;
+
+// flash/iram placement attributes and progmem helpers are no-ops on the host
+#define ICACHE_FLASH_ATTR
+#define ICACHE_RAM_ATTR
+#define PROGMEM
+#define PGM_P const char *
+#define PSTR(s) (s)
+#define F(s) (s)
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t *)(addr))
+#define strcpy_P strcpy
+#define strncpy_P strncpy
+#define strlen_P strlen
+#define strcmp_P strcmp
+#define memcpy_P memcpy
+#define sprintf_P sprintf
+#define snprintf_P snprintf
+#define vsnprintf_P vsnprintf
+
+#define ArraySize(x) (sizeof(x) / sizeof(x[0]))
+
+using std::max;
+using std::min;
+
+// virtual clock, implemented in emssim.cpp
+uint32_t millis();
+uint32_t micros();
+void     delay(uint32_t ms);
+void     delayMicroseconds(uint32_t us);
+void     yield();
+
+// BSD/newlib string and number helpers that glibc does not provide
+size_t emssim_strlcpy(char * dst, const char * src, size_t size);
+size_t emssim_strlcat(char * dst, const char * src, size_t size);
+char * emssim_ltoa(long value, char * s, int radix);
+char * emssim_ultoa(unsigned long value, char * s, int radix);
+
+#define strlcpy emssim_strlcpy
+#define strlcat emssim_strlcat
+#define ltoa emssim_ltoa
+#define ultoa emssim_ultoa
+#define itoa(v, s, r) emssim_ltoa((long)(v), s, r)
+#define utoa(v, s, r) emssim_ultoa((unsigned long)(v), s, r)
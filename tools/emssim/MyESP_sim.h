@@ -0,0 +1,58 @@
+/*
+ * MyESP_sim.h
+ *
+ * Host stand-in for MyESP, force-included (-include MyESP_sim.h) by the native build.
+ * It defines MyESP_h so the real src/MyESP.h, with its WiFi/MQTT/web dependencies, compiles to nothing.
+ * Only what ems.cpp and ems_utils.cpp use is provided. Log output goes to stdout, prefixed with the virtual time.
+ *
+ * Paul Derbyshire - https://github.com/proddy/EMS-ESP
+ */
+
+#pragma once
+
+#ifndef MyESP_h
+#define MyESP_h
+
+#include <Arduino.h>
+
+// ANSI Colors
+#define COLOR_RESET "\x1B[0m"
+#define COLOR_BLACK "\x1B[0;30m"
+#define COLOR_RED "\x1B[0;31m"
+#define COLOR_GREEN "\x1B[0;32m"
+#define COLOR_YELLOW "\x1B[0;33m"
+#define COLOR_BLUE "\x1B[0;34m"
+#define COLOR_MAGENTA "\x1B[0;35m"
+#define COLOR_CYAN "\x1B[0;36m"
+#define COLOR_WHITE "\x1B[0;37m"
+#define COLOR_BOLD_ON "\x1B[1m"
+#define COLOR_BOLD_OFF "\x1B[22m"
+#define COLOR_BRIGHT_BLACK "\x1B[0;90m"
+#define COLOR_BRIGHT_RED "\x1B[0;91m"
+#define COLOR_BRIGHT_GREEN "\x1B[0;92m"
+#define COLOR_BRIGHT_YELLOW "\x1B[0;99m"
+#define COLOR_BRIGHT_BLUE "\x1B[0;94m"
+#define COLOR_BRIGHT_MAGENTA "\x1B[0;95m"
+#define COLOR_BRIGHT_CYAN "\x1B[0;96m"
+#define COLOR_BRIGHT_WHITE "\x1B[0;97m"
+
+enum MYESP_SYSLOG_LEVEL : uint8_t { MYESP_SYSLOG_INFO, MYESP_SYSLOG_ERROR };
+
+class MyESP {
+  public:
+    MyESP();
+
+    void myDebug(const char * format, ...);
+    void myDebug_P(PGM_P format_P, ...);
+    void writeLogEvent(const uint8_t type, const char * msg);
+
+    unsigned long getSystemTime();
+    bool          getUseSerial();
+    bool          isMQTTConnected();
+
+    bool quiet; // suppress all log output, set by the simulator's -q option
+};
+
+extern MyESP myESP;
+
+#endif
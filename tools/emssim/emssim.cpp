@@ -0,0 +1,570 @@
+/*
+ * emssim.cpp
+ *
+ * Virtual clock and bus engine for the EMS bus simulator.
+ * Frames are scheduled as discrete events on a microsecond clock: a frame occupies the wire for
+ * its bytes plus the closing <BRK>, and is delivered to every listener (ems.cpp and the simulated devices)
+ * when the <BRK> is seen. The master polls the next device after the bus has been idle for EMSSIM_MASTER_IDLE.
+ *
+ * Paul Derbyshire - https://github.com/proddy/EMS-ESP
+ */
+
+#include "emssim.h"
+#include "ems_devices.h"
+
+#include <time.h>
+#include <unistd.h>
+
+extern uint8_t _crcCalculator(uint8_t * data, uint8_t len);
+
+typedef enum {
+    EMSSIM_EVENT_FRAME,  // a frame's closing <BRK> reached the wire
+    EMSSIM_EVENT_REPLY,  // a device is ready to send its answer
+    EMSSIM_EVENT_MASTER, // the master checks if it can send the next poll
+} _EMSSIM_EVENT;
+
+typedef struct {
+    _EMSSIM_EVENT event;
+    uint32_t      generation; // for EMSSIM_EVENT_MASTER, ignored if the bus was used in the meantime
+    _EMSSIM_Frame frame;
+} _EMSSIM_Event;
+
+static uint64_t                               _now      = 0; // virtual clock, in microseconds
+static uint64_t                               _bus_free = 0; // time the wire is free again
+static uint32_t                               _generation;
+static uint8_t                                _bus_mask;
+static std::multimap<uint64_t, _EMSSIM_Event> _events; // equal times keep insertion order
+static EMSSimDevice *                         _devices[EMSSIM_MAX_DEVICES];
+static uint8_t                                _devices_count = 0;
+static EMSSimDevice *                         _master        = nullptr;
+static uint8_t                                _poll_list[EMSSIM_MAX_DEVICES + 1];
+static uint8_t                                _poll_count = 0;
+static uint8_t                                _poll_next  = 0;
+static _EMSSIM_Stats                          _stats;
+static uint8_t                                _lose_replies = 0; // # reads from us still to be left unanswered
+static bool                                   _realtime     = false; // use the wall clock, for the tty and tcp backends
+static struct timespec                        _realtime_start;
+
+/*
+ * Arduino core replacements
+ * on the virtual clock, or the wall clock when talking to a real bus
+ */
+static uint64_t _emssim_clock() {
+    if (_realtime) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)(ts.tv_sec - _realtime_start.tv_sec) * 1000000 + (ts.tv_nsec - _realtime_start.tv_nsec) / 1000;
+    }
+    return _now;
+}
+
+uint32_t millis() {
+    return (uint32_t)(_emssim_clock() / 1000);
+}
+
+uint32_t micros() {
+    return (uint32_t)_emssim_clock();
+}
+
+void delay(uint32_t ms) {
+    delayMicroseconds(ms * 1000);
+}
+
+void delayMicroseconds(uint32_t us) {
+    if (_realtime) {
+        usleep(us);
+    } else {
+        emssim_advance(us);
+    }
+}
+
+void yield() {
+}
+
+size_t emssim_strlcpy(char * dst, const char * src, size_t size) {
+    size_t len = strlen(src);
+    if (size) {
+        size_t n = (len >= size) ? size - 1 : len;
+        memcpy(dst, src, n);
+        dst[n] = '\0';
+    }
+    return len;
+}
+
+size_t emssim_strlcat(char * dst, const char * src, size_t size) {
+    size_t dlen = strnlen(dst, size);
+    if (dlen == size) {
+        return size + strlen(src);
+    }
+    return dlen + emssim_strlcpy(dst + dlen, src, size - dlen);
+}
+
+char * emssim_ultoa(unsigned long value, char * s, int radix) {
+    char   tmp[33];
+    char * p = tmp;
+    do {
+        uint8_t digit = value % radix;
+        *p++          = (digit < 10) ? ('0' + digit) : ('a' + digit - 10);
+        value /= radix;
+    } while (value);
+
+    char * out = s;
+    while (p != tmp) {
+        *out++ = *--p;
+    }
+    *out = '\0';
+    return s;
+}
+
+char * emssim_ltoa(long value, char * s, int radix) {
+    if ((value < 0) && (radix == 10)) {
+        *s = '-';
+        emssim_ultoa((unsigned long)(-value), s + 1, radix);
+        return s;
+    }
+    return emssim_ultoa((unsigned long)value, s, radix);
+}
+
+/*
+ * MyESP replacement, logs to stdout with the virtual time
+ */
+MyESP myESP;
+
+MyESP::MyESP() {
+    quiet = false;
+}
+
+static void _emssim_log(const char * format, va_list args) {
+    if (myESP.quiet) {
+        return;
+    }
+    uint32_t ms = millis();
+    printf("[%4u.%03u] ", ms / 1000, ms % 1000);
+    vprintf(format, args);
+    printf(COLOR_RESET "\n");
+}
+
+void MyESP::myDebug(const char * format, ...) {
+    va_list args;
+    va_start(args, format);
+    _emssim_log(format, args);
+    va_end(args);
+}
+
+void MyESP::myDebug_P(PGM_P format_P, ...) {
+    va_list args;
+    va_start(args, format_P);
+    _emssim_log(format_P, args);
+    va_end(args);
+}
+
+void MyESP::writeLogEvent(const uint8_t type, const char * msg) {
+    myDebug("[syslog] %s", msg);
+}
+
+// no NTP on the simulated bus, so always the elapsed time
+unsigned long MyESP::getSystemTime() {
+    return millis();
+}
+
+bool MyESP::getUseSerial() {
+    return false;
+}
+
+bool MyESP::isMQTTConnected() {
+    return false;
+}
+
+/*
+ * EMSSimDevice - register blocks and broadcast schedule
+ */
+EMSSimDevice::EMSSimDevice(uint8_t device_id, uint8_t product_id, uint8_t version_major, uint8_t version_minor) {
+    this->device_id  = device_id;
+    this->product_id = product_id;
+    version[0]       = version_major;
+    version[1]       = version_minor;
+
+    // every device can report its product id and version
+    uint8_t data[] = {product_id, version_major, version_minor};
+    setRegister(EMS_TYPE_Version, data, sizeof(data));
+}
+
+void EMSSimDevice::setRegister(uint16_t type, const uint8_t * data, uint8_t length) {
+    _registers[type].assign(data, data + length);
+}
+
+uint8_t * EMSSimDevice::getRegister(uint16_t type, uint8_t * length) {
+    auto it = _registers.find(type);
+    if (it == _registers.end()) {
+        return nullptr;
+    }
+    if (length) {
+        *length = it->second.size();
+    }
+    return it->second.data();
+}
+
+void EMSSimDevice::addBroadcast(uint16_t type, uint32_t period_ms, uint32_t first_ms) {
+    _broadcasts.push_back({type, period_ms, first_ms});
+}
+
+// sends a broadcast on the next poll, as a device does when one of its values changes. It then carries on from there
+void EMSSimDevice::broadcastNow(uint16_t type) {
+    for (auto & b : _broadcasts) {
+        if (b.type == type) {
+            b.next_ms = 0;
+        }
+    }
+}
+
+// returns the most overdue broadcast, if any
+bool EMSSimDevice::nextBroadcast(uint32_t now_ms, uint16_t * type) {
+    _Broadcast * due = nullptr;
+    for (auto & b : _broadcasts) {
+        if ((b.next_ms <= now_ms) && ((due == nullptr) || (b.next_ms < due->next_ms))) {
+            due = &b;
+        }
+    }
+    if (due == nullptr) {
+        return false;
+    }
+
+    *type = due->type;
+    due->next_ms += due->period_ms;
+    if (due->next_ms <= now_ms) {
+        due->next_ms = now_ms + due->period_ms; // don't burst to catch up
+    }
+    return true;
+}
+
+void EMSSimDevice::update(uint32_t now_ms) {
+}
+
+// default write, straight into the register block. Returns false if the type or range is unknown.
+bool EMSSimDevice::write(uint16_t type, uint8_t offset, const uint8_t * data, uint8_t length) {
+    auto it = _registers.find(type);
+    if ((it == _registers.end()) || (type == EMS_TYPE_Version) || ((offset + length) > it->second.size())) {
+        return false;
+    }
+    memcpy(it->second.data() + offset, data, length);
+    return true;
+}
+
+/*
+ * Bus engine
+ */
+static void _emssim_schedule(uint64_t at, _EMSSIM_EVENT event, const _EMSSIM_Frame * frame = nullptr) {
+    _EMSSIM_Event e;
+    e.event      = event;
+    e.generation = _generation;
+    if (frame) {
+        e.frame = *frame;
+    } else {
+        e.frame.length = 0;
+    }
+    _events.insert(std::make_pair(at, e));
+}
+
+// queue a device answer to go out after the reply delay
+static void _emssim_reply(uint8_t from, const uint8_t * data, uint8_t length) {
+    _EMSSIM_Frame frame;
+    frame.from   = from;
+    frame.length = length;
+    memcpy(frame.data, data, length);
+    _emssim_schedule(_now + EMSSIM_REPLY_DELAY, EMSSIM_EVENT_REPLY, &frame);
+}
+
+// build a telegram from a device, either EMS 1.0 or EMS+ depending on the type, and queue it
+static void _emssim_sendTelegram(EMSSimDevice * device, uint8_t dest, uint16_t type, uint8_t offset, uint8_t max_length) {
+    uint8_t   reg_length = 0;
+    uint8_t * reg        = device->getRegister(type, &reg_length);
+    uint8_t   buf[EMS_MAX_TELEGRAM_LENGTH];
+    uint8_t   header = (type > 0xFF) ? 6 : 4;
+    uint8_t   length = 0;
+
+    buf[length++] = device->device_id ^ _bus_mask;
+    buf[length++] = dest;
+    if (type > 0xFF) {
+        buf[length++] = 0xFF;
+        buf[length++] = offset;
+        buf[length++] = type >> 8;
+        buf[length++] = type & 0xFF;
+    } else {
+        buf[length++] = type;
+        buf[length++] = offset;
+    }
+
+    // an unknown type is answered with an empty telegram
+    if (reg) {
+        uint8_t n = (offset < reg_length) ? reg_length - offset : 0;
+        n         = min(n, max_length);
+        n         = min(n, (uint8_t)(EMS_MAX_TELEGRAM_LENGTH - header - 1));
+        memcpy(buf + length, reg + offset, n);
+        length += n;
+    } else {
+        _stats.unknownTypes++;
+    }
+
+    length++; // CRC
+    buf[length - 1] = _crcCalculator(buf, length);
+    _emssim_reply(device->device_id, buf, length);
+}
+
+// a device has heard a frame on the wire, see if it needs to respond
+static void _emssim_deviceHear(EMSSimDevice * device, const _EMSSIM_Frame * frame) {
+    const uint8_t * t  = frame->data;
+    uint32_t        ms = millis();
+
+    if (frame->from == device->device_id) {
+        return; // our own echo
+    }
+
+    // a poll from the master: send a due broadcast, or a poll acknowledge with our ID
+    if (frame->length == 1) {
+        if ((t[0] ^ _bus_mask) == (device->device_id | 0x80)) {
+            uint16_t type;
+            device->update(ms);
+            if (device->nextBroadcast(ms, &type)) {
+                _emssim_sendTelegram(device, EMS_ID_NONE, type, 0, EMS_MAX_TELEGRAM_LENGTH);
+            } else {
+                uint8_t ack = device->device_id ^ _bus_mask;
+                _emssim_reply(device->device_id, &ack, 1);
+            }
+        }
+        return;
+    }
+
+    // only well formed telegrams addressed to us
+    if ((frame->length < 5) || ((t[1] & 0x7F) != device->device_id) || (t[frame->length - 1] != _crcCalculator((uint8_t *)t, frame->length))) {
+        return;
+    }
+
+    uint8_t  src     = (t[0] ^ _bus_mask) & 0x7F;
+    uint8_t  offset  = t[3];
+    bool     emsplus = (t[2] == 0xFF);
+    uint16_t type;
+
+    device->update(ms);
+
+    if (t[1] & 0x80) {
+        // read, reply to the sender. EMS 1.0: src dest|80 type offset length crc, EMS+: src dest|80 FF offset length typeH typeL crc
+        uint8_t max_length;
+        if (emsplus) {
+            max_length = t[4];
+            type       = (t[5] << 8) | t[6];
+        } else {
+            max_length = t[4];
+            type       = t[2];
+        }
+        if ((src == EMS_ID_ME) && _lose_replies) {
+            _lose_replies--;
+            _stats.lostReplies++;
+            return; // as if the reply was lost on the bus
+        }
+        _stats.reads++;
+        _emssim_sendTelegram(device, src, type, offset, max_length);
+    } else {
+        // write, acknowledge with 01 (ok) or 04 (error). EMS+: src dest FF offset typeH typeL data crc
+        const uint8_t * data;
+        uint8_t         length;
+        if (emsplus) {
+            type   = (t[4] << 8) | t[5];
+            data   = t + 6;
+            length = frame->length - 7;
+        } else {
+            type   = t[2];
+            data   = t + 4;
+            length = frame->length - 5;
+        }
+        uint8_t ack = device->write(type, offset, data, length) ? EMS_TX_SUCCESS : EMS_TX_ERROR;
+        if (ack == EMS_TX_SUCCESS) {
+            _stats.writes++;
+        } else {
+            _stats.unknownTypes++;
+        }
+        _emssim_reply(device->device_id, &ack, 1);
+    }
+}
+
+// the master has the bus: send its own due broadcast, else poll the next device
+static void _emssim_master() {
+    uint32_t ms = millis();
+    uint16_t type;
+
+    _master->update(ms);
+    if (_master->nextBroadcast(ms, &type)) {
+        _emssim_sendTelegram(_master, EMS_ID_NONE, type, 0, EMS_MAX_TELEGRAM_LENGTH);
+        return;
+    }
+
+    if (_poll_count == 0) {
+        return;
+    }
+
+    uint8_t id   = _poll_list[_poll_next];
+    _poll_next   = (_poll_next + 1) % _poll_count;
+    uint8_t poll = (id | 0x80) ^ _bus_mask;
+    _stats.polls++;
+    if (id == EMS_ID_ME) {
+        _stats.pollsMe++;
+    }
+    emssim_transmit(_master->device_id, &poll, 1, EMSSIM_BYTE_TIME + EMSSIM_BRK_TIME);
+}
+
+// a frame's <BRK> is on the wire, hand it to everyone listening
+static void _emssim_deliver(const _EMSSIM_Frame * frame) {
+    // our frame is out, and ems.cpp sees everything on the bus including the echo of its own frames
+    if ((frame->from == EMS_ID_ME) && !frame->txDone) {
+        emsuart_tx_done(EMS_TX_STATUS_OK);
+    }
+    emsuart_sim_rx(frame->data, frame->length);
+
+    for (uint8_t i = 0; i < _devices_count; i++) {
+        _emssim_deviceHear(_devices[i], frame);
+    }
+
+    // if nothing else happens the master carries on
+    if (_master) {
+        _emssim_schedule(_now + EMSSIM_MASTER_IDLE, EMSSIM_EVENT_MASTER);
+    }
+}
+
+/*
+ * put a frame on the wire. It starts as soon as the wire is free and is delivered when its <BRK> has been sent.
+ * duration is the time from the first byte to the end of the <BRK>.
+ */
+void emssim_transmit(uint8_t from, const uint8_t * data, uint8_t length, uint32_t duration) {
+    _EMSSIM_Frame frame;
+    uint64_t      start = (_now > _bus_free) ? _now : _bus_free;
+
+    frame.from   = from;
+    frame.length = min(length, (uint8_t)EMS_MAXBUFFERSIZE);
+    frame.end    = start + duration;
+    frame.txDone = false;
+    memcpy(frame.data, data, frame.length);
+
+    _bus_free = frame.end;
+    _generation++; // the bus is in use, cancel any pending master check
+
+    _stats.frames++;
+    _stats.bytes += frame.length;
+    _stats.busBusy += duration;
+
+    _emssim_schedule(frame.end, EMSSIM_EVENT_FRAME, &frame);
+}
+
+void emssim_init(uint8_t bus_mask) {
+    _now           = 0;
+    _bus_free      = 0;
+    _generation    = 0;
+    _bus_mask      = bus_mask;
+    _devices_count = 0;
+    _master        = nullptr;
+    _poll_count    = 0;
+    _poll_next     = 0;
+    _events.clear();
+    memset(&_stats, 0, sizeof(_stats));
+
+    _poll_list[_poll_count++] = EMS_ID_ME; // the master always polls us
+}
+
+void emssim_addDevice(EMSSimDevice * device, bool master) {
+    if (_devices_count >= EMSSIM_MAX_DEVICES) {
+        return;
+    }
+    _devices[_devices_count++] = device;
+
+    if (master) {
+        _master = device;
+        _emssim_schedule(_now, EMSSIM_EVENT_MASTER); // start the bus
+    } else {
+        _poll_list[_poll_count++] = device->device_id;
+    }
+}
+
+EMSSimDevice * emssim_getDevice(uint8_t device_id) {
+    for (uint8_t i = 0; i < _devices_count; i++) {
+        if (_devices[i]->device_id == device_id) {
+            return _devices[i];
+        }
+    }
+    return nullptr;
+}
+
+// run the bus for the given number of virtual milliseconds
+void emssim_run(uint32_t ms) {
+    uint64_t until = _now + (uint64_t)ms * 1000;
+
+    while (!_events.empty() && (_events.begin()->first <= until)) {
+        auto          it = _events.begin();
+        _EMSSIM_Event e  = it->second;
+        if (it->first > _now) {
+            _now = it->first; // time never goes backwards, a blocking Tx may have run past queued events
+        }
+        _events.erase(it);
+
+        switch (e.event) {
+        case EMSSIM_EVENT_FRAME:
+            _emssim_deliver(&e.frame);
+            break;
+        case EMSSIM_EVENT_REPLY:
+            emssim_transmit(e.frame.from, e.frame.data, e.frame.length, (e.frame.length * EMSSIM_BYTE_TIME) + EMSSIM_BRK_TIME);
+            break;
+        case EMSSIM_EVENT_MASTER:
+            if ((e.generation == _generation) && (_now >= _bus_free)) {
+                _emssim_master();
+            }
+            break;
+        }
+    }
+
+    if (_now < until) {
+        _now = until;
+    }
+}
+
+uint64_t emssim_now() {
+    return _emssim_clock();
+}
+
+// time passes while ems.cpp is busy, e.g. in the blocking Tx loops
+// switch between the virtual clock and the wall clock
+void emssim_setRealtime(bool realtime) {
+    _realtime = realtime;
+    clock_gettime(CLOCK_MONOTONIC, &_realtime_start);
+}
+
+void emssim_advance(uint32_t us) {
+    _now += us;
+}
+
+// the next reads from us aren't answered, to test the Tx timeouts
+void emssim_loseReplies(uint8_t count) {
+    _lose_replies = count;
+}
+
+/*
+ * our frame on the wire is out now, as if ems.cpp had been busy until then. emsuart_tx_done() is called straight away,
+ * everyone still hears the frame when it's due
+ */
+void emssim_finishTx() {
+    for (auto & it : _events) {
+        _EMSSIM_Event & e = it.second;
+        if ((e.event == EMSSIM_EVENT_FRAME) && (e.frame.from == EMS_ID_ME) && !e.frame.txDone) {
+            if (it.first > _now) {
+                _now = it.first;
+            }
+            e.frame.txDone = true;
+            emsuart_tx_done(EMS_TX_STATUS_OK);
+            return;
+        }
+    }
+}
+
+uint8_t emssim_getBusMask() {
+    return _bus_mask;
+}
+
+_EMSSIM_Stats * emssim_getStats() {
+    return &_stats;
+}
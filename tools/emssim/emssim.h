@@ -0,0 +1,112 @@
+/*
+ * emssim.h
+ *
+ * Host-native EMS bus simulator. A virtual 9600 baud bus with a polling UBA master and simulated
+ * boiler, thermostat, solar and mixing modules, driving the real ems.cpp through the emsuart_* API.
+ *
+ * Paul Derbyshire - https://github.com/proddy/EMS-ESP
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+#include <map>
+#include <vector>
+
+#include "ems.h"
+#include "emsuart.h"
+
+#define EMSSIM_BYTE_TIME EMSUART_TX_WAIT_BYTE // one 8N1 character on the wire at 9600 baud, in microseconds
+#define EMSSIM_BRK_TIME EMSUART_TX_WAIT_BRK   // the <BRK> closing every frame, in microseconds
+#define EMSSIM_REPLY_DELAY 1500               // time a device takes to answer a poll, read or write, in microseconds
+#define EMSSIM_MASTER_IDLE 4000               // bus silence before the master carries on polling, in microseconds
+#define EMSSIM_ECHO_DELAY 200                 // time the master takes to echo a byte in EMS+ and HT3, in microseconds
+#define EMSSIM_TURNAROUND 150                 // and after the echo before it can take the next byte, which doesn't show in the echo
+#define EMSSIM_TX_SPACING (EMSSIM_BYTE_TIME + EMSSIM_ECHO_DELAY + EMSSIM_TURNAROUND) // least time from one byte to the next
+#define EMSSIM_MAX_DEVICES 8
+
+// one frame as seen on the wire, without the closing <BRK>
+typedef struct {
+    uint8_t  from; // device ID of the sender, EMS_ID_ME for us
+    uint8_t  length;
+    uint8_t  data[EMS_MAXBUFFERSIZE];
+    uint64_t end;    // virtual time the closing <BRK> is on the wire
+    bool     txDone; // for our frames, emsuart_tx_done() has already been called. See emssim_finishTx()
+} _EMSSIM_Frame;
+
+// bus counters, shown at the end of a run
+typedef struct {
+    uint32_t frames;       // all frames put on the wire
+    uint32_t bytes;        // all bytes put on the wire
+    uint32_t polls;        // polls sent by the master
+    uint32_t pollsMe;      // polls addressed to us
+    uint32_t reads;        // reads answered by simulated devices
+    uint32_t writes;       // writes acknowledged by simulated devices
+    uint32_t unknownTypes; // reads/writes to a type a device doesn't implement
+    uint32_t txFrames;     // frames sent by us
+    uint32_t lostReplies;  // reads from us left unanswered, see emssim_loseReplies()
+    uint32_t stagePolls;   // polls for us fed in while a telegram was staged, see emsuart_sim_pollOnStage()
+    uint64_t busBusy;      // total time the wire was in use, in microseconds
+} _EMSSIM_Stats;
+
+/*
+ * A simulated EMS device. Holds one register block per telegram type, answers reads and writes
+ * against those blocks and sends its broadcasts when polled by the master.
+ */
+class EMSSimDevice {
+  public:
+    EMSSimDevice(uint8_t device_id, uint8_t product_id, uint8_t version_major, uint8_t version_minor);
+    virtual ~EMSSimDevice() {
+    }
+
+    void      setRegister(uint16_t type, const uint8_t * data, uint8_t length);
+    uint8_t * getRegister(uint16_t type, uint8_t * length = nullptr);
+    void      addBroadcast(uint16_t type, uint32_t period_ms, uint32_t first_ms = 0);
+    void      broadcastNow(uint16_t type);
+    bool      nextBroadcast(uint32_t now_ms, uint16_t * type);
+
+    virtual void update(uint32_t now_ms); // advance live values, called before anything is sent
+    virtual bool write(uint16_t type, uint8_t offset, const uint8_t * data, uint8_t length);
+
+    uint8_t device_id;
+    uint8_t product_id;
+    uint8_t version[2];
+
+  private:
+    typedef struct {
+        uint16_t type;
+        uint32_t period_ms;
+        uint32_t next_ms;
+    } _Broadcast;
+
+    std::map<uint16_t, std::vector<uint8_t>> _registers;
+    std::vector<_Broadcast>                  _broadcasts;
+};
+
+// the simulated devices, see emssim_devices.cpp
+EMSSimDevice * emssim_newBoiler();
+EMSSimDevice * emssim_newThermostat();
+EMSSimDevice * emssim_newSolarModule();
+EMSSimDevice * emssim_newMixingModule();
+
+// simulator control
+void     emssim_init(uint8_t bus_mask);
+void     emssim_addDevice(EMSSimDevice * device, bool master = false);
+void     emssim_run(uint32_t ms);
+uint64_t emssim_now();
+void     emssim_advance(uint32_t us);
+void     emssim_setRealtime(bool realtime);
+uint8_t  emssim_getBusMask();
+void     emssim_transmit(uint8_t from, const uint8_t * data, uint8_t length, uint32_t duration);
+void     emssim_loseReplies(uint8_t count);
+void     emssim_finishTx();
+
+EMSSimDevice *  emssim_getDevice(uint8_t device_id);
+_EMSSIM_Stats * emssim_getStats();
+
+// the simulated bus as a UART backend, see emsuart_sim.cpp
+extern const _EMSUART_Backend EMSUART_Backend_Sim;
+void                          emsuart_sim_rx(const uint8_t * data, uint8_t length);
+uint32_t                      emsuart_sim_txDuration(uint8_t length);
+void                          emsuart_sim_pollOnStage(uint8_t count);
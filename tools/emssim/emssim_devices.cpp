@@ -0,0 +1,307 @@
+/*
+ * emssim_devices.cpp
+ *
+ * The simulated EMS devices: a UBA boiler (also the bus master), an RC35 thermostat,
+ * an SM100 solar module and an MM100 mixing module. Register layouts follow the _process_* decoders in ems.cpp.
+ * Live values move slowly with the virtual clock so repeated broadcasts carry different data.
+ *
+ * Paul Derbyshire - https://github.com/proddy/EMS-ESP
+ */
+
+#include "emssim.h"
+#include "ems_devices.h"
+
+static void _put16(uint8_t * reg, uint8_t index, uint16_t value) {
+    reg[index]     = value >> 8;
+    reg[index + 1] = value & 0xFF;
+}
+
+static void _put24(uint8_t * reg, uint8_t index, uint32_t value) {
+    reg[index]     = (value >> 16) & 0xFF;
+    reg[index + 1] = (value >> 8) & 0xFF;
+    reg[index + 2] = value & 0xFF;
+}
+
+// a slow triangle wave between 0 and amplitude, so values change over time but stay deterministic
+static uint16_t _wave(uint32_t now_ms, uint32_t period_ms, uint16_t amplitude) {
+    uint32_t phase = now_ms % period_ms;
+    uint32_t half  = period_ms / 2;
+    return (phase < half) ? (phase * amplitude / half) : ((period_ms - phase) * amplitude / half);
+}
+
+/*
+ * UBA boiler on 0x08, a Buderus GBx72 (product 123)
+ */
+class EMSSimBoiler : public EMSSimDevice {
+  public:
+    EMSSimBoiler()
+        : EMSSimDevice(EMS_ID_BOILER, 123, 6, 3) {
+        uint8_t fast[25]     = {0};
+        uint8_t slow[27]     = {0};
+        uint8_t ww_mon[19]   = {0};
+        uint8_t ww_par[11]   = {0};
+        uint8_t uptime[3]    = {0};
+        uint8_t params[11]   = {0};
+        uint8_t setpoints[4] = {0};
+        uint8_t flags[4]     = {0};
+        uint8_t devices[13]  = {0};
+        uint8_t errors[36]   = {0};
+
+        // UBAMonitorFast
+        fast[0]  = 45;  // selected flow temp
+        fast[3]  = 100; // selected burner power
+        fast[17] = 15;  // system pressure 1.5 bar
+        fast[18] = '-'; // service code on the display
+        fast[19] = 'H';
+        _put16(fast, 11, 0x8000); // boiler temp not available here
+        _put16(fast, 20, 200);    // service code
+
+        // UBAMonitorSlow
+        _put16(slow, 0, 52);  // outside temp 5.2 C
+        _put16(slow, 2, 480); // boiler temp
+        _put16(slow, 25, 0x8000);
+
+        // UBAParameterWW
+        ww_par[1] = 0xFF; // warm water activated
+        ww_par[2] = 55;   // selected temp
+        ww_par[6] = 0xFF; // circulation pump available
+        ww_par[8] = 60;   // desired temp
+        ww_par[9] = EMS_VALUE_UBAParameterWW_wwComfort_Hot;
+
+        // UBAParametersMessage
+        params[1]  = 75;  // heating temp
+        params[9]  = 100; // pump modulation max
+        params[10] = 30;  // pump modulation min
+
+        setpoints[0] = 45;
+
+        // UBAErrorMessages, 3 entries so the block is shorter than asked for
+        for (uint8_t i = 0; i < sizeof(errors); i += 12) {
+            errors[i]     = 'A';
+            errors[i + 1] = '0' + (i / 12);
+            _put16(errors, i + 2, 200 + i); // error code
+            errors[i + 4] = 0x80 | 19;      // year, valid
+            errors[i + 5] = 12;
+            errors[i + 7] = i; // hour
+        }
+
+        setRegister(EMS_TYPE_UBAMonitorFast, fast, sizeof(fast));
+        setRegister(EMS_TYPE_UBAMonitorSlow, slow, sizeof(slow));
+        setRegister(EMS_TYPE_UBAMonitorWWMessage, ww_mon, sizeof(ww_mon));
+        setRegister(EMS_TYPE_UBAParameterWW, ww_par, sizeof(ww_par));
+        setRegister(EMS_TYPE_UBATotalUptimeMessage, uptime, sizeof(uptime));
+        setRegister(EMS_TYPE_UBAParametersMessage, params, sizeof(params));
+        setRegister(EMS_TYPE_UBASetPoints, setpoints, sizeof(setpoints));
+        setRegister(EMS_TYPE_UBAFlags, flags, sizeof(flags));
+        setRegister(EMS_TYPE_UBADevices, devices, sizeof(devices));
+        setRegister(EMS_TYPE_UBAErrorMessages, errors, sizeof(errors));
+
+        addBroadcast(EMS_TYPE_UBAMonitorFast, 10000);
+        addBroadcast(EMS_TYPE_UBAMonitorWWMessage, 10000, 5000);
+        addBroadcast(EMS_TYPE_UBAMonitorSlow, 60000, 2000);
+    }
+
+    void setDevicePresent(uint8_t device_id) {
+        uint8_t * devices = getRegister(EMS_TYPE_UBADevices);
+        if (device_id >= 8) {
+            devices[(device_id / 8) - 1] |= (1 << (device_id % 8));
+        }
+    }
+
+    void update(uint32_t now_ms) {
+        uint8_t * fast   = getRegister(EMS_TYPE_UBAMonitorFast);
+        uint8_t * slow   = getRegister(EMS_TYPE_UBAMonitorSlow);
+        uint8_t * ww_mon = getRegister(EMS_TYPE_UBAMonitorWWMessage);
+        uint8_t * uptime = getRegister(EMS_TYPE_UBATotalUptimeMessage);
+        uint8_t   sel    = getRegister(EMS_TYPE_UBASetPoints)[0];
+        bool      burner = (now_ms % 600000) < 420000; // 7 minutes on, 3 off
+
+        fast[0] = sel;
+        _put16(fast, 1, (sel * 10) - 40 + _wave(now_ms, 300000, 80)); // flow temp swings around the setpoint
+        fast[4] = burner ? 30 + _wave(now_ms, 120000, 40) : 0;
+        fast[7] = burner ? 0x21 : 0x00; // gas and heating pump
+        _put16(fast, 13, (sel * 10) - 150);
+        _put16(fast, 15, burner ? 52 : 0);
+
+        slow[9] = burner ? 60 : 0;
+        _put24(slow, 10, 12000 + (now_ms / 600000)); // burner starts
+        _put24(slow, 13, 400000 + (now_ms / 60000)); // burner minutes
+        _put24(slow, 19, 380000 + (now_ms / 60000)); // heating minutes
+
+        _put16(ww_mon, 1, 520 + _wave(now_ms, 240000, 30));
+        _put24(ww_mon, 10, 90000 + (now_ms / 60000));
+        _put24(ww_mon, 13, 5000);
+
+        _put24(uptime, 0, 100000 + (now_ms / 60000));
+    }
+};
+
+/*
+ * RC35 thermostat on 0x10 (product 86), with only heating circuit 1 in use
+ */
+class EMSSimThermostat : public EMSSimDevice {
+  public:
+    EMSSimThermostat()
+        : EMSSimDevice(EMS_ID_THERMOSTAT1, 86, 1, 5) {
+        uint8_t time[8]    = {19, 12, 8, 24, 0, 0, 2, 0}; // 08:00:00 24/12/2019
+        uint8_t status[20] = {0};
+        uint8_t set[22]    = {0};
+        uint8_t timer[EMS_LENGTH_RC35Timer];
+
+        // RC35Set_HC1
+        set[EMS_OFFSET_RC35Set_heatingtype]  = 1;  // radiators
+        set[EMS_OFFSET_RC35Set_temp_night]   = 32; // 16 C, * 2
+        set[EMS_OFFSET_RC35Set_temp_day]     = 42; // 21 C
+        set[EMS_OFFSET_RC35Set_temp_holiday] = 30;
+        set[EMS_OFFSET_RC35Set_mode]         = 2; // auto
+
+        // RC35StatusMessage_HC1
+        status[EMS_OFFSET_RC35StatusMessage_mode]     = 0x02; // day mode
+        status[EMS_OFFSET_RC35StatusMessage_setpoint] = 42;
+        status[EMS_OFFSET_RC35Set_circuitcalctemp]    = 45; // non-zero means the HC is in use
+
+        // RC35Timer_HC1, on at 06:00 and off at 22:00 every day, in 10 minute steps
+        memset(timer, 0, sizeof(timer));
+        for (uint8_t i = 0; i < 84; i += 2) {
+            timer[i]     = 0xE7; // unused switch point
+            timer[i + 1] = 0x90;
+        }
+        for (uint8_t day = 0; day < 7; day++) {
+            timer[day * 4]     = (day << 5) | 0x01;
+            timer[day * 4 + 1] = 6 * 6;
+            timer[day * 4 + 2] = (day << 5);
+            timer[day * 4 + 3] = 22 * 6;
+        }
+
+        setRegister(EMS_TYPE_RCTime, time, sizeof(time));
+        setRegister(EMS_TYPE_RC35Timer_HC1, timer, sizeof(timer));
+        setRegister(EMS_TYPE_RC35StatusMessage_HC1, status, sizeof(status));
+        setRegister(EMS_TYPE_RC35Set_HC1, set, sizeof(set));
+
+        addBroadcast(EMS_TYPE_RCTime, 60000);
+        addBroadcast(EMS_TYPE_RC35StatusMessage_HC1, 60000, 1000);
+        addBroadcast(EMS_TYPE_RC35Set_HC1, 300000, 60000);
+    }
+
+    void update(uint32_t now_ms) {
+        uint8_t * time   = getRegister(EMS_TYPE_RCTime);
+        uint8_t * status = getRegister(EMS_TYPE_RC35StatusMessage_HC1);
+        uint32_t  secs   = (8 * 3600) + (now_ms / 1000);
+
+        time[2] = (secs / 3600) % 24;
+        time[4] = (secs / 60) % 60;
+        time[5] = secs % 60;
+
+        // room temp creeps towards the setpoint
+        _put16(status, EMS_OFFSET_RC35StatusMessage_curr, (status[EMS_OFFSET_RC35StatusMessage_setpoint] * 5) - 15 + _wave(now_ms, 900000, 20));
+    }
+
+    // a new day/night temp is reflected in the status message and both are broadcast, like the real thermostat does
+    bool write(uint16_t type, uint8_t offset, const uint8_t * data, uint8_t length) {
+        if (!EMSSimDevice::write(type, offset, data, length)) {
+            return false;
+        }
+        if (type == EMS_TYPE_RC35Set_HC1) {
+            uint8_t * set    = getRegister(EMS_TYPE_RC35Set_HC1);
+            uint8_t * status = getRegister(EMS_TYPE_RC35StatusMessage_HC1);
+            bool      day    = status[EMS_OFFSET_RC35StatusMessage_mode] & 0x02;
+
+            status[EMS_OFFSET_RC35StatusMessage_setpoint] = day ? set[EMS_OFFSET_RC35Set_temp_day] : set[EMS_OFFSET_RC35Set_temp_night];
+            broadcastNow(EMS_TYPE_RC35Set_HC1);
+            broadcastNow(EMS_TYPE_RC35StatusMessage_HC1);
+        }
+        return true;
+    }
+};
+
+/*
+ * SM100 solar module on 0x30 (product 163), EMS+ telegrams
+ */
+class EMSSimSolarModule : public EMSSimDevice {
+  public:
+    EMSSimSolarModule()
+        : EMSSimDevice(EMS_ID_SM, 163, 2, 1) {
+        uint8_t monitor[20] = {0};
+        uint8_t status[12]  = {0};
+        uint8_t status2[12] = {0};
+        uint8_t energy[14]  = {0};
+
+        status2[10] = 0x03; // pump off
+
+        setRegister(EMS_TYPE_SM100Monitor, monitor, sizeof(monitor));
+        setRegister(EMS_TYPE_SM100Status, status, sizeof(status));
+        setRegister(EMS_TYPE_SM100Status2, status2, sizeof(status2));
+        setRegister(EMS_TYPE_SM100Energy, energy, sizeof(energy));
+
+        addBroadcast(EMS_TYPE_SM100Monitor, 30000);
+        addBroadcast(EMS_TYPE_SM100Status, 60000, 10000);
+        addBroadcast(EMS_TYPE_SM100Status2, 60000, 20000);
+    }
+
+    void update(uint32_t now_ms) {
+        uint8_t * monitor   = getRegister(EMS_TYPE_SM100Monitor);
+        uint8_t * status    = getRegister(EMS_TYPE_SM100Status);
+        uint8_t * status2   = getRegister(EMS_TYPE_SM100Status2);
+        uint8_t * energy    = getRegister(EMS_TYPE_SM100Energy);
+        uint16_t  collector = 300 + _wave(now_ms, 1200000, 500);
+
+        _put16(monitor, 0, collector);
+        _put16(monitor, 2, 420);
+        status[9]   = (collector > 500) ? 70 : 0;
+        status2[10] = (collector > 500) ? 0x04 : 0x03;
+        _put16(energy, 2, collector / 10);
+        _put16(energy, 6, 1500 + (now_ms / 60000));
+        _put16(energy, 10, 2710);
+    }
+};
+
+/*
+ * MM100 mixing module on 0x21 (product 160), EMS+ telegrams for HC1
+ */
+class EMSSimMixingModule : public EMSSimDevice {
+  public:
+    EMSSimMixingModule()
+        : EMSSimDevice(EMS_ID_MIXING2, 160, 1, 4) {
+        uint8_t status[8] = {0};
+
+        setRegister(EMS_TYPE_MMPLUSStatusMessage_HC1, status, sizeof(status));
+        addBroadcast(EMS_TYPE_MMPLUSStatusMessage_HC1, 30000);
+    }
+
+    void update(uint32_t now_ms) {
+        uint8_t * status = getRegister(EMS_TYPE_MMPLUSStatusMessage_HC1);
+
+        status[EMS_OFFSET_MMPLUSStatusMessage_valve_status] = _wave(now_ms, 600000, 100);
+        _put16(status, EMS_OFFSET_MMPLUSStatusMessage_flow_temp, 350 + _wave(now_ms, 600000, 50));
+        status[EMS_OFFSET_MMPLUSStatusMessage_pump_mod] = 80;
+    }
+};
+
+static EMSSimBoiler * _boiler = nullptr;
+
+EMSSimDevice * emssim_newBoiler() {
+    _boiler = new EMSSimBoiler();
+    _boiler->setDevicePresent(EMS_ID_BOILER);
+    _boiler->setDevicePresent(EMS_ID_ME);
+    return _boiler;
+}
+
+// the boiler reports all devices on the bus in its UBADevices telegram
+static EMSSimDevice * _emssim_present(EMSSimDevice * device) {
+    if (_boiler) {
+        _boiler->setDevicePresent(device->device_id);
+    }
+    return device;
+}
+
+EMSSimDevice * emssim_newThermostat() {
+    return _emssim_present(new EMSSimThermostat());
+}
+
+EMSSimDevice * emssim_newSolarModule() {
+    return _emssim_present(new EMSSimSolarModule());
+}
+
+EMSSimDevice * emssim_newMixingModule() {
+    return _emssim_present(new EMSSimMixingModule());
+}
@@ -0,0 +1,135 @@
+/*
+ * emsuart_sim.cpp
+ *
+ * The simulated bus as a UART backend for emsuart.cpp, selected with emsuart_setBackend(&EMSUART_Backend_Sim).
+ * Tx is asynchronous like the interrupt-driven Tx on the ESP8266: the frame takes as long on the wire as it does in each
+ * tx_mode, and emsuart_tx_done() is called when it's delivered. Rx goes through emsuart_posix_rx() so it can be captured and replayed.
+ *
+ * Paul Derbyshire - https://github.com/proddy/EMS-ESP
+ */
+
+#include "emssim.h"
+#include "ems_devices.h"
+
+static bool    _emsuart_sim_enabled     = false;
+static uint8_t _emsuart_sim_pollOnStage = 0;     // # acks still to have a poll come in on, see emsuart_sim_pollOnStage()
+static bool    _emsuart_sim_inAck       = false; // one of those acks is being processed
+
+static bool emsuart_sim_init() {
+    _emsuart_sim_enabled = true;
+    return true;
+}
+
+static void emsuart_sim_stop() {
+    _emsuart_sim_enabled = false;
+}
+
+static void emsuart_sim_start() {
+    _emsuart_sim_enabled = true;
+}
+
+/*
+ * how long a telegram of length bytes takes to go out in each tx_mode, including the gaps between the bytes
+ */
+uint32_t emsuart_sim_txDuration(uint8_t length) {
+    if (EMS_Sys_Status.emsTxMode == EMS_TXMODE_EMSPLUS) {
+        return (length + 1) * emsuart_getTxTiming()->brkWait; // per-byte wait, plus the <BRK>
+    } else if (EMS_Sys_Status.emsTxMode == EMS_TXMODE_HT3) {
+        return (length * (EMSUART_TX_WAIT_BYTE - EMSUART_TX_LAG + emsuart_getTxTiming()->gap)) + (EMSUART_TX_WAIT_BRK - EMSUART_TX_LAG);
+    }
+    return (length * EMSUART_TX_WAIT_BYTE) + EMSUART_TX_WAIT_BRK; // wait for each echo, then the loopback <BRK>
+}
+
+/*
+ * EMS+ and HT3 send the bytes on a timer. If the next byte is sent before the master is ready for it
+ * they collide, and the telegram is garbled
+ */
+static bool _emsuart_sim_txCollides(uint8_t length) {
+    uint32_t spacing;
+    if (EMS_Sys_Status.emsTxMode == EMS_TXMODE_EMSPLUS) {
+        spacing = emsuart_getTxTiming()->brkWait;
+    } else if (EMS_Sys_Status.emsTxMode == EMS_TXMODE_HT3) {
+        spacing = EMSUART_TX_WAIT_BYTE - EMSUART_TX_LAG + emsuart_getTxTiming()->gap;
+    } else {
+        return false;
+    }
+    return (length > 1) && (spacing < EMSSIM_TX_SPACING);
+}
+
+/*
+ * Send to Tx, ending with a <BRK>
+ */
+static _EMS_TX_STATUS emsuart_sim_tx(uint8_t * buf, uint8_t len) {
+    if (!len || !_emsuart_sim_enabled) {
+        emsuart_tx_done(EMS_TX_STATUS_OK);
+        return EMS_TX_STATUS_OK;
+    }
+
+    if (EMS_Sys_Status.emsTxMode != EMS_TXMODE_DEFAULT) {
+        emsuart_tx_echo(EMSSIM_BYTE_TIME + EMSSIM_ECHO_DELAY);
+    }
+
+    if (_emsuart_sim_txCollides(len)) {
+        uint8_t garbled[EMS_MAXBUFFERSIZE];
+        uint8_t n = min(len, (uint8_t)EMS_MAXBUFFERSIZE);
+        memcpy(garbled, buf, n);
+        garbled[n - 1] ^= 0xFF; // the CRC won't match
+        emssim_transmit(EMS_ID_ME, garbled, n, emsuart_sim_txDuration(len));
+    } else {
+        emssim_transmit(EMS_ID_ME, buf, len, emsuart_sim_txDuration(len)); // emsuart_tx_done() is called when it's delivered
+    }
+    emssim_getStats()->txFrames++;
+
+    return EMS_TX_STATUS_OK;
+}
+
+/*
+ * The next count acks to our writes have a poll for us come in as soon as a telegram is staged while the ack is processed,
+ * like the Rx interrupt firing while ems.cpp is changing the Tx queue. By then the poll acknowledgement ems.cpp sent for
+ * the ack has gone out. The poll itself isn't put on the wire
+ */
+void emsuart_sim_pollOnStage(uint8_t count) {
+    _emsuart_sim_pollOnStage = count;
+}
+
+/*
+ * a telegram has been staged. Feed in the poll the way the Rx interrupt does, it's taken out of the Rx ring
+ * once the ack is done
+ */
+static void emsuart_sim_staged(uint8_t tag) {
+    if (!_emsuart_sim_inAck || (tag == EMSUART_STAGE_POLLACK)) {
+        return;
+    }
+    _emsuart_sim_inAck = false;
+    emssim_finishTx();
+
+    uint8_t     poll = (EMS_ID_ME | 0x80) ^ emssim_getBusMask();
+    _EMSRxBuf * slot = emsuart_rx_begin();
+    if (slot) {
+        slot->buffer[0] = poll;
+    }
+    emsuart_rx_end(slot, 2, (uint8_t)(emsuart_rx_crc(0, poll) >> 8));
+    emssim_getStats()->stagePolls++;
+}
+
+/*
+ * a frame has been seen on the bus, excluding the <BRK>
+ */
+void emsuart_sim_rx(const uint8_t * data, uint8_t length) {
+    static uint8_t buffer[EMS_MAXBUFFERSIZE];
+
+    if (!_emsuart_sim_enabled) {
+        return;
+    }
+
+    _emsuart_sim_inAck = _emsuart_sim_pollOnStage && (length == 1) && (data[0] == EMS_TX_SUCCESS);
+    if (_emsuart_sim_inAck) {
+        _emsuart_sim_pollOnStage--;
+    }
+
+    memcpy(buffer, data, length);
+    emsuart_posix_rx(buffer, length);
+    _emsuart_sim_inAck = false;
+}
+
+const _EMSUART_Backend EMSUART_Backend_Sim = {"sim", emsuart_sim_init, emsuart_sim_stop, emsuart_sim_start, emsuart_sim_tx, nullptr, emsuart_sim_staged};
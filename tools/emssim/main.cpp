@@ -0,0 +1,442 @@
+/*
+ * main.cpp
+ *
+ * EMS bus simulator - runs the real ems.cpp against a simulated bus on a virtual clock.
+ * Discovers the simulated devices, keeps them up to date with ems_refreshTick() like the timer in ems-esp.cpp,
+ * performs a few writes and then checks what ems.cpp decoded against the simulated devices.
+ * With -b ems.cpp runs against a real bus on a serial port or TCP socket instead, or replays a capture.
+ *
+ *   emssim [-t seconds] [-m tx_mode] [-l none|basic|verbose|raw|jabber] [-j] [-q]
+ *          [-b sim|tty:<path>|tcp:<host:port>|replay:<file>] [-c capture file]
+ *
+ * Paul Derbyshire - https://github.com/proddy/EMS-ESP
+ */
+
+#include "emssim.h"
+#include "ems_devices.h"
+#include "ems_utils.h"
+
+#include <unistd.h>
+
+#define EMSSIM_WRITES_TIME 120    // seconds after start when the test writes are sent
+#define EMSSIM_CALIBRATE_TIME 240 // seconds after start when the Tx timing calibration is started, in tx_mode 2 and 3
+#define EMSSIM_REFRESH_TIME 300   // seconds after start when the values are fetched, like the telnet refresh command
+#define EMSSIM_LOST_REPLY_TIME 360 // seconds after start when the reply to our next read is lost
+#define EMSSIM_SCAN_TIME 420       // seconds after start when the device list is cleared and the bus scanned, without a device bitmap
+#define EMSSIM_LOOP_TIME 10        // ms of bus time between two runs of the Tx state machine, like the main loop
+
+static uint8_t _checks_failed = 0;
+
+static void _check(const char * what, bool ok) {
+    printf("  %-46s %s\n", what, ok ? "ok" : "FAILED");
+    if (!ok) {
+        _checks_failed++;
+    }
+}
+
+static _EMS_SYS_LOGGING _parseLogging(const char * s) {
+    if (strcmp(s, "basic") == 0) {
+        return EMS_SYS_LOGGING_BASIC;
+    } else if (strcmp(s, "verbose") == 0) {
+        return EMS_SYS_LOGGING_VERBOSE;
+    } else if (strcmp(s, "raw") == 0) {
+        return EMS_SYS_LOGGING_RAW;
+    } else if (strcmp(s, "jabber") == 0) {
+        return EMS_SYS_LOGGING_JABBER;
+    }
+    return EMS_SYS_LOGGING_NONE;
+}
+
+/*
+ * pick the UART backend from the -b argument
+ */
+static const _EMSUART_Backend * _parseBackend(const char * s) {
+    if (strcmp(s, "sim") == 0) {
+        return &EMSUART_Backend_Sim;
+    } else if (strncmp(s, "tty:", 4) == 0) {
+        emsuart_posix_setDevice(s + 4);
+        return &EMSUART_Backend_TTY;
+    } else if (strncmp(s, "tcp:", 4) == 0) {
+        emsuart_posix_setDevice(s + 4);
+        return &EMSUART_Backend_TCP;
+    } else if (strncmp(s, "replay:", 7) == 0) {
+        emsuart_posix_setDevice(s + 7);
+        return &EMSUART_Backend_Replay;
+    }
+    return nullptr;
+}
+
+/*
+ * run against the simulated bus
+ */
+static void _runSim(uint32_t seconds) {
+    for (uint32_t t = 1; t <= seconds; t++) {
+        for (uint8_t i = 0; i < (1000 / EMSSIM_LOOP_TIME); i++) {
+            emssim_run(EMSSIM_LOOP_TIME);
+            ems_txTick();
+        }
+
+        if ((t % EMS_REFRESH_TICK_TIME) == 0) {
+            ems_refreshTick();
+        }
+
+        if (t == EMSSIM_WRITES_TIME) {
+            emsuart_sim_pollOnStage(1); // the Rx interrupt takes whatever is staged while the warm water write's ack is processed
+            // like a slider dragged across the setpoints, only the last value should go out on the bus
+            for (uint8_t temp = 54; temp <= 58; temp++) {
+                ems_setWarmWaterTemp(temp);
+            }
+            ems_setThermostatTemp(22.5, 1, 2); // day temp on HC1
+            ems_setThermostatTemp(17, 1, 1);   // and the night temp next to it, which should go in the same telegram
+        }
+
+        if (t == EMSSIM_CALIBRATE_TIME) {
+            emsuart_calibrate(); // does nothing in tx_mode 1
+        }
+
+        if (t == EMSSIM_REFRESH_TIME) {
+            ems_getThermostatValues();
+            ems_getBoilerValues();
+            ems_getSolarModuleValues();
+        }
+
+        if (t == EMSSIM_LOST_REPLY_TIME) {
+            emssim_loseReplies(1);
+            ems_doReadCommand(EMS_TYPE_UBAParameterWW, EMS_Boiler.device_id);
+        }
+
+        if (t == EMSSIM_SCAN_TIME) {
+            ems_clearDeviceList();
+            ems_scanDevices(); // like the telnet autodetect scan command
+        }
+    }
+
+    // let anything still in flight finish
+    emssim_run(5000);
+}
+
+/*
+ * run against a real bus or a capture, until the time is up or the backend has closed
+ */
+static void _runBackend(uint32_t seconds) {
+    uint32_t lastUpdate = millis();
+
+    while (emsuart_posix_isOpen() && (millis() < (seconds * 1000))) {
+        emsuart_loop();
+        ems_txTick();
+
+        if ((millis() - lastUpdate) >= (EMS_REFRESH_TICK_TIME * 1000)) {
+            lastUpdate = millis();
+            ems_refreshTick();
+        }
+    }
+}
+
+static void _showStats(bool sim) {
+    _EMSSIM_Stats *    stats   = emssim_getStats();
+    _EMSUART_RxStats * rxStats = emsuart_getRxStats();
+    _EMSUART_TxStats * txStats = emsuart_getTxStats();
+    uint64_t           elapsed = emssim_now();
+
+    printf("\nBus (%s, %.0f seconds)\n", emsuart_getBackendName(), elapsed / 1000000.0);
+    if (sim) {
+        printf("  frames %u, bytes %u, occupancy %.1f%%\n", stats->frames, stats->bytes, elapsed ? (100.0 * stats->busBusy / elapsed) : 0.0);
+        printf("  polls %u (%u to us), last poll interval %.3f ms\n", stats->polls, stats->pollsMe, ems_getPollFrequency() / 1000.0);
+        printf("  device reads answered %u, writes acknowledged %u, unknown types %u\n", stats->reads, stats->writes, stats->unknownTypes);
+        printf("  our Tx frames %u, polls while staging %u\n", stats->txFrames, stats->stagePolls);
+    } else {
+        printf("  last poll interval %.3f ms\n", ems_getPollFrequency() / 1000.0);
+    }
+    printf("  Tx: telegrams %u, collisions %u, timeouts %u, busy %u\n", txStats->telegrams, txStats->collisions, txStats->timeouts, txStats->busy);
+    printf("    main loop blocked %u us (max %u us), on the bus %u us (max %u us) for the last telegram\n",
+           txStats->blockedLast,
+           txStats->blockedMax,
+           txStats->busLast,
+           txStats->busMax);
+    printf("    polls answered from the Rx interrupt %u, on time %u, late %u, last %u us (max %u us) after the poll\n",
+           txStats->pollsStaged,
+           txStats->pollsOnTime,
+           txStats->pollsLate,
+           txStats->pollLast,
+           txStats->pollMax);
+    printf("    came back right %u, failed %u, echo %u us (max %u us), brk_wait %u us, gap %u us\n",
+           txStats->echoOk,
+           txStats->echoErrors,
+           txStats->echoLast,
+           txStats->echoMax,
+           emsuart_getTxTiming()->brkWait,
+           emsuart_getTxTiming()->gap);
+    _EMSUART_Timing *      timing       = emsuart_getTiming();
+    const char *           names[]      = {"poll interval", "poll to Tx", "read to reply", "gap"};
+    const _EMS_Histogram * histograms[] = {&timing->pollInterval, &timing->pollLatency, &timing->readLatency, &timing->gap};
+    printf("  timing in us         count      p50      p90      p99      max\n");
+    for (uint8_t i = 0; i < 4; i++) {
+        printf("    %-14s %9u %8u %8u %8u %8u\n",
+               names[i],
+               histograms[i]->count,
+               _histogram_percentile(histograms[i], 50),
+               _histogram_percentile(histograms[i], 90),
+               _histogram_percentile(histograms[i], 99),
+               histograms[i]->max);
+    }
+    printf("  Rx ring: telegrams %u, dropped %u, too long %u, max depth %u of %u\n",
+           rxStats->telegrams,
+           rxStats->dropped,
+           rxStats->overflows,
+           rxStats->depthMax,
+           EMSUART_RXRING_SIZE);
+    printf("  Rx discarded: too short %u, double BRK %u\n", rxStats->runts, rxStats->breaks);
+    printf("  ems.cpp: Rx ok %u, Tx ok %u, CRC errors %u, unchanged %u (%u not decoded), Tx queue %u\n",
+           EMS_Sys_Status.emsRxPgks,
+           EMS_Sys_Status.emsTxPkgs,
+           EMS_Sys_Status.emxCrcErr,
+           EMS_Sys_Status.emsRxUnchanged,
+           EMS_Sys_Status.emsRxSkipped,
+           EMS_TxQueue.size());
+    printf("  Tx queue: reads merged %u, reads planned %u, writes replaced %u, writes combined %u, validates skipped %u\n",
+           EMS_Sys_Status.emsTxReadsMerged,
+           EMS_Sys_Status.emsTxReadsPlanned,
+           EMS_Sys_Status.emsTxWritesReplaced,
+           EMS_Sys_Status.emsTxWritesCombined,
+           EMS_Sys_Status.emsTxValidatesSkipped);
+    for (uint8_t lane = 0; lane < EMS_TX_LANES; lane++) {
+        const _EMS_TxLaneStats * laneStats = EMS_TxQueue.laneStats(lane);
+        printf("    lane %-11s sent %3u, avg wait %5u ms, max wait %5u ms\n",
+               ems_getTxLaneName(lane),
+               laneStats->telegrams,
+               laneStats->telegrams ? (laneStats->waitTotal / laneStats->telegrams) : 0,
+               laneStats->waitMax);
+    }
+    for (uint8_t fail = 0; fail < EMS_TX_FAILS; fail++) {
+        _EMS_TxFailStats * failStats = ems_getTxFailStats(fail);
+        if (failStats->count) {
+            printf("    failed with %-11s %3u, avg lost %5u ms\n", ems_getTxFailName(fail), failStats->count, failStats->lost / failStats->count);
+        }
+    }
+    printf("  refresh: %u types kept up to date, %u reads\n", ems_getRefreshCount(), EMS_Sys_Status.emsRefreshReads);
+    for (uint8_t i = 0; i < ems_getRefreshCount(); i++) {
+        _EMS_Refresh * refresh = ems_getRefresh(i);
+        printf("    type 0x%04X from 0x%02X: broadcast every %5.1f s, reads %u\n", refresh->type, refresh->dest, refresh->interval / 1000.0, refresh->reads);
+    }
+    printf("  discovery: %u runs, the last took %u ms, %u of %u devices replied\n",
+           ems_getDiscovery()->runs,
+           ems_getDiscovery()->time,
+           ems_getDiscovery()->found,
+           ems_getDiscovery()->probed);
+    printf("  cache: %u served from memory, %u read from the bus\n", EMS_Sys_Status.emsCacheHits, EMS_Sys_Status.emsCacheMisses);
+    printf("  blocks: %u kept\n", ems_getBlockCount());
+    for (uint8_t i = 0; i < ems_getBlockCount(); i++) {
+        _EMS_Block * block = ems_getBlock(i);
+        printf("    type 0x%04X from 0x%02X: %u bytes, transfers %u, failed %u, last %u ms (max %u ms)\n",
+               block->type,
+               block->dest,
+               block->length,
+               block->transfers,
+               block->failed,
+               block->timeLast,
+               block->timeMax);
+    }
+    ems_busStatsTick();
+    _EMS_BusStats * busStats = ems_getBusStats();
+    printf("  traffic: telegrams %u, bytes %u, polls %u, busy %.1f s, ours %u bytes\n",
+           busStats->telegrams,
+           busStats->bytes,
+           busStats->polls,
+           busStats->busy / 1000.0,
+           busStats->ourBytes);
+    printf("    occupancy %.1f%% last %u s, %.1f%% 1 min, %.1f%% 5 min, %.1f%% 15 min, ours %.1f%% 1 min\n",
+           busStats->lastBusy / 10.0,
+           EMS_BUSSTATS_SAMPLE / 1000,
+           busStats->load[0] / (float)(1 << EMS_BUSSTATS_FSHIFT),
+           busStats->load[1] / (float)(1 << EMS_BUSSTATS_FSHIFT),
+           busStats->load[2] / (float)(1 << EMS_BUSSTATS_FSHIFT),
+           busStats->ourLoad[0] / (float)(1 << EMS_BUSSTATS_FSHIFT));
+    for (uint8_t i = 0; i < busStats->sourceCount; i++) {
+        printf("    from 0x%02X: telegrams %5u, bytes %6u\n", busStats->sources[i].id, busStats->sources[i].telegrams, busStats->sources[i].bytes);
+    }
+    for (uint8_t src = 0; src < 0x80; src++) {
+        if (EMS_Sys_Status.emsCrcErrSrc[src]) {
+            printf("    CRC errors from 0x%02X: %u\n", src, EMS_Sys_Status.emsCrcErrSrc[src]);
+        }
+    }
+}
+
+// # reads the refresh scheduler made for a type
+static uint16_t _refreshReads(uint16_t type, uint8_t dest) {
+    for (uint8_t i = 0; i < ems_getRefreshCount(); i++) {
+        if ((ems_getRefresh(i)->type == type) && (ems_getRefresh(i)->dest == dest)) {
+            return ems_getRefresh(i)->reads;
+        }
+    }
+    return 0xFFFF;
+}
+
+// a block has been read whole, and is the same as on the simulated device
+static bool _blockRead(EMSSimDevice * device, uint16_t type) {
+    uint8_t   length = 0;
+    uint8_t * reg    = device->getRegister(type, &length);
+    for (uint8_t i = 0; i < ems_getBlockCount(); i++) {
+        _EMS_Block * block = ems_getBlock(i);
+        if ((block->type == type) && (block->dest == device->device_id)) {
+            return block->complete && (block->length == length) && (memcmp(block->data, reg, length) == 0);
+        }
+    }
+    return false;
+}
+
+// the calibration has found a timing shorter than the default, that still gives the simulated master time to echo each byte
+static bool _calibrated() {
+    _EMSUART_TxTiming * timing = emsuart_getTxTiming();
+    if (EMS_Sys_Status.emsTxMode == EMS_TXMODE_EMSPLUS) {
+        return (emsuart_getCalibrateState() == EMSUART_CALIBRATE_DONE) && (timing->brkWait < EMSUART_TX_BRK_WAIT)
+               && (timing->brkWait >= EMSSIM_TX_SPACING);
+    } else if (EMS_Sys_Status.emsTxMode == EMS_TXMODE_HT3) {
+        return (emsuart_getCalibrateState() == EMSUART_CALIBRATE_DONE) && (timing->gap < EMSUART_TX_WAIT_GAP)
+               && ((EMSUART_TX_WAIT_BYTE - EMSUART_TX_LAG + timing->gap) >= EMSSIM_TX_SPACING);
+    }
+    return emsuart_getCalibrateState() == EMSUART_CALIBRATE_OFF;
+}
+
+static void _showChecks() {
+    EMSSimDevice * boiler     = emssim_getDevice(EMS_ID_BOILER);
+    EMSSimDevice * thermostat = emssim_getDevice(EMS_ID_THERMOSTAT1);
+
+    printf("\nChecks\n");
+    _check("bus connected", ems_getBusConnected());
+    _check("Tx capable", ems_getTxCapable());
+    _check("no CRC errors but the calibration's", EMS_Sys_Status.emxCrcErr == EMS_Sys_Status.emsCrcErrSrc[EMS_ID_ME]);
+    _check("no telegrams dropped from the Rx ring", emsuart_getRxStats()->dropped == 0);
+    _check("Tx queue drained", EMS_TxQueue.isEmpty());
+    _check("polls answered straight from the Rx interrupt", emsuart_getTxStats()->pollsStaged > 0);
+    _check("no polls answered late", emsuart_getTxStats()->pollsLate == 0);
+    _check("read replies timed", (emsuart_getTiming()->readLatency.count > 0) && (_histogram_percentile(&emsuart_getTiming()->readLatency, 50) >= EMSSIM_REPLY_DELAY));
+    _check("bus traffic counted", // the last frame on the bus may not have been received yet
+           (ems_getBusStats()->telegrams == emsuart_getRxStats()->telegrams) && (ems_getBusStats()->bytes + EMS_MAXBUFFERSIZE >= emssim_getStats()->bytes)
+               && (ems_getBusStats()->ourTelegrams == emssim_getStats()->txFrames));
+    _check("Tx timing calibrated", _calibrated());
+    _check("lost reply noticed without stalling the Tx queue", (emssim_getStats()->lostReplies == 1) && (ems_getTxFailStats(EMS_TX_FAIL_NOREPLY)->count >= 1));
+    _check("superseded writes replaced in the Tx queue", EMS_Sys_Status.emsTxWritesReplaced == 4);
+    _check("each write reached the bus once, with a poll while the Tx queue changed", (emssim_getStats()->writes == 2) && (emssim_getStats()->stagePolls == 1));
+    _check("broadcast types not read by the scheduler", _refreshReads(EMS_TYPE_UBAMonitorFast, EMS_ID_BOILER) == 0);
+    _check("other types read by the scheduler", _refreshReads(EMS_TYPE_UBAParameterWW, EMS_ID_BOILER) > 0);
+    _check("only the decoded bytes read once there's a whole copy", EMS_Sys_Status.emsTxReadsPlanned > 0);
+    _check("refresh served from memory what's just come in", (EMS_Sys_Status.emsCacheHits > 0) && (EMS_Sys_Status.emsCacheMisses > 0));
+    _check("writes wait less than the refresh reads",
+           EMS_TxQueue.laneStats(EMS_TX_LANE_INTERACTIVE)->waitMax < EMS_TxQueue.laneStats(EMS_TX_LANE_REFRESH)->waitMax);
+    _check("bus scanned, each ID not there read once", // the devices it knows where to look for
+           (ems_getDiscovery()->runs == 2) && (ems_getDiscovery()->found == 4) && (ems_getDiscovery()->absent == 7) && !ems_getDiscovery()->running);
+    _check("device list found by ID",
+           (ems_getDeviceCount() == 4) && ems_getDevice(EMS_ID_BOILER) && (ems_getDevice(EMS_ID_BOILER)->product_id == boiler->product_id)
+               && !ems_getDevice(EMS_ID_HP));
+    _check("boiler detected", ems_getBoilerEnabled() && (EMS_Boiler.product_id == boiler->product_id));
+    _check("thermostat detected", ems_getThermostatEnabled() && (EMS_Thermostat.product_id == thermostat->product_id));
+    _check("solar module detected", ems_getSolarModuleEnabled() && (EMS_SolarModule.product_id == emssim_getDevice(EMS_ID_SM)->product_id));
+    _check("mixing module detected", ems_getMixingDeviceEnabled() && (EMS_Mixing.product_id == emssim_getDevice(EMS_ID_MIXING2)->product_id));
+    _check("boiler warm water temp written and read back", (EMS_Boiler.wWSelTemp == 58) && (boiler->getRegister(EMS_TYPE_UBAParameterWW)[2] == 58));
+    _check("boiler selected flow temp decoded", EMS_Boiler.selFlowTemp == boiler->getRegister(EMS_TYPE_UBAMonitorFast)[0]);
+    _check("boiler pressure decoded", EMS_Boiler.sysPress == 15);
+    _check("thermostat day temp written and read back",
+           (EMS_Thermostat.hc[0].daytemp == 45) && (thermostat->getRegister(EMS_TYPE_RC35Set_HC1)[EMS_OFFSET_RC35Set_temp_day] == 45));
+    _check("thermostat night temp written with the day temp",
+           (EMS_Sys_Status.emsTxWritesCombined == 1) && (EMS_Thermostat.hc[0].nighttemp == 34)
+               && (thermostat->getRegister(EMS_TYPE_RC35Set_HC1)[EMS_OFFSET_RC35Set_temp_night] == 34));
+    _check("thermostat setpoint follows", EMS_Thermostat.hc[0].setpoint_roomTemp == 45);
+    _check("thermostat write confirmed by its broadcast", EMS_Sys_Status.emsTxValidatesSkipped == 1);
+    _check("thermostat time decoded", strcmp(EMS_Thermostat.datetime, "?") != 0);
+    _check("thermostat switching program read in chunks", _blockRead(thermostat, EMS_TYPE_RC35Timer_HC1));
+    _check("boiler error log ends where the boiler's does", _blockRead(boiler, EMS_TYPE_UBAErrorMessages));
+    _check("solar collector temp decoded", EMS_SolarModule.collectorTemp != EMS_VALUE_SHORT_NOTSET);
+    _check("mixing HC1 flow temp decoded", EMS_Mixing.hc[0].active && (EMS_Mixing.hc[0].flowTemp != EMS_VALUE_USHORT_NOTSET));
+}
+
+int main(int argc, char * argv[]) {
+    uint32_t                 seconds = 600;
+    uint8_t                  tx_mode = EMS_TXMODE_DEFAULT;
+    uint8_t                  mask    = 0x00;
+    _EMS_SYS_LOGGING         logging = EMS_SYS_LOGGING_NONE;
+    const _EMSUART_Backend * backend = &EMSUART_Backend_Sim;
+    const char *             capture = nullptr;
+    int                      opt;
+
+    while ((opt = getopt(argc, argv, "t:m:l:jqb:c:")) != -1) {
+        switch (opt) {
+        case 't':
+            seconds = atoi(optarg);
+            break;
+        case 'm':
+            tx_mode = atoi(optarg);
+            break;
+        case 'l':
+            logging = _parseLogging(optarg);
+            break;
+        case 'j':
+            mask = 0x80; // Junkers/HT3 bus, IDs have the 8th bit set
+            break;
+        case 'q':
+            myESP.quiet = true;
+            break;
+        case 'b':
+            backend = _parseBackend(optarg);
+            break;
+        case 'c':
+            capture = optarg;
+            break;
+        default:
+            backend = nullptr;
+            break;
+        }
+    }
+
+    if (!backend) {
+        fprintf(stderr,
+                "usage: %s [-t seconds] [-m tx_mode] [-l none|basic|verbose|raw|jabber] [-j] [-q]\n"
+                "       [-b sim|tty:<path>|tcp:<host:port>|replay:<file>] [-c capture file]\n",
+                argv[0]);
+        return 2;
+    }
+
+    if (capture && !emsuart_posix_setCapture(capture)) {
+        fprintf(stderr, "cannot write %s\n", capture);
+        return 2;
+    }
+
+    // a real bus runs on the wall clock, the simulation and replays on the virtual clock
+    emssim_setRealtime((backend == &EMSUART_Backend_TTY) || (backend == &EMSUART_Backend_TCP));
+
+    if (backend == &EMSUART_Backend_Sim) {
+        emssim_init(mask);
+        emssim_addDevice(emssim_newBoiler(), true);
+        emssim_addDevice(emssim_newThermostat());
+        emssim_addDevice(emssim_newSolarModule());
+        emssim_addDevice(emssim_newMixingModule());
+    }
+
+    // same start-up sequence as ems-esp.cpp
+    ems_init();
+    ems_setTxMode(tx_mode);
+    ems_setLogging(logging);
+    if (backend == &EMSUART_Backend_Replay) {
+        ems_setTxDisabled(true); // nobody to answer
+    }
+    emsuart_setBackend(backend);
+    if (!emsuart_init()) {
+        return 2;
+    }
+    ems_discoverModels();
+
+    if (backend == &EMSUART_Backend_Sim) {
+        _runSim(seconds);
+    } else {
+        _runBackend(seconds);
+    }
+
+    _showStats(backend == &EMSUART_Backend_Sim);
+
+    if (backend != &EMSUART_Backend_Sim) {
+        return 0;
+    }
+
+    _showChecks();
+
+    return _checks_failed ? 1 : 0;
+}
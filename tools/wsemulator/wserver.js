@@ -152,7 +152,13 @@ function sendCustomStatus() {
                 { "type": 2, "model": "RC20/Nefit Moduline 300", "version": "03.03", "productid": 77, "deviceid": "17" },
                 { "type": 3, "model": "SM100 Solar Module", "version": "01.01", "productid": 163, "deviceid": "30" },
                 { "type": 4, "model": "HeatPump Module", "version": "01.01", "productid": 252, "deviceid": "38" }
-            ]
+            ],
+            "timing": {
+                "poll_interval": { "n": 16685, "p50": 36864, "p90": 40960, "p99": 40960, "max": 40012 },
+                "poll_latency": { "n": 62, "p50": 19, "p90": 47, "p99": 95, "max": 88 },
+                "read_latency": { "n": 60, "p50": 3584, "p90": 4096, "p99": 4096, "max": 4012 },
+                "gap": { "n": 117108, "p50": 1535, "p90": 3584, "p99": 4096, "max": 4012 }
+            }
         },
 
         "thermostat": {